@@ -1,176 +1,548 @@
 #include <lsm_tree.hh>
+#include <key_generator.hh>
+#include <metrics.hh>
+#include <op_stream.hh>
 #include <iostream>
-#include <map>
 #include <sstream>
 #include <fstream>
+#include <iomanip>
 #include <vector>
 #include <thread>
 #include <chrono>
 
-using namespace std;
+// db_bench-style harness: named workloads run in order against one tree
+//   ./benchmark [--benchmarks=fillseq,readrandom,...] [--num=N] [--threads=T] ...
+// or replays a text workload file of p/g/r/d lines on one thread, as before:
+//   ./benchmark <file under ./experiments/>   |   ./benchmark --replay=<path>
+// binary op streams from ./datagen replay the same way
 
-void runCommand(const string& line, LSMTree* lsmTree) {
-    istringstream iss(line);
+struct BenchmarkOptions {
+    std::vector<std::string> benchmarks = {"fillseq", "fillrandom", "readrandom"};
+    // key space [0, num), and ops of fill/delete benchmarks
+    uint64_t num = 100000;
+    // ops of read/seek benchmarks, 0 means num
+    uint64_t reads = 0;
+    size_t threads = 1;
+    KeyDistribution distribution = KeyDistribution::UNIFORM;
+    int value_min = 0;
+    int value_max = INT_MAX;
+    // entries read after each seek
+    size_t seek_nexts = 10;
+    uint64_t seed = 301;
+    std::string db = "benchmark_db";
+    bool use_existing_db = false;
+    size_t buffer_capacity = BUFFER_CAPACITY;
+    size_t base_level_table_capacity = BASE_LEVEL_TABLE_CAPACITY;
+    size_t level_size_ratio = LEVEL_SIZE_RATIO;
+    // results as JSON, "-" for stdout
+    std::string json_path;
+    std::string replay_path;
+};
+
+struct BenchmarkResult {
+    std::string name;
+    size_t threads = 0;
+    uint64_t ops = 0;
+    // reads that found their key, entries returned by seeks
+    uint64_t found = 0;
+    double seconds = 0.0;
+    HistogramSnapshot latency;
+    // writes done by the background writer of readwhilewriting
+    uint64_t background_writes = 0;
+
+    double opsPerSecond() const {
+        return seconds > 0.0 ? static_cast<double>(ops) / seconds : 0.0;
+    }
+};
+
+// what one worker thread did
+struct ThreadState {
+    size_t thread_id;
+    uint64_t ops = 0;
+    uint64_t found = 0;
+    std::unique_ptr<LatencyHistogram> latency = std::make_unique<LatencyHistogram>();
+};
+
+class Benchmark {
+    public:
+    Benchmark(const BenchmarkOptions& options, LSMTree* lsm_tree)
+        : options_(options), lsm_tree_(lsm_tree) {
+        // an existing db is assumed to hold the whole key space
+        inserted_keys_ = options_.use_existing_db ? options_.num : 0;
+        if (usesZipfian(options_.distribution)) {
+            zipfian_ = std::make_unique<ZipfianGenerator>(options_.num);
+        }
+    }
+
+    bool run(const std::string& name, BenchmarkResult* result) {
+        uint64_t reads = options_.reads == 0 ? options_.num : options_.reads;
+        if (name == "fillseq") {
+            *result = runThreads(name, options_.num, [this](ThreadState&, KeyGenerator& keys) {
+                // one shared counter, so keys go in ascending order across threads
+                uint64_t index = next_seq_index_.fetch_add(1);
+                lsm_tree_->putData({static_cast<int>(index), randomValue(keys), false});
+                noteInserted(index);
+            });
+        } else if (name == "fillrandom") {
+            *result = runThreads(name, options_.num, [this](ThreadState&, KeyGenerator& keys) {
+                uint64_t index = keys.next();
+                lsm_tree_->putData({static_cast<int>(index), randomValue(keys), false});
+                noteInserted(index);
+            });
+        } else if (name == "readrandom") {
+            *result = runThreads(name, reads, [this](ThreadState& state, KeyGenerator& keys) {
+                if (lsm_tree_->getData(static_cast<int>(keys.next())).has_value()) {
+                    state.found++;
+                }
+            });
+        } else if (name == "readmissing") {
+            // negative keys are never written by the fill benchmarks
+            *result = runThreads(name, reads, [this](ThreadState& state, KeyGenerator& keys) {
+                if (lsm_tree_->getData(-1 - static_cast<int>(keys.next())).has_value()) {
+                    state.found++;
+                }
+            });
+        } else if (name == "seekrandom") {
+            *result = runThreads(name, reads, [this](ThreadState& state, KeyGenerator& keys) {
+                LSMIterator it = lsm_tree_->newIterator(static_cast<int>(keys.next()), INT_MAX, options_.seek_nexts);
+                for (; it.valid(); it.next()) {
+                    state.found++;
+                }
+            });
+        } else if (name == "deleterandom") {
+            *result = runThreads(name, options_.num, [this](ThreadState&, KeyGenerator& keys) {
+                lsm_tree_->deleteData(static_cast<int>(keys.next()));
+            });
+        } else if (name == "readwhilewriting") {
+            *result = readWhileWriting(reads);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    private:
+    const BenchmarkOptions& options_;
+    LSMTree* lsm_tree_;
+    std::unique_ptr<ZipfianGenerator> zipfian_;
+    std::atomic<uint64_t> next_seq_index_{0};
+    // keys [0, inserted_keys_) are treated as written, for the latest distribution
+    std::atomic<uint64_t> inserted_keys_{0};
+
+    int randomValue(KeyGenerator& keys) {
+        return std::uniform_int_distribution<int>(options_.value_min, options_.value_max)(keys.rng());
+    }
+
+    void noteInserted(uint64_t index) {
+        uint64_t inserted = inserted_keys_.load(std::memory_order_relaxed);
+        while (index >= inserted && !inserted_keys_.compare_exchange_weak(inserted, index + 1)) {}
+    }
+
+    KeyGenerator makeKeyGenerator(size_t thread_id) {
+        return KeyGenerator(options_.distribution, options_.num, options_.seed + thread_id * 7919,
+                            zipfian_.get(), &inserted_keys_);
+    }
+
+    // ops split over options_.threads workers, each op timed on its own
+    template <typename OpFn>
+    BenchmarkResult runThreads(const std::string& name, uint64_t ops, OpFn op) {
+        size_t num_threads = std::max<size_t>(options_.threads, 1);
+        std::vector<ThreadState> states(num_threads);
+        std::vector<std::thread> workers;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t t = 0; t < num_threads; ++t) {
+            states[t].thread_id = t;
+            uint64_t thread_ops = ops / num_threads + (t < ops % num_threads ? 1 : 0);
+            workers.emplace_back([this, &state = states[t], thread_ops, &op]() {
+                KeyGenerator keys = makeKeyGenerator(state.thread_id);
+                for (uint64_t i = 0; i < thread_ops; ++i) {
+                    auto op_start = std::chrono::steady_clock::now();
+                    op(state, keys);
+                    auto op_nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - op_start).count();
+                    state.latency->record(op_nanos);
+                    state.ops++;
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        BenchmarkResult result;
+        result.name = name;
+        result.threads = num_threads;
+        result.seconds = std::chrono::duration<double>(elapsed).count();
+        for (const auto& state : states) {
+            result.ops += state.ops;
+            result.found += state.found;
+            result.latency.merge(*state.latency);
+        }
+        return result;
+    }
+
+    // readrandom on every thread while one extra thread does random puts until they finish
+    BenchmarkResult readWhileWriting(uint64_t reads) {
+        std::atomic<bool> readers_done{false};
+        std::atomic<uint64_t> background_writes{0};
+        std::thread writer([this, &readers_done, &background_writes]() {
+            KeyGenerator keys = makeKeyGenerator(options_.threads);
+            while (!readers_done.load()) {
+                uint64_t index = keys.next();
+                lsm_tree_->putData({static_cast<int>(index), randomValue(keys), false});
+                noteInserted(index);
+                background_writes++;
+            }
+        });
+        BenchmarkResult result = runThreads("readwhilewriting", reads, [this](ThreadState& state, KeyGenerator& keys) {
+            if (lsm_tree_->getData(static_cast<int>(keys.next())).has_value()) {
+                state.found++;
+            }
+        });
+        readers_done = true;
+        writer.join();
+        result.background_writes = background_writes.load();
+        return result;
+    }
+};
+
+static double toMicros(uint64_t nanos) {
+    return static_cast<double>(nanos) / 1000.0;
+}
+
+void printResult(const BenchmarkResult& result) {
+    double micros_per_op = result.ops == 0 ? 0.0 : result.seconds * 1e6 / static_cast<double>(result.ops);
+    std::cout << std::left << std::setw(18) << result.name << ": " << std::right << std::fixed
+              << std::setprecision(3) << std::setw(10) << micros_per_op << " micros/op "
+              << std::setprecision(0) << std::setw(10) << result.opsPerSecond() << " ops/sec;"
+              << std::setprecision(1)
+              << " p50 " << toMicros(result.latency.percentile(50))
+              << " p99 " << toMicros(result.latency.percentile(99))
+              << " p999 " << toMicros(result.latency.percentile(99.9)) << " us"
+              << " (" << result.ops << " ops, " << result.threads << " threads";
+    if (result.name.find("read") != std::string::npos) {
+        std::cout << ", " << result.found << " found";
+    } else if (result.name == "seekrandom") {
+        std::cout << ", " << result.found << " entries";
+    }
+    if (result.background_writes > 0) {
+        std::cout << ", " << result.background_writes << " background writes";
+    }
+    std::cout << ")" << std::endl;
+}
+
+std::string resultsToJson(const BenchmarkOptions& options, const std::vector<BenchmarkResult>& results) {
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(3);
+    ss << "{\"options\":{\"num\":" << options.num << ",\"reads\":" << (options.reads == 0 ? options.num : options.reads)
+       << ",\"threads\":" << options.threads
+       << ",\"distribution\":\"" << keyDistributionName(options.distribution) << "\""
+       << ",\"value_min\":" << options.value_min << ",\"value_max\":" << options.value_max
+       << ",\"seek_nexts\":" << options.seek_nexts
+       << ",\"buffer_capacity\":" << options.buffer_capacity
+       << ",\"base_level_table_capacity\":" << options.base_level_table_capacity
+       << ",\"level_size_ratio\":" << options.level_size_ratio << "},\"results\":[";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchmarkResult& result = results[i];
+        if (i > 0) {
+            ss << ",";
+        }
+        ss << "{\"name\":\"" << result.name << "\",\"threads\":" << result.threads
+           << ",\"ops\":" << result.ops << ",\"found\":" << result.found
+           << ",\"background_writes\":" << result.background_writes
+           << ",\"seconds\":" << result.seconds << ",\"ops_per_sec\":" << result.opsPerSecond()
+           << ",\"mean_us\":" << result.latency.mean() / 1000.0
+           << ",\"p50_us\":" << toMicros(result.latency.percentile(50))
+           << ",\"p99_us\":" << toMicros(result.latency.percentile(99))
+           << ",\"p999_us\":" << toMicros(result.latency.percentile(99.9))
+           << ",\"max_us\":" << toMicros(result.latency.max) << "}";
+    }
+    ss << "]}";
+    return ss.str();
+}
+
+/**
+ * replay mode: one text workload file, one thread
+ */
+
+// returns false for an unknown command
+bool runCommand(const std::string& line, LSMTree* lsm_tree) {
+    std::istringstream iss(line);
     char command;
     int key, val;
-
-    string fileName;
     iss >> command;
 
     switch (command) {
         case 'p':
             iss >> key >> val;
-            lsmTree->putData({key, val, false});
-            break;
-        case 'g': {
+            lsm_tree->putData({key, val, false});
+            return true;
+        case 'g':
             iss >> key;
-            // Assuming get method prints the value or result
-            std::optional<DataPair> data = lsmTree->getData(key);
-            if (data.has_value()) {
-                cout << "Get: Key = " << key << ", Value = " << data.value().value_ << endl;
-            } else {
-                cout << "boo" << endl;
-            }
-            break;
-        }
-        case 'd': {
+            lsm_tree->getData(key);
+            return true;
+        case 'd':
             iss >> key;
-            lsmTree->deleteData(key);
-            cout << "Deleted: " << key << endl;
-            break;
-        }
+            lsm_tree->deleteData(key);
+            return true;
         case 'r': {
             int low, high;
             iss >> low >> high;
-            vector<DataPair> range = lsmTree->rangeData(low, high);
-            cout << "Range: " << low << " to " << high << ", lenth: " << range.size() << endl;
-            // for (const auto& data : range) {
-            //     cout << data.key_ << ":" << data.value_ << " ";
-            // }
-            cout << endl;
-            break;
+            lsm_tree->rangeData(low, high);
+            return true;
         }
         default:
-            cout << "Unknown: " << command << endl;
+            return false;
     }
-    // std::this_thread::sleep_for(std::chrono::milliseconds(200));
 }
 
-void loadFileCommands(const string& filePath, LSMTree* db) {
-    ifstream file(filePath);
-    string line;
-
-    if (!file.is_open()) {
-        cout << "can't open " << filePath << endl;
-        return;
-    }
-    while (getline(file, line)) {
-        runCommand(line, db);
+// returns false for an unknown op type
+bool runRecord(const OpRecord& record, LSMTree* lsm_tree) {
+    switch (record.type) {
+        case 'p':
+            lsm_tree->putData({record.key, record.arg, false});
+            return true;
+        case 'g':
+            lsm_tree->getData(record.key);
+            return true;
+        case 'd':
+            lsm_tree->deleteData(record.key);
+            return true;
+        case 'r':
+            lsm_tree->rangeData(record.key, record.arg);
+            return true;
+        default:
+            return false;
     }
-    file.close();
 }
 
-void loadFileCommandsLoad(const string& file_path, LSMTree* db) {
-    // open file in binary, and every 4 bytes is a key, and 4 more bytes is a value
-    std::ifstream file(file_path, std::ios::binary | std::ios::ate);
+// records are read in batches straight into OpRecords, nothing to parse
+void replayOpStream(std::ifstream& file, const OpStreamHeader& header, LSMTree* lsm_tree,
+                    uint64_t* ops, uint64_t* unknown) {
+    file.seekg(sizeof(header));
+    std::vector<OpRecord> batch(1 << 16);
+    uint64_t remaining = header.num_ops;
+    while (remaining > 0) {
+        size_t count = static_cast<size_t>(std::min<uint64_t>(remaining, batch.size()));
+        file.read(reinterpret_cast<char*>(batch.data()), count * sizeof(OpRecord));
+        count = static_cast<size_t>(file.gcount()) / sizeof(OpRecord);
+        if (count == 0) {
+            std::cerr << "op stream ends after " << header.num_ops - remaining << " of "
+                      << header.num_ops << " ops" << std::endl;
+            return;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if (runRecord(batch[i], lsm_tree)) {
+                (*ops)++;
+            } else {
+                (*unknown)++;
+            }
+        }
+        remaining -= count;
+    }
+}
 
+int replayWorkload(const BenchmarkOptions& options) {
+    std::cout << "Replaying workload from: " << options.replay_path << std::endl;
+    std::ifstream file(options.replay_path);
     if (!file.is_open()) {
-        cout << "can't open" << file_path << endl;
+        std::cerr << "can't open " << options.replay_path << std::endl;
+        return 1;
     }
-    std::streamsize file_size = file.tellg();
-    file.seekg(0, std::ios::beg);
+    LSMTree lsm_tree(options.db, options.buffer_capacity, options.base_level_table_capacity,
+                     MAX_LEVELS, options.level_size_ratio);
 
-    if (file_size == 0) {
-        file.close();
-        cout << "File is empty: " << file_path << endl;
+    uint64_t ops = 0;
+    uint64_t unknown = 0;
+    auto start = std::chrono::steady_clock::now();
+    OpStreamHeader header;
+    if (readOpStreamHeader(options.replay_path, &header)) {
+        replayOpStream(file, header, &lsm_tree, &ops, &unknown);
+    } else if (options.replay_path.find("load") != std::string::npos) {
+        // binary LOAD file of int32 key,value pairs
+        size_t pairs_loaded = 0;
+        if (!lsm_tree.bulkLoad(options.replay_path, &pairs_loaded)) {
+            std::cerr << "failed to load " << options.replay_path << std::endl;
+            return 1;
+        }
+        ops = pairs_loaded;
+    } else {
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.empty()) {
+                continue;
+            }
+            if (runCommand(line, &lsm_tree)) {
+                ops++;
+            } else {
+                unknown++;
+            }
+        }
     }
-
-    // file_size must be a multiple of 8 (4+4 bytes key/val pairs)
-    if (file_size % 8 != 0) {
-        file.close();
-        cout << "File size is not a multiple of 8: " << file_path << endl;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << std::fixed << std::setprecision(3) << "Total time to perform workload: " << seconds
+              << " seconds, " << ops << " ops (" << std::setprecision(0)
+              << (seconds > 0.0 ? static_cast<double>(ops) / seconds : 0.0) << " ops/sec)";
+    if (unknown > 0) {
+        std::cout << ", " << unknown << " unknown ops skipped";
     }
+    std::cout << ". Workload name: " << options.replay_path << std::endl;
+    return 0;
+}
 
-    int key_from_file;
-    int value_from_file;
-    unsigned long items_processed_from_file = 0;
-    unsigned long items_successfully_put = 0;
-    bool read_error_occurred = false;
+/**
+ * command line
+ */
 
-    // read key/val pairs from file
-    while (file.good() && (items_processed_from_file < (unsigned long)(file_size / 8))) {
-        // Read 4 bytes for the key
-        if (!file.read(reinterpret_cast<char*>(&key_from_file), sizeof(key_from_file))) {
-            if (!file.eof()) {
-                read_error_occurred = true;
-            }
-            break;
-        }
-        // Read 4 bytes for the value
-        if (!file.read(reinterpret_cast<char*>(&value_from_file), sizeof(value_from_file))) {
-            if (!file.eof()) { // If not EOF, it's an actual read error for value
-                read_error_occurred = true;
-            }
-            // This implies we read a key but couldn't read its corresponding value
-            cout << "[SERVER] LOAD: Read key but failed to read value from '" << file_path 
-                 << "'. File might be truncated or corrupt.\n";
-        }
-        // track items processed
-        items_processed_from_file++;
-        DataPair data_to_put(key_from_file, value_from_file, false);
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " [--flag=value ...]\n"
+              << "       " << program << " <workload file under ./experiments/>\n"
+              << "  --benchmarks=fillseq,fillrandom,readrandom  comma separated, run in order; also\n"
+              << "                readmissing, seekrandom, deleterandom, readwhilewriting\n"
+              << "  --num=100000           key space and ops of fill/delete benchmarks\n"
+              << "  --reads=0              ops of read/seek benchmarks, 0 means num\n"
+              << "  --threads=1            worker threads per benchmark\n"
+              << "  --distribution=uniform uniform, zipfian, latest or sequential\n"
+              << "  --value_min=0 --value_max=2147483647\n"
+              << "  --seek_nexts=10        entries read after each seek\n"
+              << "  --seed=301\n"
+              << "  --db=benchmark_db      --use_existing_db=0\n"
+              << "  --buffer_capacity=" << BUFFER_CAPACITY
+              << " --base_level_table_capacity=" << BASE_LEVEL_TABLE_CAPACITY
+              << " --level_size_ratio=" << LEVEL_SIZE_RATIO << "\n"
+              << "  --json=<path>          also write results as JSON, - for stdout\n"
+              << "  --replay=<path>        replay a text workload file or binary op stream instead" << std::endl;
+}
 
-        if (db->putData(data_to_put)) {
-            items_successfully_put++;
-            cout << "loaded " << key_from_file << ":" << value_from_file << endl;
-        } else {
-            cout << "[SERVER] LOAD: putData failed for key " << key_from_file << ", value " 
-                 << value_from_file << " from file '" << file_path << "'. Continuing.\n";
+std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
         }
-    } 
-
-    if (read_error_occurred) {
-        file.close();
-        char err_buf[FILENAME_MAX + 128];
-        cout << "read error" << endl;
     }
-
-    file.close();
-    cout << "loaded " << items_processed_from_file << " pairs, successfully put " 
-         << items_successfully_put << " pairs into LSM Tree from '" << file_path << "'." << endl;
+    return items;
 }
 
+bool parseOptions(int argc, char* argv[], BenchmarkOptions* options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) != 0) {
+            // old usage: a workload file name under ./experiments/
+            options->replay_path = "./experiments/" + arg;
+            continue;
+        }
+        size_t equals = arg.find('=');
+        std::string flag = arg.substr(2, equals == std::string::npos ? std::string::npos : equals - 2);
+        std::string value = equals == std::string::npos ? "" : arg.substr(equals + 1);
+        try {
+            if (flag == "benchmarks") {
+                options->benchmarks = splitList(value);
+            } else if (flag == "num") {
+                options->num = std::stoull(value);
+            } else if (flag == "reads") {
+                options->reads = std::stoull(value);
+            } else if (flag == "threads") {
+                options->threads = std::stoul(value);
+            } else if (flag == "distribution") {
+                if (!parseKeyDistribution(value, &options->distribution)) {
+                    std::cerr << "unknown distribution: " << value << std::endl;
+                    return false;
+                }
+            } else if (flag == "value_min") {
+                options->value_min = std::stoi(value);
+            } else if (flag == "value_max") {
+                options->value_max = std::stoi(value);
+            } else if (flag == "seek_nexts") {
+                options->seek_nexts = std::stoul(value);
+            } else if (flag == "seed") {
+                options->seed = std::stoull(value);
+            } else if (flag == "db") {
+                options->db = value;
+            } else if (flag == "use_existing_db") {
+                options->use_existing_db = value.empty() || value == "1" || value == "true";
+            } else if (flag == "buffer_capacity") {
+                options->buffer_capacity = std::stoul(value);
+            } else if (flag == "base_level_table_capacity") {
+                options->base_level_table_capacity = std::stoul(value);
+            } else if (flag == "level_size_ratio") {
+                options->level_size_ratio = std::stoul(value);
+            } else if (flag == "json") {
+                options->json_path = value.empty() ? "-" : value;
+            } else if (flag == "replay") {
+                options->replay_path = value;
+            } else if (flag == "help") {
+                return false;
+            } else {
+                std::cerr << "unknown flag: " << arg << std::endl;
+                return false;
+            }
+        } catch (const std::exception&) {
+            std::cerr << "bad value for " << arg << std::endl;
+            return false;
+        }
+    }
+    if (options->num == 0 || options->num > static_cast<uint64_t>(INT_MAX)) {
+        std::cerr << "--num must be in [1, " << INT_MAX << "]" << std::endl;
+        return false;
+    }
+    if (options->value_min > options->value_max) {
+        std::cerr << "--value_min must not exceed --value_max" << std::endl;
+        return false;
+    }
+    return true;
+}
 
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        cout << "Usage: " << argv[0] << " <path_to_benchmark_file>" << endl;
+    BenchmarkOptions options;
+    if (!parseOptions(argc, argv, &options)) {
+        printUsage(argv[0]);
         return 1;
     }
+    if (!options.replay_path.empty()) {
+        return replayWorkload(options);
+    }
 
-    std::string workload_filename = "./experiments/" + std::string(argv[1]);
-    std::cout << "Loading workload from: " << workload_filename << std::endl;
-
-    // Initialize the LSM Tree
-    auto start = std::chrono::high_resolution_clock::now();
-    LSMTree lsmTree("benchmark_db");
-    // loadFileCommands("./experiments/put/1000MB_put.txt", &lsmTree);
-    auto end = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::seconds>(end - start).count();
-    // std::cout << "Initial load time for 1000MB_put: " << duration << " seconds" << std::endl;
-
-    // if the workload filename includes "load":
-    if (workload_filename.find("load") != std::string::npos) {
-        loadFileCommandsLoad(workload_filename, &lsmTree);
-    } else {
-        loadFileCommands(workload_filename, &lsmTree);
+    if (!options.use_existing_db) {
+        std::error_code ec;
+        std::filesystem::remove_all(options.db, ec);
+    }
+    std::vector<BenchmarkResult> results;
+    {
+        LSMTree lsm_tree(options.db, options.buffer_capacity, options.base_level_table_capacity,
+                         MAX_LEVELS, options.level_size_ratio);
+        Benchmark benchmark(options, &lsm_tree);
+        std::cout << "Keys: " << options.num << " (" << keyDistributionName(options.distribution)
+                  << "), threads: " << options.threads << ", buffer: " << options.buffer_capacity
+                  << ", size ratio: " << options.level_size_ratio << std::endl;
+        for (const std::string& name : options.benchmarks) {
+            BenchmarkResult result;
+            if (!benchmark.run(name, &result)) {
+                std::cerr << "unknown benchmark: " << name << std::endl;
+                return 1;
+            }
+            printResult(result);
+            results.push_back(result);
+        }
+        // engine counters for the whole run, write amplification among them
+        std::cout << lsm_tree.getMetrics().toText() << std::endl;
     }
 
-    // Final duration after loading the workload
-    auto end_get = std::chrono::high_resolution_clock::now();
-    duration = std::chrono::duration_cast<std::chrono::seconds>(end_get - end).count();
-    std::cout << "Total time to perform workload: " << duration << " seconds" 
-              << ". Workload name: " << workload_filename << std::endl;
+    if (!options.json_path.empty()) {
+        std::string json = resultsToJson(options, results);
+        if (options.json_path == "-") {
+            std::cout << json << std::endl;
+        } else {
+            std::ofstream json_file(options.json_path);
+            if (!json_file) {
+                std::cerr << "can't write " << options.json_path << std::endl;
+                return 1;
+            }
+            json_file << json << std::endl;
+        }
+    }
     return 0;
 }
-
-// Start timer
-auto start = std::chrono::high_resolution_clock::now();
\ No newline at end of file
@@ -16,11 +16,17 @@ BloomFilter::BloomFilter(size_t items_num, double fp_rate) {
 
     this->num_bits_ = std::max(m_double, 1.0);
 
-    double k_double = std::round(
-        (static_cast<double>(num_bits_) / static_cast<double>(items_num)) * std::log(2.)
-    );
-
-    this->num_hashes_ = std::max(k_double, 1.);
+    // an empty table (e.g. a flush holding only range tombstones) would make k infinite,
+    // one hash over the single zeroed bit answers "absent" for every key
+    if (items_num == 0) {
+        this->num_hashes_ = 1;
+    } else {
+        double k_double = std::round(
+            (static_cast<double>(num_bits_) / static_cast<double>(items_num)) * std::log(2.)
+        );
+
+        this->num_hashes_ = std::max(k_double, 1.);
+    }
 
     // assign num_bits to bits_, packed in bytes, and set them all to false
     if (num_bits_ > 0) {
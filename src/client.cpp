@@ -9,8 +9,9 @@ machine please look into this as a a source of error. */
  *
  * This file provides a basic unix socket implementation for a client
  * used in an interactive client-server database.
- * The client receives input from stdin and sends it to the server.
- * No pre-processing is done on the client-side.
+ * The client receives input from stdin, encodes each command as a binary
+ * frame and pipelines up to PIPELINE_WINDOW of them to the server.
+ * Replies may come back out of order; they are printed in input order.
  *
  * For more information on unix sockets, refer to:
  * http://beej.us/guide/bgipc/output/html/multipage/unixsock.html
@@ -25,10 +26,17 @@ machine please look into this as a a source of error. */
 #include <sys/un.h>
 #include <errno.h>
 
+#include <map>
+#include <set>
+#include <string>
+
 #include "message.h"
+#include "parse.h"
 #include "utils.h"
 
 #define DEFAULT_STDIN_BUFFER_SIZE 1024
+// max requests sent before waiting on a reply
+#define PIPELINE_WINDOW 64
 
 /**
  * connect_client()
@@ -61,9 +69,82 @@ int connect_client() {
     return client_socket;
 }
 
+// send the whole buffer, -1 on failure
+int send_all(int client_socket, const std::string& buffer) {
+    size_t sent_total = 0;
+    while (sent_total < buffer.size()) {
+        ssize_t sent = send(client_socket, buffer.data() + sent_total, buffer.size() - sent_total, 0);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        sent_total += sent;
+    }
+    return 0;
+}
+
 /**
- * Getting Started Hint:
- *      What kind of protocol or structure will you use to deliver your results from the server to the client?
+ * receive_response()
+ *
+ * Reads one response frame and renders it the way it is printed.
+ * Returns the request id it answers, or -1 if the connection is gone.
+ * *final_part is false for a streamed part (FRAME_FLAG_MORE), more frames follow.
+ **/
+long receive_response(int client_socket, std::string* output, bool* final_part) {
+    frame_header header;
+    ssize_t header_len_recv = recv(client_socket, &header, sizeof(header), MSG_WAITALL);
+    if (header_len_recv != (ssize_t)sizeof(header)) {
+        if (header_len_recv < 0) {
+            log_err("Client: Failed to receive response header: %s\n", strerror(errno));
+        } else {
+            log_info("-- Server closed connection\n");
+        }
+        return -1;
+    }
+    if (header.magic != FRAME_MAGIC || header.version != FRAME_VERSION) {
+        log_err("Client: Received malformed response frame.\n");
+        return -1;
+    }
+
+    std::string payload(header.payload_len, '\0');
+    if (header.payload_len > 0) {
+        ssize_t payload_bytes_actual = recv(client_socket, &payload[0], header.payload_len, MSG_WAITALL);
+        if (payload_bytes_actual != (ssize_t)header.payload_len) {
+            log_err("Client: Incomplete payload. Expected %u, Got %zd\n", header.payload_len, payload_bytes_actual);
+            return -1;
+        }
+    }
+
+    output->clear();
+    *final_part = !(header.flags & FRAME_FLAG_MORE);
+    if (!*final_part) {
+        // streamed text is printed as it arrives, the final frame ends the line
+        *output = payload;
+    } else if (header.flags & FRAME_FLAG_PAIRS) {
+        // key:value pairs separated by spaces
+        size_t num_ints = header.payload_len / sizeof(int32_t);
+        for (size_t i = 0; i + 1 < num_ints; i += 2) {
+            int32_t pair[2];
+            memcpy(pair, payload.data() + i * sizeof(int32_t), sizeof(pair));
+            if (i > 0) {
+                *output += " ";
+            }
+            *output += std::to_string(pair[0]) + ":" + std::to_string(pair[1]);
+        }
+        *output += "\n";
+    } else if (!payload.empty()) {
+        *output = payload + "\n";
+    } else if (header.opcode != OK_DONE) {
+        // empty range or missing key prints an empty line, a plain ack prints nothing
+        *output = "\n";
+    }
+    return header.request_id;
+}
+
+/**
+ * Getting Started Hint:      What kind of protocol or structure will you use to deliver your results from the server to the client?
  *      What kind of protocol or structure will you use to interpret results for final display to the user?
  *      
 **/
@@ -74,24 +155,71 @@ int main(void)
         exit(1);
     }
 
-    message send_message;
-    message recv_message;
-
     // Always output an interactive marker at the start of each command if the
     // input is from stdin. Do not output if piped in from file or from other fd
     const char* prefix = "";
+    // interactive users wait for each answer, piped input is pipelined
+    size_t window = PIPELINE_WINDOW;
     if (isatty(fileno(stdin))) {
         prefix = "db_client > ";
+        window = 1;
     }
 
     const char *output_str = NULL;
 
+    // rendered replies by request id, printed strictly in request order
+    // a streamed reply may arrive in parts, finished_output holds the complete ones
+    std::map<uint32_t, std::string> ready_output;
+    std::set<uint32_t> finished_output;
+    uint32_t next_request_id = 0;
+    uint32_t next_to_print = 0;
+    size_t requests_in_flight = 0;
+    std::string send_buffer;
+
+    auto print_ready = [&]() {
+        auto it = ready_output.begin();
+        while (it != ready_output.end() && it->first == next_to_print) {
+            fputs(it->second.c_str(), stdout);
+            if (!finished_output.erase(next_to_print)) {
+                // head of the line is still streaming, print the rest as it comes
+                it->second.clear();
+                break;
+            }
+            it = ready_output.erase(it);
+            next_to_print++;
+        }
+    };
+
+    // flush queued frames, then collect replies until at most max_in_flight are outstanding
+    auto drain = [&](size_t max_in_flight) {
+        if (!send_buffer.empty()) {
+            if (send_all(client_socket, send_buffer) == -1) {
+                log_err("Failed to send query frames.");
+                exit(1);
+            }
+            send_buffer.clear();
+        }
+        while (requests_in_flight > max_in_flight) {
+            std::string output;
+            bool final_part = true;
+            long request_id = receive_response(client_socket, &output, &final_part);
+            if (request_id < 0) {
+                exit(1);
+            }
+            ready_output[(uint32_t)request_id] += output;
+            if (final_part) {
+                finished_output.insert((uint32_t)request_id);
+                requests_in_flight--;
+            }
+            print_ready();
+        }
+        print_ready();
+    };
+
     // loop and wait for:
     // 1. output interactive marker
     // 2. read from stdin until eof.
     char read_buffer[DEFAULT_STDIN_BUFFER_SIZE];
-    send_message.payload = read_buffer;
-    send_message.status = OK_DONE;
 
     while (printf("%s", prefix), output_str = fgets(read_buffer,
            DEFAULT_STDIN_BUFFER_SIZE, stdin), !feof(stdin)) {
@@ -101,74 +229,27 @@ int main(void)
         }
 
         // Only process input that is greater than 1 character.
-        // convert to message and send the message and the
-        // payload directly to the server.
-        send_message.length = strlen(read_buffer);
-        if (send_message.length > 1) {
-            // send the message_header, which tells server payload size
-            if (send(client_socket, &(send_message), sizeof(message), 0) == -1) {
-                log_err("Failed to send message header.");
-                exit(1);
-            }
-
-            // send the payload (query) to server
-            if (send(client_socket, send_message.payload, send_message.length, 0) == -1) {
-                log_err("Failed to send query payload.");
-                exit(1);
-            }
+        if (strlen(read_buffer) <= 1) {
+            continue;
+        }
+        message parse_message;
+        DbOperator* query = parse_command(read_buffer, &parse_message, client_socket);
+        if (!query) {
+            finished_output.insert(next_request_id);
+            ready_output[next_request_id++] = "[CLIENT] Error: Could not parse command.\n";
+            print_ready();
+            continue;
+        }
+        encode_request_frame(query, next_request_id++, &send_buffer);
+        delete query;
+        requests_in_flight++;
 
-            // always wait for server response
-            ssize_t header_len_recv;
-            if ((header_len_recv = recv(client_socket, &recv_message, sizeof(message), 0)) > 0) {
-
-                // received the header
-                if (recv_message.length < 0) {
-                    log_err("Client: Received header with invalid length: %d\n", recv_message.length);
-                    exit(1); // Or break, then exit outside loop
-                }
-
-                char* server_payload_buffer = NULL;
-                if (recv_message.length > 0) {
-                    // Allocate buffer for the payload
-                    server_payload_buffer = (char*)malloc(recv_message.length + 1);
-                    if (!server_payload_buffer) {
-                        log_err("Client: Failed to allocate memory for server payload.\n");
-                        exit(1);
-                    }
-
-                    // Receive the payload from the server
-                    ssize_t payload_bytes_actual = recv(client_socket, server_payload_buffer, recv_message.length, MSG_WAITALL);
-                    
-                    if (payload_bytes_actual > 0) {
-                        if (payload_bytes_actual != recv_message.length) {
-                             log_err("Client: Incomplete payload. Expected %d, Got %zd\n", recv_message.length, payload_bytes_actual);
-                             free(server_payload_buffer);
-                             exit(1);
-                        }
-                        server_payload_buffer[recv_message.length] = '\0';
-                        printf("%s\n", server_payload_buffer);
-                    } else if (payload_bytes_actual == 0) {
-                        log_info("Client: Server closed connection while expecting payload.\n");
-                    } else {
-                        log_err("Client: Failed to receive payload: %s\n", strerror(errno)); // Need #include <errno.h>
-                        // No payload to print
-                    }
-                    free(server_payload_buffer);
-                } else {
-                    if (recv_message.status == OK_WAIT_FOR_RESPONSE || recv_message.status == OK_DONE) {
-                         printf("\n");
-                    }
-                }
-            } else {
-                if (header_len_recv < 0) {
-                    log_err("Client: Failed to receive message header: %s\n", strerror(errno)); // Need #include <errno.h>
-                } else {
-                    log_info("-- Server closed connection\n");
-                }
-                exit(1);
-            }
+        if (requests_in_flight >= window) {
+            drain(window - 1);
         }
+        fflush(stdout);
     }
+    drain(0);
     close(client_socket);
     return 0;
 }
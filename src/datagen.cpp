@@ -0,0 +1,339 @@
+#include <key_generator.hh>
+#include <op_stream.hh>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+// parallel generator of binary test data, no dependencies beyond the standard library
+//   ./datagen --load=data_load.bin --num=N [--order=random|sorted]
+//   ./datagen --ops=ops.bin --operations=M [--gets=.8 --puts=.1 --ranges=.05 --deletes=.05]
+// the load file is the LOAD format (int32 key, int32 value per pair); the op stream
+// is the binary workload format of op_stream.hh, replayed by ./benchmark
+//
+// loaded keys are 0, 2, 4, ..., 2(num-1): a missing key is the odd key next to a
+// loaded one, so misses pass the fence/range checks and only the filter or the
+// block search turns them away
+// output is a pure function of the flags and --seed, whatever --threads is
+
+struct DatagenOptions {
+    std::string load_path;
+    std::string ops_path;
+    uint64_t num = 1000000;
+    bool sorted = false;
+    uint64_t operations = 1000000;
+    // relative weights of the op mix
+    double gets = 1.0;
+    double puts = 0.0;
+    double ranges = 0.0;
+    double deletes = 0.0;
+    KeyDistribution distribution = KeyDistribution::UNIFORM;
+    double theta = ZipfianGenerator::DEFAULT_THETA;
+    // gets asking for a key that was never loaded
+    double miss_ratio = 0.0;
+    // loaded keys covered by one range
+    uint64_t range_length = 100;
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    uint64_t seed = 265;
+};
+
+// records generated and written per chunk, chunks are handed out to the threads
+#define DATAGEN_CHUNK_RECORDS (1 << 20)
+
+// bijection on [0, n): a 4-round balanced Feistel network over the smallest even
+// power of two >= n, cycle-walking any value that lands past n (< 4 steps on average)
+class IndexPermutation {
+    public:
+    IndexPermutation(uint64_t n, uint64_t seed) : n_(std::max<uint64_t>(n, 1)) {
+        uint64_t bits = 1;
+        while (bits < 64 && (1ULL << bits) < n_) {
+            ++bits;
+        }
+        half_bits_ = (bits + 1) / 2;
+        mask_ = (1ULL << half_bits_) - 1;
+        for (int round = 0; round < 4; ++round) {
+            round_keys_[round] = fnvHash64(seed * 4 + round);
+        }
+    }
+
+    uint64_t apply(uint64_t index) const {
+        do {
+            index = feistel(index);
+        } while (index >= n_);
+        return index;
+    }
+
+    private:
+    uint64_t n_;
+    uint64_t half_bits_;
+    uint64_t mask_;
+    uint64_t round_keys_[4];
+
+    uint64_t feistel(uint64_t value) const {
+        uint64_t left = value >> half_bits_;
+        uint64_t right = value & mask_;
+        for (uint64_t round_key : round_keys_) {
+            uint64_t next_right = left ^ (fnvHash64(right ^ round_key) & mask_);
+            left = right;
+            right = next_right;
+        }
+        return (left << half_bits_) | right;
+    }
+};
+
+static int loadedKey(uint64_t index) {
+    return static_cast<int>(2 * index);
+}
+
+static int missingKey(uint64_t index) {
+    return static_cast<int>(2 * index + 1);
+}
+
+// every chunk has its own stream, so chunks can be made in any order on any thread
+static uint64_t chunkSeed(uint64_t seed, uint64_t chunk) {
+    return fnvHash64(seed) ^ fnvHash64(chunk + 1);
+}
+
+// runs make_chunk(chunk, &bytes) over all chunks on options.threads threads and
+// writes each chunk's bytes at header_bytes + chunk * chunk_bytes
+template <typename ChunkFn>
+bool writeChunks(const std::string& path, const DatagenOptions& options, const std::string& header,
+                 uint64_t num_records, size_t record_bytes, ChunkFn make_chunk) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "can't open " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    bool ok = ftruncate(fd, static_cast<off_t>(header.size() + num_records * record_bytes)) == 0
+              && pwrite(fd, header.data(), header.size(), 0) == static_cast<ssize_t>(header.size());
+
+    uint64_t num_chunks = (num_records + DATAGEN_CHUNK_RECORDS - 1) / DATAGEN_CHUNK_RECORDS;
+    std::atomic<uint64_t> next_chunk{0};
+    std::atomic<bool> failed{!ok};
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < std::max<size_t>(options.threads, 1); ++t) {
+        workers.emplace_back([&]() {
+            std::string bytes;
+            for (uint64_t chunk = next_chunk++; chunk < num_chunks && !failed; chunk = next_chunk++) {
+                uint64_t begin = chunk * DATAGEN_CHUNK_RECORDS;
+                uint64_t end = std::min<uint64_t>(num_records, begin + DATAGEN_CHUNK_RECORDS);
+                bytes.assign((end - begin) * record_bytes, '\0');
+                make_chunk(chunk, begin, end, &bytes[0]);
+                off_t offset = static_cast<off_t>(header.size() + begin * record_bytes);
+                size_t written = 0;
+                while (written < bytes.size()) {
+                    ssize_t n = pwrite(fd, bytes.data() + written, bytes.size() - written,
+                                       offset + static_cast<off_t>(written));
+                    if (n <= 0) {
+                        failed = true;
+                        break;
+                    }
+                    written += n;
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    ok = !failed && close(fd) == 0;
+    if (!ok) {
+        std::cerr << "failed writing " << path << ": " << strerror(errno) << std::endl;
+    }
+    return ok;
+}
+
+// num pairs, one per loaded key, ascending or in a seeded random order
+bool writeLoadFile(const DatagenOptions& options) {
+    IndexPermutation permutation(options.num, options.seed);
+    return writeChunks(options.load_path, options, std::string(), options.num, 2 * sizeof(int32_t),
+                       [&](uint64_t chunk, uint64_t begin, uint64_t end, char* out) {
+        std::mt19937_64 rng(chunkSeed(options.seed, chunk));
+        for (uint64_t position = begin; position < end; ++position) {
+            uint64_t index = options.sorted ? position : permutation.apply(position);
+            int32_t pair[2] = {loadedKey(index), static_cast<int32_t>(rng() & INT_MAX)};
+            memcpy(out, pair, sizeof(pair));
+            out += sizeof(pair);
+        }
+    });
+}
+
+bool writeOpStream(const DatagenOptions& options) {
+    OpStreamHeader header;
+    header.num_ops = options.operations;
+    std::string header_bytes(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    double total = options.gets + options.puts + options.ranges + options.deletes;
+    const double cumulative[3] = {
+        options.gets / total,
+        (options.gets + options.puts) / total,
+        (options.gets + options.puts + options.ranges) / total,
+    };
+    // O(num) to build, shared read-only by every chunk
+    std::unique_ptr<ZipfianGenerator> zipfian;
+    if (usesZipfian(options.distribution)) {
+        zipfian = std::make_unique<ZipfianGenerator>(options.num, options.theta);
+    }
+    int64_t max_key = 2 * static_cast<int64_t>(options.num);
+
+    return writeChunks(options.ops_path, options, header_bytes, options.operations, sizeof(OpRecord),
+                       [&](uint64_t chunk, uint64_t begin, uint64_t end, char* out) {
+        KeyGenerator keys(options.distribution, options.num, chunkSeed(options.seed, chunk), zipfian.get());
+        keys.seek(begin);
+        std::mt19937_64& rng = keys.rng();
+        std::uniform_real_distribution<double> pick(0.0, 1.0);
+        for (uint64_t position = begin; position < end; ++position) {
+            double draw = pick(rng);
+            uint64_t index = keys.next();
+            OpRecord record = {};
+            if (draw < cumulative[0]) {
+                record.type = 'g';
+                record.key = pick(rng) < options.miss_ratio ? missingKey(index) : loadedKey(index);
+            } else if (draw < cumulative[1]) {
+                record.type = 'p';
+                record.key = loadedKey(index);
+                record.arg = static_cast<int32_t>(rng() & INT_MAX);
+            } else if (draw < cumulative[2]) {
+                record.type = 'r';
+                record.key = loadedKey(index);
+                int64_t high = static_cast<int64_t>(record.key) + 2 * static_cast<int64_t>(options.range_length);
+                record.arg = static_cast<int32_t>(std::min<int64_t>(high, std::min<int64_t>(max_key, INT_MAX)));
+            } else {
+                record.type = 'd';
+                record.key = loadedKey(index);
+            }
+            memcpy(out, &record, sizeof(record));
+            out += sizeof(record);
+        }
+    });
+}
+
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " [--flag=value ...]\n"
+              << "  --load=<path>         write a binary LOAD file of num pairs\n"
+              << "  --num=1000000         loaded keys: 0, 2, 4, ..., 2(num-1)\n"
+              << "  --order=random        or sorted, order of the load file\n"
+              << "  --ops=<path>          write a binary op stream of --operations ops\n"
+              << "  --operations=1000000\n"
+              << "  --gets=1 --puts=0 --ranges=0 --deletes=0   relative weights of the op mix\n"
+              << "  --distribution=uniform uniform, zipfian, latest or sequential keys\n"
+              << "  --theta=0.99          zipfian skew, for zipfian and latest\n"
+              << "  --miss_ratio=0        gets of keys that were never loaded\n"
+              << "  --range_length=100    loaded keys per range\n"
+              << "  --threads=<cores>\n"
+              << "  --seed=265" << std::endl;
+}
+
+bool parseOptions(int argc, char* argv[], DatagenOptions* options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        size_t equals = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || equals == std::string::npos) {
+            return false;
+        }
+        std::string flag = arg.substr(2, equals - 2);
+        std::string value = arg.substr(equals + 1);
+        try {
+            if (flag == "load") {
+                options->load_path = value;
+            } else if (flag == "ops") {
+                options->ops_path = value;
+            } else if (flag == "num") {
+                options->num = std::stoull(value);
+            } else if (flag == "order") {
+                if (value != "random" && value != "sorted") {
+                    throw std::invalid_argument(value);
+                }
+                options->sorted = value == "sorted";
+            } else if (flag == "operations") {
+                options->operations = std::stoull(value);
+            } else if (flag == "gets") {
+                options->gets = std::stod(value);
+            } else if (flag == "puts") {
+                options->puts = std::stod(value);
+            } else if (flag == "ranges") {
+                options->ranges = std::stod(value);
+            } else if (flag == "deletes") {
+                options->deletes = std::stod(value);
+            } else if (flag == "distribution") {
+                if (!parseKeyDistribution(value, &options->distribution)) {
+                    throw std::invalid_argument(value);
+                }
+            } else if (flag == "theta") {
+                options->theta = std::stod(value);
+            } else if (flag == "miss_ratio") {
+                options->miss_ratio = std::stod(value);
+            } else if (flag == "range_length") {
+                options->range_length = std::stoull(value);
+            } else if (flag == "threads") {
+                options->threads = std::stoul(value);
+            } else if (flag == "seed") {
+                options->seed = std::stoull(value);
+            } else {
+                return false;
+            }
+        } catch (const std::exception&) {
+            std::cerr << "bad value for " << arg << std::endl;
+            return false;
+        }
+    }
+    if (options->load_path.empty() && options->ops_path.empty()) {
+        std::cerr << "nothing to write, give --load and/or --ops" << std::endl;
+        return false;
+    }
+    // keys go up to 2 * num, they must stay ints
+    if (options->num == 0 || options->num > static_cast<uint64_t>(INT_MAX) / 2) {
+        std::cerr << "--num must be in [1, " << INT_MAX / 2 << "]" << std::endl;
+        return false;
+    }
+    if (options->gets < 0 || options->puts < 0 || options->ranges < 0 || options->deletes < 0
+        || options->gets + options->puts + options->ranges + options->deletes <= 0) {
+        std::cerr << "op weights must be non-negative with a positive sum" << std::endl;
+        return false;
+    }
+    if (options->theta <= 0.0 || options->theta >= 1.0) {
+        std::cerr << "--theta must be in (0, 1)" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+template <typename WriteFn>
+bool timed(const std::string& what, const std::string& path, uint64_t records, size_t record_bytes,
+           WriteFn write) {
+    auto start = std::chrono::steady_clock::now();
+    if (!write()) {
+        return false;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double megabytes = static_cast<double>(records * record_bytes) / (1 << 20);
+    std::cout << std::fixed << std::setprecision(2) << "wrote " << records << " " << what << " to " << path
+              << " (" << megabytes << " MB) in " << seconds << "s, "
+              << (seconds > 0.0 ? megabytes / seconds : 0.0) << " MB/s" << std::endl;
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    DatagenOptions options;
+    if (!parseOptions(argc, argv, &options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (!options.load_path.empty()
+        && !timed("pairs", options.load_path, options.num, 2 * sizeof(int32_t),
+                  [&]() { return writeLoadFile(options); })) {
+        return 1;
+    }
+    if (!options.ops_path.empty()
+        && !timed("ops", options.ops_path, options.operations, sizeof(OpRecord),
+                  [&]() { return writeOpStream(options); })) {
+        return 1;
+    }
+    return 0;
+}
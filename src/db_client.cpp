@@ -0,0 +1,197 @@
+#include "db_client.hh"
+#include "parse.h"
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+DbClient::~DbClient() {
+    close();
+}
+
+bool DbClient::connect(const std::string& socket_path) {
+    close();
+    struct sockaddr_un remote;
+    if (socket_path.size() >= sizeof(remote.sun_path)) {
+        std::cerr << "[DbClient] socket path too long: " << socket_path << std::endl;
+        return false;
+    }
+    socket_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socket_fd_ < 0) {
+        std::cerr << "[DbClient] socket failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+    memset(&remote, 0, sizeof(remote));
+    remote.sun_family = AF_UNIX;
+    strncpy(remote.sun_path, socket_path.c_str(), sizeof(remote.sun_path) - 1);
+    if (::connect(socket_fd_, reinterpret_cast<struct sockaddr*>(&remote), sizeof(remote)) == -1) {
+        std::cerr << "[DbClient] connect to " << socket_path << " failed: " << strerror(errno) << std::endl;
+        close();
+        return false;
+    }
+    next_request_id_ = 0;
+    partial_text_.clear();
+    return true;
+}
+
+void DbClient::close() {
+    int fd = socket_fd_.exchange(-1);
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+bool DbClient::put(int key, int value) {
+    DbOperator dbo;
+    dbo.type = PUT;
+    dbo.args = {key, value};
+    DbReply reply;
+    return call(dbo, &reply) && reply.status == OK_DONE;
+}
+
+bool DbClient::putBatch(const std::vector<std::pair<int, int>>& pairs) {
+    // argc is 16 bits on the wire
+    if (pairs.empty() || pairs.size() > UINT16_MAX / 2) {
+        return false;
+    }
+    DbOperator dbo;
+    dbo.type = PUT_BATCH;
+    dbo.args.reserve(pairs.size() * 2);
+    for (const auto& pair : pairs) {
+        dbo.args.push_back(pair.first);
+        dbo.args.push_back(pair.second);
+    }
+    DbReply reply;
+    return call(dbo, &reply) && reply.status == OK_DONE;
+}
+
+std::optional<int> DbClient::get(int key) {
+    DbOperator dbo;
+    dbo.type = GET;
+    dbo.args = {key};
+    DbReply reply;
+    if (!call(dbo, &reply) || reply.pairs.empty()) {
+        return std::nullopt;
+    }
+    return reply.pairs.front().second;
+}
+
+bool DbClient::remove(int key) {
+    DbOperator dbo;
+    dbo.type = DELETE;
+    dbo.args = {key};
+    DbReply reply;
+    return call(dbo, &reply) && reply.status == OK_DONE;
+}
+
+bool DbClient::range(int low, int high, std::vector<std::pair<int, int>>* pairs) {
+    DbOperator dbo;
+    dbo.type = RANGE;
+    dbo.args = {low, high};
+    DbReply reply;
+    if (!call(dbo, &reply)) {
+        return false;
+    }
+    *pairs = std::move(reply.pairs);
+    return true;
+}
+
+bool DbClient::call(const DbOperator& dbo, DbReply* reply) {
+    uint32_t request_id;
+    uint32_t reply_id;
+    if (!send(dbo, &request_id) || !receive(reply, &reply_id)) {
+        return false;
+    }
+    if (reply_id != request_id) {
+        std::cerr << "[DbClient] reply for request " << reply_id << ", expected " << request_id << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool DbClient::send(const DbOperator& dbo, uint32_t* request_id) {
+    if (socket_fd_ < 0) {
+        return false;
+    }
+    *request_id = next_request_id_++;
+    std::string frame;
+    encode_request_frame(&dbo, *request_id, &frame);
+    return sendAll(frame);
+}
+
+bool DbClient::receive(DbReply* reply, uint32_t* request_id) {
+    if (socket_fd_ < 0) {
+        return false;
+    }
+    // a streamed reply arrives as several frames, other replies can come in between
+    while (true) {
+        if (!receiveFrame(reply, request_id)) {
+            return false;
+        }
+        if (reply->flags & FRAME_FLAG_MORE) {
+            partial_text_[*request_id] += reply->text;
+            continue;
+        }
+        auto partial = partial_text_.find(*request_id);
+        if (partial != partial_text_.end()) {
+            reply->text = partial->second + reply->text;
+            partial_text_.erase(partial);
+        }
+        return true;
+    }
+}
+
+bool DbClient::sendAll(const std::string& buffer) {
+    size_t sent_total = 0;
+    while (sent_total < buffer.size()) {
+        ssize_t sent = ::send(socket_fd_, buffer.data() + sent_total, buffer.size() - sent_total, MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "[DbClient] send failed: " << strerror(errno) << std::endl;
+            close();
+            return false;
+        }
+        sent_total += sent;
+    }
+    return true;
+}
+
+bool DbClient::receiveFrame(DbReply* reply, uint32_t* request_id) {
+    frame_header header;
+    if (recv(socket_fd_, &header, sizeof(header), MSG_WAITALL) != (ssize_t)sizeof(header)
+        || header.magic != FRAME_MAGIC || header.version != FRAME_VERSION) {
+        std::cerr << "[DbClient] connection closed or malformed reply" << std::endl;
+        close();
+        return false;
+    }
+    std::string payload(header.payload_len, '\0');
+    if (header.payload_len > 0
+        && recv(socket_fd_, &payload[0], header.payload_len, MSG_WAITALL) != (ssize_t)header.payload_len) {
+        std::cerr << "[DbClient] incomplete reply payload" << std::endl;
+        close();
+        return false;
+    }
+
+    *request_id = header.request_id;
+    reply->status = static_cast<message_status>(header.opcode);
+    reply->flags = header.flags;
+    reply->pairs.clear();
+    reply->text.clear();
+    if (header.flags & FRAME_FLAG_PAIRS) {
+        size_t num_pairs = header.payload_len / (2 * sizeof(int32_t));
+        reply->pairs.resize(num_pairs);
+        for (size_t i = 0; i < num_pairs; ++i) {
+            int32_t pair[2];
+            memcpy(pair, payload.data() + i * sizeof(pair), sizeof(pair));
+            reply->pairs[i] = {pair[0], pair[1]};
+        }
+    } else {
+        reply->text = std::move(payload);
+    }
+    return true;
+}
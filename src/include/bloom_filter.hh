@@ -6,6 +6,7 @@
 #include <functional>
 #include <cmath>
 #include <algorithm>
+#include <climits>
 
 const double DEFAULT_FALSE_POSITIVE_RATE = 0.01;
 
@@ -0,0 +1,65 @@
+#ifndef DB_CLIENT_HH
+#define DB_CLIENT_HH
+
+#include <atomic>
+#include <map>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+#include "db_types.hh"
+#include "message.h"
+
+// one decoded response frame
+struct DbReply {
+    message_status status = OK_DONE;
+    uint16_t flags = 0;
+    // int32 key,value pairs of a GET/RANGE result
+    std::vector<std::pair<int, int>> pairs;
+    std::string text;
+};
+
+// blocking client for the server's framed protocol, for the workload drivers
+// call() keeps one request in flight; pipelined callers send() from one thread and
+// receive() on another, replies can come back out of order
+class DbClient {
+    public:
+    DbClient() = default;
+    ~DbClient();
+    DbClient(const DbClient&) = delete;
+    DbClient& operator=(const DbClient&) = delete;
+
+    // unix socket path, the server's SOCK_PATH by default
+    bool connect(const std::string& socket_path);
+    bool connected() const {
+        return socket_fd_ >= 0;
+    }
+    void close();
+
+    bool put(int key, int value);
+    // one request for all the pairs, applied atomically; at most 32767 pairs per call
+    bool putBatch(const std::vector<std::pair<int, int>>& pairs);
+    std::optional<int> get(int key);
+    bool remove(int key);
+    // pairs in [low, high), false on a transport error
+    bool range(int low, int high, std::vector<std::pair<int, int>>* pairs);
+
+    // sends the operator and waits for its (final) reply frame
+    bool call(const DbOperator& dbo, DbReply* reply);
+
+    // request ids count up from 0 on each connection
+    bool send(const DbOperator& dbo, uint32_t* request_id);
+    // the next complete reply of any request, streamed parts joined
+    bool receive(DbReply* reply, uint32_t* request_id);
+
+    private:
+    std::atomic<int> socket_fd_{-1};
+    uint32_t next_request_id_ = 0;
+    // text of streamed replies still missing their final frame, by request id
+    std::map<uint32_t, std::string> partial_text_;
+
+    bool sendAll(const std::string& buffer);
+    bool receiveFrame(DbReply* reply, uint32_t* request_id);
+};
+
+#endif
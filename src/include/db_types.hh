@@ -2,6 +2,9 @@
 #define DB_TYPES
 
 #include <vector>
+#include <string>
+#include <stdint.h>
+#include "message.h"
 
 typedef enum OperatorType {
     PUT,
@@ -10,6 +13,16 @@ typedef enum OperatorType {
     DELETE,
     LOAD,
     PRINT_STATS,
+    INGEST,
+    DUMP,
+    METRICS,
+    // appended so the wire opcodes of the others stay put
+    DELETE_RANGE,
+    MERGE,
+    // key,value pairs, applied as one WriteBatch
+    PUT_BATCH,
+    // workload-driven tuning advice, applied when the string arg is "apply"
+    TUNE,
 } OperatorType;
 
 typedef struct DbOperator {
@@ -22,4 +35,12 @@ typedef struct DbOperator {
 
 } DbOperator;
 
+// result of one operator, the server encodes it as a response frame
+typedef struct DbResult {
+    message_status status;
+    // GET/RANGE hits as key,value pairs, sent as int32 without formatting
+    std::vector<int32_t> pairs;
+    std::string text;
+} DbResult;
+
 #endif
\ No newline at end of file
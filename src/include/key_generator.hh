@@ -0,0 +1,167 @@
+#ifndef KEY_GENERATOR_HH
+#define KEY_GENERATOR_HH
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+
+// key distributions shared by the benchmark and workload tools
+// uniform: every key equally likely
+// zipfian: a few hot keys, scattered over the key space (YCSB scrambled zipfian)
+// latest: zipfian over recency, the most recently inserted keys are hottest
+// sequential: 0, 1, 2, ... wrapping at the key count
+enum class KeyDistribution {
+    UNIFORM,
+    ZIPFIAN,
+    LATEST,
+    SEQUENTIAL,
+};
+
+inline bool parseKeyDistribution(const std::string& name, KeyDistribution* distribution) {
+    if (name == "uniform") {
+        *distribution = KeyDistribution::UNIFORM;
+    } else if (name == "zipfian") {
+        *distribution = KeyDistribution::ZIPFIAN;
+    } else if (name == "latest") {
+        *distribution = KeyDistribution::LATEST;
+    } else if (name == "sequential") {
+        *distribution = KeyDistribution::SEQUENTIAL;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline const char* keyDistributionName(KeyDistribution distribution) {
+    switch (distribution) {
+        case KeyDistribution::ZIPFIAN: return "zipfian";
+        case KeyDistribution::LATEST: return "latest";
+        case KeyDistribution::SEQUENTIAL: return "sequential";
+        default: return "uniform";
+    }
+}
+
+// whether a KeyGenerator of this distribution draws from a ZipfianGenerator
+inline bool usesZipfian(KeyDistribution distribution) {
+    return distribution == KeyDistribution::ZIPFIAN || distribution == KeyDistribution::LATEST;
+}
+
+// item ranks in [0, num_items), rank 0 most popular (Gray et al., "Quickly
+// generating billion-record synthetic databases"), zeta is O(num_items) once
+class ZipfianGenerator {
+    public:
+    static constexpr double DEFAULT_THETA = 0.99;
+
+    explicit ZipfianGenerator(uint64_t num_items, double theta = DEFAULT_THETA)
+        : num_items_(num_items == 0 ? 1 : num_items), theta_(theta) {
+        zeta_n_ = zeta(num_items_, theta_);
+        double zeta_2 = zeta(2, theta_);
+        alpha_ = 1.0 / (1.0 - theta_);
+        eta_ = (1.0 - std::pow(2.0 / static_cast<double>(num_items_), 1.0 - theta_)) / (1.0 - zeta_2 / zeta_n_);
+        half_pow_theta_ = 1.0 + std::pow(0.5, theta_);
+    }
+
+    uint64_t next(std::mt19937_64& rng) const {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        double uz = u * zeta_n_;
+        if (uz < 1.0) {
+            return 0;
+        }
+        if (uz < half_pow_theta_) {
+            return 1;
+        }
+        uint64_t rank = static_cast<uint64_t>(static_cast<double>(num_items_) * std::pow(eta_ * u - eta_ + 1.0, alpha_));
+        return rank < num_items_ ? rank : num_items_ - 1;
+    }
+
+    uint64_t numItems() const {
+        return num_items_;
+    }
+
+    private:
+    uint64_t num_items_;
+    double theta_;
+    double zeta_n_;
+    double alpha_;
+    double eta_;
+    double half_pow_theta_;
+
+    static double zeta(uint64_t n, double theta) {
+        double sum = 0.0;
+        for (uint64_t i = 1; i <= n; ++i) {
+            sum += 1.0 / std::pow(static_cast<double>(i), theta);
+        }
+        return sum;
+    }
+};
+
+// FNV-1a over the 8 bytes of value, spreads zipfian ranks over the key space
+inline uint64_t fnvHash64(uint64_t value) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < 8; ++i) {
+        hash ^= value & 0xff;
+        hash *= 0x100000001b3ULL;
+        value >>= 8;
+    }
+    return hash;
+}
+
+// key indices in [0, num_keys) drawn from one distribution, one per thread
+// building a ZipfianGenerator is O(num_keys), pass one in to share it read-only
+class KeyGenerator {
+    public:
+    // latest follows *inserted_keys (keys [0, inserted) exist) when given, else num_keys
+    KeyGenerator(KeyDistribution distribution, uint64_t num_keys, uint64_t seed,
+                 const ZipfianGenerator* zipfian = nullptr,
+                 const std::atomic<uint64_t>* inserted_keys = nullptr)
+        : distribution_(distribution), num_keys_(num_keys == 0 ? 1 : num_keys), rng_(seed),
+          zipfian_(zipfian), inserted_keys_(inserted_keys) {
+        if (usesZipfian(distribution_) && !zipfian_) {
+            owned_zipfian_ = std::make_shared<ZipfianGenerator>(num_keys_);
+            zipfian_ = owned_zipfian_.get();
+        }
+    }
+
+    uint64_t next() {
+        switch (distribution_) {
+            case KeyDistribution::ZIPFIAN:
+                return fnvHash64(zipfian_->next(rng_)) % num_keys_;
+            case KeyDistribution::LATEST: {
+                uint64_t inserted = inserted_keys_ ? inserted_keys_->load(std::memory_order_relaxed) : num_keys_;
+                if (inserted == 0) {
+                    // nothing written yet, no recency to follow
+                    return std::uniform_int_distribution<uint64_t>(0, num_keys_ - 1)(rng_);
+                }
+                uint64_t offset = zipfian_->next(rng_) % inserted;
+                return inserted - 1 - offset;
+            }
+            case KeyDistribution::SEQUENTIAL:
+                return sequential_position_++ % num_keys_;
+            default:
+                return std::uniform_int_distribution<uint64_t>(0, num_keys_ - 1)(rng_);
+        }
+    }
+
+    std::mt19937_64& rng() {
+        return rng_;
+    }
+
+    // where the sequential distribution continues from
+    void seek(uint64_t position) {
+        sequential_position_ = position;
+    }
+
+    private:
+    KeyDistribution distribution_;
+    uint64_t num_keys_;
+    std::mt19937_64 rng_;
+    const ZipfianGenerator* zipfian_;
+    const std::atomic<uint64_t>* inserted_keys_;
+    std::shared_ptr<ZipfianGenerator> owned_zipfian_;
+    uint64_t sequential_position_ = 0;
+};
+
+#endif
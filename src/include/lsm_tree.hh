@@ -5,19 +5,30 @@
 #include <vector>
 #include <memory>
 #include <map>
+#include <set>
 #include <mutex>
 #include <shared_mutex>
 #include <thread>
 #include <queue>
+#include <deque>
 // persistence
 #include <filesystem>
 #include <sstream>
 #include <iomanip>
 #include <atomic>
+#include <optional>
+#include <condition_variable>
+#include <functional>
+#include <climits>
+#include <cstring>
 #include <fstream>
 #include <unistd.h>
 #include <sys/types.h>
 #include "bloom_filter.hh"
+#include "hyperloglog.hh"
+#include "metrics.hh"
+#include "thread_pool.hh"
+#include "tuner.hh"
 
 
 #define BUFFER_CAPACITY 100
@@ -27,22 +38,76 @@
 // #define MAX_ENTRIES_PER_LEVEL 5120000000000
 #define MAX_TABLE_SIZE 1000000
 #define FENCE_PTR_BLOCK_SIZE 170 // 4096 / (12 * 2) = 170 bytes
+#define RANGE_PARTITION_MIN_ENTRIES 65536 // smaller range scans stay on the calling thread
+#define BULK_LOAD_CHUNK_PAIRS (1 << 24) // pairs sorted in memory per run, 128MB of input
+#define TOMBSTONE_DENSITY_THRESHOLD 0.5 // a level this full of tombstones is pushed down, 0 disables
+#define DELETE_PERSISTENCE_MS 0 // max time from a delete to its purge at the last level, 0 is unbounded
 
-// DataPair is 12 bytes
+// DataPair is 12 bytes on the wire (key, value, tombstone), plus its sequence number in memory
 // 10MB = 10485760 Bytes = 873,814 DataPairs
 class DataPair {
     public:
-    DataPair(int key, int value, bool deleted = false);
+    DataPair(int key, int value, bool deleted = false, uint64_t seq = 0);
     int key_;
     int value_;
     // tombstone to mark deleted keys
     bool deleted_;
+    // merge operand, value_ is combined with the older value instead of replacing it
+    bool merge_ = false;
+    // sequence number of the write, later writes get larger numbers
+    // 0 for data written before sequence numbers existed
+    uint64_t seq_;
 
     bool operator<(int other_key) const;
     bool operator<(const DataPair& other) const;
     bool operator==(const DataPair& other) const;
 };
 
+// every version of a key in [low, high) older than seq reads as deleted
+// one entry for the whole range, however many keys it covers
+struct RangeTombstone {
+    int low;
+    int high;
+    uint64_t seq;
+};
+
+// range tombstones cut into disjoint fragments, each with the seqs of the tombstones
+// covering it, so a lookup is one binary search however many tombstones overlap;
+// built once and shared by readers at any snapshot
+class RangeTombstoneSet {
+    public:
+    RangeTombstoneSet() = default;
+    // tombstones newer than max_seq are left out
+    RangeTombstoneSet(const std::vector<RangeTombstone>& tombstones, uint64_t max_seq = UINT64_MAX);
+
+    // newest seq <= max_seq of a tombstone covering key, 0 if none does
+    uint64_t coveringSeq(int key, uint64_t max_seq = UINT64_MAX) const;
+    // a version written at seq is hidden by a newer tombstone visible at max_seq
+    bool covers(int key, uint64_t seq, uint64_t max_seq = UINT64_MAX) const;
+    bool empty() const;
+
+    private:
+    struct Fragment {
+        int low;
+        int high;
+        // newest first
+        std::vector<uint64_t> seqs;
+    };
+    // disjoint, ascending
+    std::vector<Fragment> fragments_;
+};
+
+// the buffer's and a Version's tombstone sets as a reader at max_seq sees them,
+// two refcounts to copy however many tombstones there are
+struct RangeTombstoneView {
+    std::shared_ptr<const RangeTombstoneSet> buffer;
+    std::shared_ptr<const RangeTombstoneSet> tables;
+    uint64_t max_seq = UINT64_MAX;
+
+    uint64_t coveringSeq(int key) const;
+    bool covers(int key, uint64_t seq) const;
+};
+
 struct fence_ptr {
     int min_key;
     // where the block starts in the file
@@ -51,6 +116,34 @@ struct fence_ptr {
     size_t block_size_actual_;
 };
 
+// I/O footprint of one getData/rangeData call, in fence pointer blocks
+struct QueryStats {
+    // tables whose key range covered the query
+    size_t tables_probed = 0;
+    size_t bloom_checks = 0;
+    size_t bloom_passes = 0;
+    // passed the filter but the table did not hold the key
+    size_t bloom_false_positives = 0;
+    size_t blocks_read = 0;
+    size_t bytes_read = 0;
+
+    void add(const QueryStats& other);
+};
+
+// what one compaction read and wrote
+struct CompactionStats {
+    size_t source_level;
+    size_t input_tables = 0;
+    size_t output_tables = 0;
+    size_t input_entries = 0;
+    size_t output_entries = 0;
+    size_t bytes_read = 0;
+    size_t bytes_written = 0;
+};
+
+// compactions kept for recentCompactions()
+#define COMPACTION_STATS_HISTORY 32
+
 // snapshots of the states
 struct SSTableSnapshot {
     int level_num;
@@ -74,11 +167,18 @@ struct LevelSnapshot {
 
 class SSTable {
     public:
+    // oldest_tombstone_time: when the oldest tombstone in data was written, 0 for now
+    // fp_rate: of the bloom filter, LSMTree::levelFalsePositiveRate for the level
     SSTable(const std::vector<DataPair>& data, int level_num, 
-            const std::string& file_path, const std::string& bf_file_path);
+            const std::string& file_path, const std::string& bf_file_path,
+            uint64_t oldest_tombstone_time = 0,
+            const std::vector<RangeTombstone>& range_tombstones = {},
+            double fp_rate = DEFAULT_FALSE_POSITIVE_RATE);
     // prepare for log loading
     SSTable(int level_num, const std::string& file_path, 
             const std::string& bf_file_path);
+    // removes the files once marked obsolete
+    ~SSTable();
 
     std::string file_path_;
     std::string bf_file_path_;
@@ -98,25 +198,73 @@ class SSTable {
     size_t fence_pointer_block_size_ = FENCE_PTR_BLOCK_SIZE;
 
     // persistence:
-    // maybe use lazy-loading, only load data when needed
+    // tables opened at startup are lazy, table_data_ is read on first use
     std::vector<DataPair> table_data_;
-    bool data_loaded_;
+    // set last by loadFromDisk, after table_data_ and the fence pointers are ready
+    std::atomic<bool> data_loaded_;
 
-    // TODO: synchronization: add a mutex to protect lazy loading in loadFromDisk
+    // serializes lazy loading, see ensureLoaded
     mutable std::mutex sstable_mutex_;
 
+    // set when compaction retires this table; the files are removed by the
+    // destructor, after the last Version and reader let go of it
+    std::atomic<bool> obsolete_{false};
+
+    // files ingested as-is keep seq 0 on disk, every entry reads as global_seq_
+    // 0 means use the file's seqs
+    uint64_t global_seq_ = 0;
+
+    // range deletes, outside min_key_/max_key_ and the bloom filter; written after the
+    // entries in the data file and copied into the .meta, so opening needs no data
+    std::vector<RangeTombstone> range_tombstones_;
+
+    // -- statistics, kept in file_path_ + ".meta" next to the table --
+    size_t tombstone_count_ = 0;
+    size_t data_bytes_ = 0;
+    // largest entry or range tombstone seq, so opening needs no data to restore the sequence
+    uint64_t max_seq_ = 0;
+    // wall clock ms of the oldest delete among the tombstones, 0 without tombstones;
+    // inherited through compaction, so it bounds how long a delete has been in the tree
+    uint64_t oldest_tombstone_time_ = 0;
+    // current-version .meta was read, its stats need no recount on load
+    bool meta_loaded_ = false;
+    // distinct keys of the table, tombstones included
+    HyperLogLog key_sketch_;
+    // recount from table_data_
+    void computeStats();
+    // size, key range, tombstones and their age, bytes, seqs, sketch and range tombstones
+    bool writeMeta() const;
+    bool loadMeta();
+
     std::optional<std::pair<size_t, size_t>> getFenceRange(int key) const;
+    // blocks of ~fence_pointer_block_size_ entries, never splitting one key's versions
+    void buildFencePointers();
 
     bool writeToDisk() const;
+    // caller holds sstable_mutex_ or the table is not shared yet, else use ensureLoaded
     bool loadFromDisk();
+    // loadFromDisk under sstable_mutex_, for concurrent readers and compactions;
+    // the call that does the load adds the whole file, every block, to *stats
+    bool ensureLoaded(QueryStats* stats = nullptr);
     // end persistence
 
     void printSSTable() const;
 
     // check if Key is in range of SSTable
     bool keyInRange(int key) const;
+    // keys held or covered: min_key_/max_key_ widened by the range tombstones, inclusive;
+    // first > second for a table with neither
+    std::pair<int, int> coveredKeyRange() const;
     bool keyInSSTable(int key);
-    std::optional<DataPair> getDataPair(int key);
+    // newest version of key with seq <= max_seq
+    // the searched block is added to stats->blocks_read/bytes_read, and the whole file
+    // if this lookup is the one that loads it
+    std::optional<DataPair> getDataPair(int key, uint64_t max_seq = UINT64_MAX, QueryStats* stats = nullptr);
+    // blocks and bytes holding the entries in [low, high), table data must be loaded;
+    // the first load is counted by ensureLoaded
+    void addRangeFootprint(int low, int high, QueryStats* stats) const;
+    // average on-disk bytes per entry
+    size_t entryBytes() const;
 
 };
 
@@ -130,11 +278,21 @@ class Level {
 
     int level_num_;
 
-    size_t table_capacity_;
+    // the tuner can change it while running
+    std::atomic<size_t> table_capacity_;
     // size_t entries_capacity_;
 
     size_t cur_table_count_;
     size_t cur_total_entries_;
+    // kept up to date by add/remove, so stats never touch the tables
+    size_t cur_tombstones_;
+    // range tombstones are kept apart from the entries, and from cur_tombstones_
+    size_t cur_range_tombstones_;
+    size_t cur_bytes_;
+    // oldest of the tables' oldest_tombstone_time_, 0 without tombstones
+    uint64_t oldest_tombstone_time_;
+    // union of the tables' key sketches
+    HyperLogLog key_sketch_;
 
     // tracks all SSTables on the current level
     std::vector<std::shared_ptr<SSTable>> sstables_;
@@ -150,38 +308,278 @@ class Level {
     void addSSTable(std::shared_ptr<SSTable> sstable_ptr);
     void removeSSTable(std::shared_ptr<SSTable> sstable_ptr);
     void removeAllSSTables(const std::vector<std::shared_ptr<SSTable>>& tables_to_remove);
+    // recount the aggregates from sstables_, caller holds level_mutex_
+    void recomputeStats();
 
     // compaction
+    // at table capacity; tombstone triggers are LSMTree::levelNeedsCompaction
     bool needsCompaction() const;
 
     void printLevel() const;
 };
 
+// buffer entries are ordered by key, then newest version first
+// that is the same order SSTables store versions in
+struct BufferKey {
+    int key;
+    uint64_t seq;
+};
+
+struct BufferKeyCompare {
+    // lets buffer_data_.lower_bound(int) find a key's newest version
+    using is_transparent = void;
+
+    bool operator()(const BufferKey& a, const BufferKey& b) const {
+        if (a.key != b.key) {
+            return a.key < b.key;
+        }
+        return a.seq > b.seq;
+    }
+    bool operator()(const BufferKey& a, int key) const {
+        return a.key < key;
+    }
+    bool operator()(int key, const BufferKey& b) const {
+        return key < b.key;
+    }
+};
+
+// combines the older value with a newer merge operand; must be associative, since
+// compaction combines operands with each other before the value under them is known
+using MergeOperator = std::function<int(int existing, int operand)>;
+// older combined under the merge operand newer: over a put it becomes a put of the
+// combined value, over a tombstone a put of the operand, over an operand one operand
+DataPair foldMerge(const DataPair& older, const DataPair& newer, const MergeOperator& merge_operator);
+// operands newest first, applied oldest first on top of base; no base is a missing key
+int applyMergeOperands(std::optional<int> base, const std::vector<int>& operands,
+                       const MergeOperator& merge_operator);
+
+// puts, deletes and merge operands applied as one: a single buffer lock acquisition and
+// consecutive seqs, so readers and snapshots see all of them or none
+class WriteBatch {
+    public:
+    void putData(int key, int value);
+    void deleteData(int key);
+    void mergeData(int key, int operand);
+    size_t size() const;
+    bool empty() const;
+    void clear();
+
+    // in the order added, a later write to a key wins
+    std::vector<DataPair> entries_;
+};
+
+// an older version must be kept while some live snapshot reads it:
+// a snapshot at s sees the newest version with seq <= s
+bool versionNeeded(uint64_t newer_seq, uint64_t seq, const std::vector<uint64_t>& snapshots);
+
 // buffer/memtable, where all data is stored before being flushed to disk
 class Buffer {
     public:
     Buffer(size_t capacity = BUFFER_CAPACITY);
     
-    size_t capacity_;
+    // the tuner can change it while running
+    std::atomic<size_t> capacity_;
     // need to refactor to balanced binary tree, skip list, or B tree
     // std::vector<DataPair> buffer_data_;
-    std::map<int, DataPair> buffer_data_;
+    // older versions of a key stay only while a snapshot needs them
+    std::map<BufferKey, DataPair, BufferKeyCompare> buffer_data_;
+    // tombstones among buffer_data_, guarded by buffer_mutex_
+    size_t tombstone_count_ = 0;
+    // range deletes since the last flush, in seq order, guarded by buffer_mutex_
+    std::vector<RangeTombstone> range_tombstones_;
+    std::shared_ptr<const RangeTombstoneSet> range_tombstone_set_ = std::make_shared<RangeTombstoneSet>();
+    // wall clock ms of the first tombstone since the buffer last had none, 0 without any
+    uint64_t oldest_tombstone_time_ = 0;
 
     // add concurrency protection for buffer synchronization
     // mutable std::mutex buffer_mutex_;
     // add shared mutex, so read can acquire shared lock, while write acquires exclusive locks
     mutable std::shared_mutex buffer_mutex_;
 
+    // sequence numbers are handed out under buffer_mutex_, so a snapshot taken
+    // under the same lock sees every write up to its seq and nothing after
+    uint64_t last_seq_;
+    // seqs of live snapshots, a multiset since two snapshots can share a seq
+    std::multiset<uint64_t> snapshots_;
+    mutable std::mutex snapshot_mutex_;
+
+    // key ranges of ingests from reserving their seq to installing their tables, guarded
+    // by buffer_mutex_; a put into one waits on ingest_done_cv_, or it would take a smaller
+    // seq than the ingest yet be read first from the buffer
+    std::vector<std::pair<int, int>> ingest_ranges_;
+    std::condition_variable_any ingest_done_cv_;
+
     void printBuffer() const;
     bool isFull() const;
     std::shared_ptr<SSTable> flushBuffer();
     // API: put, get, range, delete
-    bool putData(const DataPair& data);
-    std::optional<DataPair> getData(int key) const;
+    // stamps data with the next sequence number
+    // adds the time spent waiting for buffer_mutex_ to *lock_wait_nanos
+    bool putData(const DataPair& data, uint64_t* lock_wait_nanos = nullptr);
+    // newest version of key with seq <= max_seq
+    std::optional<DataPair> getData(int key, uint64_t max_seq = UINT64_MAX) const;
+    // versions of key with seq <= max_seq newest first, down to the first that is not
+    // a merge operand, read under one lock so a concurrent put can't drop the rest
+    std::vector<DataPair> getVersions(int key, uint64_t max_seq = UINT64_MAX) const;
+    // every entry under one exclusive lock, stamped with consecutive sequence numbers
+    bool applyBatch(const WriteBatch& batch, uint64_t* lock_wait_nanos = nullptr);
+    // one range tombstone for [low, high), stamped with the next sequence number
+    bool deleteRange(int low, int high, uint64_t* lock_wait_nanos = nullptr);
+    // copy of range_tombstones_
+    std::vector<RangeTombstone> rangeTombstones() const;
+    // range_tombstones_ fragmented, rebuilt on each change instead of on each read
+    std::shared_ptr<const RangeTombstoneSet> rangeTombstoneSet() const;
     // std::vector<DataPair> getRangeData(long start, long end) const;
     // bool deleteData(long key);
+
+    uint64_t lastSequence() const;
+    void setLastSequence(uint64_t seq);
+    // hands out a seq without writing to the buffer, for data installed directly as SSTables
+    uint64_t reserveSequence();
+    // reserveSequence that also holds back puts to keys in the inclusive key_ranges until
+    // endIngest, in one step; *overlaps: the buffer already holds a key in one of them
+    uint64_t beginIngest(const std::vector<std::pair<int, int>>& key_ranges, bool* overlaps);
+    void endIngest(const std::vector<std::pair<int, int>>& key_ranges);
+    // caller holds lock on buffer_mutex_, waits out ingests into [min_key, max_key]
+    void waitForIngests(std::unique_lock<std::shared_mutex>& lock, int min_key, int max_key,
+                        uint64_t* lock_wait_nanos);
+    // any version of a key in [min_key, max_key]
+    bool overlaps(int min_key, int max_key) const;
+
+    uint64_t acquireSnapshot();
+    void releaseSnapshot(uint64_t seq);
+    // sorted ascending
+    std::vector<uint64_t> liveSnapshots() const;
+    // exclusive buffer_mutex_, adding the time spent waiting for it to *lock_wait_nanos
+    std::unique_lock<std::shared_mutex> lockForWrite(uint64_t* lock_wait_nanos);
+    // caller holds buffer_mutex_ exclusively, after changing range_tombstones_
+    void rebuildRangeTombstoneSet();
+    // stamps and inserts data, caller holds buffer_mutex_ exclusively;
+    // snapshots is read on first use, one read serves a whole batch
+    void insertVersion(const DataPair& data, std::optional<std::vector<uint64_t>>& snapshots);
+
+    // shutdown dump: every version in buffer_data_ and last_seq_, written in map order
+    // so loading appends each entry at the end of the map instead of searching for it,
+    // then the range tombstones
+    bool writeToDisk(const std::string& path) const;
+    // entries and range tombstones restored, or -1 if the file is missing or unreadable
+    long loadFromDisk(const std::string& path);
+};
+
+// a consistent read view: reads through it only see writes with seq <= seq_
+// released when the last shared_ptr goes away, must not outlive its LSMTree
+class Snapshot {
+    public:
+    Snapshot(Buffer* buffer, uint64_t seq);
+    ~Snapshot();
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    const uint64_t seq_;
+
+    private:
+    Buffer* buffer_;
+};
+
+
+struct RangeEntry {
+    DataPair data;
+    // position of the source run in the iterator, newest first
+    size_t run_index;
+    bool operator>(const RangeEntry& other) const {
+        if (data.key_ != other.data.key_) {
+            return data.key_ > other.data.key_;
+        }
+        return run_index > other.run_index;
+    }
+};
+
+// immutable list of every level's tables, oldest to newest within a level
+// flush and compaction publish a new one with an atomic pointer swap, and readers
+// pin the current one with a single refcount instead of locking each level
+struct Version {
+    std::vector<std::vector<std::shared_ptr<SSTable>>> levels;
+    // every table's range tombstones, gathered and fragmented once per edit instead of once per read
+    std::vector<RangeTombstone> range_tombstones;
+    std::shared_ptr<const RangeTombstoneSet> range_tombstone_set = std::make_shared<RangeTombstoneSet>();
+};
+
+// tables added to and removed from levels by one flush/compaction/ingest
+struct VersionEdit {
+    // (level index, table)
+    std::vector<std::pair<size_t, std::shared_ptr<SSTable>>> added_tables;
+    std::vector<std::pair<size_t, std::shared_ptr<SSTable>>> removed_tables;
+};
+
+// cursor over one sorted run: a copy of the buffer's range, or one SSTable
+// SSTables are borrowed, whoever builds the runs keeps their Version pinned
+class RunIterator {
+    public:
+    RunIterator(std::vector<DataPair> buffer_data, size_t run_index);
+    // loads the table if it is still lazy, adding the file read to *stats
+    RunIterator(SSTable* sstable_ptr, size_t run_index, QueryStats* stats = nullptr);
+
+    // position at the first entry with key >= key
+    void seek(int key);
+    bool valid() const;
+    void next();
+    const DataPair& current() const;
+    // nullptr for the buffer run
+    const SSTable* sstable() const;
+
+    // smaller run_index = newer run, wins on duplicate keys
+    size_t run_index_;
+
+    private:
+    SSTable* sstable_ptr_;
+    std::vector<DataPair> buffer_data_;
+    size_t pos_;
+
+    const std::vector<DataPair>& data() const;
 };
 
+// merged cursor over the buffer and every SSTable that overlaps [low, high)
+// yields the newest live version of each key in ascending order, skipping tombstones
+// and versions hidden by a newer range tombstone; merge operands are combined with
+// the versions under them
+// limit > 0 caps how many pairs are returned before valid() turns false, for paging
+class LSMIterator {
+    public:
+    // version pins the tables the runs borrow
+    LSMIterator(std::vector<RunIterator> runs, std::shared_ptr<const Version> version,
+                int high, size_t limit = 0, uint64_t max_seq = UINT64_MAX,
+                RangeTombstoneView range_tombstones = RangeTombstoneView(),
+                MergeOperator merge_operator = MergeOperator());
+
+    void seek(int key);
+    bool valid() const;
+    void next();
+    int key() const;
+    int value() const;
+    const DataPair& current() const;
+    // level the current pair came from, -1 for the buffer
+    int currentLevel() const;
+
+    private:
+    std::vector<RunIterator> runs_;
+    std::shared_ptr<const Version> version_;
+    int high_;
+    size_t limit_;
+    size_t returned_;
+    // only versions with seq <= max_seq_ are visible
+    uint64_t max_seq_;
+    RangeTombstoneView range_tombstones_;
+    MergeOperator merge_operator_;
+    std::optional<DataPair> current_;
+    size_t current_run_ = 0;
+    std::priority_queue<RangeEntry, std::vector<RangeEntry>, std::greater<RangeEntry>> heap_;
+
+    // pop the next live key off the heap into current_
+    void findNextLive();
+    // value of a key whose newest visible version is a merge operand, nullopt if deleted;
+    // versions holds every visible version with whether it came from the buffer
+    std::optional<DataPair> combineOperands(std::vector<std::pair<DataPair, bool>>& versions) const;
+};
 
 class LSMTree {
     public:
@@ -189,20 +587,31 @@ class LSMTree {
             size_t buffer_capacity = BUFFER_CAPACITY,
             size_t base_level_table_capacity = BASE_LEVEL_TABLE_CAPACITY, 
             size_t total_levels = MAX_LEVELS, 
-            size_t level_size_ratio = LEVEL_SIZE_RATIO);
+            size_t level_size_ratio = LEVEL_SIZE_RATIO,
+            std::shared_ptr<ThreadPool> range_pool = nullptr);
     ~LSMTree();
+    // waits for the flusher and the queued compactions, then persists the buffer
     void shutdown();
 
+    // -- clean shutdown --
+    // the buffer has no log, so shutdown dumps it to memtable_path_ and the next open
+    // reads it back; true flushes it into a level 0 SSTable instead
+    bool flush_on_shutdown_ = false;
+    std::string memtable_path_;
+    // set while the dump holds entries not yet flushed, the next flush removes it
+    std::atomic<bool> memtable_dump_pending_{false};
+
     // directory with levels that are folders
     std::string db_path_;
 
     std::string history_path_;
     std::atomic<uint64_t> next_file_id_{1};
 
-    size_t buffer_capacity_;
-    size_t base_level_table_capacity_;
+    // targets the tuner can change while running, see applyTuning
+    std::atomic<size_t> buffer_capacity_;
+    std::atomic<size_t> base_level_table_capacity_;
     size_t total_levels_;
-    size_t level_size_ratio_;
+    std::atomic<size_t> level_size_ratio_;
     
     std::unique_ptr<Buffer> buffer_;
     // LSM tree owns the levels, so unique_ptr, and it coordinates buffer/level flushes
@@ -216,6 +625,8 @@ class LSMTree {
     std::mutex flush_mutex_;
     std::condition_variable flush_request_cv_;
     bool flush_needed_{false};
+    // one flushBufferHelper at a time: two copying the same buffer would both write it
+    std::mutex flush_write_mutex_;
     // automatic joining using jthread
     std::thread flusher_thread_;
 
@@ -238,6 +649,36 @@ class LSMTree {
     void compactLevelHelper(size_t level_index);
     void doCompactionCheck(size_t level_index);
 
+    // -- delete-aware compaction --
+    // tombstones are only purged once no older table may hold their key, so a level is
+    // also pushed down when it is dense with tombstones, or when its oldest tombstone
+    // has outlived the level's share of delete_persistence_ms_; the same triggers on
+    // the last level merge its tables holding tombstones in place
+    double tombstone_density_threshold_ = TOMBSTONE_DENSITY_THRESHOLD;
+    uint64_t delete_persistence_ms_ = DELETE_PERSISTENCE_MS;
+    // capacity, tombstone density or tombstone age; the last level has no capacity trigger
+    bool levelNeedsCompaction(size_t level_index) const;
+    // the level's share of delete_persistence_ms_, growing with level size so the
+    // shares of levels above the last add up to the whole bound; the last level's is all of it
+    uint64_t tombstoneTtl(size_t level_index) const;
+    // last-level tables holding point or range tombstones no snapshot reads under, plus
+    // every table overlapping them, transitively: merged together nothing outside can
+    // hold their keys
+    // empty when no tombstone could be purged, so held tombstones don't recompact
+    std::vector<std::shared_ptr<SSTable>> lastLevelPurgeInputs(
+        const std::vector<std::shared_ptr<SSTable>>& tables) const;
+
+    // -- tombstone elision --
+    // flush and compaction drop a tombstone once no older table may hold its key, going
+    // by key range and bloom filter, instead of carrying it down to the last level
+    // version's tables from level from_level down, minus exclude: all a tombstone
+    // written above them can be shadowing
+    std::vector<std::shared_ptr<SSTable>> olderTables(const Version& version, size_t from_level,
+                                                      const std::vector<std::shared_ptr<SSTable>>& exclude = {}) const;
+    // ingests reserve their seq before installing their tables, so while one is in flight
+    // a Version can miss data that a newer tombstone hides; nothing is elided then
+    std::atomic<size_t> ingests_in_flight_{0};
+
     // compaction logic
     bool checkCompaction(size_t level_index);
     void compactLevel(size_t level_index);
@@ -248,10 +689,73 @@ class LSMTree {
         int output_level_num);
 
     // API: put, get, range, delete
+    // reads take an optional snapshot, nullptr reads the latest data
+    // and add their I/O footprint to *stats when given
     bool putData(const DataPair& data);
-    std::optional<DataPair> getData(int key);
-    std::vector<DataPair> rangeData(int low, int high);
+    std::optional<DataPair> getData(int key, const Snapshot* snapshot = nullptr, QueryStats* stats = nullptr);
+    std::vector<DataPair> rangeData(int low, int high, const Snapshot* snapshot = nullptr,
+                                    QueryStats* stats = nullptr);
     bool deleteData(int key);
+    // deletes every key in [low, high) with one range tombstone, whatever the range holds
+    bool deleteRange(int low, int high);
+    // the batch's writes become visible together; one lock acquisition and one flush
+    // check for all of them, a large batch can leave the buffer over capacity until flushed
+    bool writeBatch(const WriteBatch& batch);
+    // combines operand into key's value with merge_operator_ without reading it first:
+    // operands are combined on read and folded together by compaction
+    bool mergeData(int key, int operand);
+    // set before writing operands, those already written are combined with the new operator
+    void setMergeOperator(MergeOperator merge_operator);
+    // adds operands, so a merge is an increment
+    MergeOperator merge_operator_ = [](int existing, int operand) { return existing + operand; };
+    // streaming range scan over [low, high), positioned at low
+    LSMIterator newIterator(int low, int high, size_t limit = 0,
+                            const Snapshot* snapshot = nullptr);
+
+    // repeatable reads as of the latest write so far
+    std::shared_ptr<Snapshot> getSnapshot();
+
+    // -- bulk ingestion --
+    // sorts a binary file of int32 key,value pairs into SSTables and installs them
+    // directly; the batch shares one new seq, the last pair in the file wins per key
+    bool bulkLoad(const std::string& file_path, size_t* pairs_loaded = nullptr);
+    // moves externally written SSTable files (and their .bf) into the tree, no rewrite
+    // files must be non-empty, strictly ascending and disjoint from each other; with a
+    // current .meta and .bf only their bounds are checked, verify_keys reads every file
+    // in full to check its keys too
+    bool ingestFiles(const std::vector<std::string>& file_paths, bool verify_keys = false);
+    // shallowest level with a table overlapping [min_key, max_key], else the last level
+    size_t ingestLevel(const Version& version, int min_key, int max_key) const;
+    // pairs sorted in memory per run, more than one run spills and merges from disk
+    size_t bulk_load_chunk_pairs_ = BULK_LOAD_CHUNK_PAIRS;
+    // held by compaction from picking inputs to installing outputs, and by ingestion
+    // from picking its level to installing, so older compaction output is never
+    // appended after (and so searched before) ingested tables
+    std::mutex level_install_mutex_;
+    // moves a table not installed yet to level under a fresh id: .meta, .bf, then the data
+    bool moveTableToLevel(SSTable& table, size_t level);
+
+    // -- intra-query parallel range scans --
+    // ranges holding at least this many entries are split across range_pool_
+    size_t range_partition_min_entries_ = RANGE_PARTITION_MIN_ENTRIES;
+    // shared when given to the constructor, e.g. by every shard of a ShardedLSMTree
+    std::shared_ptr<ThreadPool> range_pool_;
+
+    // newest version of key with seq <= max_seq in version's levels, tombstones included
+    std::optional<DataPair> searchLevels(const Version& version, int key, uint64_t max_seq,
+                                         QueryStats* query_stats);
+    // buffer copy and overlapping SSTables of *version for [low, high), newest first
+    // *version is pinned under the buffer lock: a flush drops entries from the buffer only
+    // after installing their table, so every copied write is either buffered or in it
+    // tables loaded on the way add their file reads to *stats
+    std::vector<RunIterator> collectRuns(int low, int high, std::shared_ptr<const Version>* version,
+                                         QueryStats* stats = nullptr);
+    // buffer and version range tombstones visible at max_seq; the buffer is read first,
+    // a flush installs its table before dropping the tombstones from the buffer
+    RangeTombstoneView collectRangeTombstones(std::shared_ptr<const RangeTombstoneSet> buffer_tombstones,
+                                              const Version& version, uint64_t max_seq) const;
+    // sub-range boundaries [low, b1, ..., high), cut at fence pointer keys
+    std::vector<int> partitionRange(const std::vector<RunIterator>& runs, int low, int high) const;
 
     // set up DB directory and history
     void setupDB();
@@ -263,14 +767,66 @@ class LSMTree {
     std::string getLevelPath(int level_num) const;
     std::string getFilePath(int level_num, int file_id) const;
     std::string getBloomFilterPath(int level_num, int file_id) const;
-    // delete physical file of an SSTable
+    // delete physical file of an SSTable, once no Version or reader holds it
     void deleteSSTableFile(const std::shared_ptr<SSTable>& sstable);
 
+    // -- level structure published as immutable Versions --
+    // only touch through std::atomic_load/atomic_store
+    std::shared_ptr<const Version> current_version_;
+    // serializes installers, readers never take it
+    std::mutex version_mutex_;
+
+    std::shared_ptr<const Version> currentVersion() const;
+    // apply edit to levels_ and publish the resulting Version atomically
+    void applyVersionEdit(const VersionEdit& edit);
+
     // for testing
     std::vector<LevelSnapshot> getLevelsSnapshot() const;
 
-    // for the print stats s command
+    // -- write path counters --
+    std::atomic<uint64_t> puts_count_{0};
+    std::atomic<uint64_t> deletes_count_{0};
+    std::atomic<uint64_t> flush_count_{0};
+    std::atomic<uint64_t> compaction_count_{0};
+
+    // latency histograms and engine counters, merged from every thread
+    EngineMetrics metrics_;
+    MetricsSnapshot getMetrics() const;
+    // last COMPACTION_STATS_HISTORY compactions, oldest first
+    std::deque<CompactionStats> recent_compactions_;
+    mutable std::mutex recent_compactions_mutex_;
+    std::vector<CompactionStats> recentCompactions() const;
+    // adds one read's footprint to the metrics counters
+    void recordQueryStats(const QueryStats& stats);
+    // adds one compaction to the metrics and recent_compactions_
+    void recordCompaction(size_t level_index, const std::vector<std::shared_ptr<SSTable>>& inputs,
+                          const std::vector<std::shared_ptr<SSTable>>& outputs);
+
+    // -- workload-driven tuning --
+    // buffer capacity, level capacities and bloom filter bits are targets: a change is
+    // picked up by the next flush and compaction, and compaction reshapes the levels
+    TuningConfig tuningConfig() const;
+    // sets the targets, then flushes and compacts whatever is now over capacity
+    void applyTuning(const TuningConfig& config);
+    // models the workload since the last applied tune against the current targets;
+    // apply sets the recommended ones and starts the next window
+    TuningAdvice tune(bool apply);
+    // for new tables of level_index, DEFAULT_FALSE_POSITIVE_RATE until a tune applies
+    // Monkey's per-level rates
+    double levelFalsePositiveRate(size_t level_index) const;
+    // entries in the current Version's tables
+    size_t diskEntries() const;
+    mutable std::mutex tuning_mutex_;
+    // guarded by tuning_mutex_
+    double bloom_bits_per_entry_ = bloomBitsPerEntry(DEFAULT_FALSE_POSITIVE_RATE);
+    std::vector<double> level_fp_rates_;
+    WorkloadStats tuning_baseline_;
+
+    // for the print stats s command, O(levels) from the counters and sketches
     std::string print_stats();
+    // every live pair grouped by level, handed out in chunks of about chunk_bytes
+    // streams through the merge iterator, stops early if emit_chunk returns false
+    bool dumpAll(const std::function<bool(const std::string&)>& emit_chunk, size_t chunk_bytes = 1 << 16);
 };
 
 struct MergeEntry {
@@ -282,20 +838,14 @@ struct MergeEntry {
         if (data.key_ != other.data.key_) {
             return data.key_ > other.data.key_;
         }
+        // newest version first, min_heap so smaller seq is later
+        if (data.seq_ != other.data.seq_) {
+            return data.seq_ < other.data.seq_;
+        }
         // prioritize the one from the lower level, min_heap so higher is later
         return source_level_num > other.source_level_num;
     }
 };
 
-struct RangeEntry {
-    DataPair data;
-    int source_level;
-    bool operator>(const RangeEntry& other) const {
-        if (data.key_ != other.data.key_) {
-            return data.key_ > other.data.key_;
-        }
-        return source_level > other.source_level;
-    }
-};
 
 #endif
\ No newline at end of file
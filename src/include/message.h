@@ -1,6 +1,8 @@
 #ifndef MESSAGE_H__
 #define MESSAGE_H__
 
+#include <stdint.h>
+
 // mesage_status defines the status of the previous request.
 typedef enum message_status {
     OK_DONE,
@@ -27,4 +29,27 @@ typedef struct message {
     char* payload;
 } message;
 
+// binary framing, version 1
+// request:  frame_header, then argc int32 args, then any string bytes (LOAD path)
+// response: frame_header with opcode = message_status, then the result;
+//           FRAME_FLAG_PAIRS marks a result of int32 key,value pairs, otherwise text
+// request_id is echoed back, so a client may pipeline and match replies out of order
+// a streamed reply is several frames for one request_id, all but the last flagged MORE
+#define FRAME_MAGIC 0x4C53
+#define FRAME_VERSION 1
+#define FRAME_FLAG_PAIRS 0x1
+#define FRAME_FLAG_MORE 0x2
+// upper bound on a single frame payload the server will buffer
+#define FRAME_MAX_PAYLOAD (1 << 20)
+
+typedef struct frame_header {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t opcode;
+    uint32_t request_id;
+    uint16_t argc;
+    uint16_t flags;
+    uint32_t payload_len;
+} frame_header;
+
 #endif
@@ -0,0 +1,166 @@
+#ifndef METRICS_HH
+#define METRICS_HH
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// engine operations timed into a latency histogram
+enum class MetricOp : size_t {
+    PUT,
+    GET,
+    RANGE,
+    DELETE,
+    FLUSH,
+    COMPACTION,
+    // one per applied WriteBatch, whatever it holds
+    WRITE_BATCH,
+    NUM_OPS,
+};
+
+// engine event counters
+enum class MetricCounter : size_t {
+    BLOOM_PROBES,
+    // probes the filter rejected, so the table was skipped
+    BLOOM_NEGATIVES,
+    // probes the filter passed but the table did not hold the key
+    BLOOM_FALSE_POSITIVES,
+    // tables whose key range covered a read
+    TABLES_PROBED,
+    // fence pointer blocks, and their bytes, searched or scanned by reads
+    BLOCKS_READ,
+    BYTES_READ,
+    // logical key and value bytes of every put and delete
+    USER_BYTES_WRITTEN,
+    FLUSH_BYTES_WRITTEN,
+    COMPACTION_BYTES_READ,
+    COMPACTION_BYTES_WRITTEN,
+    COMPACTION_ENTRIES_IN,
+    COMPACTION_ENTRIES_OUT,
+    // time writers waited for the buffer's write lock
+    WRITE_STALL_NANOS,
+    // tombstones flush or compaction dropped since no older table could hold their key
+    TOMBSTONES_ELIDED,
+    // workload mix for the tuner: entries put, deleted or merged (a range delete is one),
+    // gets that found no live value, gets the buffer answered, and pairs range scans returned
+    USER_ENTRIES_WRITTEN,
+    GET_MISSES,
+    BUFFER_GET_HITS,
+    RANGE_ENTRIES_READ,
+    // entries flushes wrote, fewer than USER_ENTRIES_WRITTEN when the buffer absorbs updates
+    FLUSH_ENTRIES_WRITTEN,
+    NUM_COUNTERS,
+};
+
+const size_t NUM_METRIC_OPS = static_cast<size_t>(MetricOp::NUM_OPS);
+const size_t NUM_METRIC_COUNTERS = static_cast<size_t>(MetricCounter::NUM_COUNTERS);
+
+const char* metricOpName(MetricOp op);
+const char* metricCounterName(MetricCounter counter);
+
+// HdrHistogram-style log-linear buckets over nanoseconds: values below 16 are exact,
+// above that every power of two is split into 16 sub-buckets, so at most ~6% error
+// written by one thread only, read (copied) concurrently by getMetrics
+class LatencyHistogram {
+    public:
+    static const int SUB_BUCKET_BITS = 4;
+    static const size_t SUB_BUCKETS = size_t(1) << SUB_BUCKET_BITS;
+    static const size_t NUM_BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    static size_t bucketFor(uint64_t value);
+    // largest value that lands in bucket
+    static uint64_t bucketUpperBound(size_t bucket);
+
+    LatencyHistogram();
+    void record(uint64_t value);
+
+    std::array<std::atomic<uint64_t>, NUM_BUCKETS> counts_;
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> min_{UINT64_MAX};
+    std::atomic<uint64_t> max_{0};
+};
+
+// plain copy of one or more merged histograms
+struct HistogramSnapshot {
+    std::vector<uint64_t> counts = std::vector<uint64_t>(LatencyHistogram::NUM_BUCKETS, 0);
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t min = UINT64_MAX;
+    uint64_t max = 0;
+
+    void merge(const LatencyHistogram& histogram);
+    void merge(const HistogramSnapshot& other);
+    double mean() const;
+    // upper bound of the bucket holding the p-th percentile, p in [0, 100]
+    uint64_t percentile(double p) const;
+};
+
+struct MetricsSnapshot {
+    std::array<HistogramSnapshot, NUM_METRIC_OPS> ops;
+    std::array<uint64_t, NUM_METRIC_COUNTERS> counters{};
+
+    const HistogramSnapshot& op(MetricOp metric_op) const {
+        return ops[static_cast<size_t>(metric_op)];
+    }
+    uint64_t counter(MetricCounter metric_counter) const {
+        return counters[static_cast<size_t>(metric_counter)];
+    }
+    // adds other's histograms and counters, e.g. to sum the shards of a ShardedLSMTree
+    void merge(const MetricsSnapshot& other);
+    // bytes flushed and compacted per user byte written, 0 before any write
+    double writeAmplification() const;
+    // latencies in microseconds
+    std::string toText() const;
+    std::string toJson() const;
+};
+
+// one thread's histograms and counters
+struct MetricsShard {
+    std::array<LatencyHistogram, NUM_METRIC_OPS> histograms;
+    std::array<std::atomic<uint64_t>, NUM_METRIC_COUNTERS> counters{};
+};
+
+class MetricsRegistry;
+
+// per-thread shards, so recording never contends; snapshot() merges them all
+// a shard outlives its thread and is handed to the next new thread, so short
+// lived threads (std::async level probes) don't grow the registry
+class EngineMetrics {
+    public:
+    EngineMetrics();
+    EngineMetrics(const EngineMetrics&) = delete;
+    EngineMetrics& operator=(const EngineMetrics&) = delete;
+
+    void record(MetricOp op, uint64_t nanos);
+    void add(MetricCounter counter, uint64_t amount = 1);
+    MetricsSnapshot snapshot() const;
+
+    private:
+    std::shared_ptr<MetricsRegistry> registry_;
+    MetricsShard& localShard();
+};
+
+// times its scope into op's histogram
+class ScopedLatency {
+    public:
+    ScopedLatency(EngineMetrics& metrics, MetricOp op)
+        : metrics_(metrics), op_(op), start_(std::chrono::steady_clock::now()) {}
+    ~ScopedLatency() {
+        auto elapsed = std::chrono::steady_clock::now() - start_;
+        metrics_.record(op_, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+    ScopedLatency(const ScopedLatency&) = delete;
+    ScopedLatency& operator=(const ScopedLatency&) = delete;
+
+    private:
+    EngineMetrics& metrics_;
+    MetricOp op_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef OP_STREAM_HH
+#define OP_STREAM_HH
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// binary op stream, the fixed-width form of the p/g/r/d workload text:
+// an OpStreamHeader, then num_ops OpRecords, little-endian as on the host
+// written by datagen, replayed by the benchmark without any parsing
+#define OP_STREAM_MAGIC 0x4f4d534cu // "LSMO"
+#define OP_STREAM_VERSION 1
+
+struct OpStreamHeader {
+    uint32_t magic = OP_STREAM_MAGIC;
+    uint32_t version = OP_STREAM_VERSION;
+    uint64_t num_ops = 0;
+};
+
+// type is the workload command letter: 'p' put, 'g' get, 'r' range, 'd' delete
+// arg is the value of a put and the exclusive high key of a range
+struct OpRecord {
+    uint8_t type;
+    uint8_t reserved[3];
+    int32_t key;
+    int32_t arg;
+};
+
+static_assert(sizeof(OpStreamHeader) == 16, "op stream header is 16 bytes on disk");
+static_assert(sizeof(OpRecord) == 12, "op records are 12 bytes on disk");
+
+// reads the header, false if path is not an op stream (e.g. a text workload)
+inline bool readOpStreamHeader(const std::string& path, OpStreamHeader* header) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    bool ok = fread(header, sizeof(*header), 1, file) == 1 && header->magic == OP_STREAM_MAGIC
+              && header->version == OP_STREAM_VERSION;
+    fclose(file);
+    return ok;
+}
+
+#endif
@@ -3,6 +3,15 @@
 #include "message.h"
 #include "db_types.hh"
 
+#include <string>
+
+// text command (client side) -> DbOperator
 DbOperator* parse_command(char* query_command, message* send_message, int client);
 
+// DbOperator -> request frame bytes, appended to *frame
+void encode_request_frame(const DbOperator* dbo, uint32_t request_id, std::string* frame);
+
+// request frame (server side) -> DbOperator, NULL with *status set on a malformed frame
+DbOperator* decode_request_frame(const frame_header* header, const char* payload, message_status* status);
+
 #endif
@@ -0,0 +1,89 @@
+#ifndef SHARDED_LSM_TREE_HH
+#define SHARDED_LSM_TREE_HH
+
+#include "lsm_tree.hh"
+
+// outcome of a sharded bulk load or ingest; the shards load their parts in parallel, each
+// all or nothing, so a failed shard can leave the others' parts applied
+struct ShardedLoadResult {
+    bool ok = false;
+    size_t shards_applied = 0;
+    size_t shards_failed = 0;
+    // distinct keys loaded, over the shards that applied their part
+    size_t pairs_loaded = 0;
+    // ingest only: the failed shards' parts, left in place; ingesting them retries exactly
+    // what is missing, the originals are removed once any shard applied its part
+    std::vector<std::string> retry_files;
+
+    // some shards applied, some did not
+    bool partial() const { return !ok && shards_applied > 0; }
+};
+
+// shared-nothing partitioning of the key space over independent LSMTrees, each with its
+// own directory, buffer, flusher and compactor, so writes to different shards share no lock
+// keys are hashed to shards, which keeps skewed or sequential keys balanced; a range query
+// asks every shard and merges their results
+// reads are of the latest data only, a snapshot would have to span every shard
+class ShardedLSMTree {
+    public:
+    // an existing database keeps the shard count it was created with, whatever num_shards
+    // says, since a key's shard depends on it; one shard is the plain layout in db_path
+    ShardedLSMTree(const std::string& db_path,
+                   size_t num_shards,
+                   size_t buffer_capacity = BUFFER_CAPACITY,
+                   size_t base_level_table_capacity = BASE_LEVEL_TABLE_CAPACITY,
+                   size_t total_levels = MAX_LEVELS,
+                   size_t level_size_ratio = LEVEL_SIZE_RATIO);
+    ~ShardedLSMTree();
+    // shuts every shard down, in parallel
+    void shutdown();
+
+    size_t numShards() const;
+    size_t shardFor(int key) const;
+    LSMTree& shard(size_t index);
+
+    // API: put, get, range, delete, as on LSMTree
+    bool putData(const DataPair& data);
+    std::optional<DataPair> getData(int key);
+    std::vector<DataPair> rangeData(int low, int high);
+    bool deleteData(int key);
+    // one range tombstone in every shard
+    bool deleteRange(int low, int high);
+    bool mergeData(int key, int operand);
+    void setMergeOperator(MergeOperator merge_operator);
+    // split by shard: atomic within each shard, not across them
+    bool writeBatch(const WriteBatch& batch);
+
+    // -- bulk ingestion --
+    // the pairs are split into one file per shard, each shard bulk loads its own in parallel
+    ShardedLoadResult bulkLoad(const std::string& file_path);
+    // each file is rewritten as one table per shard, which the shards ingest in parallel;
+    // the originals are removed once every shard has its part, or on a partial ingest once
+    // the missing parts are kept in retry_files
+    ShardedLoadResult ingestFiles(const std::vector<std::string>& file_paths);
+
+    // every shard's metrics summed
+    MetricsSnapshot getMetrics() const;
+    // every shard shares one set of targets: the summed workload is modelled for a shard's
+    // share of the entries, and apply sets the recommended targets on every shard
+    TuningAdvice tune(bool apply);
+    std::string print_stats();
+    // each shard's dump in turn, under a "Shard i" header
+    bool dumpAll(const std::function<bool(const std::string&)>& emit_chunk, size_t chunk_bytes = 1 << 16);
+
+    std::string db_path_;
+    // numbers the temp part files, so concurrent loads and ingests never share one
+    std::atomic<uint64_t> next_part_id_{0};
+    // one pool for every shard's range scans, bulk load sorts and startup table opens
+    std::shared_ptr<ThreadPool> range_pool_;
+    std::vector<std::unique_ptr<LSMTree>> shards_;
+    // one thread per shard for a range query's fan-out, shared by concurrent queries;
+    // apart from range_pool_, whose workers run the sub-ranges these tasks wait on.
+    // declared after shards_ so it drains before they go
+    std::unique_ptr<ThreadPool> shard_pool_;
+    // serializes tunes, guards tuning_baseline_
+    std::mutex tuning_mutex_;
+    WorkloadStats tuning_baseline_;
+};
+
+#endif
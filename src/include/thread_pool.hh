@@ -0,0 +1,88 @@
+#ifndef THREAD_POOL_HH
+#define THREAD_POOL_HH
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+
+// fixed-size pool of worker threads pulling tasks off a FIFO queue
+// submit() returns a future, so callers can join results in their own order
+class ThreadPool {
+    public:
+    explicit ThreadPool(size_t num_threads) {
+        if (num_threads == 0) {
+            num_threads = 1;
+        }
+        workers_.reserve(num_threads);
+        for (size_t i = 0; i < num_threads; ++i) {
+            workers_.emplace_back(&ThreadPool::workerLoop, this);
+        }
+    }
+
+    // drains queued tasks, then joins every worker
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            stopping_ = true;
+        }
+        queue_cv_.notify_all();
+        for (auto& worker : workers_) {
+            if (worker.joinable()) {
+                worker.join();
+            }
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const {
+        return workers_.size();
+    }
+
+    template <typename F>
+    std::future<std::invoke_result_t<F>> submit(F&& task_fn) {
+        using Result = std::invoke_result_t<F>;
+        // packaged_task is move-only, std::function needs copyable, so share it
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task_fn));
+        std::future<Result> result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            tasks_.emplace([task]() { (*task)(); });
+        }
+        queue_cv_.notify_one();
+        return result;
+    }
+
+    private:
+    std::vector<std::thread> workers_;
+    std::queue<std::function<void()>> tasks_;
+    std::mutex queue_mutex_;
+    std::condition_variable queue_cv_;
+    bool stopping_ = false;
+
+    void workerLoop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex_);
+                queue_cv_.wait(lock, [this] {
+                    return stopping_ || !tasks_.empty();
+                });
+                if (stopping_ && tasks_.empty()) {
+                    return;
+                }
+                task = std::move(tasks_.front());
+                tasks_.pop();
+            }
+            task();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef TUNER_HH
+#define TUNER_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "metrics.hh"
+
+// entries per fence pointer block, the I/O unit the cost model counts in
+#define TUNER_ENTRIES_PER_BLOCK 170
+// memory one buffered entry takes, map node included, traded against filter bits
+#define TUNER_BUFFER_ENTRY_BITS (64 * 8)
+// fewer operations than this since the last tune are too few to tune on
+#define TUNER_MIN_OPS 1000
+// a config has to model this much cheaper than the current one to be worth reshaping for
+#define TUNER_MIN_GAIN 0.05
+
+// bits per entry a bloom filter needs for fp_rate, and the rate those bits give
+double bloomBitsPerEntry(double fp_rate);
+double bloomFalsePositiveRate(double bits_per_entry);
+
+// the workload mix, read off a MetricsSnapshot; since() turns two of them into a window
+struct WorkloadStats {
+    // puts, deletes and merge operands, a range delete is one
+    uint64_t writes = 0;
+    uint64_t gets = 0;
+    // gets that found no live value
+    uint64_t get_misses = 0;
+    // gets the buffer answered without touching a table
+    uint64_t buffer_get_hits = 0;
+    uint64_t ranges = 0;
+    // pairs the range scans returned
+    uint64_t range_entries = 0;
+    // entries flushes wrote, fewer than writes when the buffer absorbs updates to hot keys
+    uint64_t flushed_entries = 0;
+
+    static WorkloadStats fromMetrics(const MetricsSnapshot& metrics);
+    WorkloadStats since(const WorkloadStats& earlier) const;
+    uint64_t operations() const;
+    // key skew of the writes as the number of distinct keys they cycle over, inferred
+    // from how many the buffer absorbed at buffer_capacity; infinity when none were
+    double writeWorkingSet(size_t buffer_capacity) const;
+    std::string toText(size_t buffer_capacity) const;
+};
+
+// the targets the tuner sets, as on LSMTree
+struct TuningConfig {
+    size_t buffer_capacity = 0;
+    size_t base_level_table_capacity = 0;
+    size_t level_size_ratio = 0;
+    // averaged over the tree, spread over the levels Monkey-style
+    double bloom_bits_per_entry = 0;
+
+    bool operator==(const TuningConfig& other) const;
+    std::string toText() const;
+};
+
+// modelled block I/Os of one config
+struct TuningCost {
+    // per write, the flush and compaction it amortizes to
+    double write = 0;
+    // per get, misses and hits in the workload's proportions
+    double get = 0;
+    double range = 0;
+    // per operation, weighted by the workload mix
+    double total = 0;
+    size_t levels = 0;
+};
+
+// Monkey/Dostoevsky/Endure-style analytical model of the tiered levels:
+// a flushed entry is rewritten once per level it reaches, a lookup probes every run
+// behind a bloom filter, a range scan seeks every run; filter bits go to each level
+// in proportion to its run size (Monkey), and the buffer and the filters share one
+// memory budget (Endure), so a bigger buffer costs filter bits
+class CostModel {
+    public:
+    // entries held by the tree, max_levels its level count
+    CostModel(const WorkloadStats& workload, const TuningConfig& current, size_t entries, size_t max_levels);
+
+    TuningCost estimate(const TuningConfig& config) const;
+    // false positive rate for new tables of each level under config
+    std::vector<double> levelFalsePositiveRates(const TuningConfig& config) const;
+    // cheapest config of a grid around current with the same memory, or current when the
+    // window is too short, the tree is empty or nothing saves TUNER_MIN_GAIN
+    TuningConfig recommend() const;
+
+    private:
+    WorkloadStats workload_;
+    TuningConfig current_;
+    double entries_;
+    size_t max_levels_;
+    double write_working_set_;
+
+    // runs (on average) and entries per run of each level holding entries_, and the
+    // number of levels in use
+    size_t levelShape(const TuningConfig& config, std::vector<double>* runs,
+                      std::vector<double>* run_entries) const;
+    std::vector<double> levelFalsePositiveRates(const TuningConfig& config, const std::vector<double>& runs,
+                                                const std::vector<double>& run_entries, size_t levels) const;
+};
+
+// what one tune saw and decided
+struct TuningAdvice {
+    WorkloadStats workload;
+    TuningConfig current;
+    TuningCost current_cost;
+    TuningConfig recommended;
+    TuningCost recommended_cost;
+    bool applied = false;
+
+    std::string toText() const;
+};
+
+// models workload against current for a tree of entries and fills in the advice
+TuningAdvice adviseTuning(const WorkloadStats& workload, const TuningConfig& current,
+                          size_t entries, size_t max_levels);
+
+#endif
@@ -0,0 +1,325 @@
+#include <db_client.hh>
+#include <metrics.hh>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <climits>
+
+// open-loop load generator for the server: requests go out on a fixed schedule
+// whether or not earlier ones were answered, and latency runs from the scheduled
+// send time, so time spent queued behind a slow server is not omitted
+//   ./loadgen --rates=1000,2000,4000 [--connections=8] [--duration=5] ...
+// each rate is one stage; the knee is the last stage the server kept up with
+
+struct LoadgenOptions {
+    std::string socket_path = SOCK_PATH;
+    // requests per second over all connections, one stage per rate
+    std::vector<double> rates = {1000};
+    size_t connections = 8;
+    double duration_seconds = 5.0;
+    // GETs, the rest are PUTs
+    double read_ratio = 0.9;
+    int keys = 100000;
+    bool poisson = false;
+    uint64_t seed = 40;
+    // a stage falls behind below this fraction of its target rate
+    double keep_up_ratio = 0.95;
+};
+
+struct StageResult {
+    double target_rate = 0.0;
+    uint64_t sent = 0;
+    uint64_t completed = 0;
+    uint64_t errors = 0;
+    double seconds = 0.0;
+    // from the scheduled send time
+    HistogramSnapshot corrected;
+    // from the moment the request was actually written, what a closed-loop client sees
+    HistogramSnapshot uncorrected;
+
+    double achievedRate() const {
+        return seconds > 0.0 ? static_cast<double>(completed) / seconds : 0.0;
+    }
+};
+
+static uint64_t nowNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// one connection of a stage: a sender thread on the schedule, a receiver thread
+// matching replies to their send times by request id
+struct ConnectionLoad {
+    DbClient client;
+    uint64_t num_requests = 0;
+    // by request id, written by the sender before the request goes out
+    std::unique_ptr<std::atomic<uint64_t>[]> scheduled_nanos;
+    std::unique_ptr<std::atomic<uint64_t>[]> sent_nanos;
+    std::atomic<uint64_t> sent{0};
+    uint64_t completed = 0;
+    uint64_t errors = 0;
+    uint64_t last_reply_nanos = 0;
+    LatencyHistogram corrected;
+    LatencyHistogram uncorrected;
+};
+
+void runSender(const LoadgenOptions& options, ConnectionLoad& load, uint64_t start_nanos,
+               double interval_nanos, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> pick(0.0, 1.0);
+    std::uniform_int_distribution<int> key_dist(0, options.keys - 1);
+    std::exponential_distribution<double> gap(1.0 / interval_nanos);
+    double scheduled = static_cast<double>(start_nanos);
+    for (uint64_t i = 0; i < load.num_requests; ++i) {
+        uint64_t scheduled_nanos = static_cast<uint64_t>(scheduled);
+        uint64_t now = nowNanos();
+        if (now < scheduled_nanos) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(scheduled_nanos - now));
+        }
+        // running late (the socket was full or we overslept) sends at once, the
+        // latency still counts from the schedule
+        DbOperator dbo;
+        if (pick(rng) < options.read_ratio) {
+            dbo.type = GET;
+            dbo.args = {key_dist(rng)};
+        } else {
+            dbo.type = PUT;
+            dbo.args = {key_dist(rng), static_cast<int>(rng() & INT_MAX)};
+        }
+        // ids count up from 0 on the fresh connection, so id i is request i
+        load.scheduled_nanos[i].store(scheduled_nanos, std::memory_order_release);
+        load.sent_nanos[i].store(nowNanos(), std::memory_order_release);
+        uint32_t request_id;
+        if (!load.client.send(dbo, &request_id)) {
+            break;
+        }
+        load.sent.fetch_add(1, std::memory_order_release);
+        scheduled += options.poisson ? gap(rng) : interval_nanos;
+    }
+}
+
+void runReceiver(ConnectionLoad& load) {
+    while (load.completed + load.errors < load.num_requests) {
+        DbReply reply;
+        uint32_t request_id;
+        if (!load.client.receive(&reply, &request_id) || request_id >= load.num_requests) {
+            // connection lost, nothing more comes back
+            load.errors = load.num_requests - load.completed;
+            break;
+        }
+        uint64_t now = nowNanos();
+        uint64_t scheduled = load.scheduled_nanos[request_id].load(std::memory_order_acquire);
+        uint64_t sent = load.sent_nanos[request_id].load(std::memory_order_acquire);
+        load.corrected.record(now > scheduled ? now - scheduled : 0);
+        load.uncorrected.record(now > sent ? now - sent : 0);
+        // a GET miss is an answer like any other
+        if (reply.status == OK_DONE || reply.status == OK_WAIT_FOR_RESPONSE || reply.status == OBJECT_NOT_FOUND) {
+            load.completed++;
+        } else {
+            load.errors++;
+        }
+        load.last_reply_nanos = now;
+    }
+}
+
+bool runStage(const LoadgenOptions& options, double rate, StageResult* result) {
+    size_t num_connections = std::max<size_t>(options.connections, 1);
+    double per_connection_rate = rate / static_cast<double>(num_connections);
+    double interval_nanos = 1e9 / per_connection_rate;
+    uint64_t requests_per_connection = std::max<uint64_t>(
+        1, static_cast<uint64_t>(per_connection_rate * options.duration_seconds));
+
+    std::vector<std::unique_ptr<ConnectionLoad>> loads;
+    for (size_t c = 0; c < num_connections; ++c) {
+        auto load = std::make_unique<ConnectionLoad>();
+        if (!load->client.connect(options.socket_path)) {
+            return false;
+        }
+        load->num_requests = requests_per_connection;
+        load->scheduled_nanos = std::make_unique<std::atomic<uint64_t>[]>(requests_per_connection);
+        load->sent_nanos = std::make_unique<std::atomic<uint64_t>[]>(requests_per_connection);
+        loads.push_back(std::move(load));
+    }
+
+    // connections are staggered over one interval, so the arrivals interleave
+    uint64_t start_nanos = nowNanos() + 10 * 1000 * 1000;
+    std::vector<std::thread> threads;
+    for (size_t c = 0; c < num_connections; ++c) {
+        uint64_t offset = static_cast<uint64_t>(interval_nanos * static_cast<double>(c)
+                                                / static_cast<double>(num_connections));
+        threads.emplace_back(runSender, std::cref(options), std::ref(*loads[c]), start_nanos + offset,
+                             interval_nanos, options.seed * 977 + c);
+        threads.emplace_back(runReceiver, std::ref(*loads[c]));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    *result = StageResult();
+    result->target_rate = rate;
+    uint64_t last_reply_nanos = start_nanos;
+    for (const auto& load : loads) {
+        result->sent += load->sent.load();
+        result->completed += load->completed;
+        result->errors += load->errors;
+        result->corrected.merge(load->corrected);
+        result->uncorrected.merge(load->uncorrected);
+        last_reply_nanos = std::max(last_reply_nanos, load->last_reply_nanos);
+    }
+    result->seconds = static_cast<double>(last_reply_nanos - start_nanos) / 1e9;
+    return true;
+}
+
+void printHeader() {
+    std::cout << std::right << std::setw(12) << "target/s" << std::setw(12) << "achieved/s"
+              << std::setw(10) << "errors"
+              << std::setw(11) << "p50(us)" << std::setw(11) << "p99(us)" << std::setw(12) << "p99.9(us)"
+              << std::setw(12) << "max(us)" << std::setw(18) << "uncorr p99(us)" << std::endl;
+}
+
+void printStage(const StageResult& stage) {
+    std::cout << std::fixed << std::setprecision(0)
+              << std::setw(12) << stage.target_rate << std::setw(12) << stage.achievedRate()
+              << std::setw(10) << stage.errors
+              << std::setprecision(1)
+              << std::setw(11) << stage.corrected.percentile(50) / 1000.0
+              << std::setw(11) << stage.corrected.percentile(99) / 1000.0
+              << std::setw(12) << stage.corrected.percentile(99.9) / 1000.0
+              << std::setw(12) << stage.corrected.max / 1000.0
+              << std::setw(18) << stage.uncorrected.percentile(99) / 1000.0 << std::endl;
+}
+
+// the server kept up if it answered nearly everything at nearly the offered rate
+// and the tail did not blow up past the lightest stage's by an order of magnitude
+bool keptUp(const LoadgenOptions& options, const StageResult& stage, const StageResult& baseline) {
+    if (stage.errors > 0 || stage.achievedRate() < options.keep_up_ratio * stage.target_rate) {
+        return false;
+    }
+    // floor of 1us so a near-zero baseline does not make every later stage fail
+    uint64_t baseline_p99 = std::max<uint64_t>(baseline.corrected.percentile(99), 1000);
+    return stage.corrected.percentile(99) <= 10 * baseline_p99;
+}
+
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " [--flag=value ...]\n"
+              << "  --rates=1000,2000     target requests/s of each stage, or --ramp=start:end:step\n"
+              << "  --connections=8       connections, each with a sender and a receiver thread\n"
+              << "  --duration=5          seconds per stage\n"
+              << "  --read_ratio=0.9      GETs, the rest are PUTs\n"
+              << "  --keys=100000         uniform keys in [0, keys)\n"
+              << "  --arrival=uniform     or poisson\n"
+              << "  --socket=" << SOCK_PATH << "\n"
+              << "  --seed=40" << std::endl;
+}
+
+bool parseOptions(int argc, char* argv[], LoadgenOptions* options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        size_t equals = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || equals == std::string::npos) {
+            return false;
+        }
+        std::string flag = arg.substr(2, equals - 2);
+        std::string value = arg.substr(equals + 1);
+        try {
+            if (flag == "rates") {
+                options->rates.clear();
+                std::stringstream ss(value);
+                std::string rate;
+                while (std::getline(ss, rate, ',')) {
+                    options->rates.push_back(std::stod(rate));
+                }
+            } else if (flag == "ramp") {
+                double start, end, step;
+                char colon1, colon2;
+                std::stringstream ss(value);
+                if (!(ss >> start >> colon1 >> end >> colon2 >> step) || colon1 != ':' || colon2 != ':'
+                    || step <= 0.0) {
+                    throw std::invalid_argument(value);
+                }
+                options->rates.clear();
+                for (double rate = start; rate <= end; rate += step) {
+                    options->rates.push_back(rate);
+                }
+            } else if (flag == "connections") {
+                options->connections = std::stoul(value);
+            } else if (flag == "duration") {
+                options->duration_seconds = std::stod(value);
+            } else if (flag == "read_ratio") {
+                options->read_ratio = std::stod(value);
+            } else if (flag == "keys") {
+                options->keys = std::stoi(value);
+            } else if (flag == "arrival") {
+                if (value != "uniform" && value != "poisson") {
+                    throw std::invalid_argument(value);
+                }
+                options->poisson = value == "poisson";
+            } else if (flag == "socket") {
+                options->socket_path = value;
+            } else if (flag == "seed") {
+                options->seed = std::stoull(value);
+            } else {
+                return false;
+            }
+        } catch (const std::exception&) {
+            std::cerr << "bad value for " << arg << std::endl;
+            return false;
+        }
+    }
+    if (options->rates.empty() || options->keys <= 0 || options->duration_seconds <= 0.0) {
+        return false;
+    }
+    for (double rate : options->rates) {
+        if (rate <= 0.0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    LoadgenOptions options;
+    if (!parseOptions(argc, argv, &options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    std::cout << "open loop against " << options.socket_path << ", " << options.connections
+              << " connections, " << options.duration_seconds << "s per stage, "
+              << (options.poisson ? "poisson" : "uniform") << " arrivals, read ratio "
+              << options.read_ratio << std::endl;
+    printHeader();
+
+    std::vector<StageResult> stages;
+    for (double rate : options.rates) {
+        StageResult stage;
+        if (!runStage(options, rate, &stage)) {
+            std::cerr << "could not connect to the server at " << options.socket_path << std::endl;
+            return 1;
+        }
+        printStage(stage);
+        stages.push_back(stage);
+    }
+
+    // the knee: the highest rate before the first stage that fell behind
+    const StageResult* knee = nullptr;
+    for (const StageResult& stage : stages) {
+        if (!keptUp(options, stage, stages.front())) {
+            break;
+        }
+        knee = &stage;
+    }
+    if (!knee) {
+        std::cout << "saturated already at " << std::fixed << std::setprecision(0)
+                  << stages.front().target_rate << " req/s" << std::endl;
+    } else if (knee == &stages.back()) {
+        std::cout << "kept up through " << std::fixed << std::setprecision(0) << knee->target_rate
+                  << " req/s, no knee in range" << std::endl;
+    } else {
+        std::cout << "knee near " << std::fixed << std::setprecision(0) << knee->target_rate
+                  << " req/s, fell behind at " << (knee + 1)->target_rate << " req/s" << std::endl;
+    }
+    return 0;
+}
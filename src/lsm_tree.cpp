@@ -2,9 +2,14 @@
 #include <iostream>
 #include <queue>
 #include <algorithm>
+#include <cmath>
 #include <shared_mutex>
 #include <chrono>
 #include <future>
+#include <tuple>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 // helper function to generate SSTable filename
 inline std::string generateSSTableFilename(uint64_t file_id) {
@@ -13,14 +18,40 @@ inline std::string generateSSTableFilename(uint64_t file_id) {
     return ss.str();
 }
 
+// tombstone ages are wall clock, they have to survive a restart
+static uint64_t wallClockMillis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// key range, then bloom filter: false proves no table holds key
+static bool tablesMayHoldKey(const std::vector<std::shared_ptr<SSTable>>& tables, int key) {
+    for (const auto& table : tables) {
+        if (table->keyInRange(key) && table->bloom_filter_.might_contain(key)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// last write of path in wall clock ms, now if it can't be read
+static uint64_t fileWriteMillis(const std::string& path) {
+    struct stat file_stat;
+    if (stat(path.c_str(), &file_stat) != 0) {
+        return wallClockMillis();
+    }
+    return static_cast<uint64_t>(file_stat.st_mtim.tv_sec) * 1000 + file_stat.st_mtim.tv_nsec / 1000000;
+}
+
 /**
  * DataPair methods
  */
 
-DataPair::DataPair(int key, int value, bool deleted) {
+DataPair::DataPair(int key, int value, bool deleted, uint64_t seq) {
     this->key_ = key;
     this->value_ = value;
     this->deleted_ = deleted;
+    this->seq_ = seq;
 }
 
 bool DataPair::operator<(int other_key) const {
@@ -35,17 +66,106 @@ bool DataPair::operator==(const DataPair& other) const {
     return key_ == other.key_;
 }
 
+/**
+ * RangeTombstoneSet methods
+ */
+
+// sweep the tombstone bounds left to right, each fragment keeps every open tombstone
+// so a snapshot older than the newest one still finds the one it can see
+RangeTombstoneSet::RangeTombstoneSet(const std::vector<RangeTombstone>& tombstones, uint64_t max_seq) {
+    // (bound, opens, seq); at one bound the closing tombstones go first
+    std::vector<std::tuple<int, bool, uint64_t>> bounds;
+    for (const RangeTombstone& tombstone : tombstones) {
+        if (tombstone.seq <= max_seq && tombstone.low < tombstone.high) {
+            bounds.emplace_back(tombstone.low, true, tombstone.seq);
+            bounds.emplace_back(tombstone.high, false, tombstone.seq);
+        }
+    }
+    std::sort(bounds.begin(), bounds.end());
+
+    std::multiset<uint64_t> open_seqs;
+    size_t i = 0;
+    while (i < bounds.size()) {
+        int fragment_low = std::get<0>(bounds[i]);
+        for (; i < bounds.size() && std::get<0>(bounds[i]) == fragment_low; ++i) {
+            if (std::get<1>(bounds[i])) {
+                open_seqs.insert(std::get<2>(bounds[i]));
+            } else {
+                open_seqs.erase(open_seqs.find(std::get<2>(bounds[i])));
+            }
+        }
+        // an open tombstone still has its high bound ahead, so i is in range
+        if (open_seqs.empty()) {
+            continue;
+        }
+        int fragment_high = std::get<0>(bounds[i]);
+        std::vector<uint64_t> seqs(open_seqs.rbegin(), open_seqs.rend());
+        if (!fragments_.empty() && fragments_.back().high == fragment_low && fragments_.back().seqs == seqs) {
+            fragments_.back().high = fragment_high;
+        } else {
+            fragments_.push_back({fragment_low, fragment_high, std::move(seqs)});
+        }
+    }
+}
+
+uint64_t RangeTombstoneSet::coveringSeq(int key, uint64_t max_seq) const {
+    // last fragment starting at or before key
+    auto it = std::upper_bound(fragments_.begin(), fragments_.end(), key,
+                               [](int k, const Fragment& fragment) { return k < fragment.low; });
+    if (it == fragments_.begin()) {
+        return 0;
+    }
+    --it;
+    if (key >= it->high) {
+        return 0;
+    }
+    for (uint64_t seq : it->seqs) {
+        if (seq <= max_seq) {
+            return seq;
+        }
+    }
+    return 0;
+}
+
+bool RangeTombstoneSet::covers(int key, uint64_t seq, uint64_t max_seq) const {
+    return coveringSeq(key, max_seq) > seq;
+}
+
+bool RangeTombstoneSet::empty() const {
+    return fragments_.empty();
+}
+
+uint64_t RangeTombstoneView::coveringSeq(int key) const {
+    uint64_t seq = 0;
+    if (buffer) {
+        seq = buffer->coveringSeq(key, max_seq);
+    }
+    if (tables) {
+        seq = std::max(seq, tables->coveringSeq(key, max_seq));
+    }
+    return seq;
+}
+
+bool RangeTombstoneView::covers(int key, uint64_t seq) const {
+    return coveringSeq(key) > seq;
+}
+
 /**
  * SSTable methods
  */
 SSTable::SSTable(const std::vector<DataPair>& data, int level_num,
-                 const std::string& file_path, const std::string& bf_file_path) :
-    bloom_filter_(data.size())
+                 const std::string& file_path, const std::string& bf_file_path,
+                 uint64_t oldest_tombstone_time,
+                 const std::vector<RangeTombstone>& range_tombstones,
+                 double fp_rate) :
+    bloom_filter_(data.size(), fp_rate)
 {
     this->table_data_ = data;
     this->level_num_ = level_num;
     this->file_path_ = file_path;
     this->bf_file_path_ = bf_file_path;
+    this->oldest_tombstone_time_ = oldest_tombstone_time;
+    this->range_tombstones_ = range_tombstones;
     this->data_loaded_ = true;
     // add bloom filter
     // this->bloom_filter_ = BloomFilter(data.size());
@@ -63,32 +183,23 @@ SSTable::SSTable(const std::vector<DataPair>& data, int level_num,
         max_key_ = data.back().key_;
         
         // TODO: bloom filter
-        bloom_filter_ = BloomFilter(size_);
+        bloom_filter_ = BloomFilter(size_, fp_rate);
         for (const auto& dataPair : data) {
             bloom_filter_.add(dataPair.key_);
         }
 
         // TODO: create fence pointers for binary search
-        this->fence_pointers_.clear();
-        if (this->size_ > 0) {
-            // add fence pointers
-            for (size_t i = 0; i < this->size_; i += fence_pointer_block_size_) {
-                fence_ptr fp;
-                fp.min_key = this->table_data_[i].key_;
-                fp.data_offset = i;
-
-                // block size calculation, since it might be the last one
-                size_t remain_items = this->size_ - i;
-                fp.block_size_actual_ = std::min(remain_items, fence_pointer_block_size_);
-                this->fence_pointers_.push_back(fp);
-            }
-        }
+        buildFencePointers();
     }
 
     // writeToDisk
     if (!writeToDisk()) {
         throw std::runtime_error("Failed to persist SSTable to disk");
     }
+    computeStats();
+    if (!writeMeta()) {
+        throw std::runtime_error("Failed to persist SSTable metadata to disk");
+    }
 }
 
 // eager loading bloom filter, but lazy load table data
@@ -104,6 +215,9 @@ SSTable::SSTable(int level_num, const std::string& file_path,
     this->min_key_ = std::numeric_limits<int>::max();
     this->max_key_ = std::numeric_limits<int>::min();
 
+    // stats and, for ingested files, the seq their entries take
+    loadMeta();
+
     // TODO: Bloom filter: setting and loading eagerly
 
     std::ifstream bf_infile(bf_file_path_, std::ios::binary);
@@ -153,6 +267,133 @@ SSTable::SSTable(int level_num, const std::string& file_path,
     }
 }
 
+// compaction only marks retired tables, the last owner removes the files,
+// so a lazy load through an old Version never finds its file gone
+SSTable::~SSTable() {
+    if (!obsolete_.load()) {
+        return;
+    }
+    std::error_code ec;
+    if (std::filesystem::remove(file_path_, ec)) {
+        // std::cout << "[SSTable] delete SSTable file: " << file_path_ << std::endl;
+    } else {
+        std::cerr << "Warning: fail to delete SSTable file " << file_path_ << ": " << ec.message() << std::endl;
+    }
+    // delete the bloom filter file
+    if (std::filesystem::remove(bf_file_path_, ec)) {
+        // std::cout << "[SSTable] delete Bloom filter file: " << bf_file_path_ << std::endl;
+    } else {
+        std::cerr << "Warning: fail to delete Bloom filter file " << bf_file_path_ << ": " << ec.message() << std::endl;
+    }
+    std::filesystem::remove(file_path_ + ".meta", ec);
+}
+
+void SSTable::computeStats() {
+    tombstone_count_ = 0;
+    max_seq_ = 0;
+    key_sketch_.clear();
+    for (const auto& dataPair : table_data_) {
+        if (dataPair.deleted_) {
+            tombstone_count_++;
+        }
+        max_seq_ = std::max(max_seq_, dataPair.seq_);
+        key_sketch_.add(dataPair.key_);
+    }
+    for (const RangeTombstone& tombstone : range_tombstones_) {
+        max_seq_ = std::max(max_seq_, tombstone.seq);
+    }
+    std::error_code ec;
+    uintmax_t file_bytes = std::filesystem::file_size(file_path_, ec);
+    data_bytes_ = ec ? 0 : static_cast<size_t>(file_bytes);
+    if (tombstone_count_ == 0 && range_tombstones_.empty()) {
+        oldest_tombstone_time_ = 0;
+    } else if (oldest_tombstone_time_ == 0) {
+        // not passed in, or a table from before ages were kept: the deletes are
+        // at least as old as the file
+        oldest_tombstone_time_ = fileWriteMillis(file_path_);
+    }
+}
+
+// .meta layout: magic, version, then the fields below in order, then the sketch registers,
+// then the range tombstone count and records
+// version 2 added max_seq, version 3 oldest_tombstone_time, version 4 range tombstones;
+// older files still give the stats, the table is read once on open to fill in the rest
+static const uint32_t SSTABLE_META_MAGIC = 0x4D4D534C;
+static const uint32_t SSTABLE_META_VERSION = 4;
+static_assert(sizeof(RangeTombstone) == 16, "range tombstones are 16 bytes in the .meta");
+
+bool SSTable::writeMeta() const {
+    std::ofstream meta_outfile(file_path_ + ".meta", std::ios::binary);
+    if (!meta_outfile) {
+        std::cerr << "[SSTable] error opening meta file " << file_path_ << ".meta" << std::endl;
+        return false;
+    }
+    uint64_t fields[] = {size_, tombstone_count_, data_bytes_, global_seq_, max_seq_, oldest_tombstone_time_};
+    int32_t key_range[] = {min_key_, max_key_};
+    meta_outfile.write(reinterpret_cast<const char*>(&SSTABLE_META_MAGIC), sizeof(SSTABLE_META_MAGIC));
+    meta_outfile.write(reinterpret_cast<const char*>(&SSTABLE_META_VERSION), sizeof(SSTABLE_META_VERSION));
+    meta_outfile.write(reinterpret_cast<const char*>(fields), sizeof(fields));
+    meta_outfile.write(reinterpret_cast<const char*>(key_range), sizeof(key_range));
+    meta_outfile.write(reinterpret_cast<const char*>(key_sketch_.registers_.data()), key_sketch_.registers_.size());
+    uint64_t num_range_tombstones = range_tombstones_.size();
+    meta_outfile.write(reinterpret_cast<const char*>(&num_range_tombstones), sizeof(num_range_tombstones));
+    meta_outfile.write(reinterpret_cast<const char*>(range_tombstones_.data()),
+                       range_tombstones_.size() * sizeof(RangeTombstone));
+    meta_outfile.close();
+    if (meta_outfile.fail()) {
+        std::cerr << "[SSTable] error writing meta file " << file_path_ << ".meta" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool SSTable::loadMeta() {
+    std::ifstream meta_infile(file_path_ + ".meta", std::ios::binary);
+    if (!meta_infile) {
+        return false;
+    }
+    uint32_t magic = 0, version = 0;
+    uint64_t fields[6] = {};
+    int32_t key_range[2];
+    HyperLogLog sketch;
+    meta_infile.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+    meta_infile.read(reinterpret_cast<char*>(&version), sizeof(version));
+    if (!meta_infile || magic != SSTABLE_META_MAGIC || version < 1 || version > SSTABLE_META_VERSION) {
+        std::cerr << "[SSTable WARN] Ignoring unreadable meta file for " << file_path_ << std::endl;
+        return false;
+    }
+    size_t num_fields = std::min<size_t>(version + 3, 6);
+    meta_infile.read(reinterpret_cast<char*>(fields), num_fields * sizeof(uint64_t));
+    meta_infile.read(reinterpret_cast<char*>(key_range), sizeof(key_range));
+    meta_infile.read(reinterpret_cast<char*>(sketch.registers_.data()), sketch.registers_.size());
+    std::vector<RangeTombstone> range_tombstones;
+    if (version >= 4) {
+        uint64_t num_range_tombstones = 0;
+        meta_infile.read(reinterpret_cast<char*>(&num_range_tombstones), sizeof(num_range_tombstones));
+        if (meta_infile) {
+            range_tombstones.resize(num_range_tombstones);
+            meta_infile.read(reinterpret_cast<char*>(range_tombstones.data()),
+                             range_tombstones.size() * sizeof(RangeTombstone));
+        }
+    }
+    if (!meta_infile) {
+        std::cerr << "[SSTable WARN] Ignoring unreadable meta file for " << file_path_ << std::endl;
+        return false;
+    }
+    size_ = fields[0];
+    tombstone_count_ = fields[1];
+    data_bytes_ = fields[2];
+    global_seq_ = fields[3];
+    max_seq_ = fields[4];
+    oldest_tombstone_time_ = fields[5];
+    min_key_ = key_range[0];
+    max_key_ = key_range[1];
+    key_sketch_ = sketch;
+    range_tombstones_ = std::move(range_tombstones);
+    meta_loaded_ = version == SSTABLE_META_VERSION;
+    return true;
+}
+
 // persistence on SSTable
 bool SSTable::writeToDisk() const {
     // parent directory must exist
@@ -164,9 +405,14 @@ bool SSTable::writeToDisk() const {
     }
 
     // TODO: refactor to use binary write
-    // key:value:tombstone per line
+    // key:value:flag:seq per line, flag 1 for a tombstone and 3 for a merge operand
     for (const auto& pair : table_data_) {
-        outfile << pair.key_ << ":" << pair.value_ << ":" << (pair.deleted_ ? 1 : 0) << "\n";
+        outfile << pair.key_ << ":" << pair.value_ << ":" << (pair.deleted_ ? 1 : pair.merge_ ? 3 : 0)
+                << ":" << pair.seq_ << "\n";
+    }
+    // then range tombstones as low:high:2:seq, so the table survives losing its .meta
+    for (const auto& tombstone : range_tombstones_) {
+        outfile << tombstone.low << ":" << tombstone.high << ":2:" << tombstone.seq << "\n";
     }
     outfile.close();
 
@@ -218,8 +464,10 @@ bool SSTable::loadFromDisk() {
                   << file_path_ << " (Error: " << strerror(errno) << ")" << std::endl; // Include system error
         return false;
     }
-    // clean slate
-    table_data_.clear();
+    // parsed aside, table_data_ is assigned once the whole file has been read
+    std::vector<DataPair> table_data;
+    // the .meta already gave them to readers, they are only taken from here without it
+    std::vector<RangeTombstone> range_tombstones;
     std::string line;
     int key, value;
     int deleted_int;
@@ -234,20 +482,31 @@ bool SSTable::loadFromDisk() {
         }
 
         std::stringstream ss(line);
-        // parse the line in format key:value:deleted
+        // parse the line in format key:value:deleted:seq
         if (ss >> key >> colon1 >> value >> colon2 >> deleted_int && colon1 == ':' && colon2 == ':') {
+             // files written before sequence numbers have no seq, they read as 0
+             uint64_t seq = 0;
+             char colon3;
+             if (ss >> colon3 && (colon3 != ':' || !(ss >> seq))) {
+                std::cerr << "[SSTable ERROR] Parsing error: bad sequence number on line " << line_num << " in " << file_path_ << ": '" << line << "'" << std::endl;
+                infile.close();
+                return false;
+             }
              char remaining_char;
              if (ss >> remaining_char) {
                 std::cerr << "[SSTable ERROR] Parsing error: Trailing characters found on line " << line_num << " in " << file_path_ << ": '" << line << "'" << std::endl;
-                table_data_.clear();
                 infile.close();
                 return false;
              }
             // Successfully parsed
-            table_data_.emplace_back(key, value, deleted_int == 1);
+            if (deleted_int == 2) {
+                range_tombstones.push_back({key, value, seq});
+                continue;
+            }
+            table_data.emplace_back(key, value, deleted_int == 1, seq);
+            table_data.back().merge_ = deleted_int == 3;
         } else {
             std::cerr << "[SSTable ERROR] Parsing error on line " << line_num << " in " << file_path_ << ": '" << line << "'" << std::endl;
-            table_data_.clear();
             infile.close();
             return false;
         }
@@ -257,23 +516,34 @@ bool SSTable::loadFromDisk() {
     if (infile.bad()) {
          std::cerr << "[SSTable ERROR] File stream badbit set after reading: " << file_path_ << std::endl;
          infile.close();
-         table_data_.clear(); // Data is likely corrupted
          return false;
     }
     infile.close();
-    // metadata update after loading
-    if (table_data_.empty()) {
-        // std::cout << "[SSTable] warning: Loaded empty table data from " << file_path_ << std::endl;
-        size_ = 0;
-        min_key_ = std::numeric_limits<int>::max();
-        max_key_ = std::numeric_limits<int>::min();
-    } else {
-        size_ = table_data_.size();
-        min_key_ = table_data_.front().key_;
-        max_key_ = table_data_.back().key_;
-        // std::cout << "[SSTable] successfully loaded " << size_ << " entries from " << file_path_ << std::endl;
+    if (global_seq_ != 0) {
+        for (auto& dataPair : table_data) {
+            dataPair.seq_ = global_seq_;
+        }
+        for (auto& tombstone : range_tombstones) {
+            tombstone.seq = global_seq_;
+        }
+    }
+    table_data_ = std::move(table_data);
+    // metadata update after loading; with a .meta, readers already use size_ and the
+    // key range without the mutex, so they are only taken from the data without it
+    if (!meta_loaded_) {
+        range_tombstones_ = std::move(range_tombstones);
+        if (table_data_.empty()) {
+            // std::cout << "[SSTable] warning: Loaded empty table data from " << file_path_ << std::endl;
+            size_ = 0;
+            min_key_ = std::numeric_limits<int>::max();
+            max_key_ = std::numeric_limits<int>::min();
+        } else {
+            size_ = table_data_.size();
+            min_key_ = table_data_.front().key_;
+            max_key_ = table_data_.back().key_;
+            // std::cout << "[SSTable] successfully loaded " << size_ << " entries from " << file_path_ << std::endl;
+        }
     }
-    data_loaded_ = true;
 
     // TODO: attempt loading bloom filter
     // placeholder constructor might have already loaded it
@@ -290,23 +560,58 @@ bool SSTable::loadFromDisk() {
     }
 
     // TODO: build fence pointers using loaded data
-    this->fence_pointers_.clear();
-    if (this->size_ > 0) {
-        // add fence pointers
-        for (size_t i = 0; i < this->size_; i += fence_pointer_block_size_) {
-            fence_ptr fp;
-            fp.min_key = this->table_data_[i].key_;
-            fp.data_offset = i;
-
-            size_t remain_items = this->size_ - i;
-            fp.block_size_actual_ = std::min(remain_items, fence_pointer_block_size_);
-            this->fence_pointers_.push_back(fp);
-        }
+    buildFencePointers();
+    // the .meta stats are already in the level's totals, only legacy tables recount
+    if (!meta_loaded_) {
+        computeStats();
     }
+    // readers check the flag without the mutex, so it goes last
+    data_loaded_ = true;
+
+    return true;
+}
 
+bool SSTable::ensureLoaded(QueryStats* stats) {
+    if (data_loaded_) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(sstable_mutex_);
+    // another reader may have loaded it while we waited, only the loader pays the read
+    if (data_loaded_) {
+        return true;
+    }
+    if (!loadFromDisk()) {
+        return false;
+    }
+    if (stats) {
+        stats->blocks_read += fence_pointers_.size();
+        stats->bytes_read += data_bytes_;
+    }
     return true;
 }
 
+// a block is extended past fence_pointer_block_size_ until the key changes,
+// so all versions of a key sit in one block and getFenceRange finds them all
+void SSTable::buildFencePointers() {
+    this->fence_pointers_.clear();
+    size_t i = 0;
+    while (i < this->size_) {
+        fence_ptr fp;
+        fp.min_key = this->table_data_[i].key_;
+        fp.data_offset = i;
+
+        // block size calculation, since it might be the last one
+        size_t block_end = std::min(this->size_, i + fence_pointer_block_size_);
+        while (block_end < this->size_ && 
+               this->table_data_[block_end].key_ == this->table_data_[block_end - 1].key_) {
+            block_end++;
+        }
+        fp.block_size_actual_ = block_end - i;
+        this->fence_pointers_.push_back(fp);
+        i = block_end;
+    }
+}
+
 
 
 void SSTable::printSSTable() const {
@@ -363,16 +668,11 @@ std::optional<std::pair<size_t, size_t>> SSTable::getFenceRange(int key) const {
 }
 
 // assume the data must be within the current SSTable range, having checked bloom filter
-std::optional<DataPair> SSTable::getDataPair(int key) {
+std::optional<DataPair> SSTable::getDataPair(int key, uint64_t max_seq, QueryStats* stats) {
     // persistence check: if data not loaded, load from disk
-    if (!data_loaded_) {
-        // TODO: lock before checking data and loading
-        std::lock_guard<std::mutex> lock(this->sstable_mutex_);
-        // load from disk
-        if (!loadFromDisk()) {
-            std::cerr << "[SSTable] failed to load SSTable from disk: " << file_path_ << std::endl;
-            return std::nullopt;
-        }
+    if (!ensureLoaded(stats)) {
+        std::cerr << "[SSTable] failed to load SSTable from disk: " << file_path_ << std::endl;
+        return std::nullopt;
     }
     // check if data is empty
     if (table_data_.empty()) {
@@ -397,6 +697,11 @@ std::optional<DataPair> SSTable::getDataPair(int key) {
         }
     }
 
+    if (stats) {
+        stats->blocks_read++;
+        stats->bytes_read += (end_index_exclusive - start_index) * entryBytes();
+    }
+
     // search within the fence pointer block range
     auto block_begin_it = table_data_.begin() + start_index;
     auto block_end_it = table_data_.begin() + end_index_exclusive;
@@ -407,17 +712,71 @@ std::optional<DataPair> SSTable::getDataPair(int key) {
                                     return dataPair.key_ < key;
                                 });
     // auto it = std::lower_bound(block_begin_it, block_end_it, key);
-    if (it != block_end_it && it->key_ == key) {
-        // always return, even if tombstone/deleted, so we can check in the return
-        return *it;
+    // versions run newest first, skip the ones newer than the reader
+    for (; it != block_end_it && it->key_ == key; ++it) {
+        if (it->seq_ <= max_seq) {
+            // always return, even if tombstone/deleted, so we can check in the return
+            return *it;
+        }
     }
     return std::nullopt;
 }
 
+void SSTable::addRangeFootprint(int low, int high, QueryStats* stats) const {
+    if (!data_loaded_ || table_data_.empty() || fence_pointers_.empty()) {
+        return;
+    }
+    auto by_key = [](const DataPair& dataPair, int key) {
+        return dataPair.key_ < key;
+    };
+    size_t first = std::lower_bound(table_data_.begin(), table_data_.end(), low, by_key) - table_data_.begin();
+    size_t last = std::lower_bound(table_data_.begin(), table_data_.end(), high, by_key) - table_data_.begin();
+    if (first >= last) {
+        return;
+    }
+    // block holding entry index: the last fence pointer starting at or before it
+    auto block_of = [this](size_t index) {
+        auto it = std::upper_bound(fence_pointers_.begin(), fence_pointers_.end(), index,
+                                   [](size_t index, const fence_ptr& fp) {
+                                       return index < fp.data_offset;
+                                   });
+        return static_cast<size_t>(it - fence_pointers_.begin()) - 1;
+    };
+    size_t first_block = block_of(first);
+    size_t last_block = block_of(last - 1);
+    stats->blocks_read += last_block - first_block + 1;
+    // whole blocks are read, not just the entries in range
+    size_t bytes_start = fence_pointers_[first_block].data_offset;
+    const fence_ptr& end_block = fence_pointers_[last_block];
+    stats->bytes_read += (end_block.data_offset + end_block.block_size_actual_ - bytes_start) * entryBytes();
+}
+
+size_t SSTable::entryBytes() const {
+    return size_ == 0 ? 0 : data_bytes_ / size_;
+}
+
 bool SSTable::keyInRange(int key) const {
     return key >= min_key_ && key <= max_key_;
 }
 
+std::pair<int, int> SSTable::coveredKeyRange() const {
+    std::pair<int, int> range = {min_key_, max_key_};
+    for (const RangeTombstone& tombstone : range_tombstones_) {
+        range.first = std::min(range.first, tombstone.low);
+        range.second = std::max(range.second, tombstone.high - 1);
+    }
+    return range;
+}
+
+void QueryStats::add(const QueryStats& other) {
+    tables_probed += other.tables_probed;
+    bloom_checks += other.bloom_checks;
+    bloom_passes += other.bloom_passes;
+    bloom_false_positives += other.bloom_false_positives;
+    blocks_read += other.blocks_read;
+    bytes_read += other.bytes_read;
+}
+
 /**
  * Level methods
  * 
@@ -431,6 +790,10 @@ Level::Level(int level_num, size_t table_capacity) {
     // this->entries_capacity_ = entries_capacity;
     this->cur_table_count_ = 0;
     this->cur_total_entries_ = 0;
+    this->cur_tombstones_ = 0;
+    this->cur_range_tombstones_ = 0;
+    this->cur_bytes_ = 0;
+    this->oldest_tombstone_time_ = 0;
 }
 
 // READ: shared locked
@@ -449,6 +812,14 @@ void Level::addSSTable(std::shared_ptr<SSTable> sstable_ptr) {
     sstables_.push_back(sstable_ptr);
     cur_total_entries_ += sstable_ptr->size_;
     cur_table_count_++;
+    cur_tombstones_ += sstable_ptr->tombstone_count_;
+    cur_range_tombstones_ += sstable_ptr->range_tombstones_.size();
+    cur_bytes_ += sstable_ptr->data_bytes_;
+    if (sstable_ptr->oldest_tombstone_time_ != 0 &&
+        (oldest_tombstone_time_ == 0 || sstable_ptr->oldest_tombstone_time_ < oldest_tombstone_time_)) {
+        oldest_tombstone_time_ = sstable_ptr->oldest_tombstone_time_;
+    }
+    key_sketch_.merge(sstable_ptr->key_sketch_);
 }
 
 // write: uniquely LOCKED
@@ -458,9 +829,8 @@ void Level::removeSSTable(std::shared_ptr<SSTable> sstable_ptr) {
 
     auto it = std::find(sstables_.begin(), sstables_.end(), sstable_ptr);
     if (it != sstables_.end()) {
-        cur_total_entries_ -= (*it)->size_;
         sstables_.erase(it);
-        cur_table_count_--;
+        recomputeStats();
     }
 }
 
@@ -496,6 +866,29 @@ void Level::removeAllSSTables(const std::vector<std::shared_ptr<SSTable>>& table
     sstables_ = std::move(tables_to_keep);
     cur_total_entries_ = new_total_entries;
     cur_table_count_ = new_table_count;
+    recomputeStats();
+}
+
+// a sketch can't forget keys, so removals rebuild it from the remaining tables
+void Level::recomputeStats() {
+    cur_total_entries_ = 0;
+    cur_tombstones_ = 0;
+    cur_range_tombstones_ = 0;
+    cur_bytes_ = 0;
+    oldest_tombstone_time_ = 0;
+    key_sketch_.clear();
+    for (const auto& table : sstables_) {
+        cur_total_entries_ += table->size_;
+        cur_tombstones_ += table->tombstone_count_;
+        cur_range_tombstones_ += table->range_tombstones_.size();
+        cur_bytes_ += table->data_bytes_;
+        if (table->oldest_tombstone_time_ != 0 &&
+            (oldest_tombstone_time_ == 0 || table->oldest_tombstone_time_ < oldest_tombstone_time_)) {
+            oldest_tombstone_time_ = table->oldest_tombstone_time_;
+        }
+        key_sketch_.merge(table->key_sketch_);
+    }
+    cur_table_count_ = sstables_.size();
 }
 
 
@@ -534,6 +927,7 @@ void LevelSnapshot::printLevel() const{
 
 Buffer::Buffer(size_t capacity) {
     this->capacity_ = capacity;
+    this->last_seq_ = 0;
     // reserve space for buffer_data_ so it doesn't have to resize
     // buffer_data_.reserve(capacity);
 }
@@ -543,7 +937,7 @@ bool Buffer::isFull() const {
     // std::lock_guard<std::mutex> lock(this->buffer_mutex_);
     std::shared_lock lock(this->buffer_mutex_);
     // return cur_size_ >= capacity_;
-    return buffer_data_.size() >= capacity_;
+    return buffer_data_.size() + range_tombstones_.size() >= capacity_;
 }
 
 // print buffer for debugging
@@ -571,12 +965,65 @@ void Buffer::printBuffer() const {
 
 // buffer is sorted, so flush to level 1 is much easier
 // TODO: refactor to use a tree/skip list, or add binary search
-bool Buffer::putData(const DataPair& data) {
+bool Buffer::putData(const DataPair& data, uint64_t* lock_wait_nanos) {
     // first load the buffer
     // exclusive lock on the write to buffer
     // std::lock_guard<std::mutex> lock(this->buffer_mutex_);
-    std::unique_lock lock(this->buffer_mutex_);
+    std::unique_lock lock = lockForWrite(lock_wait_nanos);
+    waitForIngests(lock, data.key_, data.key_, lock_wait_nanos);
+    std::optional<std::vector<uint64_t>> snapshots;
+    insertVersion(data, snapshots);
+    return true;
+}
+
+bool Buffer::applyBatch(const WriteBatch& batch, uint64_t* lock_wait_nanos) {
+    std::unique_lock lock = lockForWrite(lock_wait_nanos);
+    if (!batch.entries_.empty()) {
+        auto [min_entry, max_entry] = std::minmax_element(
+            batch.entries_.begin(), batch.entries_.end(),
+            [](const DataPair& a, const DataPair& b) { return a.key_ < b.key_; });
+        waitForIngests(lock, min_entry->key_, max_entry->key_, lock_wait_nanos);
+    }
+    std::optional<std::vector<uint64_t>> snapshots;
+    for (const DataPair& data : batch.entries_) {
+        insertVersion(data, snapshots);
+    }
+    return true;
+}
+
+std::unique_lock<std::shared_mutex> Buffer::lockForWrite(uint64_t* lock_wait_nanos) {
+    std::unique_lock lock(this->buffer_mutex_, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        // only time the contended case, the fast path stays clock-free
+        auto wait_start = std::chrono::steady_clock::now();
+        lock.lock();
+        if (lock_wait_nanos) {
+            *lock_wait_nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - wait_start).count();
+        }
+    }
+    return lock;
+}
+
+void Buffer::waitForIngests(std::unique_lock<std::shared_mutex>& lock, int min_key, int max_key,
+                            uint64_t* lock_wait_nanos) {
+    auto blocked = [&]() {
+        return std::any_of(ingest_ranges_.begin(), ingest_ranges_.end(), [&](const std::pair<int, int>& range) {
+            return range.first <= max_key && range.second >= min_key;
+        });
+    };
+    if (!blocked()) {
+        return;
+    }
+    auto wait_start = std::chrono::steady_clock::now();
+    ingest_done_cv_.wait(lock, [&]() { return !blocked(); });
+    if (lock_wait_nanos) {
+        *lock_wait_nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - wait_start).count();
+    }
+}
 
+void Buffer::insertVersion(const DataPair& data, std::optional<std::vector<uint64_t>>& snapshots) {
     // search through buffer to see if data exists, if so, update it
     // will be more efficient once I refactor to a tree/skip list
     // auto it = std::lower_bound(buffer_data_.begin(), buffer_data_.end(), data.key_);
@@ -588,12 +1035,41 @@ bool Buffer::putData(const DataPair& data) {
     //     buffer_data_.insert(it, data);
     //     cur_size_++;
     // }
-    buffer_data_.insert_or_assign(data.key_, data);
-    return true;
+    DataPair versioned_data = data;
+    versioned_data.seq_ = ++last_seq_;
+    auto it = buffer_data_.emplace(BufferKey{data.key_, versioned_data.seq_}, versioned_data).first;
+    if (versioned_data.deleted_) {
+        if (tombstone_count_ == 0 && range_tombstones_.empty()) {
+            oldest_tombstone_time_ = wallClockMillis();
+        }
+        tombstone_count_++;
+    }
+
+    // a merge operand is combined on read, so it can't drop anything; anything else
+    // drops the older versions no live snapshot or newer operand still reads
+    if (versioned_data.merge_) {
+        return;
+    }
+    if (!snapshots.has_value()) {
+        snapshots = liveSnapshots();
+    }
+    auto newer = it;
+    ++it;
+    while (it != buffer_data_.end() && it->first.key == data.key_) {
+        if (newer->second.merge_ || versionNeeded(newer->first.seq, it->first.seq, snapshots.value())) {
+            newer = it;
+            ++it;
+        } else {
+            if (it->second.deleted_) {
+                tombstone_count_--;
+            }
+            it = buffer_data_.erase(it);
+        }
+    }
 }
 
 // get data from buffer, shared mutex
-std::optional<DataPair> Buffer::getData(int key) const {
+std::optional<DataPair> Buffer::getData(int key, uint64_t max_seq) const {
     // lock the get operation in the buffer
     // std::shared_lock<std::shared_mutex> lock(this->buffer_mutex_);
     std::shared_lock lock(this->buffer_mutex_);
@@ -603,8 +1079,9 @@ std::optional<DataPair> Buffer::getData(int key) const {
     // if (it != buffer_data_.end() && it->key_ == key) {
     //     return *it;
     // }
-    auto it = buffer_data_.find(key);
-    if (it != buffer_data_.end()) {
+    // first version of key that is not newer than the reader
+    auto it = buffer_data_.lower_bound(BufferKey{key, max_seq});
+    if (it != buffer_data_.end() && it->first.key == key) {
         return it->second;
     }
     return std::nullopt;
@@ -612,80 +1089,600 @@ std::optional<DataPair> Buffer::getData(int key) const {
     // need to search the levels next, using bloom filter on each level
 }
 
-/**
- * LSMTree methods
- * 
- */
-LSMTree::LSMTree(const std::string& db_path, 
-                 size_t buffer_capacity, 
-                 size_t base_level_capacity, 
-                 size_t total_levels,
-                 size_t level_size_ratio) {
-
-    this->db_path_ = db_path;
-    this->buffer_capacity_ = buffer_capacity;
-    this->base_level_table_capacity_ = base_level_capacity;
-    this->total_levels_ = total_levels;
-    this->level_size_ratio_ = level_size_ratio;
-    // path for history of SSTables
-    this->history_path_ = db_path + "/history";
-
-    this->buffer_ = std::make_unique<Buffer>(buffer_capacity);
+std::vector<DataPair> Buffer::getVersions(int key, uint64_t max_seq) const {
+    std::shared_lock lock(this->buffer_mutex_);
+    std::vector<DataPair> versions;
+    for (auto it = buffer_data_.lower_bound(BufferKey{key, max_seq});
+         it != buffer_data_.end() && it->first.key == key; ++it) {
+        versions.push_back(it->second);
+        if (!it->second.merge_) {
+            break;
+        }
+    }
+    return versions;
+}
 
-    // create levels, each which bigger capacity
-    levels_.reserve(total_levels);
-    size_t cur_level_capacity = base_level_capacity;
-    for (size_t i = 0; i < total_levels; i++) {
-        // levels_.push_back(std::make_unique<Level>(i, cur_level_capacity, MAX_ENTRIES_PER_LEVEL));
-        levels_.push_back(std::make_unique<Level>(i, cur_level_capacity));
-        std::cout << "[LSMTree] Created Level " << i 
-                  << " with table capacity: " << cur_level_capacity 
-                  << " (buffer capacity: " << buffer_capacity_ << ")" << std::endl;
-        cur_level_capacity *= level_size_ratio;
+// covered versions stay in buffer_data_ for snapshots, compaction drops them later
+bool Buffer::deleteRange(int low, int high, uint64_t* lock_wait_nanos) {
+    std::unique_lock lock = lockForWrite(lock_wait_nanos);
+    if (tombstone_count_ == 0 && range_tombstones_.empty()) {
+        oldest_tombstone_time_ = wallClockMillis();
     }
+    range_tombstones_.push_back({low, high, ++last_seq_});
+    rebuildRangeTombstoneSet();
+    return true;
+}
 
-    // configure file system
-    setupDB();
+std::vector<RangeTombstone> Buffer::rangeTombstones() const {
+    std::shared_lock lock(this->buffer_mutex_);
+    return range_tombstones_;
+}
 
-    // start background threads
-    this->flusher_thread_ = std::thread(&LSMTree::flushThreadLoop, this);
-    this->compactor_thread_ = std::thread(&LSMTree::compactThreadLoop, this);
+std::shared_ptr<const RangeTombstoneSet> Buffer::rangeTombstoneSet() const {
+    std::shared_lock lock(this->buffer_mutex_);
+    return range_tombstone_set_;
+}
 
-    std::cout << "[LSMTree] Started 1 flusher and " 
-              << " 1 compactor thread." << std::endl;
+void Buffer::rebuildRangeTombstoneSet() {
+    range_tombstone_set_ = std::make_shared<RangeTombstoneSet>(range_tombstones_);
 }
 
-// destructor for thread consistency
-LSMTree::~LSMTree() {
-    shutdown();
-    std::cout << "[LSMTree] Shutdown complete." << std::endl;
+uint64_t Buffer::lastSequence() const {
+    std::shared_lock lock(this->buffer_mutex_);
+    return last_seq_;
 }
 
-// shutdown function for a background thread
-void LSMTree::shutdown() {
-    // set to three and return val before set
-    if (shutdown_requested_.exchange(true)) {
-        return;
-    }
-    std::cout << "[LSMTree] Shutdown requested. Waiting for threads to finish..." << std::endl;
+// on startup, continue numbering after the newest seq found on disk
+void Buffer::setLastSequence(uint64_t seq) {
+    std::unique_lock lock(this->buffer_mutex_);
+    last_seq_ = seq;
+}
 
-    // wake up all threads to check shutdown flag
-    flush_request_cv_.notify_all();
-    compaction_task_cv_.notify_all();
+uint64_t Buffer::reserveSequence() {
+    std::unique_lock lock(this->buffer_mutex_);
+    return ++last_seq_;
+}
 
-    // TODO: join threads
-    if (flusher_thread_.joinable()) {
-        flusher_thread_.join();
-        std::cout << "[LSMTree] Flusher thread joined." << std::endl;
+// under one exclusive lock: every put into the range either got its seq before this one,
+// and is in the buffer for the caller to flush, or waits for endIngest and gets a newer one
+uint64_t Buffer::beginIngest(const std::vector<std::pair<int, int>>& key_ranges, bool* overlaps) {
+    std::unique_lock lock(this->buffer_mutex_);
+    *overlaps = false;
+    for (const auto& key_range : key_ranges) {
+        ingest_ranges_.push_back(key_range);
+        auto it = buffer_data_.lower_bound(key_range.first);
+        *overlaps = *overlaps || (it != buffer_data_.end() && it->first.key <= key_range.second);
     }
-    if (compactor_thread_.joinable()) {
-        compactor_thread_.join();
-        std::cout << "[LSMTree] Compactor thread joined." << std::endl;
+    return ++last_seq_;
+}
+
+void Buffer::endIngest(const std::vector<std::pair<int, int>>& key_ranges) {
+    {
+        std::unique_lock lock(this->buffer_mutex_);
+        for (const auto& key_range : key_ranges) {
+            auto it = std::find(ingest_ranges_.begin(), ingest_ranges_.end(), key_range);
+            if (it != ingest_ranges_.end()) {
+                ingest_ranges_.erase(it);
+            }
+        }
     }
+    ingest_done_cv_.notify_all();
 }
 
+bool Buffer::overlaps(int min_key, int max_key) const {
+    std::shared_lock lock(this->buffer_mutex_);
+    auto it = buffer_data_.lower_bound(min_key);
+    return it != buffer_data_.end() && it->first.key <= max_key;
+}
 
-void LSMTree::setupDB() {
+// shared buffer lock: no put can take a seq while we read last_seq_,
+// and putData reads snapshots_ under the exclusive lock, so it sees this one
+uint64_t Buffer::acquireSnapshot() {
+    std::shared_lock lock(this->buffer_mutex_);
+    std::lock_guard<std::mutex> snapshot_lock(this->snapshot_mutex_);
+    snapshots_.insert(last_seq_);
+    return last_seq_;
+}
+
+void Buffer::releaseSnapshot(uint64_t seq) {
+    std::lock_guard<std::mutex> snapshot_lock(this->snapshot_mutex_);
+    auto it = snapshots_.find(seq);
+    if (it != snapshots_.end()) {
+        snapshots_.erase(it);
+    }
+}
+
+std::vector<uint64_t> Buffer::liveSnapshots() const {
+    std::lock_guard<std::mutex> snapshot_lock(this->snapshot_mutex_);
+    return std::vector<uint64_t>(snapshots_.begin(), snapshots_.end());
+}
+
+// memtable dump layout: header, then num_entries fixed-width records in buffer_data_ order,
+// then a range tombstone count and records (version 2, a version 1 dump ends after the entries)
+static const uint32_t MEMTABLE_DUMP_MAGIC = 0x424D534C; // "LSMB"
+static const uint32_t MEMTABLE_DUMP_VERSION = 2;
+
+struct MemtableDumpHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t num_entries;
+    uint64_t last_seq;
+};
+
+struct MemtableDumpRecord {
+    int32_t key;
+    int32_t value;
+    uint64_t seq;
+    // 0 put, 1 tombstone, 2 merge operand
+    uint32_t deleted;
+    uint32_t reserved;
+};
+
+// written next to path and renamed over it, so a crash mid-write leaves the old dump
+bool Buffer::writeToDisk(const std::string& path) const {
+    std::vector<MemtableDumpRecord> records;
+    std::vector<RangeTombstone> range_tombstones;
+    MemtableDumpHeader header{MEMTABLE_DUMP_MAGIC, MEMTABLE_DUMP_VERSION, 0, 0};
+    {
+        std::shared_lock lock(this->buffer_mutex_);
+        records.reserve(buffer_data_.size());
+        for (const auto& entry : buffer_data_) {
+            const DataPair& data = entry.second;
+            records.push_back({data.key_, data.value_, data.seq_, data.deleted_ ? 1u : data.merge_ ? 2u : 0u, 0});
+        }
+        range_tombstones = range_tombstones_;
+        header.num_entries = records.size();
+        header.last_seq = last_seq_;
+    }
+    uint64_t num_range_tombstones = range_tombstones.size();
+    std::string tmp_path = path + ".tmp";
+    std::ofstream outfile(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!outfile) {
+        std::cerr << "[Buffer] error opening memtable dump " << tmp_path << std::endl;
+        return false;
+    }
+    outfile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    outfile.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(MemtableDumpRecord));
+    outfile.write(reinterpret_cast<const char*>(&num_range_tombstones), sizeof(num_range_tombstones));
+    outfile.write(reinterpret_cast<const char*>(range_tombstones.data()),
+                  range_tombstones.size() * sizeof(RangeTombstone));
+    outfile.close();
+    std::error_code ec;
+    if (!outfile.fail()) {
+        std::filesystem::rename(tmp_path, path, ec);
+    }
+    if (outfile.fail() || ec) {
+        std::cerr << "[Buffer] error writing memtable dump " << path << std::endl;
+        std::filesystem::remove(tmp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+long Buffer::loadFromDisk(const std::string& path) {
+    std::ifstream infile(path, std::ios::binary);
+    if (!infile) {
+        return -1;
+    }
+    MemtableDumpHeader header;
+    infile.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!infile || header.magic != MEMTABLE_DUMP_MAGIC || header.version < 1
+        || header.version > MEMTABLE_DUMP_VERSION) {
+        std::cerr << "[Buffer WARN] Ignoring unreadable memtable dump " << path << std::endl;
+        return -1;
+    }
+    std::vector<MemtableDumpRecord> records(header.num_entries);
+    infile.read(reinterpret_cast<char*>(records.data()), records.size() * sizeof(MemtableDumpRecord));
+    std::vector<RangeTombstone> range_tombstones;
+    if (infile && header.version >= 2) {
+        uint64_t num_range_tombstones = 0;
+        infile.read(reinterpret_cast<char*>(&num_range_tombstones), sizeof(num_range_tombstones));
+        if (infile) {
+            range_tombstones.resize(num_range_tombstones);
+            infile.read(reinterpret_cast<char*>(range_tombstones.data()),
+                        range_tombstones.size() * sizeof(RangeTombstone));
+        }
+    }
+    if (!infile) {
+        std::cerr << "[Buffer WARN] Ignoring truncated memtable dump " << path << std::endl;
+        return -1;
+    }
+
+    std::unique_lock lock(this->buffer_mutex_);
+    if (tombstone_count_ == 0 && range_tombstones_.empty()) {
+        // the dump doesn't keep the time, the deletes are at least as old as the file
+        oldest_tombstone_time_ = fileWriteMillis(path);
+    }
+    for (const auto& record : records) {
+        DataPair data(record.key, record.value, record.deleted == 1, record.seq);
+        data.merge_ = record.deleted == 2;
+        // records come in map order, so the end is the right hint
+        buffer_data_.emplace_hint(buffer_data_.end(), BufferKey{data.key_, data.seq_}, data);
+        if (data.deleted_) {
+            tombstone_count_++;
+        }
+    }
+    range_tombstones_.insert(range_tombstones_.end(), range_tombstones.begin(), range_tombstones.end());
+    rebuildRangeTombstoneSet();
+    last_seq_ = std::max(last_seq_, header.last_seq);
+    return static_cast<long>(records.size() + range_tombstones.size());
+}
+
+DataPair foldMerge(const DataPair& older, const DataPair& newer, const MergeOperator& merge_operator) {
+    DataPair folded = newer;
+    if (!older.deleted_) {
+        folded.value_ = merge_operator(older.value_, newer.value_);
+        folded.merge_ = older.merge_;
+    } else {
+        folded.merge_ = false;
+    }
+    return folded;
+}
+
+int applyMergeOperands(std::optional<int> base, const std::vector<int>& operands,
+                       const MergeOperator& merge_operator) {
+    auto operand = operands.rbegin();
+    int value = base.has_value() ? merge_operator(base.value(), *operand) : *operand;
+    for (++operand; operand != operands.rend(); ++operand) {
+        value = merge_operator(value, *operand);
+    }
+    return value;
+}
+
+bool versionNeeded(uint64_t newer_seq, uint64_t seq, const std::vector<uint64_t>& snapshots) {
+    // smallest snapshot that can see this version, it must not see the newer one
+    auto it = std::lower_bound(snapshots.begin(), snapshots.end(), seq);
+    return it != snapshots.end() && *it < newer_seq;
+}
+
+/**
+ * WriteBatch methods
+ * 
+ */
+void WriteBatch::putData(int key, int value) {
+    entries_.emplace_back(key, value);
+}
+
+void WriteBatch::deleteData(int key) {
+    entries_.emplace_back(key, 0, true);
+}
+
+void WriteBatch::mergeData(int key, int operand) {
+    entries_.emplace_back(key, operand);
+    entries_.back().merge_ = true;
+}
+
+size_t WriteBatch::size() const {
+    return entries_.size();
+}
+
+bool WriteBatch::empty() const {
+    return entries_.empty();
+}
+
+void WriteBatch::clear() {
+    entries_.clear();
+}
+
+/**
+ * Snapshot methods
+ * 
+ */
+
+Snapshot::Snapshot(Buffer* buffer, uint64_t seq) : seq_(seq), buffer_(buffer) {}
+
+Snapshot::~Snapshot() {
+    buffer_->releaseSnapshot(seq_);
+}
+
+/**
+ * Iterator methods
+ * 
+ */
+
+// buffer run owns a copy of just the requested range, bounded by buffer capacity
+RunIterator::RunIterator(std::vector<DataPair> buffer_data, size_t run_index) {
+    this->run_index_ = run_index;
+    this->sstable_ptr_ = nullptr;
+    this->buffer_data_ = std::move(buffer_data);
+    this->pos_ = 0;
+}
+
+// SSTable run reads table_data_ in place, no copy
+RunIterator::RunIterator(SSTable* sstable_ptr, size_t run_index, QueryStats* stats) {
+    this->run_index_ = run_index;
+    this->sstable_ptr_ = sstable_ptr;
+    this->pos_ = 0;
+    if (!sstable_ptr_->ensureLoaded(stats)) {
+        std::cerr << "[RunIterator] failed to load SSTable from disk: " 
+                  << sstable_ptr_->file_path_ << std::endl;
+    }
+}
+
+const SSTable* RunIterator::sstable() const {
+    return sstable_ptr_;
+}
+
+const std::vector<DataPair>& RunIterator::data() const {
+    return sstable_ptr_ ? sstable_ptr_->table_data_ : buffer_data_;
+}
+
+void RunIterator::seek(int key) {
+    // fence pointers narrow the lower_bound to one block
+    size_t start_index = 0;
+    size_t end_index_exclusive = data().size();
+    if (sstable_ptr_ && sstable_ptr_->data_loaded_ && key > sstable_ptr_->min_key_) {
+        std::optional<std::pair<size_t, size_t>> block_range = sstable_ptr_->getFenceRange(key);
+        if (block_range.has_value() && block_range.value().second <= data().size()) {
+            start_index = block_range.value().first;
+            // key may be past the block's last entry, then it starts the next block
+            end_index_exclusive = block_range.value().second;
+        }
+    }
+    auto it = std::lower_bound(data().begin() + start_index, data().begin() + end_index_exclusive, key,
+                               [](const DataPair& dataPair, int key) {
+                                   return dataPair.key_ < key;
+                               });
+    pos_ = it - data().begin();
+}
+
+bool RunIterator::valid() const {
+    return pos_ < data().size();
+}
+
+void RunIterator::next() {
+    pos_++;
+}
+
+const DataPair& RunIterator::current() const {
+    return data()[pos_];
+}
+
+LSMIterator::LSMIterator(std::vector<RunIterator> runs, std::shared_ptr<const Version> version,
+                         int high, size_t limit, uint64_t max_seq, RangeTombstoneView range_tombstones,
+                         MergeOperator merge_operator) {
+    this->runs_ = std::move(runs);
+    this->version_ = std::move(version);
+    this->high_ = high;
+    this->limit_ = limit;
+    this->returned_ = 0;
+    this->max_seq_ = max_seq;
+    this->range_tombstones_ = std::move(range_tombstones);
+    this->merge_operator_ = std::move(merge_operator);
+}
+
+// reposition every run at key, and restart the limit count
+void LSMIterator::seek(int key) {
+    heap_ = decltype(heap_)();
+    returned_ = 0;
+    for (size_t i = 0; i < runs_.size(); ++i) {
+        runs_[i].seek(key);
+        if (runs_[i].valid()) {
+            heap_.push({runs_[i].current(), i});
+        }
+    }
+    findNextLive();
+}
+
+void LSMIterator::findNextLive() {
+    current_.reset();
+    while (!heap_.empty()) {
+        // versions of the smallest key come off newest first: by run, then seq within a run
+        int key = heap_.top().data.key_;
+        if (key >= high_) {
+            heap_ = decltype(heap_)();
+            return;
+        }
+        // keep the first version visible to us, drop the rest; a merge operand keeps
+        // them all, with whether they came from the buffer, to be combined with
+        std::optional<DataPair> visible;
+        std::vector<std::pair<DataPair, bool>> versions;
+        while (!heap_.empty() && heap_.top().data.key_ == key) {
+            size_t run_i = heap_.top().run_index;
+            if (heap_.top().data.seq_ <= max_seq_) {
+                if (!visible.has_value()) {
+                    visible = heap_.top().data;
+                    current_run_ = run_i;
+                }
+                if (visible.value().merge_) {
+                    versions.push_back({heap_.top().data, runs_[run_i].sstable() == nullptr});
+                }
+            }
+            heap_.pop();
+            runs_[run_i].next();
+            if (runs_[run_i].valid()) {
+                heap_.push({runs_[run_i].current(), run_i});
+            }
+        }
+        if (visible.has_value() && visible.value().merge_) {
+            visible = combineOperands(versions);
+        }
+        if (visible.has_value() && !visible.value().deleted_ &&
+            !range_tombstones_.covers(key, visible.value().seq_)) {
+            current_ = visible;
+            return;
+        }
+    }
+}
+
+std::optional<DataPair> LSMIterator::combineOperands(std::vector<std::pair<DataPair, bool>>& versions) const {
+    // newest first across runs; the buffer copy may hold entries a flush already put in
+    // a table, alone or folded, so once a table entry is taken the buffer's are skipped
+    std::sort(versions.begin(), versions.end(), [](const auto& a, const auto& b) {
+        if (a.first.seq_ != b.first.seq_) {
+            return a.first.seq_ > b.first.seq_;
+        }
+        return !a.second && b.second;
+    });
+    std::vector<int> operands;
+    std::optional<DataPair> base;
+    bool from_table = false;
+    uint64_t taken_seq = UINT64_MAX;
+    for (const auto& [version, from_buffer] : versions) {
+        if ((from_buffer && from_table) || version.seq_ == taken_seq) {
+            continue;
+        }
+        from_table = from_table || !from_buffer;
+        taken_seq = version.seq_;
+        if (range_tombstones_.covers(version.key_, version.seq_)) {
+            break;
+        }
+        if (!version.merge_) {
+            if (!version.deleted_) {
+                base = version;
+            }
+            break;
+        }
+        operands.push_back(version.value_);
+    }
+    if (operands.empty()) {
+        return base;
+    }
+    std::optional<int> base_value;
+    if (base.has_value()) {
+        base_value = base.value().value_;
+    }
+    DataPair combined = versions.front().first;
+    combined.value_ = applyMergeOperands(base_value, operands, merge_operator_);
+    combined.merge_ = false;
+    return combined;
+}
+
+bool LSMIterator::valid() const {
+    return current_.has_value() && (limit_ == 0 || returned_ < limit_);
+}
+
+void LSMIterator::next() {
+    if (!valid()) {
+        return;
+    }
+    returned_++;
+    findNextLive();
+}
+
+int LSMIterator::key() const {
+    return current_.value().key_;
+}
+
+int LSMIterator::value() const {
+    return current_.value().value_;
+}
+
+int LSMIterator::currentLevel() const {
+    const SSTable* sstable_ptr = runs_[current_run_].sstable();
+    return sstable_ptr ? sstable_ptr->level_num_ : -1;
+}
+
+const DataPair& LSMIterator::current() const {
+    return current_.value();
+}
+
+/**
+ * LSMTree methods
+ * 
+ */
+LSMTree::LSMTree(const std::string& db_path, 
+                 size_t buffer_capacity, 
+                 size_t base_level_capacity, 
+                 size_t total_levels,
+                 size_t level_size_ratio,
+                 std::shared_ptr<ThreadPool> range_pool) {
+
+    this->db_path_ = db_path;
+    this->buffer_capacity_ = buffer_capacity;
+    this->base_level_table_capacity_ = base_level_capacity;
+    this->total_levels_ = total_levels;
+    this->level_size_ratio_ = level_size_ratio;
+    // path for history of SSTables
+    this->history_path_ = db_path + "/history";
+    this->memtable_path_ = db_path + "/memtable";
+
+    this->buffer_ = std::make_unique<Buffer>(buffer_capacity);
+
+    // create levels, each which bigger capacity
+    levels_.reserve(total_levels);
+    size_t cur_level_capacity = base_level_capacity;
+    for (size_t i = 0; i < total_levels; i++) {
+        // levels_.push_back(std::make_unique<Level>(i, cur_level_capacity, MAX_ENTRIES_PER_LEVEL));
+        levels_.push_back(std::make_unique<Level>(i, cur_level_capacity));
+        std::cout << "[LSMTree] Created Level " << i 
+                  << " with table capacity: " << cur_level_capacity 
+                  << " (buffer capacity: " << buffer_capacity_ << ")" << std::endl;
+        cur_level_capacity *= level_size_ratio;
+    }
+
+    // empty Version, setupDB publishes the tables found on disk
+    auto empty_version = std::make_shared<Version>();
+    empty_version->levels.resize(total_levels);
+    std::atomic_store(&current_version_, std::shared_ptr<const Version>(empty_version));
+
+    // workers for splitting wide range scans, and for opening tables at startup
+    this->range_pool_ = range_pool ? std::move(range_pool)
+                                   : std::make_shared<ThreadPool>(std::thread::hardware_concurrency());
+
+    // configure file system
+    setupDB();
+
+    // start background threads
+    this->flusher_thread_ = std::thread(&LSMTree::flushThreadLoop, this);
+    this->compactor_thread_ = std::thread(&LSMTree::compactThreadLoop, this);
+
+    std::cout << "[LSMTree] Started 1 flusher and " 
+              << " 1 compactor thread." << std::endl;
+}
+
+// destructor for thread consistency
+LSMTree::~LSMTree() {
+    shutdown();
+    std::cout << "[LSMTree] Shutdown complete." << std::endl;
+}
+
+// shutdown function for a background thread
+void LSMTree::shutdown() {
+    // set to three and return val before set
+    if (shutdown_requested_.exchange(true)) {
+        return;
+    }
+    std::cout << "[LSMTree] Shutdown requested. Waiting for threads to finish..." << std::endl;
+
+    // wake up all threads to check shutdown flag
+    flush_request_cv_.notify_all();
+    compaction_task_cv_.notify_all();
+
+    // TODO: join threads
+    if (flusher_thread_.joinable()) {
+        flusher_thread_.join();
+        std::cout << "[LSMTree] Flusher thread joined." << std::endl;
+    }
+    if (compactor_thread_.joinable()) {
+        compactor_thread_.join();
+        std::cout << "[LSMTree] Compactor thread joined." << std::endl;
+    }
+
+    // nothing else writes now; whatever is still buffered would be lost at exit
+    size_t buffered = 0;
+    {
+        std::shared_lock buffer_lock(buffer_->buffer_mutex_);
+        buffered = buffer_->buffer_data_.size() + buffer_->range_tombstones_.size();
+    }
+    if (buffered == 0) {
+        return;
+    }
+    auto persist_start = std::chrono::steady_clock::now();
+    std::string persisted_to = memtable_path_;
+    if (flush_on_shutdown_ || !buffer_->writeToDisk(memtable_path_)) {
+        // a table costs more to write but is just as durable
+        flushBufferHelper();
+        persisted_to = "level 0";
+    }
+    std::cout << "[LSMTree] Persisted " << buffered << " buffered entries to " << persisted_to << " in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - persist_start).count()
+              << " ms" << std::endl;
+}
+
+
+void LSMTree::setupDB() {
     std::error_code ec;
     // makes sure path looks good
     if (!std::filesystem::exists(db_path_) || 
@@ -705,7 +1702,17 @@ void LSMTree::setupDB() {
               << std::endl;
 
     // configure each level
+    VersionEdit loaded_tables_edit;
     int max_loaded_file_id = 0;
+    uint64_t max_loaded_seq = 0;
+    // every .sst found, opened together once all levels are listed
+    struct TableFile {
+        size_t level;
+        uint64_t file_id;
+        std::string path;
+        std::shared_ptr<SSTable> table;
+    };
+    std::vector<TableFile> tables_to_open;
     for (size_t i = 0; i < total_levels_; ++i) {
         std::string level_path_str = getLevelPath(i);
         std::filesystem::path level_path(level_path_str);
@@ -733,9 +1740,6 @@ void LSMTree::setupDB() {
             std::cerr << "Bloom filter path " << bf_dir_path_str << " exists but is not a directory." << std::endl;
             throw std::runtime_error("Bloom filter path is not a directory");
         }
-        // need to load the sstables for the level
-        std::vector<std::pair<uint64_t, std::shared_ptr<SSTable>>> loaded_sstables_for_level;
-
         // Load SSTables for this level
         if (std::filesystem::exists(level_path) && std::filesystem::is_directory(level_path)) {
             
@@ -759,24 +1763,7 @@ void LSMTree::setupDB() {
                         if (file_id > max_loaded_file_id) {
                             max_loaded_file_id = file_id;
                         }
-
-                        std::string bf_file_path_str = getBloomFilterPath(i, file_id);
-
-                        // SSTable placeholder that loads the bloom filter
-                        auto sstable_ptr = std::make_shared<SSTable>(i, sst_file_path_str, bf_file_path_str);
-                        
-                        // load the data and metadata: min/max keys, size
-                        // TODO: load just the bloom filter, min/max keys, fence pointers
-                        if (!sstable_ptr->data_loaded_) {
-                            // Attempt to load the data from disk
-                            bool data_loaded = sstable_ptr->loadFromDisk();
-                            if (!data_loaded) { 
-                                std::cerr << "[LSMTree::setupDB] Failed to load data for SSTable " 
-                                          << sst_file_path_str << ". Skipping." << std::endl;
-                                continue; 
-                            }
-                        }
-                        loaded_sstables_for_level.push_back({file_id, sstable_ptr});
+                        tables_to_open.push_back({i, file_id, sst_file_path_str, nullptr});
 
                     } catch (const std::invalid_argument& ia) {
                         std::cerr << "[LSMTree::setupDB] Invalid argument for SSTable filename: " 
@@ -784,27 +1771,76 @@ void LSMTree::setupDB() {
                     } catch (const std::out_of_range& oor) {
                         std::cerr << "[LSMTree::setupDB] Filename number out of range for SSTable: " 
                                   << sst_filename << ". Skipping. Error: " << oor.what() << std::endl;
-                    } catch (const std::exception& e) {
-                        std::cerr << "[LSMTree::setupDB] Error processing SSTable " << sst_filename 
-                                  << ": " << e.what() << ". Skipping." << std::endl;
                     }
                 }
             }
         }
-        
-        // sort SSTables by ascending file_id before adding to the level
-        std::sort(loaded_sstables_for_level.begin(), loaded_sstables_for_level.end(),
-                  [](const auto& a, const auto& b) {
-                      return a.first < b.first;
-                  });
-        
-        // add sorted sstables to level memory
-        for (const auto& pair : loaded_sstables_for_level) {
-            levels_[i]->addSSTable(pair.second);
+    }
+
+    // open every table on range_pool_: only the .meta and .bf are read, the data stays
+    // on disk until the first lookup, scan or compaction touches the table
+    auto open_start = std::chrono::steady_clock::now();
+    std::vector<std::future<std::shared_ptr<SSTable>>> opened;
+    opened.reserve(tables_to_open.size());
+    for (const auto& table_file : tables_to_open) {
+        size_t level_index = table_file.level;
+        uint64_t file_id = table_file.file_id;
+        std::string sst_file_path_str = table_file.path;
+        opened.push_back(range_pool_->submit([this, level_index, file_id, sst_file_path_str]()
+                                                 -> std::shared_ptr<SSTable> {
+            try {
+                auto sstable_ptr = std::make_shared<SSTable>(level_index, sst_file_path_str,
+                                                             getBloomFilterPath(level_index, file_id));
+                if (!sstable_ptr->meta_loaded_ ||
+                    (sstable_ptr->bloom_filter_.num_bits_ == 0 && sstable_ptr->size_ > 0)) {
+                    // no current .meta (older table): read the data once for its size, key
+                    // range and seqs, and write the .meta so the next open is lazy; a lost
+                    // .bf is rebuilt here too, before readers can probe the filter
+                    if (!sstable_ptr->ensureLoaded()) {
+                        std::cerr << "[LSMTree::setupDB] Failed to load data for SSTable " 
+                                  << sst_file_path_str << ". Skipping." << std::endl;
+                        return nullptr;
+                    }
+                    sstable_ptr->writeMeta();
+                }
+                return sstable_ptr;
+            } catch (const std::exception& e) {
+                std::cerr << "[LSMTree::setupDB] Error processing SSTable " << sst_file_path_str 
+                          << ": " << e.what() << ". Skipping." << std::endl;
+                return nullptr;
+            }
+        }));
+    }
+    for (size_t t = 0; t < tables_to_open.size(); ++t) {
+        tables_to_open[t].table = opened[t].get();
+        if (tables_to_open[t].table) {
+            const SSTable& table = *tables_to_open[t].table;
+            max_loaded_seq = std::max({max_loaded_seq, table.max_seq_, table.global_seq_});
+        }
+    }
+    
+    // sort SSTables by level, then ascending file_id before adding to the levels
+    std::sort(tables_to_open.begin(), tables_to_open.end(),
+              [](const auto& a, const auto& b) {
+                  return a.level != b.level ? a.level < b.level : a.file_id < b.file_id;
+              });
+    std::vector<size_t> tables_per_level(total_levels_, 0);
+    for (const auto& table_file : tables_to_open) {
+        if (table_file.table) {
+            loaded_tables_edit.added_tables.push_back({table_file.level, table_file.table});
+            tables_per_level[table_file.level]++;
         }
+    }
+    for (size_t i = 0; i < total_levels_; ++i) {
          std::cout << "[LSMTree::setupDB] Level " << i << " loaded with " 
-                   << loaded_sstables_for_level.size() << " SSTables." << std::endl;
+                   << tables_per_level[i] << " SSTables." << std::endl;
     }
+    std::cout << "[LSMTree::setupDB] Opened " << loaded_tables_edit.added_tables.size() << " SSTables in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - open_start).count()
+              << " ms on " << range_pool_->size() << " threads" << std::endl;
+
+    applyVersionEdit(loaded_tables_edit);
 
     // set the next_file_id_ based on the maximum ID found on disk
     if (max_loaded_file_id > 0) {
@@ -812,7 +1848,23 @@ void LSMTree::setupDB() {
     } else {
         next_file_id_.store(1);
     }
-    std::cout << "[LSMTree::setupDB] Database setup complete. Next file ID will be: " << next_file_id_.load() << std::endl;
+    // new writes must sort after everything already on disk
+    buffer_->setLastSequence(max_loaded_seq);
+
+    // entries buffered at the last clean shutdown, with their seqs; the dump stays
+    // until the next flush has them in level 0
+    if (std::filesystem::exists(memtable_path_)) {
+        long restored = buffer_->loadFromDisk(memtable_path_);
+        if (restored > 0) {
+            memtable_dump_pending_ = true;
+            std::cout << "[LSMTree::setupDB] Restored " << restored << " buffered entries from "
+                      << memtable_path_ << std::endl;
+        } else if (restored == 0) {
+            std::filesystem::remove(memtable_path_, ec);
+        }
+    }
+    std::cout << "[LSMTree::setupDB] Database setup complete. Next file ID will be: " << next_file_id_.load() 
+              << ", last sequence number: " << buffer_->lastSequence() << std::endl;
 
     // may add history file? probably not
     if (!std::filesystem::exists(history_path_)) {
@@ -859,6 +1911,8 @@ std::vector<LevelSnapshot> LSMTree::getLevelsSnapshot() const {
         level_snap.sstables.reserve(level_ptr->sstables_.size());
         for (const auto& sstable_ptr : level_ptr->sstables_) {
             if (sstable_ptr) {
+                // tables opened lazily are read in for the copy
+                sstable_ptr->ensureLoaded();
                 SSTableSnapshot table_snap;
                 table_snap.level_num = sstable_ptr->level_num_;
                 table_snap.min_key = sstable_ptr->min_key_;
@@ -881,11 +1935,13 @@ void LSMTree::flushBuffer() {
     // need to lock buffer before accessing it
     // flush buffer to level 0
     std::vector<DataPair> data_to_flush;
+    std::vector<RangeTombstone> range_tombstones_to_flush;
+    uint64_t oldest_tombstone_time = 0;
     bool buffer_was_empty = true;
     // ciritical section: access and clear buffer
     {
         std::unique_lock<std::shared_mutex> buffer_lock(buffer_->buffer_mutex_);
-        if (buffer_->buffer_data_.empty()) {
+        if (buffer_->buffer_data_.empty() && buffer_->range_tombstones_.empty()) {
             return;
         }
         // data_to_flush = buffer_->buffer_data_;
@@ -893,13 +1949,19 @@ void LSMTree::flushBuffer() {
         for (const auto& pair : buffer_->buffer_data_) {
             data_to_flush.push_back(pair.second);
         }
+        range_tombstones_to_flush.swap(buffer_->range_tombstones_);
+        buffer_->rebuildRangeTombstoneSet();
+        oldest_tombstone_time = buffer_->oldest_tombstone_time_;
         buffer_->buffer_data_.clear();
+        buffer_->tombstone_count_ = 0;
+        buffer_->oldest_tombstone_time_ = 0;
         buffer_was_empty = false;
     }
     // if buffer is empty, we don't flush
     if (buffer_was_empty) {
         return;
     }
+    ScopedLatency latency(metrics_, MetricOp::FLUSH);
     
     // now for flush operation, lock flush_mutex_
     std::lock_guard<std::mutex> flush_lock(flush_mutex_);
@@ -912,7 +1974,9 @@ void LSMTree::flushBuffer() {
     std::shared_ptr<SSTable> sstable_ptr = nullptr;
     try {
         // create the SSTable object and write to disk
-        sstable_ptr = std::make_shared<SSTable>(data_to_flush, 0, new_file_path, bf_file_path);
+        sstable_ptr = std::make_shared<SSTable>(data_to_flush, 0, new_file_path, bf_file_path,
+                                                oldest_tombstone_time, range_tombstones_to_flush,
+                                                levelFalsePositiveRate(0));
     } catch (const std::exception& e) {
         std::cerr << "can't create/write SSTable during flush: " << e.what() << std::endl;
         // If file creation failed revert file id
@@ -922,7 +1986,17 @@ void LSMTree::flushBuffer() {
     }
 
     // add the new SSTable pointer to level 0's list
-    levels_[0]->addSSTable(sstable_ptr);
+    VersionEdit flush_edit;
+    flush_edit.added_tables.push_back({0, sstable_ptr});
+    applyVersionEdit(flush_edit);
+    flush_count_++;
+    metrics_.add(MetricCounter::FLUSH_BYTES_WRITTEN, sstable_ptr->data_bytes_);
+    metrics_.add(MetricCounter::FLUSH_ENTRIES_WRITTEN, sstable_ptr->size_);
+    // restored entries were all in the buffer when it was copied, level 0 has them now
+    if (memtable_dump_pending_.exchange(false)) {
+        std::error_code ec;
+        std::filesystem::remove(memtable_path_, ec);
+    }
 
     // trigger compaction check before adding to Level 0 in memory
     {
@@ -936,7 +2010,20 @@ bool LSMTree::putData(const DataPair& data) {
     // if (shutdown_requested_) {
     //     return false;
     // }
-    bool rt = buffer_->putData(data);
+    ScopedLatency latency(metrics_, data.deleted_ ? MetricOp::DELETE : MetricOp::PUT);
+    uint64_t lock_wait_nanos = 0;
+    bool rt = buffer_->putData(data, &lock_wait_nanos);
+    if (lock_wait_nanos > 0) {
+        metrics_.add(MetricCounter::WRITE_STALL_NANOS, lock_wait_nanos);
+    }
+    // a tombstone still carries its key and a value slot
+    metrics_.add(MetricCounter::USER_BYTES_WRITTEN, sizeof(data.key_) + sizeof(data.value_));
+    metrics_.add(MetricCounter::USER_ENTRIES_WRITTEN);
+    if (data.deleted_) {
+        deletes_count_++;
+    } else {
+        puts_count_++;
+    }
     // if level is full, flush. put data in buffer either way
 
     // isfull locks buffer_mutex_
@@ -962,51 +2049,118 @@ bool LSMTree::putData(const DataPair& data) {
     return rt;
 }
 
-std::optional<DataPair> LSMTree::getData(int key) {
+std::optional<DataPair> LSMTree::getData(int key, const Snapshot* snapshot, QueryStats* stats) {
     // in case shut down thread
     // if (shutdown_requested_) return std::nullopt;
+    ScopedLatency latency(metrics_, MetricOp::GET);
+    uint64_t max_seq = snapshot ? snapshot->seq_ : UINT64_MAX;
+    // range tombstones are read before the Version, like the buffer entries, so one
+    // being flushed is seen in the buffer or in level 0
+    std::shared_ptr<const RangeTombstoneSet> buffer_range_tombstones = buffer_->rangeTombstoneSet();
+    // a range tombstone newer than the version found and visible to us hides it
+    auto range_deleted = [&](const DataPair& found, const Version& version) {
+        return buffer_range_tombstones->covers(key, found.seq_, max_seq) ||
+               version.range_tombstone_set->covers(key, found.seq_, max_seq);
+    };
 
     // search buffer first
-    // getData locks buffer_mutex_
-    // 1. Search buffer first (sequential, highest priority)
-    std::optional<DataPair> data_pair_buffer = buffer_->getData(key);
-    if (data_pair_buffer.has_value()) {
-        if (data_pair_buffer.value().deleted_) {
-            return std::nullopt;
-        } else {
-            return data_pair_buffer;
+    // getVersions locks buffer_mutex_, the newest version and any operands over it
+    std::vector<DataPair> buffer_versions = buffer_->getVersions(key, max_seq);
+    std::shared_ptr<const Version> version = currentVersion();
+
+    // walk versions newest first: operands are collected until a put, a tombstone
+    // or a range delete decides what they apply to
+    std::vector<int> operands;
+    uint64_t newest_seq = 0;
+    std::optional<DataPair> base;
+    auto decides = [&](const DataPair& found) {
+        if (range_deleted(found, *version)) {
+            return true;
         }
-    }
-
-    // 2. Prepare for parallel level search
-    std::vector<std::future<std::optional<DataPair>>> level_search_futures;
-    level_search_futures.reserve(levels_.size());
-
-    for (size_t level_idx = 0; level_idx < levels_.size(); ++level_idx) {
-        // Capture level_idx by value for the lambda
-        level_search_futures.push_back(
-            std::async(std::launch::async, [this, key, level_idx]() -> std::optional<DataPair> {
-                // This code will run in a separate thread for each level
-                const auto& current_level_ptr = levels_[level_idx];
-                // It's good practice to check if the unique_ptr holds an object,
-                // though in your current setup, levels_ should always be populated.
-                if (!current_level_ptr) {
-                    // This should ideally not happen if levels_ is initialized correctly.
-                    std::cerr << "[LSMTree::getData] Warning: Level " << level_idx << " pointer is null." << std::endl;
-                    return std::nullopt;
-                }
+        if (operands.empty()) {
+            newest_seq = found.seq_;
+        }
+        if (!found.merge_) {
+            if (!found.deleted_) {
+                base = found;
+            }
+            return true;
+        }
+        operands.push_back(found.value_);
+        return false;
+    };
 
-                std::vector<std::shared_ptr<SSTable>> sstables_in_level;
-                {
-                    // Acquire shared lock to read the sstables list for this level
-                    std::shared_lock lock(current_level_ptr->level_mutex_);
-                    sstables_in_level = current_level_ptr->sstables_;
-                }
-                
-                // Search newer SSTables first within this level
-                std::reverse(sstables_in_level.begin(), sstables_in_level.end());
+    bool buffer_decides = !buffer_versions.empty() &&
+                          (!buffer_versions.back().merge_ || range_deleted(buffer_versions.back(), *version));
+    if (buffer_decides) {
+        metrics_.add(MetricCounter::BUFFER_GET_HITS);
+        for (const DataPair& found : buffer_versions) {
+            if (decides(found)) {
+                break;
+            }
+        }
+    } else {
+        QueryStats query_stats;
+        std::optional<DataPair> level_result = searchLevels(*version, key, max_seq, &query_stats);
+        // a flush installs its table before dropping the entries from the buffer, so
+        // operands read from the buffer may also be in the levels, alone or folded
+        while (!buffer_versions.empty() && level_result.has_value() &&
+               buffer_versions.back().seq_ <= level_result.value().seq_) {
+            buffer_versions.pop_back();
+        }
+        // the buffer held only operands, none of them range deleted
+        for (const DataPair& found : buffer_versions) {
+            decides(found);
+        }
+        bool decided = false;
+        while (!decided && level_result.has_value()) {
+            decided = decides(level_result.value());
+            uint64_t seq = level_result.value().seq_;
+            if (!decided) {
+                level_result = seq > 0 ? searchLevels(*version, key, seq - 1, &query_stats) : std::nullopt;
+            }
+        }
+        recordQueryStats(query_stats);
+        if (stats) {
+            stats->add(query_stats);
+        }
+    }
+
+    if (!operands.empty()) {
+        std::optional<int> base_value;
+        if (base.has_value()) {
+            base_value = base.value().value_;
+        }
+        return DataPair(key, applyMergeOperands(base_value, operands, merge_operator_), false, newest_seq);
+    }
+    // std::cout << "[LSMTree::getData] Key " << key << " not found in buffer or any level." << std::endl;
+    if (!base.has_value()) {
+        metrics_.add(MetricCounter::GET_MISSES);
+    }
+    return base;
+}
+
+std::optional<DataPair> LSMTree::searchLevels(const Version& version, int key, uint64_t max_seq,
+                                              QueryStats* query_stats) {
+    // one task per level, all joined before returning, so version need only outlive the call
+    const Version* version_ptr = &version;
+    std::vector<std::future<std::optional<DataPair>>> level_search_futures;
+    level_search_futures.reserve(version_ptr->levels.size());
+    // one slot per level task, summed once every task is done
+    std::vector<QueryStats> level_stats(version_ptr->levels.size());
+    QueryStats* level_stats_ptr = level_stats.data();
 
-                for (const auto& sstable_ptr : sstables_in_level) {
+    for (size_t level_idx = 0; level_idx < version_ptr->levels.size(); ++level_idx) {
+        // Capture level_idx by value for the lambda
+        level_search_futures.push_back(
+            std::async(std::launch::async, [version_ptr, level_stats_ptr, key, level_idx, max_seq]() -> std::optional<DataPair> {
+                // This code will run in a separate thread for each level
+                const std::vector<std::shared_ptr<SSTable>>& sstables_in_level = version_ptr->levels[level_idx];
+                QueryStats& level_stat = level_stats_ptr[level_idx];
+
+                // Search newer SSTables first within this level
+                for (auto table_it = sstables_in_level.rbegin(); table_it != sstables_in_level.rend(); ++table_it) {
+                    const std::shared_ptr<SSTable>& sstable_ptr = *table_it;
                     if (!sstable_ptr) continue; // Should not happen with shared_ptr
 
                     // key in SSTable's range
@@ -1015,15 +2169,19 @@ std::optional<DataPair> LSMTree::getData(int key) {
                     }
 
                     // bloom filter says key could be present
+                    level_stat.tables_probed++;
+                    level_stat.bloom_checks++;
                     if (!sstable_ptr->bloom_filter_.might_contain(key)) {
                         continue;
                     }
+                    level_stat.bloom_passes++;
 
                     // actual data lookup (might trigger lazy load, protected by sstable_mutex_)
-                    std::optional<DataPair> sstable_result = sstable_ptr->getDataPair(key);
+                    std::optional<DataPair> sstable_result = sstable_ptr->getDataPair(key, max_seq, &level_stat);
                     if (sstable_result.has_value()) {
                         return sstable_result; 
                     }
+                    level_stat.bloom_false_positives++;
                 }
                 return std::nullopt; 
             })
@@ -1031,19 +2189,12 @@ std::optional<DataPair> LSMTree::getData(int key) {
     }
 
     // 3. collect results and determine final outcome, respecting level priority
-    for (size_t i = 0; i < level_search_futures.size(); ++i) {
+    std::optional<DataPair> level_result;
+    for (size_t i = 0; i < level_search_futures.size() && !level_result.has_value(); ++i) {
         if (level_search_futures[i].valid()) {
             try {
                 // .get() will block until the task for this level is complete
-                std::optional<DataPair> level_result = level_search_futures[i].get(); 
-                
-                if (level_result.has_value()) {
-                    if (level_result.value().deleted_) {
-                        return std::nullopt;
-                    } else {
-                        return level_result;
-                    }
-                }
+                level_result = level_search_futures[i].get(); 
                 // If std::nullopt, means key not found in this level, continue to check next level's future
             } catch (const std::future_error& e) {
                 std::cerr << "[LSMTree::getData] Future error on level " << i << " for key " << key << ": " << e.what() << std::endl;
@@ -1054,93 +2205,220 @@ std::optional<DataPair> LSMTree::getData(int key) {
              std::cerr << "[LSMTree::getData] Future for level " << i << " was not valid for key " << key << "." << std::endl;
         }
     }
-    // std::cout << "[LSMTree::getData] Key " << key << " not found in buffer or any level." << std::endl;
-    return std::nullopt;
+    // deeper levels still searching write their stats slot, wait for them
+    for (auto& level_future : level_search_futures) {
+        if (level_future.valid()) {
+            level_future.wait();
+        }
+    }
+    for (const QueryStats& level_stat : level_stats) {
+        query_stats->add(level_stat);
+    }
+    return level_result;
 }
 
 // range data API, returns all data in range [low, high)
-std::vector<DataPair> LSMTree::rangeData(int low, int high) {
-    // if (shutdown_requested_) return std::vector<DataPair>();
+// wide ranges are cut into sub-ranges merged in parallel, then concatenated in order
+std::vector<DataPair> LSMTree::rangeData(int low, int high, const Snapshot* snapshot, QueryStats* stats) {
+    ScopedLatency latency(metrics_, MetricOp::RANGE);
+    uint64_t max_seq = snapshot ? snapshot->seq_ : UINT64_MAX;
     std::vector<DataPair> final_results;
-    std::map<int, DataPair> results_map;
+    std::shared_ptr<const RangeTombstoneSet> buffer_range_tombstones = buffer_->rangeTombstoneSet();
+    std::shared_ptr<const Version> version;
+    // lazy tables are read whole on first use, that read is part of this query's footprint
+    QueryStats query_stats;
+    std::vector<RunIterator> runs = collectRuns(low, high, &version, &query_stats);
+    RangeTombstoneView range_tombstones = collectRangeTombstones(buffer_range_tombstones, *version, max_seq);
+
+    // every block overlapping the range is scanned, no filter to skip a table
+    for (const auto& run : runs) {
+        if (const SSTable* sstable_ptr = run.sstable()) {
+            query_stats.tables_probed++;
+            sstable_ptr->addRangeFootprint(low, high, &query_stats);
+        }
+    }
+    recordQueryStats(query_stats);
+    if (stats) {
+        stats->add(query_stats);
+    }
+    std::vector<int> bounds = partitionRange(runs, low, high);
 
-    // scan the buffer
+    if (bounds.size() <= 2) {
+        LSMIterator it(std::move(runs), version, high, 0, max_seq, std::move(range_tombstones), merge_operator_);
+        for (it.seek(low); it.valid(); it.next()) {
+            final_results.push_back(it.current());
+        }
+        metrics_.add(MetricCounter::RANGE_ENTRIES_READ, final_results.size());
+        return final_results;
+    }
+
+    // every part merges the same runs, so all parts see one consistent set of tables
+    std::vector<std::future<std::vector<DataPair>>> part_futures;
+    part_futures.reserve(bounds.size() - 1);
+    for (size_t part = 0; part + 1 < bounds.size(); ++part) {
+        int part_low = bounds[part];
+        int part_high = bounds[part + 1];
+        part_futures.push_back(range_pool_->submit([runs, version, range_tombstones, part_low, part_high,
+                                                    max_seq, merge_operator = merge_operator_]() {
+            std::vector<DataPair> part_results;
+            LSMIterator it(runs, version, part_high, 0, max_seq, range_tombstones, merge_operator);
+            for (it.seek(part_low); it.valid(); it.next()) {
+                part_results.push_back(it.current());
+            }
+            return part_results;
+        }));
+    }
+
+    std::vector<std::vector<DataPair>> part_results;
+    part_results.reserve(part_futures.size());
+    size_t total_results = 0;
+    for (auto& part_future : part_futures) {
+        part_results.push_back(part_future.get());
+        total_results += part_results.back().size();
+    }
+    final_results.reserve(total_results);
+    for (auto& part : part_results) {
+        final_results.insert(final_results.end(), part.begin(), part.end());
+    }
+    metrics_.add(MetricCounter::RANGE_ENTRIES_READ, final_results.size());
+    return final_results;
+}
+
+// runs are ordered newest first: buffer, then each level's tables newest to oldest
+std::vector<RunIterator> LSMTree::collectRuns(int low, int high, std::shared_ptr<const Version>* version,
+                                              QueryStats* stats) {
+    std::vector<RunIterator> runs;
+
+    // copy the buffer's range, so we don't hold buffer_mutex_ while iterating
     {
+        std::vector<DataPair> buffer_range;
         std::shared_lock<std::shared_mutex> lock(buffer_->buffer_mutex_);
-        // auto it_low = std::lower_bound(buffer_->buffer_data_.begin(), 
-        //                                buffer_->buffer_data_.end(), low);
-        // for (auto it = it_low; it != buffer_->buffer_data_.end() && it->key_ < high; ++it) {
         auto it_low = buffer_->buffer_data_.lower_bound(low);
-        for (auto it = it_low; it != buffer_->buffer_data_.end() && it->first < high; ++it) {
-            // add to results_map
-            // only add if doesn't exist already
-            // results_map.emplace(it->key_, *it);
-            results_map.emplace(it->first, it->second);
+        for (auto it = it_low; it != buffer_->buffer_data_.end() && it->first.key < high; ++it) {
+            buffer_range.push_back(it->second);
         }
+        runs.emplace_back(std::move(buffer_range), runs.size());
+        *version = currentVersion();
     }
-    // scan SSTables on disk level by level
-    for (size_t level_i = 0; level_i < levels_.size(); ++level_i) {
-        std::vector<std::shared_ptr<SSTable>> sstables_to_scan;
-        {
-            // can't be const, so can't use getSSTables()
-            std::shared_lock lock(levels_[level_i]->level_mutex_);
-            sstables_to_scan = levels_[level_i]->sstables_;
-        }
 
+    for (const auto& sstables_to_scan : (*version)->levels) {
         // newer table priority, so we process the new/last tables first
-        std::reverse(sstables_to_scan.begin(), sstables_to_scan.end());
-
-        for (const auto& sstable_ptr : sstables_to_scan) {
+        for (auto table_it = sstables_to_scan.rbegin(); table_it != sstables_to_scan.rend(); ++table_it) {
+            SSTable* sstable_ptr = table_it->get();
             // skip if not in range
-            if (sstable_ptr->max_key_ < low || sstable_ptr->min_key_ > high) {
+            if (sstable_ptr->max_key_ < low || sstable_ptr->min_key_ >= high) {
                 continue;
             }
+            runs.emplace_back(sstable_ptr, runs.size(), stats);
+        }
+    }
+    return runs;
+}
 
-            // TODO: bloom filter check
+RangeTombstoneView LSMTree::collectRangeTombstones(std::shared_ptr<const RangeTombstoneSet> buffer_tombstones,
+                                                   const Version& version, uint64_t max_seq) const {
+    return RangeTombstoneView{std::move(buffer_tombstones), version.range_tombstone_set, max_seq};
+}
 
-            std::vector<DataPair> sstable_data;
-            bool load_and_successful = false;
-            {
-                std::lock_guard<std::mutex> lock(sstable_ptr->sstable_mutex_);
-                if (!sstable_ptr->data_loaded_) {
-                    if (!sstable_ptr->loadFromDisk()) {
-                        std::cerr << "[LSMTree] Error loading SSTable data from disk." << std::endl;
-                        continue;
-                    }
-                }
-            }
-            
-            // check again after potential load
-            if (sstable_ptr->data_loaded_) {
-                sstable_data = sstable_ptr->table_data_;
-                load_and_successful = true;
-            }
-            if (sstable_data.empty() || !load_and_successful) {
-                continue;
-            }
-            // binary search on [first, last), return first element not less than low
-            // so we can start fill in there
-            auto it_low = std::lower_bound(sstable_data.begin(), 
-                                           sstable_data.end(), low);
-            for (auto it = it_low; it->key_ < high && it != sstable_data.end(); ++it) {
-                // if key not in results_map, add
-                // level by level: lower level first
-                // only add if doesn't exist in results_map yet
-                if (results_map.find(it->key_) == results_map.end()) {
-                    results_map.emplace(it->key_, *it);
-                }
+// fence pointer keys are natural cut points: each part starts on a block boundary
+std::vector<int> LSMTree::partitionRange(const std::vector<RunIterator>& runs, int low, int high) const {
+    std::vector<int> bounds = {low, high};
+    if (!range_pool_ || range_pool_->size() < 2) {
+        return bounds;
+    }
+
+    // count entries in range per table with two binary searches, no data copied
+    size_t total_entries = 0;
+    std::vector<int> fence_keys;
+    for (const auto& run : runs) {
+        const SSTable* sstable_ptr = run.sstable();
+        if (!sstable_ptr || !sstable_ptr->data_loaded_) {
+            continue;
+        }
+        const std::vector<DataPair>& table_data = sstable_ptr->table_data_;
+        auto first = std::lower_bound(table_data.begin(), table_data.end(), low);
+        auto last = std::lower_bound(first, table_data.end(), high);
+        total_entries += last - first;
+
+        for (const auto& fp : sstable_ptr->fence_pointers_) {
+            if (fp.min_key > low && fp.min_key < high) {
+                fence_keys.push_back(fp.min_key);
             }
         }
     }
+    if (total_entries < range_partition_min_entries_ || fence_keys.empty()) {
+        return bounds;
+    }
+
+    size_t num_parts = std::min(range_pool_->size(), total_entries / range_partition_min_entries_);
+    num_parts = std::max<size_t>(num_parts, 2);
+    std::sort(fence_keys.begin(), fence_keys.end());
+    fence_keys.erase(std::unique(fence_keys.begin(), fence_keys.end()), fence_keys.end());
+    num_parts = std::min(num_parts, fence_keys.size() + 1);
 
-    // populate final results using results_map, and filter out tombstones
-    final_results.reserve(results_map.size());
-    for (const auto& pair_entry : results_map) {
-        if (!pair_entry.second.deleted_) {
-            final_results.push_back(pair_entry.second);
+    // evenly spaced fence keys, each part gets about the same number of blocks
+    bounds.pop_back();
+    for (size_t part = 1; part < num_parts; ++part) {
+        int cut = fence_keys[part * fence_keys.size() / num_parts];
+        if (cut > bounds.back()) {
+            bounds.push_back(cut);
         }
     }
-    return final_results;
+    bounds.push_back(high);
+    return bounds;
+}
+
+// streaming range scan, positioned at low
+LSMIterator LSMTree::newIterator(int low, int high, size_t limit, const Snapshot* snapshot) {
+    uint64_t max_seq = snapshot ? snapshot->seq_ : UINT64_MAX;
+    std::shared_ptr<const RangeTombstoneSet> buffer_range_tombstones = buffer_->rangeTombstoneSet();
+    std::shared_ptr<const Version> version;
+    std::vector<RunIterator> runs = collectRuns(low, high, &version);
+    LSMIterator iterator(std::move(runs), version, high, limit, max_seq,
+                         collectRangeTombstones(buffer_range_tombstones, *version, max_seq), merge_operator_);
+    iterator.seek(low);
+    return iterator;
+}
+
+std::shared_ptr<const Version> LSMTree::currentVersion() const {
+    return std::atomic_load(&current_version_);
+}
+
+// installers are serialized by version_mutex_; readers see the Version
+// before the edit or after it, never a level with the edit half applied
+void LSMTree::applyVersionEdit(const VersionEdit& edit) {
+    std::lock_guard<std::mutex> lock(version_mutex_);
+    auto new_version = std::make_shared<Version>(*std::atomic_load(&current_version_));
+    bool range_tombstones_changed = false;
+
+    for (const auto& [level_index, table] : edit.removed_tables) {
+        auto& level_tables = new_version->levels[level_index];
+        level_tables.erase(std::remove(level_tables.begin(), level_tables.end(), table), level_tables.end());
+        levels_[level_index]->removeSSTable(table);
+        range_tombstones_changed |= !table->range_tombstones_.empty();
+    }
+    for (const auto& [level_index, table] : edit.added_tables) {
+        new_version->levels[level_index].push_back(table);
+        levels_[level_index]->addSSTable(table);
+        range_tombstones_changed |= !table->range_tombstones_.empty();
+    }
+    if (range_tombstones_changed) {
+        new_version->range_tombstones.clear();
+        for (const auto& level_tables : new_version->levels) {
+            for (const auto& table : level_tables) {
+                new_version->range_tombstones.insert(new_version->range_tombstones.end(),
+                                                     table->range_tombstones_.begin(),
+                                                     table->range_tombstones_.end());
+            }
+        }
+        new_version->range_tombstone_set = std::make_shared<RangeTombstoneSet>(new_version->range_tombstones);
+    }
+    std::atomic_store(&current_version_, std::shared_ptr<const Version>(std::move(new_version)));
+}
+
+std::shared_ptr<Snapshot> LSMTree::getSnapshot() {
+    uint64_t seq = buffer_->acquireSnapshot();
+    return std::make_shared<Snapshot>(buffer_.get(), seq);
 }
 
 // delete is just putting in the tombstone in the buffer for now
@@ -1151,29 +2429,80 @@ bool LSMTree::deleteData(int key) {
     return this->putData(tombstone_data);
 }
 
+// one buffer entry however many keys [low, high) holds
+bool LSMTree::deleteRange(int low, int high) {
+    // an empty range deletes nothing, a reversed one is the caller's mistake
+    if (low >= high) {
+        return low == high;
+    }
+    ScopedLatency latency(metrics_, MetricOp::DELETE);
+    uint64_t lock_wait_nanos = 0;
+    bool rt = buffer_->deleteRange(low, high, &lock_wait_nanos);
+    if (lock_wait_nanos > 0) {
+        metrics_.add(MetricCounter::WRITE_STALL_NANOS, lock_wait_nanos);
+    }
+    metrics_.add(MetricCounter::USER_BYTES_WRITTEN, sizeof(low) + sizeof(high));
+    metrics_.add(MetricCounter::USER_ENTRIES_WRITTEN);
+    deletes_count_++;
+
+    // range tombstones take buffer slots too, so a stream of them still flushes
+    if (buffer_->isFull()) {
+        std::lock_guard lock(this->flush_mutex_);
+        this->flush_needed_ = true;
+        flush_request_cv_.notify_one();
+    }
+    return rt;
+}
+
+bool LSMTree::writeBatch(const WriteBatch& batch) {
+    if (batch.empty()) {
+        return true;
+    }
+    ScopedLatency latency(metrics_, MetricOp::WRITE_BATCH);
+    uint64_t lock_wait_nanos = 0;
+    bool rt = buffer_->applyBatch(batch, &lock_wait_nanos);
+    if (lock_wait_nanos > 0) {
+        metrics_.add(MetricCounter::WRITE_STALL_NANOS, lock_wait_nanos);
+    }
+    metrics_.add(MetricCounter::USER_BYTES_WRITTEN, batch.size() * (sizeof(int) + sizeof(int)));
+    metrics_.add(MetricCounter::USER_ENTRIES_WRITTEN, batch.size());
+    for (const DataPair& data : batch.entries_) {
+        if (data.deleted_) {
+            deletes_count_++;
+        } else {
+            puts_count_++;
+        }
+    }
+
+    if (buffer_->isFull()) {
+        std::lock_guard lock(this->flush_mutex_);
+        this->flush_needed_ = true;
+        flush_request_cv_.notify_one();
+    }
+    return rt;
+}
+
+// a buffer insert like any put, the older value is only read when the key is
+bool LSMTree::mergeData(int key, int operand) {
+    DataPair merge_data(key, operand);
+    merge_data.merge_ = true;
+    return this->putData(merge_data);
+}
+
+void LSMTree::setMergeOperator(MergeOperator merge_operator) {
+    merge_operator_ = std::move(merge_operator);
+}
+
 // persistence
 // delete the SSTable file and its bloom filter
-// can we delete in the background?
+// deferred: ~SSTable removes them once no Version or reader holds the table
 void LSMTree::deleteSSTableFile(const std::shared_ptr<SSTable>& sstable) {
     if (!sstable || sstable->file_path_.empty()) {
         return;
     }
-
-    std::error_code ec;
-    if (std::filesystem::remove(sstable->file_path_, ec)) {
-        // std::cout << "[LSMTree] delete SSTable file: " << sstable->file_path_ << std::endl;
-    } else {
-        std::cerr << "Warning: fail to delete SSTable file " << sstable->file_path_ << ": " << ec.message() << std::endl;
-    }
-    // delete the bloom filter file
-    if (std::filesystem::remove(sstable->bf_file_path_, ec)) {
-        // std::cout << "[LSMTree] delete Bloom filter file: " << sstable->bf_file_path_ << std::endl;
-    } else {
-        std::cerr << "Warning: fail to delete Bloom filter file " << sstable->bf_file_path_ << ": " << ec.message() << std::endl;
-    }
+    sstable->obsolete_.store(true);
 }
 
-
 // compaction logic: return compacted or not
 bool LSMTree::checkCompaction(size_t level_index) {
     if (level_index >= levels_.size()) {
@@ -1183,7 +2512,7 @@ bool LSMTree::checkCompaction(size_t level_index) {
     bool needs_compaction = false;
     {
         // needsCompaction locks level_mutex_
-        needs_compaction = levels_[level_index]->needsCompaction();
+        needs_compaction = levelNeedsCompaction(level_index);
     }
 
     if (needs_compaction) {
@@ -1209,7 +2538,7 @@ void LSMTree::compactLevel(size_t level_index) {
     // re-check needsCompaction while holding the global lock to avoid race
     bool needs_compaction = false;
     {
-        needs_compaction = levels_[level_index]->needsCompaction();
+        needs_compaction = levelNeedsCompaction(level_index);
     }
     if (!needs_compaction) {
         return;
@@ -1239,6 +2568,7 @@ void LSMTree::compactLevel(size_t level_index) {
         return;
     }
 
+    ScopedLatency latency(metrics_, MetricOp::COMPACTION);
     // Perform merge logic - mergeSSTables now takes an empty input_tables_level_next
     std::vector<std::shared_ptr<SSTable>> output_tables;
     try {
@@ -1251,17 +2581,21 @@ void LSMTree::compactLevel(size_t level_index) {
         return;
     }
 
-    // atomic replace in memory: protected by compaction_mutex_
-    // removeAllSSTables locks level_mutex_
-    levels_[level_index]->removeAllSSTables(input_tables_level);
-
+    // atomic replace in memory: one VersionEdit, readers see all or nothing
+    VersionEdit compaction_edit;
+    for (const auto& table : input_tables_level) {
+        compaction_edit.removed_tables.push_back({level_index, table});
+    }
     for (const auto& table : output_tables) {
-        levels_[next_level_index]->addSSTable(table);
+        compaction_edit.added_tables.push_back({next_level_index, table});
     }
+    applyVersionEdit(compaction_edit);
+    compaction_count_++;
+    recordCompaction(level_index, input_tables_level, output_tables);
 
     // TODO: updateHistory
 
-    // delete the SSTable files that were merged from the current level
+    // retire the merged tables, files go once the last Version drops them
     for (const auto& table : input_tables_level) {
         deleteSSTableFile(table);
     }
@@ -1281,11 +2615,21 @@ std::vector<std::shared_ptr<SSTable>> LSMTree::mergeSSTables(
     std::vector<DataPair> current_output_data;
     // todo: need to redefine this later
     const size_t TARGET_SSTABLE_SIZE = MAX_TABLE_SIZE; 
+    // read once, so a tune applied mid-merge doesn't split the outputs between two rates
+    const double output_fp_rate = levelFalsePositiveRate(output_level_num);
 
     std::priority_queue<MergeEntry, std::vector<MergeEntry>, std::greater<MergeEntry>> min_heap;
 
     std::vector<std::shared_ptr<SSTable>> all_inputs = level_l_tables;
     all_inputs.insert(all_inputs.end(), level_l_plus_1_tables.begin(), level_l_plus_1_tables.end());
+    // entries aren't timed, so every output with tombstones takes the oldest input time
+    uint64_t oldest_tombstone_time = 0;
+    for (const auto& input : all_inputs) {
+        if (input->oldest_tombstone_time_ != 0 &&
+            (oldest_tombstone_time == 0 || input->oldest_tombstone_time_ < oldest_tombstone_time)) {
+            oldest_tombstone_time = input->oldest_tombstone_time_;
+        }
+    }
 
     // load all input data first before merge
     std::vector<std::vector<DataPair>> input_data_vecs(all_inputs.size());
@@ -1293,14 +2637,9 @@ std::vector<std::shared_ptr<SSTable>> LSMTree::mergeSSTables(
 
     for(size_t i = 0; i < all_inputs.size(); ++i) {
         std::vector<DataPair> table_data_copy;
-        {
-            std::lock_guard<std::mutex> lock(all_inputs[i]->sstable_mutex_);
-            if (!all_inputs[i]->data_loaded_) {
-                if (!all_inputs[i]->loadFromDisk()) {
-                    std::cerr << "Error loading input table " << all_inputs[i]->file_path_ << " for merge." << std::endl;
-                    throw std::runtime_error("Failed to load input SSTable for merge");
-                }
-            }
+        if (!all_inputs[i]->ensureLoaded()) {
+            std::cerr << "Error loading input table " << all_inputs[i]->file_path_ << " for merge." << std::endl;
+            throw std::runtime_error("Failed to load input SSTable for merge");
         }
     
         input_data_vecs[i] = all_inputs[i]->table_data_; 
@@ -1316,44 +2655,119 @@ std::vector<std::shared_ptr<SSTable>> LSMTree::mergeSSTables(
         }
     }
 
-    int last_key = std::numeric_limits<int>::min();
-    bool first_entry = true;
-
-    // K-way merge using the heap
-    while (!min_heap.empty()) {
-        MergeEntry top = min_heap.top();
-        min_heap.pop();
-
-        if (!first_entry && top.data.key_ == last_key) {
-            current_indices[top.source_table_index]++;
-            size_t next_idx = current_indices[top.source_table_index];
-             if (next_idx < input_data_vecs[top.source_table_index].size()) {
-                 min_heap.push({input_data_vecs[top.source_table_index][next_idx],
-                                top.source_table_index,
-                                input_levels[top.source_table_index]});
-             }
-            continue;
+    // live snapshots decide which older versions survive the merge
+    std::vector<uint64_t> snapshots = buffer_->liveSnapshots();
+    // outputs are appended next to the output level's tables without merging them; those and
+    // every deeper level are older than every input, so a tombstone must stay while one of
+    // them may hold its key
+    bool may_elide = ingests_in_flight_ == 0;
+    std::vector<std::shared_ptr<SSTable>> older_tables =
+        olderTables(*currentVersion(), output_level_num, all_inputs);
+    auto older_table_may_contain = [&](int key) {
+        return !may_elide || tablesMayHoldKey(older_tables, key);
+    };
+    size_t tombstones_elided = 0;
+
+    // input range tombstones drop the versions they cover, and go to the last output;
+    // one goes once it hides nothing: no older table overlaps it and no snapshot older
+    // than it keeps a covered version
+    std::vector<RangeTombstone> input_range_tombstones;
+    std::vector<RangeTombstone> output_range_tombstones;
+    for (const auto& input : all_inputs) {
+        for (const RangeTombstone& tombstone : input->range_tombstones_) {
+            input_range_tombstones.push_back(tombstone);
+            bool shadows_older_table = !may_elide || std::any_of(
+                older_tables.begin(), older_tables.end(),
+                [&](const std::shared_ptr<SSTable>& table) {
+                    return table->min_key_ < tombstone.high && table->max_key_ >= tombstone.low;
+                });
+            bool snapshot_below = !snapshots.empty() && snapshots.front() < tombstone.seq;
+            if (shadows_older_table || snapshot_below) {
+                output_range_tombstones.push_back(tombstone);
+            } else {
+                tombstones_elided++;
+            }
         }
+    }
+    RangeTombstoneSet range_tombstones(input_range_tombstones);
+    // every version of the key being merged, newest first
+    std::vector<DataPair> key_versions;
 
-        last_key = top.data.key_;
-        first_entry = false;
-
+    auto emit_key_versions = [&]() {
+        if (key_versions.empty()) {
+            return;
+        }
+        // a covering range tombstone is one more version of the key: merged in as a point
+        // tombstone it hides the older versions no snapshot reads, then it is taken out
+        // again, the range tombstone itself still covers the key
+        int key = key_versions.front().key_;
+        uint64_t covering_seq = range_tombstones.coveringSeq(key);
+        if (covering_seq != 0) {
+            auto older = std::find_if(key_versions.begin(), key_versions.end(),
+                                      [covering_seq](const DataPair& version) { return version.seq_ < covering_seq; });
+            key_versions.insert(older, DataPair(key, 0, true, covering_seq));
+        }
+        // newest version always stays, older ones only if a snapshot reads them; one no
+        // snapshot reads under a merge operand is folded into it instead of dropped
+        // equal seqs are the same write seen twice (or pre-seq data), keep the first
+        std::vector<DataPair> kept = {key_versions.front()};
+        for (size_t i = 1; i < key_versions.size(); ++i) {
+            DataPair& newer = kept.back();
+            if (key_versions[i].seq_ == newer.seq_) {
+                continue;
+            }
+            if (versionNeeded(newer.seq_, key_versions[i].seq_, snapshots)) {
+                kept.push_back(key_versions[i]);
+            } else if (newer.merge_) {
+                newer = foldMerge(key_versions[i], newer, merge_operator_);
+            }
+        }
         //tombstoness
-        bool is_last_level = (output_level_num == static_cast<int>((levels_.size() - 1)));
-        if (!top.data.deleted_ || !is_last_level) {
-            current_output_data.push_back(top.data);
-        } // else drop the entry if it's a tombstone and we're at the last level
+        // with no older version of the key anywhere below, trailing tombstones hide nothing
+        if (kept.back().deleted_ && !older_table_may_contain(key)) {
+            while (!kept.empty() && kept.back().deleted_) {
+                if (kept.back().seq_ != covering_seq) {
+                    tombstones_elided++;
+                }
+                kept.pop_back();
+            }
+        }
+        // nothing older to apply to, the operand is the value
+        if (!kept.empty() && kept.back().merge_ && !older_table_may_contain(key)) {
+            kept.back().merge_ = false;
+        }
+        if (covering_seq != 0) {
+            kept.erase(std::remove_if(kept.begin(), kept.end(),
+                                      [covering_seq](const DataPair& version) { return version.seq_ == covering_seq; }),
+                       kept.end());
+        }
+        current_output_data.insert(current_output_data.end(), kept.begin(), kept.end());
+        key_versions.clear();
 
-        //check if the current output buffer is full
+        //check if the current output buffer is full, only cut between keys
         if (current_output_data.size() >= TARGET_SSTABLE_SIZE) {
             uint64_t new_file_id = next_file_id_++;
             std::string new_file_path = getFilePath(output_level_num, new_file_id);
             std::string new_bloom_filter_path = getBloomFilterPath(output_level_num, new_file_id);
-            auto new_sstable = std::make_shared<SSTable>(current_output_data, output_level_num, new_file_path, new_bloom_filter_path);
+            auto new_sstable = std::make_shared<SSTable>(current_output_data, output_level_num, new_file_path,
+                                                         new_bloom_filter_path, oldest_tombstone_time,
+                                                         std::vector<RangeTombstone>(), output_fp_rate);
             output_sstables.push_back(new_sstable);
             // std::cout << "[Merge] Created output SSTable: " << new_file_path << std::endl;
             current_output_data.clear(); // Reset buffer for the next file
         }
+    };
+
+    // K-way merge using the heap
+    while (!min_heap.empty()) {
+        MergeEntry top = min_heap.top();
+        min_heap.pop();
+
+        if (!key_versions.empty() && top.data.key_ != key_versions.front().key_) {
+            emit_key_versions();
+        }
+        key_versions.push_back(top.data);
+
         // push heap
         current_indices[top.source_table_index]++;
         size_t next_idx = current_indices[top.source_table_index];
@@ -1363,16 +2777,21 @@ std::vector<std::shared_ptr<SSTable>> LSMTree::mergeSSTables(
                            input_levels[top.source_table_index]});
         }
     }
+    emit_key_versions();
 
-    if (!current_output_data.empty()) {
+    // range tombstones left with no entries to ride along get a table of their own
+    if (!current_output_data.empty() || !output_range_tombstones.empty()) {
         uint64_t new_file_id = next_file_id_++;
         std::string new_file_path = getFilePath(output_level_num, new_file_id);
         std::string new_bloom_filter_path = getBloomFilterPath(output_level_num, new_file_id);
-        auto new_sstable = std::make_shared<SSTable>(current_output_data, output_level_num, new_file_path, new_bloom_filter_path);
+        auto new_sstable = std::make_shared<SSTable>(current_output_data, output_level_num, new_file_path,
+                                                     new_bloom_filter_path, oldest_tombstone_time,
+                                                     output_range_tombstones, output_fp_rate);
         output_sstables.push_back(new_sstable);
         // std::cout << "[Merge] created final output SSTable: " << new_file_path << std::endl;
     }
 
+    metrics_.add(MetricCounter::TOMBSTONES_ELIDED, tombstones_elided);
     return output_sstables;
 }
 
@@ -1414,12 +2833,21 @@ void LSMTree::compactThreadLoop() {
 
     while (true) {
         int level_to_compact = -1;
+        bool tombstone_check_due = false;
         {
             std::unique_lock lock(this->compaction_mutex_);
             // get notified if compaction task is available
-            compaction_task_cv_.wait(lock, [this]{
+            auto task_ready = [this]{
                 return shutdown_requested_.load() || !compaction_tasks_.empty();
-            });
+            };
+            if (delete_persistence_ms_ > 0) {
+                // nothing may be written for a while, so wake up to look for expired tombstones
+                uint64_t check_ms = std::clamp<uint64_t>(tombstoneTtl(0) / 2, 10, 1000);
+                tombstone_check_due = !compaction_task_cv_.wait_for(
+                    lock, std::chrono::milliseconds(check_ms), task_ready);
+            } else {
+                compaction_task_cv_.wait(lock, task_ready);
+            }
 
             // spurious wake-up check
             // take the front of the tasks, FIFO style
@@ -1429,9 +2857,15 @@ void LSMTree::compactThreadLoop() {
                 compaction_tasks_.pop();
             }
         }
+        if (tombstone_check_due) {
+            for (size_t i = 0; i < levels_.size(); ++i) {
+                doCompactionCheck(i);
+            }
+            continue;
+        }
 
         // we have a level to compact
-        if (level_to_compact != -1 && static_cast<unsigned long>(level_to_compact) < levels_.size() - 1) {
+        if (level_to_compact != -1 && static_cast<unsigned long>(level_to_compact) < levels_.size()) {
             try {
                 // compact current level, and check the next one right after
                 // includes doCompactionCheck for level_to_compact + 1
@@ -1451,47 +2885,131 @@ void LSMTree::compactThreadLoop() {
 }
 
 void LSMTree::flushBufferHelper() {
+    std::lock_guard<std::mutex> flush_write_lock(flush_write_mutex_);
     std::vector<DataPair> data_to_flush;
+    std::vector<BufferKey> flushed_keys;
+    std::vector<RangeTombstone> range_tombstones_to_flush;
+    uint64_t oldest_tombstone_time = 0;
+    bool has_tombstones = false;
     bool buffer_was_empty = true;
-    // lock buffer and get data
+    // lock buffer and copy data; entries stay readable in the buffer until L0 has them
     {
-        std::unique_lock buffer_lock(buffer_->buffer_mutex_);
-        if (buffer_->buffer_data_.empty()) {
+        std::shared_lock buffer_lock(buffer_->buffer_mutex_);
+        if (buffer_->buffer_data_.empty() && buffer_->range_tombstones_.empty()) {
             return;
         }
         // data_to_flush = buffer_->buffer_data_;
         data_to_flush.reserve(buffer_->buffer_data_.size());
+        flushed_keys.reserve(buffer_->buffer_data_.size());
         for (const auto& pair : buffer_->buffer_data_) {
             data_to_flush.push_back(pair.second);
+            flushed_keys.push_back(pair.first);
         }
-        buffer_->buffer_data_.clear();
+        range_tombstones_to_flush = buffer_->range_tombstones_;
+        oldest_tombstone_time = buffer_->oldest_tombstone_time_;
+        has_tombstones = buffer_->tombstone_count_ > 0;
         buffer_was_empty = false;
     }
     // if buffer is empty, we don't flush
     if (buffer_was_empty) {
         return;
     }
+    ScopedLatency latency(metrics_, MetricOp::FLUSH);
+
+    // the buffer is newer than every table, so a key's oldest buffered versions, when they
+    // are tombstones, go if no table may hold the key; the buffer still drops them below
+    if (has_tombstones && ingests_in_flight_ == 0) {
+        std::vector<std::shared_ptr<SSTable>> older_tables = olderTables(*currentVersion(), 0);
+        std::vector<DataPair> kept_data;
+        kept_data.reserve(data_to_flush.size());
+        size_t tombstones_elided = 0;
+        for (size_t key_begin = 0; key_begin < data_to_flush.size();) {
+            size_t key_end = key_begin + 1;
+            while (key_end < data_to_flush.size() && data_to_flush[key_end].key_ == data_to_flush[key_begin].key_) {
+                key_end++;
+            }
+            size_t kept_end = key_end;
+            if (data_to_flush[key_end - 1].deleted_ &&
+                !tablesMayHoldKey(older_tables, data_to_flush[key_begin].key_)) {
+                while (kept_end > key_begin && data_to_flush[kept_end - 1].deleted_) {
+                    kept_end--;
+                }
+            }
+            tombstones_elided += key_end - kept_end;
+            kept_data.insert(kept_data.end(), data_to_flush.begin() + key_begin, data_to_flush.begin() + kept_end);
+            key_begin = key_end;
+        }
+        data_to_flush.swap(kept_data);
+        metrics_.add(MetricCounter::TOMBSTONES_ELIDED, tombstones_elided);
+    }
 
-    // generate new level 0 SSTable id and file path
-    uint64_t new_file_id = next_file_id_.fetch_add(1);
-    std::string new_file_path = getFilePath(0, new_file_id);
-    std::string bf_file_path = getBloomFilterPath(0, new_file_id);
+    // nothing left to write when every entry was an elided tombstone
     std::shared_ptr<SSTable> sstable_ptr = nullptr;
+    if (!data_to_flush.empty() || !range_tombstones_to_flush.empty()) {
+        // generate new level 0 SSTable id and file path
+        uint64_t new_file_id = next_file_id_.fetch_add(1);
+        std::string new_file_path = getFilePath(0, new_file_id);
+        std::string bf_file_path = getBloomFilterPath(0, new_file_id);
+
+        try {
+            // create the SSTable object and write to disk
+            sstable_ptr = std::make_shared<SSTable>(data_to_flush, 0, new_file_path, bf_file_path,
+                                                    oldest_tombstone_time, range_tombstones_to_flush,
+                                                    levelFalsePositiveRate(0));
+            // std::cout << "[LSMTree] flushed buffer to new SSTable file: " << new_file_path << std::endl;
+        } catch (const std::exception& e) {
+            std::cerr << "can't create/write SSTable during flush: " << e.what() << std::endl;
+            // If file creation failed revert file id
+            next_file_id_--;
+            // maybe throw error here? idk
+            return;
+        }
 
-    try {
-        // create the SSTable object and write to disk
-        sstable_ptr = std::make_shared<SSTable>(data_to_flush, 0, new_file_path, bf_file_path);
-        // std::cout << "[LSMTree] flushed buffer to new SSTable file: " << new_file_path << std::endl;
-    } catch (const std::exception& e) {
-        std::cerr << "can't create/write SSTable during flush: " << e.what() << std::endl;
-        // If file creation failed revert file id
-        next_file_id_--;
-        // maybe throw error here? idk
-        return;
+        // add the new SSTable pointer to level 0's list
+        VersionEdit flush_edit;
+        flush_edit.added_tables.push_back({0, sstable_ptr});
+        applyVersionEdit(flush_edit);
     }
 
-    // add the new SSTable pointer to level 0's list
-    levels_[0]->addSSTable(sstable_ptr);
+    // now drop exactly what we flushed, puts that arrived meanwhile stay
+    {
+        std::unique_lock buffer_lock(buffer_->buffer_mutex_);
+        for (const auto& flushed_key : flushed_keys) {
+            auto flushed_it = buffer_->buffer_data_.find(flushed_key);
+            if (flushed_it != buffer_->buffer_data_.end()) {
+                if (flushed_it->second.deleted_) {
+                    buffer_->tombstone_count_--;
+                }
+                buffer_->buffer_data_.erase(flushed_it);
+            }
+        }
+        // range tombstones are appended in seq order, so the flushed ones are those up to the last seq copied
+        auto& buffered_range_tombstones = buffer_->range_tombstones_;
+        if (!range_tombstones_to_flush.empty()) {
+            uint64_t last_flushed_seq = range_tombstones_to_flush.back().seq;
+            buffered_range_tombstones.erase(
+                std::remove_if(buffered_range_tombstones.begin(), buffered_range_tombstones.end(),
+                               [last_flushed_seq](const RangeTombstone& tombstone) {
+                                   return tombstone.seq <= last_flushed_seq;
+                               }),
+                buffered_range_tombstones.end());
+            buffer_->rebuildRangeTombstoneSet();
+        }
+        // tombstones put during the flush keep the older time, which only errs early
+        if (buffer_->tombstone_count_ == 0 && buffered_range_tombstones.empty()) {
+            buffer_->oldest_tombstone_time_ = 0;
+        }
+    }
+    flush_count_++;
+    if (sstable_ptr) {
+        metrics_.add(MetricCounter::FLUSH_BYTES_WRITTEN, sstable_ptr->data_bytes_);
+        metrics_.add(MetricCounter::FLUSH_ENTRIES_WRITTEN, sstable_ptr->size_);
+    }
+    // restored entries were all in the buffer when it was copied, level 0 has them now
+    if (memtable_dump_pending_.exchange(false)) {
+        std::error_code ec;
+        std::filesystem::remove(memtable_path_, ec);
+    }
 
     // trigger compaction check before adding to Level 0 in memory
     // this step is now done in the compaction thread
@@ -1512,28 +3030,127 @@ void LSMTree::doCompactionCheck(size_t level_index) {
         return;
     }
 
-    bool needs_compaction = levels_[level_index]->needsCompaction();
+    bool needs_compaction = levelNeedsCompaction(level_index);
 
     if (needs_compaction) {
-        // only compact if not last level
-        // check last level here instead of in compactLevel
-        if (level_index < levels_.size() - 1) {
-            {
-                std::lock_guard lock(compaction_mutex_);
-                compaction_tasks_.push(level_index);
+        // the last level only reports tombstones it can purge, merged in place
+        {
+            std::lock_guard lock(compaction_mutex_);
+            compaction_tasks_.push(level_index);
+        }
+        // notify the compaction thread to do the compaction
+        compaction_task_cv_.notify_one();
+    }
+}
+
+bool LSMTree::levelNeedsCompaction(size_t level_index) const {
+    const Level& level = *levels_[level_index];
+    // tiering stops at the last level, only its tombstones rewrite it
+    bool last_level = level_index + 1 >= levels_.size();
+    if (!last_level && level.needsCompaction()) {
+        return true;
+    }
+    bool tombstone_trigger = false;
+    {
+        std::shared_lock lock(level.level_mutex_);
+        // a range tombstone counts as one delete, however many keys it covers
+        size_t tombstones = level.cur_tombstones_ + level.cur_range_tombstones_;
+        if (tombstones == 0) {
+            return false;
+        }
+        // at least a buffer's worth, so a few deletes don't rewrite a level
+        if (tombstone_density_threshold_ > 0 && tombstones >= buffer_capacity_ &&
+            tombstones >= tombstone_density_threshold_ * (level.cur_total_entries_ + level.cur_range_tombstones_)) {
+            tombstone_trigger = true;
+        } else if (delete_persistence_ms_ > 0 && level.oldest_tombstone_time_ != 0) {
+            uint64_t now = wallClockMillis();
+            tombstone_trigger = now > level.oldest_tombstone_time_ &&
+                                now - level.oldest_tombstone_time_ >= tombstoneTtl(level_index);
+        }
+    }
+    if (!tombstone_trigger || !last_level) {
+        return tombstone_trigger;
+    }
+    return !lastLevelPurgeInputs(level.getSSTables()).empty();
+}
+
+std::vector<std::shared_ptr<SSTable>> LSMTree::lastLevelPurgeInputs(
+    const std::vector<std::shared_ptr<SSTable>>& tables) const {
+    // an ingest may still install older data under them
+    if (ingests_in_flight_ != 0) {
+        return {};
+    }
+    // a snapshot below a table's newest seq may read versions its tombstones hide
+    std::vector<uint64_t> snapshots = buffer_->liveSnapshots();
+    std::vector<bool> taken(tables.size(), false);
+    std::vector<size_t> inputs;
+    for (size_t i = 0; i < tables.size(); ++i) {
+        bool has_tombstones = tables[i]->tombstone_count_ > 0 || !tables[i]->range_tombstones_.empty();
+        if (has_tombstones && (snapshots.empty() || snapshots.front() >= tables[i]->max_seq_)) {
+            taken[i] = true;
+            inputs.push_back(i);
+        }
+    }
+    std::vector<std::pair<int, int>> spans(tables.size());
+    for (size_t i = 0; i < tables.size(); ++i) {
+        spans[i] = tables[i]->coveredKeyRange();
+    }
+    // tables sharing keys with an input are merged too, their order in the level is lost
+    for (size_t next = 0; next < inputs.size(); ++next) {
+        const std::pair<int, int>& input_span = spans[inputs[next]];
+        for (size_t i = 0; i < tables.size(); ++i) {
+            if (!taken[i] && spans[i].first <= input_span.second && spans[i].second >= input_span.first) {
+                taken[i] = true;
+                inputs.push_back(i);
+            }
+        }
+    }
+    // keep the level's order, newest last
+    std::vector<std::shared_ptr<SSTable>> ordered;
+    for (size_t i = 0; i < tables.size(); ++i) {
+        if (taken[i]) {
+            ordered.push_back(tables[i]);
+        }
+    }
+    return ordered;
+}
+
+// levels 0..n-1 sit above the last level; with size ratio T level i gets
+// D * T^i * (T - 1) / (T^n - 1), so the shares sum to D and bigger levels wait longer
+uint64_t LSMTree::tombstoneTtl(size_t level_index) const {
+    if (level_index + 1 >= levels_.size()) {
+        return delete_persistence_ms_;
+    }
+    size_t levels_above_last = levels_.size() > 1 ? levels_.size() - 1 : 1;
+    double ratio = static_cast<double>(level_size_ratio_);
+    double share = ratio <= 1.0
+        ? 1.0 / levels_above_last
+        : std::pow(ratio, level_index) * (ratio - 1) / (std::pow(ratio, levels_above_last) - 1);
+    return static_cast<uint64_t>(delete_persistence_ms_ * share);
+}
+
+std::vector<std::shared_ptr<SSTable>> LSMTree::olderTables(const Version& version, size_t from_level,
+                                                           const std::vector<std::shared_ptr<SSTable>>& exclude) const {
+    std::vector<std::shared_ptr<SSTable>> tables;
+    for (size_t level_index = from_level; level_index < version.levels.size(); ++level_index) {
+        for (const auto& table : version.levels[level_index]) {
+            if (std::find(exclude.begin(), exclude.end(), table) == exclude.end()) {
+                tables.push_back(table);
             }
-            // notify the compaction thread to do the compaction
-            compaction_task_cv_.notify_one();
         }
     }
+    return tables;
 }
 
 // compact the given level that needs compaction
 void LSMTree::compactLevelHelper(size_t level_index) {
-    if (!levels_[level_index]->needsCompaction()) {
+    std::lock_guard<std::mutex> install_lock(level_install_mutex_);
+    if (!levelNeedsCompaction(level_index)) {
         return;
     }
-    size_t next_level_index = level_index + 1;
+    // the last level is merged in place, to purge its tombstones
+    bool last_level = level_index + 1 >= levels_.size();
+    size_t next_level_index = last_level ? level_index : level_index + 1;
     std::vector<std::shared_ptr<SSTable>> input_tables_level;
     std::vector<std::shared_ptr<SSTable>> input_tables_level_next;
 
@@ -1542,20 +3159,23 @@ void LSMTree::compactLevelHelper(size_t level_index) {
     {
         input_tables_level = levels_[level_index]->getSSTables();
     }
+    if (last_level) {
+        input_tables_level = lastLevelPurgeInputs(input_tables_level);
+    }
     if (input_tables_level.empty()) {
         std::cerr << "[LSMTree Compaction ERROR] No tables in current level " << level_index << " to compact." << std::endl;
         return;
     }
 
+    ScopedLatency latency(metrics_, MetricOp::COMPACTION);
     // Perform merge logic - mergeSSTables now takes an empty input_tables_level_next
     std::vector<std::shared_ptr<SSTable>> output_tables;
     try {
         for (auto& table : input_tables_level) {
-            if (!table->data_loaded_) {
-                if (!table->loadFromDisk()) {
-                    std::cerr << "Error loading input table " << table->file_path_ << " for merge." << std::endl;
-                    throw std::runtime_error("Failed to load input SSTable for merge");
-                }
+            // readers may be loading the same table, the load goes through its mutex
+            if (!table->ensureLoaded()) {
+                std::cerr << "Error loading input table " << table->file_path_ << " for merge." << std::endl;
+                throw std::runtime_error("Failed to load input SSTable for merge");
             }
         }
         // mergeSSTables doesn't lock levels_ since it copies the data when merging them
@@ -1572,35 +3192,39 @@ void LSMTree::compactLevelHelper(size_t level_index) {
         return;
     }
 
-    // 3. atomic replace in memory: protected by compaction_mutex_
-    // removeAllSSTables locks level_mutex_
-    // exclusive locks on levels motified
-    levels_[level_index]->removeAllSSTables(input_tables_level);
-
+    // 3. atomic replace in memory: inputs out and outputs in as one
+    // VersionEdit, a reader pins either the old Version or the new one
+    VersionEdit compaction_edit;
+    for (const auto& table : input_tables_level) {
+        compaction_edit.removed_tables.push_back({level_index, table});
+    }
     for (const auto& table : output_tables) {
-        levels_[next_level_index]->addSSTable(table);
+        compaction_edit.added_tables.push_back({next_level_index, table});
     }
+    applyVersionEdit(compaction_edit);
+    compaction_count_++;
+    recordCompaction(level_index, input_tables_level, output_tables);
 
     // TODO: updateHistory
 
-    // delete the old SSTable files that were merged from the current level
+    // retire the merged tables, files go once the last Version drops them
     for (const auto& table : input_tables_level) {
         deleteSSTableFile(table);
     }
 
     // after compacted this level, compact the next if needed
-    doCompactionCheck(next_level_index);
+    if (!last_level) {
+        doCompactionCheck(next_level_index);
+    }
 }
 
 // Strictly for testing purposes
 bool SSTable::keyInSSTable(int key) {
     if (!keyInRange(key)) { return false; }
 
-    if (!data_loaded_) {
-        if (!loadFromDisk()) {
+    if (!ensureLoaded()) {
         std::cerr << "can't load SSTable " << file_path_ << std::endl;
-            return false;
-        }
+        return false;
     }
     // Perform binary search
     // TODO: use fence pointers
@@ -1609,130 +3233,721 @@ bool SSTable::keyInSSTable(int key) {
 }
 
 // print stats commands
-// map is unique key:value pairs
-// In lsm_tree.cpp
+// O(levels): counters kept by the write, flush and compaction paths, no table is read
 std::string LSMTree::print_stats() {
-    // latest version and source for each key
-    std::map<int, std::pair<DataPair, std::string>> logical_data_map;
-
-    // buffer data collection
+    HyperLogLog all_keys;
+    size_t buffer_entries = 0;
+    size_t buffer_tombstones = 0;
     {
+        // bounded by the buffer capacity
         std::shared_lock lock(buffer_->buffer_mutex_);
-        // for (const auto& dp : buffer_->buffer_data_) {
-        //     logical_data_map.insert_or_assign(dp.key_, std::make_pair(dp, "BUF"));
+        buffer_entries = buffer_->buffer_data_.size();
+        buffer_tombstones = buffer_->tombstone_count_;
         for (const auto& entry : buffer_->buffer_data_) {
-            logical_data_map.insert_or_assign(entry.first, std::make_pair(entry.second, "BUF"));
+            all_keys.add(entry.first.key);
         }
     }
 
-    // level data collection
+    std::stringstream levels_ss;
+    size_t total_tombstones = buffer_tombstones;
+    uint64_t now_ms = wallClockMillis();
     for (size_t i = 0; i < levels_.size(); ++i) {
-        const auto& level_ptr = levels_[i];
-        std::string current_level_label = "L" + std::to_string(i + 1);
+        std::shared_lock lock(levels_[i]->level_mutex_);
+        if (levels_[i]->cur_table_count_ == 0) {
+            continue;
+        }
+        all_keys.merge(levels_[i]->key_sketch_);
+        total_tombstones += levels_[i]->cur_tombstones_;
+        levels_ss << "\nL" << (i + 1) << ": tables " << levels_[i]->cur_table_count_
+                  << ", entries " << levels_[i]->cur_total_entries_
+                  << ", tombstones " << levels_[i]->cur_tombstones_;
+        if (levels_[i]->cur_range_tombstones_ != 0) {
+            levels_ss << ", range tombstones " << levels_[i]->cur_range_tombstones_;
+        }
+        levels_ss << ", bytes " << levels_[i]->cur_bytes_;
+        uint64_t oldest_tombstone_time = levels_[i]->oldest_tombstone_time_;
+        if (oldest_tombstone_time != 0 && now_ms >= oldest_tombstone_time) {
+            levels_ss << ", oldest tombstone " << (now_ms - oldest_tombstone_time) << " ms";
+        }
+    }
 
-        std::vector<std::shared_ptr<SSTable>> sstables_from_level;
-        {
-            std::shared_lock lock(level_ptr->level_mutex_);
-            sstables_from_level = level_ptr->sstables_;
-        }
-        std::reverse(sstables_from_level.begin(), sstables_from_level.end());
-
-        for (const auto& sstable_ptr : sstables_from_level) {
-            std::vector<DataPair> sstable_data_content;
-            {
-                std::lock_guard<std::mutex> sstable_lock(sstable_ptr->sstable_mutex_);
-                if (!sstable_ptr->data_loaded_) {
-                    if (!sstable_ptr->loadFromDisk()) {
-                        std::cerr << "[STATS_ERROR] Failed to load SSTable " << sstable_ptr->file_path_
-                                  << " for stats." << std::endl;
-                        continue;
-                    }
+    // distinct keys minus tombstones; an estimate, a key deleted twice is subtracted twice
+    double distinct_keys = all_keys.estimate();
+    long long logical_pairs = std::max(0LL, std::llround(distinct_keys) - static_cast<long long>(total_tombstones));
+
+    std::stringstream result_ss;
+    result_ss << "Logical Pairs (estimated): " << logical_pairs;
+    result_ss << "\nBUF: entries " << buffer_entries << ", tombstones " << buffer_tombstones;
+    result_ss << levels_ss.str();
+    result_ss << "\nWrites: puts " << puts_count_.load()
+              << ", deletes " << deletes_count_.load()
+              << ", flushes " << flush_count_.load()
+              << ", compactions " << compaction_count_.load();
+
+    MetricsSnapshot metrics = metrics_.snapshot();
+    result_ss << std::fixed << std::setprecision(2)
+              << "\nIO: user bytes " << metrics.counter(MetricCounter::USER_BYTES_WRITTEN)
+              << ", flushed " << metrics.counter(MetricCounter::FLUSH_BYTES_WRITTEN)
+              << ", compaction read " << metrics.counter(MetricCounter::COMPACTION_BYTES_READ)
+              << ", compaction written " << metrics.counter(MetricCounter::COMPACTION_BYTES_WRITTEN)
+              << ", write amp " << metrics.writeAmplification();
+    std::vector<CompactionStats> compactions = recentCompactions();
+    if (!compactions.empty()) {
+        const CompactionStats& last = compactions.back();
+        result_ss << "\nLast compaction: L" << (last.source_level + 1) << " -> L" << (last.source_level + 2)
+                  << ", tables " << last.input_tables << " -> " << last.output_tables
+                  << ", entries " << last.input_entries << " -> " << last.output_entries
+                  << ", bytes read " << last.bytes_read << ", written " << last.bytes_written;
+    }
+    return result_ss.str();
+}
+
+MetricsSnapshot LSMTree::getMetrics() const {
+    return metrics_.snapshot();
+}
+
+void LSMTree::recordQueryStats(const QueryStats& stats) {
+    if (stats.tables_probed == 0) {
+        return;
+    }
+    metrics_.add(MetricCounter::TABLES_PROBED, stats.tables_probed);
+    metrics_.add(MetricCounter::BLOOM_PROBES, stats.bloom_checks);
+    metrics_.add(MetricCounter::BLOOM_NEGATIVES, stats.bloom_checks - stats.bloom_passes);
+    metrics_.add(MetricCounter::BLOOM_FALSE_POSITIVES, stats.bloom_false_positives);
+    metrics_.add(MetricCounter::BLOCKS_READ, stats.blocks_read);
+    metrics_.add(MetricCounter::BYTES_READ, stats.bytes_read);
+}
+
+void LSMTree::recordCompaction(size_t level_index, const std::vector<std::shared_ptr<SSTable>>& inputs,
+                               const std::vector<std::shared_ptr<SSTable>>& outputs) {
+    CompactionStats compaction;
+    compaction.source_level = level_index;
+    compaction.input_tables = inputs.size();
+    compaction.output_tables = outputs.size();
+    for (const auto& table : inputs) {
+        compaction.input_entries += table->size_;
+        compaction.bytes_read += table->data_bytes_;
+    }
+    for (const auto& table : outputs) {
+        compaction.output_entries += table->size_;
+        compaction.bytes_written += table->data_bytes_;
+    }
+    metrics_.add(MetricCounter::COMPACTION_BYTES_READ, compaction.bytes_read);
+    metrics_.add(MetricCounter::COMPACTION_BYTES_WRITTEN, compaction.bytes_written);
+    metrics_.add(MetricCounter::COMPACTION_ENTRIES_IN, compaction.input_entries);
+    metrics_.add(MetricCounter::COMPACTION_ENTRIES_OUT, compaction.output_entries);
+
+    std::lock_guard<std::mutex> lock(recent_compactions_mutex_);
+    recent_compactions_.push_back(compaction);
+    if (recent_compactions_.size() > COMPACTION_STATS_HISTORY) {
+        recent_compactions_.pop_front();
+    }
+}
+
+std::vector<CompactionStats> LSMTree::recentCompactions() const {
+    std::lock_guard<std::mutex> lock(recent_compactions_mutex_);
+    return std::vector<CompactionStats>(recent_compactions_.begin(), recent_compactions_.end());
+}
+
+/**
+ * workload-driven tuning
+ */
+
+TuningConfig LSMTree::tuningConfig() const {
+    TuningConfig config;
+    config.buffer_capacity = buffer_capacity_;
+    config.base_level_table_capacity = base_level_table_capacity_;
+    config.level_size_ratio = level_size_ratio_;
+    std::lock_guard<std::mutex> lock(tuning_mutex_);
+    config.bloom_bits_per_entry = bloom_bits_per_entry_;
+    return config;
+}
+
+void LSMTree::applyTuning(const TuningConfig& config) {
+    size_t buffer_capacity = std::max<size_t>(config.buffer_capacity, 1);
+    size_t base_level_table_capacity = std::max<size_t>(config.base_level_table_capacity, 1);
+    size_t level_size_ratio = std::max<size_t>(config.level_size_ratio, 1);
+    {
+        // Monkey's rates follow from the config and the tree's size, whatever the workload
+        std::vector<double> level_fp_rates =
+            CostModel(WorkloadStats(), config, diskEntries(), levels_.size()).levelFalsePositiveRates(config);
+        std::lock_guard<std::mutex> lock(tuning_mutex_);
+        bloom_bits_per_entry_ = config.bloom_bits_per_entry;
+        level_fp_rates_ = std::move(level_fp_rates);
+    }
+    buffer_capacity_ = buffer_capacity;
+    buffer_->capacity_ = buffer_capacity;
+    base_level_table_capacity_ = base_level_table_capacity;
+    level_size_ratio_ = level_size_ratio;
+    size_t cur_level_capacity = base_level_table_capacity;
+    for (auto& level_ptr : levels_) {
+        level_ptr->table_capacity_ = cur_level_capacity;
+        cur_level_capacity *= level_size_ratio;
+    }
+    std::cout << "[LSMTree] Tuned to " << config.toText() << std::endl;
+
+    // a smaller buffer can be full already, and smaller levels over capacity
+    if (buffer_->isFull()) {
+        std::lock_guard lock(this->flush_mutex_);
+        this->flush_needed_ = true;
+        flush_request_cv_.notify_one();
+    }
+    for (size_t i = 0; i + 1 < levels_.size(); ++i) {
+        doCompactionCheck(i);
+    }
+}
+
+TuningAdvice LSMTree::tune(bool apply) {
+    WorkloadStats workload = WorkloadStats::fromMetrics(metrics_.snapshot());
+    WorkloadStats baseline;
+    {
+        std::lock_guard<std::mutex> lock(tuning_mutex_);
+        baseline = tuning_baseline_;
+    }
+    TuningAdvice advice = adviseTuning(workload.since(baseline), tuningConfig(), diskEntries(), levels_.size());
+    if (apply) {
+        // applied even when the targets stay, so the filters move to Monkey's rates
+        applyTuning(advice.recommended);
+        std::lock_guard<std::mutex> lock(tuning_mutex_);
+        tuning_baseline_ = workload;
+        advice.applied = true;
+    }
+    return advice;
+}
+
+double LSMTree::levelFalsePositiveRate(size_t level_index) const {
+    std::lock_guard<std::mutex> lock(tuning_mutex_);
+    if (level_fp_rates_.empty()) {
+        return DEFAULT_FALSE_POSITIVE_RATE;
+    }
+    return level_fp_rates_[std::min(level_index, level_fp_rates_.size() - 1)];
+}
+
+size_t LSMTree::diskEntries() const {
+    size_t entries = 0;
+    for (const auto& level_ptr : levels_) {
+        std::shared_lock lock(level_ptr->level_mutex_);
+        entries += level_ptr->cur_total_entries_;
+    }
+    return entries;
+}
+
+// the full dump, as of one snapshot: "Logical Pairs: N", the per-source counts, then one
+// line per source of key:value:source pairs; one merge pass counts, one pass per source prints
+bool LSMTree::dumpAll(const std::function<bool(const std::string&)>& emit_chunk, size_t chunk_bytes) {
+    std::shared_ptr<Snapshot> snapshot = getSnapshot();
+    auto source_label = [](int level) {
+        return level < 0 ? std::string("BUF") : "L" + std::to_string(level + 1);
+    };
+    // every pass re-seeks one iterator over the same runs, so a compaction in between can't
+    // move keys across sections and the buffer is copied once for the whole dump
+    std::shared_ptr<const RangeTombstoneSet> buffer_range_tombstones = buffer_->rangeTombstoneSet();
+    std::shared_ptr<const Version> version;
+    std::vector<RunIterator> runs = collectRuns(INT_MIN, INT_MAX, &version);
+    RangeTombstoneView range_tombstones = collectRangeTombstones(buffer_range_tombstones, *version, snapshot->seq_);
+    LSMIterator it(std::move(runs), version, INT_MAX, 0, snapshot->seq_, range_tombstones, merge_operator_);
+
+    // pass 1: counts per source, index 0 is the buffer
+    std::vector<size_t> source_counts(levels_.size() + 1, 0);
+    size_t total_logical_pairs = 0;
+    for (it.seek(INT_MIN); it.valid(); it.next()) {
+        source_counts[it.currentLevel() + 1]++;
+        total_logical_pairs++;
+    }
+
+    std::string chunk = "Logical Pairs: " + std::to_string(total_logical_pairs);
+    std::string counts_line;
+    for (size_t source = 0; source < source_counts.size(); ++source) {
+        if (source_counts[source] == 0) {
+            continue;
+        }
+        if (!counts_line.empty()) {
+            counts_line += ", ";
+        }
+        counts_line += source_label(static_cast<int>(source) - 1) + ": " + std::to_string(source_counts[source]);
+    }
+    if (!counts_line.empty()) {
+        chunk += "\n" + counts_line;
+    }
+
+    // one pass per source; beyond the pinned runs only the current chunk of output is held,
+    // the dump is never built whole
+    for (size_t source = 0; source < source_counts.size(); ++source) {
+        if (source_counts[source] == 0) {
+            continue;
+        }
+        int level = static_cast<int>(source) - 1;
+        std::string label = source_label(level);
+        bool first_in_section = true;
+        chunk += "\n";
+        for (it.seek(INT_MIN); it.valid(); it.next()) {
+            if (it.currentLevel() != level) {
+                continue;
+            }
+            if (!first_in_section) {
+                chunk += " ";
+            }
+            chunk += std::to_string(it.key()) + ":" + std::to_string(it.value()) + ":" + label;
+            first_in_section = false;
+            if (chunk.size() >= chunk_bytes) {
+                if (!emit_chunk(chunk)) {
+                    return false;
                 }
-                sstable_data_content = sstable_ptr->table_data_;
+                chunk.clear();
             }
+        }
+    }
+    return emit_chunk(chunk);
+}
+
+/**
+ * bulk ingestion
+ */
 
-            for (const auto& dp : sstable_data_content) {
-                if (logical_data_map.find(dp.key_) == logical_data_map.end()) {
-                    logical_data_map.insert_or_assign(dp.key_, std::make_pair(dp, current_level_label));
+// marks an ingest from reserving its seq to installing its tables, see ingests_in_flight_;
+// the seq is reserved in the buffer, which holds back puts to key_ranges meanwhile
+struct IngestInFlight {
+    std::atomic<size_t>& count;
+    Buffer& buffer;
+    std::vector<std::pair<int, int>> key_ranges;
+    uint64_t seq = 0;
+    // the buffer held a key in the ranges when the seq was reserved
+    bool buffer_overlaps = false;
+    IngestInFlight(std::atomic<size_t>& ingests_in_flight, Buffer& ingest_buffer,
+                   std::vector<std::pair<int, int>> ranges)
+        : count(ingests_in_flight), buffer(ingest_buffer), key_ranges(std::move(ranges)) {
+        count++;
+        seq = buffer.beginIngest(key_ranges, &buffer_overlaps);
+    }
+    ~IngestInFlight() {
+        buffer.endIngest(key_ranges);
+        count--;
+    }
+};
+
+// one sorted, deduplicated run of a bulk load, in memory or spilled to disk
+struct BulkLoadRun {
+    std::vector<std::pair<int, int>> block;
+    size_t pos = 0;
+    int min_key = 0;
+    int max_key = 0;
+    std::string spill_path;
+    std::ifstream spill;
+
+    // pairs read back per refill from a spilled run
+    static const size_t READ_BLOCK_PAIRS = 1 << 16;
+
+    bool valid() {
+        if (pos < block.size()) {
+            return true;
+        }
+        if (!spill.is_open()) {
+            return false;
+        }
+        block.resize(READ_BLOCK_PAIRS);
+        spill.read(reinterpret_cast<char*>(block.data()), READ_BLOCK_PAIRS * sizeof(std::pair<int, int>));
+        block.resize(spill.gcount() / sizeof(std::pair<int, int>));
+        pos = 0;
+        return !block.empty();
+    }
+};
+
+bool LSMTree::bulkLoad(const std::string& file_path, size_t* pairs_loaded) {
+    if (pairs_loaded) {
+        *pairs_loaded = 0;
+    }
+    int fd = open(file_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "[LSMTree::bulkLoad] can't open " << file_path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size % (2 * sizeof(int32_t)) != 0) {
+        std::cerr << "[LSMTree::bulkLoad] " << file_path << " is not a whole number of key,value pairs" << std::endl;
+        close(fd);
+        return false;
+    }
+    size_t total_pairs = file_stat.st_size / (2 * sizeof(int32_t));
+    if (total_pairs == 0) {
+        close(fd);
+        return true;
+    }
+    void* mapped = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "[LSMTree::bulkLoad] mmap failed for " << file_path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    madvise(mapped, file_stat.st_size, MADV_SEQUENTIAL);
+    const int32_t* input = static_cast<const int32_t*>(mapped);
+
+    // 1. sort chunks in parallel, the pool bounds how many are in memory at once
+    // inside a chunk stable_sort keeps file order, so the last pair of a key wins
+    size_t chunk_pairs = std::max<size_t>(1, bulk_load_chunk_pairs_);
+    size_t num_chunks = (total_pairs + chunk_pairs - 1) / chunk_pairs;
+    bool spill_runs = num_chunks > 1;
+    std::vector<BulkLoadRun> runs(num_chunks);
+    std::vector<std::future<bool>> sort_futures;
+    sort_futures.reserve(num_chunks);
+
+    for (size_t chunk = 0; chunk < num_chunks; ++chunk) {
+        sort_futures.push_back(range_pool_->submit([&, chunk]() {
+            size_t begin = chunk * chunk_pairs;
+            size_t end = std::min(total_pairs, begin + chunk_pairs);
+            std::vector<std::pair<int, int>> sorted;
+            sorted.reserve(end - begin);
+            for (size_t i = begin; i < end; ++i) {
+                sorted.emplace_back(input[2 * i], input[2 * i + 1]);
+            }
+            std::stable_sort(sorted.begin(), sorted.end(),
+                             [](const std::pair<int, int>& a, const std::pair<int, int>& b) {
+                                 return a.first < b.first;
+                             });
+            size_t unique_count = 0;
+            for (size_t i = 0; i < sorted.size(); ++i) {
+                if (unique_count > 0 && sorted[unique_count - 1].first == sorted[i].first) {
+                    sorted[unique_count - 1] = sorted[i];
+                } else {
+                    sorted[unique_count++] = sorted[i];
                 }
             }
+            sorted.resize(unique_count);
+            runs[chunk].min_key = sorted.front().first;
+            runs[chunk].max_key = sorted.back().first;
+
+            if (!spill_runs) {
+                runs[chunk].block = std::move(sorted);
+                return true;
+            }
+            // larger than one chunk: external merge, spill the sorted run to disk
+            runs[chunk].spill_path = db_path_ + "/bulk_load_" + std::to_string(next_file_id_.fetch_add(1)) + ".run";
+            std::ofstream spill_out(runs[chunk].spill_path, std::ios::binary);
+            spill_out.write(reinterpret_cast<const char*>(sorted.data()), sorted.size() * sizeof(std::pair<int, int>));
+            return spill_out.good();
+        }));
+    }
+    bool sort_ok = true;
+    for (auto& sort_future : sort_futures) {
+        sort_ok = sort_future.get() && sort_ok;
+    }
+    munmap(mapped, file_stat.st_size);
+
+    auto remove_spills = [&runs]() {
+        for (auto& run : runs) {
+            if (!run.spill_path.empty()) {
+                run.spill.close();
+                std::error_code ec;
+                std::filesystem::remove(run.spill_path, ec);
+            }
         }
+    };
+    if (!sort_ok) {
+        std::cerr << "[LSMTree::bulkLoad] failed to write sorted runs for " << file_path << std::endl;
+        remove_spills();
+        return false;
     }
+    int min_key = std::numeric_limits<int>::max();
+    int max_key = std::numeric_limits<int>::min();
+    for (auto& run : runs) {
+        if (!run.spill_path.empty()) {
+            run.spill.open(run.spill_path, std::ios::binary);
+        }
+        min_key = std::min(min_key, run.min_key);
+        max_key = std::max(max_key, run.max_key);
+    }
+
+    // 2. k-way merge into tables at the ingest level; for equal keys the later run wins
+    // entries are written with seq 0, the batch seq is only taken at install (step 3), so
+    // puts into the range are not held back while the tables are written
+    // the level is picked again under level_install_mutex_, compactions run meanwhile
+    size_t target_level = ingestLevel(*currentVersion(), min_key, max_key);
 
-    // calculate total logical pairs (non-deleted)
-    int total_logical_pairs = 0;
-    // group data by source for printing KVL lines later AND for counts
-    std::map<std::string, std::vector<DataPair>> data_grouped_by_source;
-    // entry.first is key, entry.second is pair<DataPair, string_label>
-    for (const auto& entry : logical_data_map) {
-        if (!entry.second.first.deleted_) {
-            total_logical_pairs++;
-            data_grouped_by_source[entry.second.second].push_back(entry.second.first);
+    using HeapEntry = std::pair<int, size_t>;
+    auto heap_order = [](const HeapEntry& a, const HeapEntry& b) {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+    };
+    std::priority_queue<HeapEntry, std::vector<HeapEntry>, decltype(heap_order)> merge_heap(heap_order);
+    for (size_t i = 0; i < runs.size(); ++i) {
+        if (runs[i].valid()) {
+            merge_heap.push({runs[i].block[runs[i].pos].first, i});
         }
     }
 
-    // construct the output string
-    std::stringstream result_ss;
+    VersionEdit ingest_edit;
+    std::vector<DataPair> table_data;
+    size_t ingested = 0;
+    auto emit_table = [&]() {
+        uint64_t new_file_id = next_file_id_++;
+        auto table = std::make_shared<SSTable>(table_data, target_level,
+                                               getFilePath(target_level, new_file_id),
+                                               getBloomFilterPath(target_level, new_file_id), 0, std::vector<RangeTombstone>(),
+                                               levelFalsePositiveRate(target_level));
+        // on disk now, lazily reloaded on first read
+        table->table_data_ = std::vector<DataPair>();
+        table->data_loaded_ = false;
+        ingest_edit.added_tables.push_back({target_level, table});
+        table_data.clear();
+    };
 
-    // logical pairs: first line
-    result_ss << "Logical Pairs: " << total_logical_pairs;
+    try {
+        bool have_last_key = false;
+        int last_key = 0;
+        while (!merge_heap.empty()) {
+            size_t run_index = merge_heap.top().second;
+            merge_heap.pop();
+            BulkLoadRun& run = runs[run_index];
+            std::pair<int, int> pair = run.block[run.pos++];
+            if (run.valid()) {
+                merge_heap.push({run.block[run.pos].first, run_index});
+            }
+            if (have_last_key && pair.first == last_key) {
+                continue;
+            }
+            have_last_key = true;
+            last_key = pair.first;
+            table_data.emplace_back(pair.first, pair.second, false, 0);
+            ingested++;
+            if (table_data.size() >= MAX_TABLE_SIZE) {
+                emit_table();
+            }
+        }
+        if (!table_data.empty()) {
+            emit_table();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "[LSMTree::bulkLoad] failed to write SSTables for " << file_path << ": " << e.what() << std::endl;
+        for (const auto& added : ingest_edit.added_tables) {
+            deleteSSTableFile(added.second);
+        }
+        remove_spills();
+        return false;
+    }
+    remove_spills();
 
-    // counts for all sources on one line
-    std::stringstream counts_line_ss;
-    bool first_count_on_line = true;
+    // 3. the batch must override everything written before it: it takes a seq newer than
+    // every buffered key in its range, which go to L0 first, and puts into the range wait
+    // only from here until the tables are installed
+    IngestInFlight in_flight(ingests_in_flight_, *buffer_, {{min_key, max_key}});
+    uint64_t batch_seq = in_flight.seq;
+    if (in_flight.buffer_overlaps) {
+        flushBufferHelper();
+    }
 
-    // Buffer count
-    std::string buf_label = "BUF";
-    if (data_grouped_by_source.count(buf_label) && !data_grouped_by_source[buf_label].empty()) {
-        counts_line_ss << buf_label << ": " << data_grouped_by_source[buf_label].size();
-        first_count_on_line = false;
+    // 4. install all tables at once, newest in their level; a compaction since the level
+    // was picked may have moved the overlapping data, then the tables follow it
+    // every entry reads as batch_seq through the .meta, as an ingested file's do; it is
+    // written before the move, so the data is never found at its level without it
+    // the tables always move to fresh ids: a reopen orders a level by id, and a table
+    // flushed while they were written must stay below them
+    {
+        std::lock_guard<std::mutex> install_lock(level_install_mutex_);
+        size_t install_level = ingestLevel(*currentVersion(), min_key, max_key);
+        bool install_ok = true;
+        for (auto& added : ingest_edit.added_tables) {
+            added.second->global_seq_ = batch_seq;
+            added.second->max_seq_ = batch_seq;
+            install_ok = install_ok && added.second->writeMeta() && moveTableToLevel(*added.second, install_level);
+            added.first = install_level;
+        }
+        if (!install_ok) {
+            std::cerr << "[LSMTree::bulkLoad] failed to install SSTables at level " << install_level << std::endl;
+            for (const auto& added : ingest_edit.added_tables) {
+                deleteSSTableFile(added.second);
+            }
+            return false;
+        }
+        applyVersionEdit(ingest_edit);
+        target_level = install_level;
+    }
+    if (pairs_loaded) {
+        *pairs_loaded = ingested;
     }
+    doCompactionCheck(target_level);
+    return true;
+}
 
-    // level counts
-    for (size_t i = 0; i < levels_.size(); ++i) {
-        std::string level_label = "L" + std::to_string(i + 1);
-        if (data_grouped_by_source.count(level_label) && !data_grouped_by_source[level_label].empty()) {
-            if (!first_count_on_line) {
-                counts_line_ss << ", ";
+// rename, or copy and remove when the source is on another filesystem
+bool moveIngestedFile(const std::string& from, const std::string& to) {
+    std::error_code ec;
+    std::filesystem::rename(from, to, ec);
+    if (ec == std::errc::cross_device_link) {
+        ec.clear();
+        std::filesystem::copy_file(from, to, ec);
+        if (!ec) {
+            std::filesystem::remove(from, ec);
+        }
+    }
+    if (ec) {
+        std::cerr << "[LSMTree::ingestFiles] can't move " << from << " to " << to << ": " << ec.message() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool LSMTree::moveTableToLevel(SSTable& table, size_t level) {
+    uint64_t new_file_id = next_file_id_++;
+    std::string new_file_path = getFilePath(level, new_file_id);
+    std::string new_bf_file_path = getBloomFilterPath(level, new_file_id);
+    // the .meta first: data found without it is read in full, never stamped with seq 0
+    if (std::filesystem::exists(table.file_path_ + ".meta") &&
+        !moveIngestedFile(table.file_path_ + ".meta", new_file_path + ".meta")) {
+        return false;
+    }
+    if (std::filesystem::exists(table.bf_file_path_) && !moveIngestedFile(table.bf_file_path_, new_bf_file_path)) {
+        return false;
+    }
+    if (!moveIngestedFile(table.file_path_, new_file_path)) {
+        return false;
+    }
+    table.level_num_ = level;
+    table.file_path_ = new_file_path;
+    table.bf_file_path_ = new_bf_file_path;
+    return true;
+}
+
+bool LSMTree::ingestFiles(const std::vector<std::string>& file_paths, bool verify_keys) {
+    // 1. validate every file before touching the tree; a current .meta and .bf give the
+    // size and key range, the data is only read without them or when asked to verify
+    std::vector<std::shared_ptr<SSTable>> tables;
+    for (const auto& file_path : file_paths) {
+        auto table = std::make_shared<SSTable>(0, file_path, file_path + ".bf");
+        std::error_code size_ec;
+        uintmax_t file_bytes = std::filesystem::file_size(file_path, size_ec);
+        bool read_data = verify_keys || !table->meta_loaded_ || table->bloom_filter_.num_bits_ == 0;
+        if (!read_data) {
+            // a .meta left from another version of the data doesn't describe it
+            if (size_ec || file_bytes != table->data_bytes_ || (table->size_ > 0 && table->min_key_ > table->max_key_)) {
+                std::cerr << "[LSMTree::ingestFiles] " << file_path << " is missing or doesn't match its .meta" << std::endl;
+                return false;
+            }
+        } else if (!table->ensureLoaded()) {
+            std::cerr << "[LSMTree::ingestFiles] " << file_path << " is missing or malformed" << std::endl;
+            return false;
+        }
+        // a file of range tombstones alone is a valid delete batch
+        if (table->size_ == 0 && table->range_tombstones_.empty()) {
+            std::cerr << "[LSMTree::ingestFiles] " << file_path << " is empty" << std::endl;
+            return false;
+        }
+        for (size_t i = 1; i < table->table_data_.size(); ++i) {
+            if (table->table_data_[i].key_ <= table->table_data_[i - 1].key_) {
+                std::cerr << "[LSMTree::ingestFiles] keys in " << file_path << " are not strictly ascending" << std::endl;
+                return false;
             }
-            counts_line_ss << level_label << ": " << data_grouped_by_source[level_label].size();
-            first_count_on_line = false;
         }
+        tables.push_back(table);
+    }
+    // range tombstones count toward a file's keys: they must land above what they cover
+    std::sort(tables.begin(), tables.end(), [](const auto& a, const auto& b) {
+        return a->coveredKeyRange().first < b->coveredKeyRange().first;
+    });
+    for (size_t i = 1; i < tables.size(); ++i) {
+        if (tables[i]->coveredKeyRange().first <= tables[i - 1]->coveredKeyRange().second) {
+            std::cerr << "[LSMTree::ingestFiles] " << tables[i - 1]->file_path_ << " and "
+                      << tables[i]->file_path_ << " overlap" << std::endl;
+            return false;
+        }
+    }
+    if (tables.empty()) {
+        return true;
     }
 
-    std::string counts_line_str = counts_line_ss.str();
-    if (!counts_line_str.empty()) {
-        result_ss << "\n" << counts_line_str;
+    // 2. same override rule as bulkLoad: the seq is reserved with puts into the files'
+    // key ranges held back, and buffered keys in them go down first
+    std::vector<std::pair<int, int>> key_ranges;
+    for (const auto& table : tables) {
+        key_ranges.push_back(table->coveredKeyRange());
+    }
+    IngestInFlight in_flight(ingests_in_flight_, *buffer_, std::move(key_ranges));
+    uint64_t ingest_seq = in_flight.seq;
+    if (in_flight.buffer_overlaps) {
+        flushBufferHelper();
     }
 
-    // KVL data, grouped by source, each group on its own line
-    auto print_kvl_for_source = 
-        [&](const std::string& source_label, const std::string& display_label) {
-        if (data_grouped_by_source.count(source_label)) {
-            const auto& pairs_from_source = data_grouped_by_source[source_label];
-            if (!pairs_from_source.empty()) {
-                result_ss << "\n";
-                bool first_kvl_in_section = true;
-                // print each key-value pair
-                for (const auto& dp : pairs_from_source) { 
-                    if (!first_kvl_in_section) {
-                        result_ss << " ";
-                    }
-                    result_ss << dp.key_ << ":" << dp.value_ << ":" << display_label;
-                    first_kvl_in_section = false;
-                }
+    // 3. move each file to its level under a fresh id; only renames under the lock
+    std::lock_guard<std::mutex> install_lock(level_install_mutex_);
+    std::shared_ptr<const Version> version = currentVersion();
+    VersionEdit ingest_edit;
+    std::vector<std::pair<std::string, std::string>> moved_files;
+    bool move_ok = true;
+
+    for (const auto& table : tables) {
+        std::pair<int, int> key_range = table->coveredKeyRange();
+        size_t target_level = ingestLevel(*version, key_range.first, key_range.second);
+        uint64_t new_file_id = next_file_id_++;
+        std::string new_file_path = getFilePath(target_level, new_file_id);
+        std::string new_bf_file_path = getBloomFilterPath(target_level, new_file_id);
+        std::string old_file_path = table->file_path_;
+        std::string old_bf_file_path = table->bf_file_path_;
+
+        // the .meta with the ingest seq goes in before the data: a crash after the rename
+        // must not leave the data to be read with the writer's seq 0
+        table->level_num_ = target_level;
+        table->file_path_ = new_file_path;
+        table->bf_file_path_ = new_bf_file_path;
+        table->global_seq_ = ingest_seq;
+        // readers take range tombstones from the table, not from its data
+        for (RangeTombstone& tombstone : table->range_tombstones_) {
+            tombstone.seq = ingest_seq;
+        }
+        table->max_seq_ = ingest_seq;
+        if (!table->writeMeta()) {
+            std::error_code meta_ec;
+            std::filesystem::remove(new_file_path + ".meta", meta_ec);
+            move_ok = false;
+            break;
+        }
+        ingest_edit.added_tables.push_back({target_level, table});
+
+        if (!moveIngestedFile(old_file_path, new_file_path)) {
+            move_ok = false;
+            break;
+        }
+        moved_files.push_back({old_file_path, new_file_path});
+        // the writer's .meta lacks the ingest seq
+        std::error_code meta_ec;
+        std::filesystem::remove(old_file_path + ".meta", meta_ec);
+        // without a .bf the filter is rebuilt from the data on load
+        if (std::filesystem::exists(old_bf_file_path)) {
+            if (!moveIngestedFile(old_bf_file_path, new_bf_file_path)) {
+                move_ok = false;
+                break;
             }
+            moved_files.push_back({old_bf_file_path, new_bf_file_path});
         }
-    };
 
-    // Print KVL for Buffer
-    print_kvl_for_source("BUF", "BUF");
+        // read back lazily, stamped with ingest_seq
+        table->table_data_ = std::vector<DataPair>();
+        table->data_loaded_ = false;
+    }
 
-    // Print KVL for Levels
-    for (size_t i = 0; i < levels_.size(); ++i) {
-        std::string level_label = "L" + std::to_string(i + 1);
-        print_kvl_for_source(level_label, level_label);
+    if (!move_ok) {
+        // put the caller's files back, nothing was installed
+        for (const auto& added : ingest_edit.added_tables) {
+            std::error_code ec;
+            std::filesystem::remove(added.second->file_path_ + ".meta", ec);
+        }
+        for (auto it = moved_files.rbegin(); it != moved_files.rend(); ++it) {
+            moveIngestedFile(it->second, it->first);
+        }
+        return false;
     }
 
-    return result_ss.str();
-}
\ No newline at end of file
+    // 4. publish every file at once
+    applyVersionEdit(ingest_edit);
+    for (const auto& added : ingest_edit.added_tables) {
+        doCompactionCheck(added.first);
+    }
+    return true;
+}
+
+size_t LSMTree::ingestLevel(const Version& version, int min_key, int max_key) const {
+    for (size_t level = 0; level < version.levels.size(); ++level) {
+        for (const auto& table : version.levels[level]) {
+            if (table->max_key_ >= min_key && table->min_key_ <= max_key) {
+                return level;
+            }
+        }
+    }
+    return version.levels.size() - 1;
+}
@@ -0,0 +1,296 @@
+#include "metrics.hh"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+
+const char* metricOpName(MetricOp op) {
+    static const char* const names[NUM_METRIC_OPS] = {
+        "put", "get", "range", "delete", "flush", "compaction", "write_batch",
+    };
+    return names[static_cast<size_t>(op)];
+}
+
+const char* metricCounterName(MetricCounter counter) {
+    static const char* const names[NUM_METRIC_COUNTERS] = {
+        "bloom_probes", "bloom_negatives", "bloom_false_positives", "tables_probed",
+        "blocks_read", "bytes_read", "user_bytes_written", "flush_bytes_written",
+        "compaction_bytes_read", "compaction_bytes_written", "compaction_entries_in",
+        "compaction_entries_out", "write_stall_nanos", "tombstones_elided",
+        "user_entries_written", "get_misses", "buffer_get_hits", "range_entries_read",
+        "flush_entries_written",
+    };
+    return names[static_cast<size_t>(counter)];
+}
+
+// single writer per shard: a relaxed load + store is enough, no locked instruction
+static inline void bump(std::atomic<uint64_t>& value, uint64_t amount) {
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+/**
+ * LatencyHistogram
+ */
+
+LatencyHistogram::LatencyHistogram() {
+    for (auto& bucket_count : counts_) {
+        bucket_count.store(0, std::memory_order_relaxed);
+    }
+}
+
+size_t LatencyHistogram::bucketFor(uint64_t value) {
+    if (value < SUB_BUCKETS) {
+        return static_cast<size_t>(value);
+    }
+    // the top SUB_BUCKET_BITS + 1 bits pick the bucket
+    int shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+    size_t sub_bucket = static_cast<size_t>(value >> shift) & (SUB_BUCKETS - 1);
+    return (static_cast<size_t>(shift) + 1) * SUB_BUCKETS + sub_bucket;
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(size_t bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    int shift = static_cast<int>(bucket / SUB_BUCKETS) - 1;
+    uint64_t lower = static_cast<uint64_t>(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+    return lower + ((uint64_t(1) << shift) - 1);
+}
+
+void LatencyHistogram::record(uint64_t value) {
+    bump(counts_[bucketFor(value)], 1);
+    bump(count_, 1);
+    bump(sum_, value);
+    if (value < min_.load(std::memory_order_relaxed)) {
+        min_.store(value, std::memory_order_relaxed);
+    }
+    if (value > max_.load(std::memory_order_relaxed)) {
+        max_.store(value, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * HistogramSnapshot
+ */
+
+void HistogramSnapshot::merge(const LatencyHistogram& histogram) {
+    // the owner may record meanwhile, so count is summed from the buckets we copied
+    uint64_t copied = 0;
+    for (size_t i = 0; i < LatencyHistogram::NUM_BUCKETS; ++i) {
+        uint64_t bucket_count = histogram.counts_[i].load(std::memory_order_relaxed);
+        counts[i] += bucket_count;
+        copied += bucket_count;
+    }
+    if (copied == 0) {
+        return;
+    }
+    count += copied;
+    sum += histogram.sum_.load(std::memory_order_relaxed);
+    min = std::min(min, histogram.min_.load(std::memory_order_relaxed));
+    max = std::max(max, histogram.max_.load(std::memory_order_relaxed));
+}
+
+void HistogramSnapshot::merge(const HistogramSnapshot& other) {
+    if (other.count == 0) {
+        return;
+    }
+    for (size_t i = 0; i < LatencyHistogram::NUM_BUCKETS; ++i) {
+        counts[i] += other.counts[i];
+    }
+    count += other.count;
+    sum += other.sum;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+}
+
+double HistogramSnapshot::mean() const {
+    return count == 0 ? 0.0 : static_cast<double>(sum) / static_cast<double>(count);
+}
+
+uint64_t HistogramSnapshot::percentile(double p) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(std::ceil(p / 100.0 * static_cast<double>(count)));
+    rank = std::max<uint64_t>(rank, 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); ++i) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return std::min(LatencyHistogram::bucketUpperBound(i), max);
+        }
+    }
+    return max;
+}
+
+/**
+ * MetricsSnapshot
+ */
+
+static const size_t NUM_REPORTED_PERCENTILES = 4;
+static const double REPORTED_PERCENTILES[NUM_REPORTED_PERCENTILES] = {50.0, 90.0, 99.0, 99.9};
+static const char* const REPORTED_PERCENTILE_NAMES[NUM_REPORTED_PERCENTILES] = {"p50", "p90", "p99", "p999"};
+
+static double toMicros(double nanos) {
+    return nanos / 1000.0;
+}
+
+void MetricsSnapshot::merge(const MetricsSnapshot& other) {
+    for (size_t i = 0; i < NUM_METRIC_OPS; ++i) {
+        ops[i].merge(other.ops[i]);
+    }
+    for (size_t i = 0; i < NUM_METRIC_COUNTERS; ++i) {
+        counters[i] += other.counters[i];
+    }
+}
+
+double MetricsSnapshot::writeAmplification() const {
+    uint64_t user_bytes = counter(MetricCounter::USER_BYTES_WRITTEN);
+    if (user_bytes == 0) {
+        return 0.0;
+    }
+    uint64_t disk_bytes = counter(MetricCounter::FLUSH_BYTES_WRITTEN) + counter(MetricCounter::COMPACTION_BYTES_WRITTEN);
+    return static_cast<double>(disk_bytes) / static_cast<double>(user_bytes);
+}
+
+std::string MetricsSnapshot::toText() const {
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(1);
+    ss << "Latency (us):";
+    for (size_t i = 0; i < NUM_METRIC_OPS; ++i) {
+        const HistogramSnapshot& histogram = ops[i];
+        ss << "\n" << metricOpName(static_cast<MetricOp>(i)) << ": count " << histogram.count;
+        if (histogram.count == 0) {
+            continue;
+        }
+        ss << ", mean " << toMicros(histogram.mean());
+        for (size_t p = 0; p < NUM_REPORTED_PERCENTILES; ++p) {
+            ss << ", " << REPORTED_PERCENTILE_NAMES[p] << " " << toMicros(histogram.percentile(REPORTED_PERCENTILES[p]));
+        }
+        ss << ", max " << toMicros(histogram.max);
+    }
+    ss << "\nCounters:";
+    for (size_t i = 0; i < NUM_METRIC_COUNTERS; ++i) {
+        ss << "\n" << metricCounterName(static_cast<MetricCounter>(i)) << ": " << counters[i];
+    }
+    ss << std::setprecision(2) << "\nwrite_amplification: " << writeAmplification();
+    return ss.str();
+}
+
+std::string MetricsSnapshot::toJson() const {
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(3);
+    ss << "{\"latency_us\":{";
+    for (size_t i = 0; i < NUM_METRIC_OPS; ++i) {
+        const HistogramSnapshot& histogram = ops[i];
+        if (i > 0) {
+            ss << ",";
+        }
+        ss << "\"" << metricOpName(static_cast<MetricOp>(i)) << "\":{\"count\":" << histogram.count
+           << ",\"mean\":" << toMicros(histogram.mean());
+        for (size_t p = 0; p < NUM_REPORTED_PERCENTILES; ++p) {
+            ss << ",\"" << REPORTED_PERCENTILE_NAMES[p] << "\":" << toMicros(histogram.percentile(REPORTED_PERCENTILES[p]));
+        }
+        ss << ",\"max\":" << toMicros(histogram.max) << "}";
+    }
+    ss << "},\"counters\":{";
+    for (size_t i = 0; i < NUM_METRIC_COUNTERS; ++i) {
+        if (i > 0) {
+            ss << ",";
+        }
+        ss << "\"" << metricCounterName(static_cast<MetricCounter>(i)) << "\":" << counters[i];
+    }
+    ss << "},\"write_amplification\":" << writeAmplification() << "}";
+    return ss.str();
+}
+
+/**
+ * EngineMetrics
+ */
+
+// every shard ever handed out, and the ones whose thread has exited
+class MetricsRegistry {
+    public:
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<MetricsShard>> shards_;
+    std::vector<MetricsShard*> free_shards_;
+
+    MetricsShard* acquire() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!free_shards_.empty()) {
+            MetricsShard* shard = free_shards_.back();
+            free_shards_.pop_back();
+            return shard;
+        }
+        shards_.push_back(std::make_unique<MetricsShard>());
+        return shards_.back().get();
+    }
+
+    void release(MetricsShard* shard) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_shards_.push_back(shard);
+    }
+};
+
+namespace {
+// this thread's shard in each live registry; gives them back when the thread exits
+struct ThreadShards {
+    struct Entry {
+        const MetricsRegistry* registry;
+        // a registry freed and reallocated at the same address is caught by expired()
+        std::weak_ptr<MetricsRegistry> owner;
+        MetricsShard* shard;
+    };
+    std::vector<Entry> entries;
+
+    ~ThreadShards() {
+        for (const Entry& entry : entries) {
+            if (std::shared_ptr<MetricsRegistry> registry = entry.owner.lock()) {
+                registry->release(entry.shard);
+            }
+        }
+    }
+};
+thread_local ThreadShards thread_shards;
+}
+
+EngineMetrics::EngineMetrics() : registry_(std::make_shared<MetricsRegistry>()) {}
+
+MetricsShard& EngineMetrics::localShard() {
+    auto& entries = thread_shards.entries;
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (it->owner.expired()) {
+            it = entries.erase(it);
+        } else if (it->registry == registry_.get()) {
+            return *it->shard;
+        } else {
+            ++it;
+        }
+    }
+    MetricsShard* shard = registry_->acquire();
+    entries.push_back({registry_.get(), registry_, shard});
+    return *shard;
+}
+
+void EngineMetrics::record(MetricOp op, uint64_t nanos) {
+    localShard().histograms[static_cast<size_t>(op)].record(nanos);
+}
+
+void EngineMetrics::add(MetricCounter counter, uint64_t amount) {
+    bump(localShard().counters[static_cast<size_t>(counter)], amount);
+}
+
+MetricsSnapshot EngineMetrics::snapshot() const {
+    MetricsSnapshot result;
+    std::lock_guard<std::mutex> lock(registry_->mutex_);
+    for (const auto& shard : registry_->shards_) {
+        for (size_t i = 0; i < NUM_METRIC_OPS; ++i) {
+            result.ops[i].merge(shard->histograms[i]);
+        }
+        for (size_t i = 0; i < NUM_METRIC_COUNTERS; ++i) {
+            result.counters[i] += shard->counters[i].load(std::memory_order_relaxed);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,411 @@
+#include <lsm_tree.hh>
+#include <bloom_filter.hh>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <unistd.h>
+
+// micro-benchmarks of the engine's inner loops, each case run at working sets
+// sized to the L1/L2/L3 caches and to DRAM
+//   ./microbench [--cases=bloom,sstable_get,...] [--working_sets=L1,L2,L3,DRAM]
+// ns/op is per call, except merge/write_text/load_text where it is per entry
+
+// keeps the compiler from dropping a result nobody reads
+template <typename T>
+inline void doNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// xorshift64*, cheap enough not to show up next to an L1 lookup
+struct FastRng {
+    uint64_t state;
+
+    explicit FastRng(uint64_t seed) : state(seed ? seed : 1) {}
+
+    uint64_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1DULL;
+    }
+    // in [0, bound)
+    uint64_t next(uint64_t bound) {
+        return next() % bound;
+    }
+};
+
+struct WorkingSet {
+    std::string name;
+    size_t bytes;
+};
+
+struct MicroOptions {
+    std::vector<std::string> cases;
+    std::vector<std::string> working_sets;
+    // working sets are capped here, a level that ends up no larger than the one
+    // before it is skipped
+    size_t max_working_set = 256 << 20;
+    double min_seconds = 0.5;
+    std::string dir = "microbench_tmp";
+};
+
+struct MicroResult {
+    std::string name;
+    std::string working_set;
+    size_t bytes = 0;
+    uint64_t ops = 0;
+    double seconds = 0.0;
+
+    double nanosPerOp() const {
+        return ops > 0 ? seconds * 1e9 / static_cast<double>(ops) : 0.0;
+    }
+};
+
+static size_t cacheSize(int name, size_t fallback) {
+    long size = sysconf(name);
+    return size > 0 ? static_cast<size_t>(size) : fallback;
+}
+
+// half of each cache, so the case's own data fits with room for the rest,
+// and four times the last level cache for DRAM
+std::vector<WorkingSet> workingSets(const MicroOptions& options) {
+    size_t l1 = cacheSize(_SC_LEVEL1_DCACHE_SIZE, 32 << 10);
+    size_t l2 = cacheSize(_SC_LEVEL2_CACHE_SIZE, 1 << 20);
+    size_t l3 = cacheSize(_SC_LEVEL3_CACHE_SIZE, 16 << 20);
+    std::vector<WorkingSet> candidates = {
+        {"L1", l1 / 2}, {"L2", l2 / 2}, {"L3", l3 / 2}, {"DRAM", l3 * 4},
+    };
+    std::vector<WorkingSet> sets;
+    for (WorkingSet& set : candidates) {
+        set.bytes = std::min(set.bytes, options.max_working_set);
+        if (!sets.empty() && set.bytes <= sets.back().bytes) {
+            std::cout << "skipping " << set.name << ": capped at " << options.max_working_set
+                      << " bytes by --max_working_set" << std::endl;
+            continue;
+        }
+        sets.push_back(set);
+    }
+    return sets;
+}
+
+// calls batch(n) with growing n until one call takes min_seconds
+// batch returns how many ops it did, n is only a hint
+template <typename BatchFn>
+MicroResult runMicro(const std::string& name, const WorkingSet& set, double min_seconds, BatchFn batch) {
+    MicroResult result{name, set.name, set.bytes};
+    // warm the caches and the lazy loads
+    batch(1);
+    uint64_t n = 1;
+    while (true) {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t ops = batch(n);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (seconds >= min_seconds || n >= (1ULL << 40)) {
+            result.ops = ops;
+            result.seconds = seconds;
+            return result;
+        }
+        // aim a little past min_seconds, at most 10x per round
+        double scale = seconds > 0.0 ? std::min(min_seconds * 1.2 / seconds, 10.0) : 10.0;
+        n = std::max<uint64_t>(n + 1, static_cast<uint64_t>(static_cast<double>(n) * scale));
+    }
+}
+
+// keys 0, 2, 4, ... so odd keys fall between entries
+std::vector<DataPair> evenKeyData(size_t entries) {
+    std::vector<DataPair> data;
+    data.reserve(entries);
+    for (size_t i = 0; i < entries; ++i) {
+        data.emplace_back(static_cast<int>(2 * i), static_cast<int>(i), false, i + 1);
+    }
+    return data;
+}
+
+class MicroSuite {
+    public:
+    explicit MicroSuite(const MicroOptions& options) : options_(options) {}
+
+    void run(const WorkingSet& set) {
+        benchBloom(set);
+        benchSSTable(set);
+        benchBuffer(set);
+        benchMerge(set);
+    }
+
+    private:
+    const MicroOptions& options_;
+    std::vector<MicroResult> results_;
+    uint64_t next_file_id_ = 1;
+    // owner of mergeSSTables, opened by the first merge case
+    std::unique_ptr<LSMTree> merge_tree_;
+
+    bool selected(const std::string& name) const {
+        if (options_.cases.empty()) {
+            return true;
+        }
+        for (const std::string& pattern : options_.cases) {
+            if (name.find(pattern) != std::string::npos) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template <typename BatchFn>
+    void add(const std::string& name, const WorkingSet& set, BatchFn batch) {
+        if (!selected(name)) {
+            return;
+        }
+        results_.push_back(runMicro(name, set, options_.min_seconds, batch));
+        printResult(results_.back());
+    }
+
+    std::string tablePath(const std::string& suffix) {
+        return options_.dir + "/" + std::to_string(next_file_id_++) + suffix;
+    }
+
+    static void printResult(const MicroResult& result) {
+        std::cout << std::left << std::setw(22) << result.name
+                  << std::setw(6) << result.working_set
+                  << std::right << std::setw(12) << result.bytes
+                  << std::fixed << std::setprecision(2)
+                  << std::setw(12) << result.nanosPerOp()
+                  << std::setw(12) << (result.nanosPerOp() > 0.0 ? 1000.0 / result.nanosPerOp() : 0.0)
+                  << std::endl;
+    }
+
+    // filter bits fill the working set
+    void benchBloom(const WorkingSet& set) {
+        if (!selected("bloom_add") && !selected("bloom_might_contain")) {
+            return;
+        }
+        double bits_per_key = -std::log(DEFAULT_FALSE_POSITIVE_RATE) / (std::log(2.0) * std::log(2.0));
+        size_t items = std::max<size_t>(1, static_cast<size_t>(static_cast<double>(set.bytes * CHAR_BIT) / bits_per_key));
+
+        BloomFilter add_filter(items);
+        FastRng add_rng(1);
+        add("bloom_add", set, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                add_filter.add(static_cast<int>(add_rng.next()));
+            }
+            return n;
+        });
+
+        // even keys are in, so half the probes hit and half are (mostly) negatives
+        BloomFilter filter(items);
+        for (size_t i = 0; i < items; ++i) {
+            filter.add(static_cast<int>(2 * i));
+        }
+        FastRng rng(2);
+        add("bloom_might_contain", set, [&](uint64_t n) {
+            size_t passed = 0;
+            for (uint64_t i = 0; i < n; ++i) {
+                passed += filter.might_contain(static_cast<int>(rng.next(2 * items)));
+            }
+            doNotOptimize(passed);
+            return n;
+        });
+    }
+
+    // table data fills the working set
+    void benchSSTable(const WorkingSet& set) {
+        if (!selected("fence_range") && !selected("sstable_get") && !selected("write_text")
+            && !selected("load_text")) {
+            return;
+        }
+        size_t entries = std::max<size_t>(1, set.bytes / sizeof(DataPair));
+        SSTable table(evenKeyData(entries), 1, tablePath(".sst"), tablePath(".bf"));
+        int max_key = static_cast<int>(2 * entries);
+
+        FastRng fence_rng(3);
+        add("fence_range", set, [&](uint64_t n) {
+            size_t covered = 0;
+            for (uint64_t i = 0; i < n; ++i) {
+                auto range = table.getFenceRange(static_cast<int>(fence_rng.next(max_key)));
+                covered += range ? range->second - range->first : 0;
+            }
+            doNotOptimize(covered);
+            return n;
+        });
+
+        // fence pointer search plus the lower_bound inside the block
+        FastRng get_rng(4);
+        add("sstable_get", set, [&](uint64_t n) {
+            size_t found = 0;
+            for (uint64_t i = 0; i < n; ++i) {
+                found += table.getDataPair(static_cast<int>(get_rng.next(max_key))).has_value();
+            }
+            doNotOptimize(found);
+            return n;
+        });
+
+        add("write_text", set, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                if (!table.writeToDisk()) {
+                    throw std::runtime_error("microbench: writeToDisk failed");
+                }
+            }
+            return n * entries;
+        });
+
+        add("load_text", set, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                table.data_loaded_ = false;
+                if (!table.loadFromDisk()) {
+                    throw std::runtime_error("microbench: loadFromDisk failed");
+                }
+            }
+            return n * entries;
+        });
+    }
+
+    // overwrites of random keys in a buffer of about set.bytes, so it never grows
+    void benchBuffer(const WorkingSet& set) {
+        if (!selected("buffer_put")) {
+            return;
+        }
+        // map node: key, pair and the red-black tree links
+        const size_t node_bytes = sizeof(BufferKey) + sizeof(DataPair) + 4 * sizeof(void*);
+        size_t entries = std::max<size_t>(1, set.bytes / node_bytes);
+        Buffer buffer(SIZE_MAX);
+        for (size_t i = 0; i < entries; ++i) {
+            buffer.putData(DataPair(static_cast<int>(i), static_cast<int>(i)));
+        }
+        FastRng rng(5);
+        add("buffer_put", set, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                buffer.putData(DataPair(static_cast<int>(rng.next(entries)), static_cast<int>(i)));
+            }
+            return n;
+        });
+    }
+
+    // four interleaved input tables holding set.bytes between them, into level 1
+    void benchMerge(const WorkingSet& set) {
+        if (!selected("merge")) {
+            return;
+        }
+        const size_t num_inputs = 4;
+        size_t entries_per_input = std::max<size_t>(1, set.bytes / sizeof(DataPair) / num_inputs);
+        if (!merge_tree_) {
+            merge_tree_ = std::make_unique<LSMTree>(options_.dir + "/merge_tree");
+        }
+        std::vector<std::shared_ptr<SSTable>> inputs;
+        for (size_t t = 0; t < num_inputs; ++t) {
+            std::vector<DataPair> data;
+            data.reserve(entries_per_input);
+            for (size_t i = 0; i < entries_per_input; ++i) {
+                data.emplace_back(static_cast<int>(i * num_inputs + t), static_cast<int>(i), false, t + 1);
+            }
+            inputs.push_back(std::make_shared<SSTable>(data, 0, tablePath(".sst"), tablePath(".bf")));
+        }
+        add("merge", set, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                for (auto& output : merge_tree_->mergeSSTables(inputs, {}, 1)) {
+                    output->obsolete_.store(true);
+                }
+            }
+            return n * entries_per_input * num_inputs;
+        });
+    }
+};
+
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " [--flag=value ...]\n"
+              << "  --cases=a,b           substrings of the cases to run, all by default:\n"
+              << "                          bloom_add, bloom_might_contain, fence_range, sstable_get,\n"
+              << "                          write_text, load_text, buffer_put, merge\n"
+              << "  --working_sets=L1,L2,L3,DRAM\n"
+              << "  --max_working_set=256M  cap on any working set, K/M/G suffixes\n"
+              << "  --min_time=0.5        seconds per measurement\n"
+              << "  --dir=microbench_tmp  scratch directory for table files, removed afterwards" << std::endl;
+}
+
+std::vector<std::string> splitList(const std::string& value) {
+    std::vector<std::string> items;
+    std::stringstream ss(value);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+size_t parseBytes(const std::string& value) {
+    size_t suffix_pos = 0;
+    size_t bytes = std::stoull(value, &suffix_pos);
+    std::string suffix = value.substr(suffix_pos);
+    if (suffix == "K" || suffix == "k") {
+        bytes <<= 10;
+    } else if (suffix == "M" || suffix == "m") {
+        bytes <<= 20;
+    } else if (suffix == "G" || suffix == "g") {
+        bytes <<= 30;
+    } else if (!suffix.empty()) {
+        throw std::invalid_argument(value);
+    }
+    return bytes;
+}
+
+bool parseOptions(int argc, char* argv[], MicroOptions* options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        size_t equals = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || equals == std::string::npos) {
+            return false;
+        }
+        std::string flag = arg.substr(2, equals - 2);
+        std::string value = arg.substr(equals + 1);
+        try {
+            if (flag == "cases") {
+                options->cases = splitList(value);
+            } else if (flag == "working_sets") {
+                options->working_sets = splitList(value);
+            } else if (flag == "max_working_set") {
+                options->max_working_set = parseBytes(value);
+            } else if (flag == "min_time") {
+                options->min_seconds = std::stod(value);
+            } else if (flag == "dir") {
+                options->dir = value;
+            } else {
+                return false;
+            }
+        } catch (const std::exception&) {
+            std::cerr << "bad value for " << arg << std::endl;
+            return false;
+        }
+    }
+    return options->max_working_set > 0 && !options->dir.empty();
+}
+
+int main(int argc, char* argv[]) {
+    MicroOptions options;
+    if (!parseOptions(argc, argv, &options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    std::error_code ec;
+    std::filesystem::remove_all(options.dir, ec);
+    std::filesystem::create_directories(options.dir);
+
+    std::vector<WorkingSet> sets = workingSets(options);
+    std::cout << std::left << std::setw(22) << "case" << std::setw(6) << "set"
+              << std::right << std::setw(12) << "bytes" << std::setw(12) << "ns/op"
+              << std::setw(12) << "Mops/s" << std::endl;
+    {
+        MicroSuite suite(options);
+        for (const WorkingSet& set : sets) {
+            if (!options.working_sets.empty()
+                && std::find(options.working_sets.begin(), options.working_sets.end(), set.name)
+                       == options.working_sets.end()) {
+                continue;
+            }
+            suite.run(set);
+        }
+    }
+    std::filesystem::remove_all(options.dir, ec);
+    return 0;
+}
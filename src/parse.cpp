@@ -50,15 +50,20 @@ DbOperator* parse_command(char* query_command, message* send_message, int client
      * get: g [INT1]
      * range: r [INT1] [INT2]
      * delete: d [INT1]
+     * range delete of [INT1, INT2): d [INT1] [INT2]
+     * batched put: b [KEY1] [VAL1] [KEY2] [VAL2] ...
+     * merge an operand into a key's value: a [KEY] [OPERAND]
      * load: l [PATH_TO_FILE_NAME]
      * print stats: s
+     * ingest: i [PATH_TO_SST_FILE] ...
+     * full dump of every pair (streamed): f
+     * latency histograms and engine counters: m [json]
+     * tuning advice, applied only if asked: t [apply]
     **/
 
     DbOperator *dbo = new DbOperator();
     // dbo->client_fd = client_socket;
 
-    cs165_log(stdout, "FD %i> QUERY: %s\n", client_socket, query_command);
-
     send_message->status = OK_WAIT_FOR_RESPONSE;
 
     // case match the commands
@@ -113,9 +118,35 @@ DbOperator* parse_command(char* query_command, message* send_message, int client
         case 'd': {
             query_command += 1;
             dbo->type = DELETE;
-            // delete first argument here:
+            // delete first argument here, a second one makes it a range delete of [low, high):
             parse_args(query_command, dbo);
-            if (dbo->args.size() != 1) {
+            if (dbo->args.size() == 2) {
+                dbo->type = DELETE_RANGE;
+            } else if (dbo->args.size() != 1) {
+                send_message->status = INCORRECT_FORMAT;
+                delete dbo;
+                return NULL;
+            }
+            break;
+        }
+        case 'b': {
+            query_command += 1;
+            dbo->type = PUT_BATCH;
+            // any number of key value pairs, at least one:
+            parse_args(query_command, dbo);
+            if (dbo->args.empty() || dbo->args.size() % 2 != 0) {
+                send_message->status = INCORRECT_FORMAT;
+                delete dbo;
+                return NULL;
+            }
+            break;
+        }
+        case 'a': {
+            query_command += 1;
+            dbo->type = MERGE;
+            // merge operand second argument into the first one's value:
+            parse_args(query_command, dbo);
+            if (dbo->args.size() != 2) {
                 send_message->status = INCORRECT_FORMAT;
                 delete dbo;
                 return NULL;
@@ -173,6 +204,56 @@ DbOperator* parse_command(char* query_command, message* send_message, int client
             }
             break;
         }
+        case 'f': {
+            dbo->type = DUMP;
+            break;
+        }
+        case 't': {
+            query_command += 1;
+            dbo->type = TUNE;
+            // recommends only, unless told to apply
+            char* apply_token = strtok(query_command, " \t\r\n");
+            if (apply_token != nullptr) {
+                if (strcmp(apply_token, "apply") != 0) {
+                    send_message->status = INCORRECT_FORMAT;
+                    delete dbo;
+                    return NULL;
+                }
+                dbo->s_args.push_back(apply_token);
+            }
+            break;
+        }
+        case 'm': {
+            query_command += 1;
+            dbo->type = METRICS;
+            // optional output format, text by default
+            char* format_token = strtok(query_command, " \t\r\n");
+            if (format_token != nullptr) {
+                if (strcmp(format_token, "json") != 0) {
+                    send_message->status = INCORRECT_FORMAT;
+                    delete dbo;
+                    return NULL;
+                }
+                dbo->s_args.push_back(format_token);
+            }
+            break;
+        }
+        case 'i': {
+            query_command += 1;
+            dbo->type = INGEST;
+            // whitespace separated SSTable file paths
+            char* path_token = strtok(query_command, " \t\r\n");
+            while (path_token != nullptr) {
+                dbo->s_args.push_back(path_token);
+                path_token = strtok(nullptr, " \t\r\n");
+            }
+            if (dbo->s_args.empty()) {
+                send_message->status = INCORRECT_FORMAT;
+                delete dbo;
+                return NULL;
+            }
+            break;
+        }
         default: {
             send_message->status = UNKNOWN_COMMAND;
             delete dbo;
@@ -183,3 +264,71 @@ DbOperator* parse_command(char* query_command, message* send_message, int client
     dbo->client_fd = client_socket;
     return dbo;
 }
+
+void encode_request_frame(const DbOperator* dbo, uint32_t request_id, std::string* frame) {
+    frame_header header;
+    header.magic = FRAME_MAGIC;
+    header.version = FRAME_VERSION;
+    header.opcode = static_cast<uint8_t>(dbo->type);
+    header.request_id = request_id;
+    header.argc = static_cast<uint16_t>(dbo->args.size());
+    header.flags = 0;
+
+    // several string args (INGEST paths) are newline separated
+    std::string string_arg;
+    for (size_t i = 0; i < dbo->s_args.size(); ++i) {
+        if (i > 0) {
+            string_arg += "\n";
+        }
+        string_arg += dbo->s_args[i];
+    }
+    header.payload_len = header.argc * sizeof(int32_t) + string_arg.size();
+
+    frame->append(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (int arg : dbo->args) {
+        int32_t wire_arg = arg;
+        frame->append(reinterpret_cast<const char*>(&wire_arg), sizeof(wire_arg));
+    }
+    frame->append(string_arg);
+}
+
+DbOperator* decode_request_frame(const frame_header* header, const char* payload, message_status* status) {
+    // number of int32 args each opcode expects, -1 for any non-zero even count
+    static const int expected_argc[] = {2, 1, 2, 1, 0, 0, 0, 0, 0, 2, 2, -1, 0};
+
+    if (header->opcode > TUNE) {
+        *status = UNKNOWN_COMMAND;
+        return NULL;
+    }
+    size_t args_len = header->argc * sizeof(int32_t);
+    bool argc_ok = expected_argc[header->opcode] < 0
+                       ? header->argc > 0 && header->argc % 2 == 0
+                       : header->argc == expected_argc[header->opcode];
+    if (!argc_ok || header->payload_len < args_len) {
+        *status = INCORRECT_FORMAT;
+        return NULL;
+    }
+
+    DbOperator *dbo = new DbOperator();
+    dbo->type = static_cast<OperatorType>(header->opcode);
+    dbo->args.resize(header->argc);
+    for (size_t i = 0; i < header->argc; ++i) {
+        int32_t wire_arg;
+        memcpy(&wire_arg, payload + i * sizeof(int32_t), sizeof(wire_arg));
+        dbo->args[i] = wire_arg;
+    }
+    if (header->payload_len > args_len) {
+        std::string string_arg(payload + args_len, header->payload_len - args_len);
+        size_t start = 0;
+        while (start <= string_arg.size()) {
+            size_t end = string_arg.find('\n', start);
+            if (end == std::string::npos) {
+                end = string_arg.size();
+            }
+            dbo->s_args.push_back(string_arg.substr(start, end - start));
+            start = end + 1;
+        }
+    }
+    *status = OK_WAIT_FOR_RESPONSE;
+    return dbo;
+}
@@ -5,6 +5,10 @@
 #include <sys/types.h>
 #include <sys/un.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <signal.h>
 #include <unistd.h>
 #include <string.h>
 #include <queue>
@@ -13,42 +17,68 @@
 #include <iostream>
 #include <set>
 #include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <unordered_map>
 
 #include "parse.h"
 #include "message.h"
 #include "utils.h"
 #include "db_types.hh"
-#include "lsm_tree.hh"
+#include "sharded_lsm_tree.hh"
+#include "thread_pool.hh"
 
 // --- Configuration ---
 const std::string DB_PATH = "./lsm_db_directory";
 
 // --- Global LSM Tree ---
-std::unique_ptr<LSMTree> lsm_tree_ptr;
+std::unique_ptr<ShardedLSMTree> lsm_tree_ptr;
 
 #define DEFAULT_QUERY_BUFFER_SIZE 1024
-// #define WORKER_THREADS_NUM 5 // Not used
+// max events handled per epoll_wait call
+#define MAX_EPOLL_EVENTS 256
 
 // shut sown worker threads
 bool shutdown_requested = false;
 pthread_mutex_t shutdown_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+// text replies carry their status in the message prefix
+message_status result_status(const char* result) {
+    if (strncmp(result, "[SERVER] Error", 14) == 0 || strncmp(result, "[CLIENT] Error", 14) == 0) {
+        return EXECUTION_ERROR;
+    } else if (strstr(result, "not found.") != NULL) {
+        return OBJECT_NOT_FOUND;
+    }
+    return OK_WAIT_FOR_RESPONSE;
+}
+
+void set_text_result(DbResult* result, const char* text) {
+    result->status = result_status(text);
+    result->text = text;
+}
+
 /** Step 2 in handle_client_request:
  * TODO: handle query types according CS265 domain specific language
  **/
-char* execute_DbOperator(DbOperator* query) {
+void execute_DbOperator(DbOperator* query, DbResult* result) {
     if (!lsm_tree_ptr) {
-         return strdup("[SERVER] Error: Database not initialized.");
+         set_text_result(result, "[SERVER] Error: Database not initialized.");
+         return;
     }
     if(!query) {
-        return strdup("[SERVER] Error: Invalid DB query object.");
+        set_text_result(result, "[SERVER] Error: Invalid DB query object.");
+        return;
     }
 
     size_t num_args = query->args.size(); 
 
     if (query->type == PUT) {
         if (num_args != 2) {
-             return strdup("[SERVER] Error: PUT requires 2 arguments (key, value).");
+             set_text_result(result, "[SERVER] Error: PUT requires 2 arguments (key, value).");
+             return;
         }
        
         int key = query->args[0];
@@ -58,238 +88,476 @@ char* execute_DbOperator(DbOperator* query) {
         DataPair data_to_put(static_cast<int>(key), static_cast<int>(value), false);
 
         if (lsm_tree_ptr->putData(data_to_put)) {
-            return strdup("[SERVER] PUT successful.");
+            result->status = OK_DONE;
+            return;
         } else {
-            return strdup("[SERVER] Error: PUT operation failed internally.");
+            set_text_result(result, "[SERVER] Error: PUT operation failed internally.");
+            return;
         }
 
     } else if (query->type == GET) {
         if (num_args != 1) {
-             return strdup("[SERVER] Error: GET requires 1 argument (key).");
+             set_text_result(result, "[SERVER] Error: GET requires 1 argument (key).");
+             return;
         }
         int key = query->args[0];
 
-        std::optional<DataPair> result = lsm_tree_ptr->getData(key);
+        std::optional<DataPair> found = lsm_tree_ptr->getData(key);
 
-        if (result.has_value()) {
-            char buffer[64];
-            // Use the values from the result DataPair (which are 'long')
-            int len = snprintf(buffer, sizeof(buffer), "%d:%d", result.value().key_, result.value().value_);
-            if (len < 0 || static_cast<unsigned long>(len) >= sizeof(buffer)) {
-                return strdup("[SERVER] Error: Failed to format GET result.");
-            }
-            return strdup(buffer);
+        if (found.has_value()) {
+            result->status = OK_WAIT_FOR_RESPONSE;
+            result->pairs = {found.value().key_, found.value().value_};
         } else {
-             char buffer[100];
-             // Use the original key requested for the not found message
-             snprintf(buffer, sizeof(buffer), "[SERVER] Key %d not found.", key);
-            return strdup(buffer);
+            // empty reply, the status says it all
+            result->status = OBJECT_NOT_FOUND;
         }
+        return;
 
     } else if (query->type == RANGE) {
         if (num_args != 2) {
-            return strdup("[SERVER] Error: RANGE requires 2 arguments (start_key, end_key).");
+            set_text_result(result, "[SERVER] Error: RANGE requires 2 arguments (start_key, end_key).");
+            return;
         }
         int start_key = query->args[0];
         int end_key = query->args[1];
 
         if (end_key < start_key) {
-            return strdup("[SERVER] Error: RANGE end_key must be greater than or equal to start_key.");
+            set_text_result(result, "[SERVER] Error: RANGE end_key must be greater than or equal to start_key.");
+            return;
         }
 
         std::vector<DataPair> results = lsm_tree_ptr->rangeData(start_key, end_key);
 
-        if (results.empty()) {
-            return strdup("");
-        } else {
-            std::string result_str;
-            for (size_t i = 0; i < results.size(); ++i) {
-                // Append key:value
-                result_str += std::to_string(results[i].key_);
-                result_str += ":";
-                result_str += std::to_string(results[i].value_);
-                if (i < results.size() - 1) {
-                    result_str += " ";
-                }
-            }
-            // strdup creates a C-style string copy on the heap
-            return strdup(result_str.c_str());
+        result->status = OK_WAIT_FOR_RESPONSE;
+        result->pairs.reserve(results.size() * 2);
+        for (const DataPair& pair : results) {
+            result->pairs.push_back(pair.key_);
+            result->pairs.push_back(pair.value_);
         }
+        return;
 
     } else if (query->type == DELETE) {
         if (num_args != 1) {
-             return strdup("[SERVER] Error: DELETE requires 1 argument (key).");
+             set_text_result(result, "[SERVER] Error: DELETE requires 1 argument (key).");
+             return;
         }
         int key = query->args[0];
         bool deleted_processed = lsm_tree_ptr->deleteData(key);
 
         if (deleted_processed) {
-            char response_buffer[138];
-            snprintf(response_buffer, sizeof(response_buffer), 
-                     "[SERVER] Key %d marked for deletion.", key);
-            return strdup(response_buffer);
+            result->status = OK_DONE;
+            return;
         } else {
             char error_buffer[128];
             snprintf(error_buffer, sizeof(error_buffer),
                      "[SERVER] Error: Failed to process DELETE for key %d internally.", key);
-            return strdup(error_buffer);
+            set_text_result(result, error_buffer);
+            return;
         }
 
-    } else if (query->type == LOAD) {
-        if (query->s_args.empty() || query->s_args[0].empty()) {
-            return strdup("[SERVER] Error: LOAD requires a file path argument.");
+    } else if (query->type == DELETE_RANGE) {
+        if (num_args != 2) {
+            set_text_result(result, "[SERVER] Error: DELETE_RANGE requires 2 arguments (start_key, end_key).");
+            return;
         }
-        const std::string& file_path = query->s_args[0];
+        int start_key = query->args[0];
+        int end_key = query->args[1];
 
-        // open file in binary, and every 4 bytes is a key, and 4 more bytes is a value
-        char cwd[1024];
-        if (getcwd(cwd, sizeof(cwd)) != NULL) {
-            log_info("[SERVER CWD] Current working directory: %s\n", cwd);
+        if (end_key < start_key) {
+            set_text_result(result, "[SERVER] Error: DELETE_RANGE end_key must be greater than or equal to start_key.");
+            return;
+        }
+        // one range tombstone, however many keys the range holds
+        if (lsm_tree_ptr->deleteRange(start_key, end_key)) {
+            result->status = OK_DONE;
         } else {
-            log_err("[SERVER CWD] getcwd() error\n");
+            set_text_result(result, "[SERVER] Error: DELETE_RANGE operation failed internally.");
         }
-        log_info("[SERVER] Attempting to load file with path argument: '%s'\n", file_path.c_str());
-        
-        std::ifstream file(file_path, std::ios::binary | std::ios::ate);
-        if (!file.is_open()) {
-            char err_buf[FILENAME_MAX + 128];
-            snprintf(err_buf, sizeof(err_buf), "[SERVER] Error: Cannot open file '%s': %s",
-                     file_path.c_str(), strerror(errno));
-            return strdup(err_buf);
+        return;
+
+    } else if (query->type == PUT_BATCH) {
+        if (num_args == 0 || num_args % 2 != 0) {
+            set_text_result(result, "[SERVER] Error: PUT_BATCH requires key,value pairs.");
+            return;
+        }
+        // one buffer lock for the whole request, visible all at once
+        WriteBatch batch;
+        batch.entries_.reserve(num_args / 2);
+        for (size_t i = 0; i < num_args; i += 2) {
+            batch.putData(query->args[i], query->args[i + 1]);
         }
-        std::streamsize file_size = file.tellg();
-        file.seekg(0, std::ios::beg);
+        if (lsm_tree_ptr->writeBatch(batch)) {
+            result->status = OK_DONE;
+        } else {
+            set_text_result(result, "[SERVER] Error: PUT_BATCH operation failed internally.");
+        }
+        return;
 
-        if (file_size == 0) {
-            file.close();
-            char msg_buf[FILENAME_MAX + 64];
-            snprintf(msg_buf, sizeof(msg_buf), "[SERVER] LOAD file '%s' is empty. 0 pairs loaded.", file_path.c_str());
-            return strdup(msg_buf);
+    } else if (query->type == MERGE) {
+        if (num_args != 2) {
+            set_text_result(result, "[SERVER] Error: MERGE requires 2 arguments (key, operand).");
+            return;
         }
+        // no read of the current value, the operand is combined with it on the next get
+        if (lsm_tree_ptr->mergeData(query->args[0], query->args[1])) {
+            result->status = OK_DONE;
+        } else {
+            set_text_result(result, "[SERVER] Error: MERGE operation failed internally.");
+        }
+        return;
 
-        // file_size must be a multiple of 8 (4+4 bytes key/val pairs)
-        if (file_size % 8 != 0) {
-            file.close();
-            char err_buf[FILENAME_MAX + 128];
-            snprintf(err_buf, sizeof(err_buf),
-                     "[SERVER] Error: LOAD file '%s' has incorrect size (%lld bytes). Must be a multiple of 8 bytes for key-value pairs.",
-                     file_path.c_str(), (long long)file_size);
-            return strdup(err_buf);
-        }
-
-        int key_from_file;
-        int value_from_file;
-        unsigned long items_processed_from_file = 0;
-        unsigned long items_successfully_put = 0;
-        bool read_error_occurred = false;
-
-        // read key/val pairs from file
-        while (file.good() && (items_processed_from_file < (unsigned long)(file_size / 8))) {
-            // Read 4 bytes for the key
-            if (!file.read(reinterpret_cast<char*>(&key_from_file), sizeof(key_from_file))) {
-                if (!file.eof()) {
-                    read_error_occurred = true;
-                }
-                break;
-            }
-            // Read 4 bytes for the value
-            if (!file.read(reinterpret_cast<char*>(&value_from_file), sizeof(value_from_file))) {
-                if (!file.eof()) { // If not EOF, it's an actual read error for value
-                    read_error_occurred = true;
-                }
-                // This implies we read a key but couldn't read its corresponding value
-                log_err("[SERVER] LOAD: Read key but failed to read value from '%s'. File might be truncated or corrupt.\n", file_path.c_str());
-                break;
-            }
-            // track items processed
-            items_processed_from_file++;
-            DataPair data_to_put(key_from_file, value_from_file, false);
+    } else if (query->type == LOAD) {
+        if (query->s_args.empty() || query->s_args[0].empty()) {
+            set_text_result(result, "[SERVER] Error: LOAD requires a file path argument.");
+            return;
+        }
+        const std::string& file_path = query->s_args[0];
 
-            if (lsm_tree_ptr->putData(data_to_put)) {
-                items_successfully_put++;
-            } else {
-                log_err("[SERVER] LOAD: putData failed for key %d, value %d from file '%s'. Continuing.\n",
-                        key_from_file, value_from_file, file_path.c_str());
-            }
-        } 
+        // binary file, every 4 bytes is a key, and 4 more bytes is a value
+        // sorted and installed as SSTables directly instead of pair-by-pair puts
+        log_info("[SERVER] Attempting to bulk load file with path argument: '%s'\n", file_path.c_str());
 
-        if (read_error_occurred) {
-            file.close();
+        ShardedLoadResult loaded = lsm_tree_ptr->bulkLoad(file_path);
+        if (loaded.partial()) {
+            // reloading the whole file is safe, its pairs override the same keys again
+            char err_buf[FILENAME_MAX + 192];
+            snprintf(err_buf, sizeof(err_buf),
+                     "[SERVER] Error: LOAD partially applied for '%s': %zu distinct keys loaded into %zu shard(s), "
+                     "%zu shard(s) failed. Retry the LOAD.",
+                     file_path.c_str(), loaded.pairs_loaded, loaded.shards_applied, loaded.shards_failed);
+            set_text_result(result, err_buf);
+            return;
+        }
+        if (!loaded.ok) {
             char err_buf[FILENAME_MAX + 128];
             snprintf(err_buf, sizeof(err_buf),
-                    "[SERVER] Error: A read error occurred while processing file '%s' after %lu pairs.",
-                    file_path.c_str(), items_processed_from_file);
-            return strdup(err_buf);
+                     "[SERVER] Error: LOAD failed for '%s'. File must exist and hold whole 8-byte key-value pairs.",
+                     file_path.c_str());
+            set_text_result(result, err_buf);
+            return;
         }
 
-        file.close();
         char success_buf[FILENAME_MAX + 128];
         snprintf(success_buf, sizeof(success_buf),
-                "[SERVER] LOAD successful. Processed %lu pairs, successfully put %lu pairs into LSM Tree from '%s'.",
-                items_processed_from_file, items_successfully_put, file_path.c_str());
-        return strdup(success_buf);
+                "[SERVER] LOAD successful. Ingested %zu distinct keys into LSM Tree from '%s'.",
+                loaded.pairs_loaded, file_path.c_str());
+        set_text_result(result, success_buf);
+        return;
+
+    } else if (query->type == INGEST) {
+        if (query->s_args.empty()) {
+            set_text_result(result, "[SERVER] Error: INGEST requires at least one SSTable file path.");
+            return;
+        }
+        log_info("[SERVER] Attempting to ingest %zu SSTable file(s)\n", query->s_args.size());
+
+        ShardedLoadResult ingested = lsm_tree_ptr->ingestFiles(query->s_args);
+        if (ingested.partial()) {
+            // the originals are gone, the parts still missing are what a retry must ingest
+            std::string message = "[SERVER] Error: INGEST partially applied, " + std::to_string(ingested.shards_failed) +
+                                  " shard(s) failed. Retry with: i";
+            for (const std::string& retry_file : ingested.retry_files) {
+                message += " " + retry_file;
+            }
+            set_text_result(result, message.c_str());
+            return;
+        }
+        if (!ingested.ok) {
+            set_text_result(result, "[SERVER] Error: INGEST failed. Files must be non-empty, sorted and must not overlap each other.");
+            return;
+        }
+        char success_buf[128];
+        snprintf(success_buf, sizeof(success_buf),
+                 "[SERVER] INGEST successful. Ingested %zu SSTable file(s).", query->s_args.size());
+        set_text_result(result, success_buf);
+        return;
 
     } else if (query->type == PRINT_STATS) {
-        // directly call the print_stats function
-        std::string stats_output = lsm_tree_ptr->print_stats();
-        return strdup(stats_output.c_str());
+        // O(levels) summary; the full dump is the streamed DUMP command
+        result->status = OK_WAIT_FOR_RESPONSE;
+        result->text = lsm_tree_ptr->print_stats();
+        return;
+    } else if (query->type == METRICS) {
+        MetricsSnapshot metrics = lsm_tree_ptr->getMetrics();
+        bool as_json = !query->s_args.empty() && query->s_args[0] == "json";
+        result->status = OK_WAIT_FOR_RESPONSE;
+        result->text = as_json ? metrics.toJson() : metrics.toText();
+        return;
+    } else if (query->type == TUNE) {
+        bool apply = !query->s_args.empty() && query->s_args[0] == "apply";
+        result->status = OK_WAIT_FOR_RESPONSE;
+        result->text = lsm_tree_ptr->tune(apply).toText();
+        return;
     } else {
-        return strdup("[SERVER] Error: Unknown query type.");
+        set_text_result(result, "[SERVER] Error: Unknown query type.");
+        return;
     }
 }
 
 
-void handle_client_request(int client_socket) {
-    message send_message;
-    message recv_message;
-
-    int length = recv(client_socket, &recv_message, sizeof(message), 0);
-    if (length <= 0) { return; }
+// max requests dispatched per connection before we stop reading its frames
+#define MAX_REQUESTS_IN_FLIGHT 128
+// a streaming reply pauses while this much output is still unsent
+#define STREAM_MAX_UNSENT_BYTES (4 << 20)
+
+// shared between a connection and the workers streaming to it
+struct StreamState {
+    // output queued for the socket and not yet sent: added when a frame is queued,
+    // subtracted by the event loop as the socket takes it
+    std::atomic<size_t> unsent_bytes{0};
+    std::atomic<bool> closed{false};
+    // a streaming worker sleeps on room_cv while unsent_bytes is over the limit;
+    // whatever can end the wait changes under room_mutex so no wakeup is lost
+    std::mutex room_mutex;
+    std::condition_variable room_cv;
+
+    void sent(size_t bytes) {
+        std::lock_guard<std::mutex> lock(room_mutex);
+        size_t before = unsent_bytes.fetch_sub(bytes);
+        if (before > STREAM_MAX_UNSENT_BYTES && before - bytes <= STREAM_MAX_UNSENT_BYTES) {
+            room_cv.notify_all();
+        }
+    }
 
-    if (recv_message.length <= 0 || recv_message.length > DEFAULT_QUERY_BUFFER_SIZE * 10) {
-        log_info("[SERVER] Received invalid message length: %d on socket %d\n", recv_message.length, client_socket);
-        return;
+    void close() {
+        std::lock_guard<std::mutex> lock(room_mutex);
+        closed = true;
+        room_cv.notify_all();
     }
 
-    char recv_buffer[recv_message.length + 1];
-    length = recv(client_socket, recv_buffer, recv_message.length, MSG_WAITALL);
-    if (length != recv_message.length) {
-        log_err("[SERVER] Failed to receive full payload on socket %d. Expected %d, Got %d\n", client_socket, recv_message.length, length);
-        return;
+    // false if the connection closed while waiting
+    bool wait_for_room() {
+        std::unique_lock<std::mutex> lock(room_mutex);
+        room_cv.wait(lock, [this] { return unsent_bytes.load() <= STREAM_MAX_UNSENT_BYTES || closed.load(); });
+        return !closed.load();
+    }
+};
+
+// per-connection state owned by the event loop thread
+// reads run concurrently; a run of writes waits for everything before it and runs as
+// one ordered task, so a pipelining client still reads its own writes
+struct Connection {
+    int fd;
+    uint64_t id;
+    std::string in_buffer;
+    std::string out_buffer;
+    size_t requests_in_flight = 0;
+    bool write_in_flight = false;
+    std::shared_ptr<StreamState> stream = std::make_shared<StreamState>();
+};
+
+// finished response frames handed from a worker back to the event loop
+// a streamed part has num_requests 0, only the last frame finishes its request
+struct Completion {
+    int fd;
+    uint64_t conn_id;
+    size_t num_requests;
+    bool was_write;
+    std::string response;
+};
+
+// one decoded request waiting for a worker
+struct PendingRequest {
+    DbOperator* query;
+    uint32_t request_id;
+};
+
+std::mutex completions_mutex;
+std::vector<Completion> completions;
+// wakes epoll_wait when a worker finishes a request
+int completion_event_fd = -1;
+
+// response header + payload, appended to *response
+// FRAME_FLAG_MORE in extra_flags marks one part of a streamed reply
+void encode_response_frame(uint32_t request_id, const DbResult& result, std::string* response,
+                           uint16_t extra_flags = 0) {
+    frame_header header;
+    header.magic = FRAME_MAGIC;
+    header.version = FRAME_VERSION;
+    header.opcode = static_cast<uint8_t>(result.status);
+    header.request_id = request_id;
+    header.argc = 0;
+    header.flags = (result.pairs.empty() ? 0 : FRAME_FLAG_PAIRS) | extra_flags;
+    header.payload_len = result.pairs.empty() ? result.text.size() : result.pairs.size() * sizeof(int32_t);
+
+    response->append(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (result.pairs.empty()) {
+        response->append(result.text);
+    } else {
+        response->append(reinterpret_cast<const char*>(result.pairs.data()), header.payload_len);
     }
-    recv_message.payload = recv_buffer;
-    recv_message.payload[recv_message.length] = '\0';
+}
 
-    DbOperator* query = parse_command(recv_message.payload, &send_message, client_socket);
+int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
 
-    char* result = execute_DbOperator(query);
-    // TODO: If query was allocated by parse_command, free it here, e.g., free_DbOperator(query);
+void push_completion(Completion completion, StreamState& stream) {
+    int fd = completion.fd;
+    stream.unsent_bytes += completion.response.size();
+    {
+        std::lock_guard<std::mutex> lock(completions_mutex);
+        completions.push_back(std::move(completion));
+    }
+    uint64_t one = 1;
+    if (write(completion_event_fd, &one, sizeof(one)) == -1) {
+        log_err("[SERVER] Failed to signal completion for socket %d: %s\n", fd, strerror(errno));
+    }
+}
 
+// full dump: each chunk goes out as its own MORE frame, paced by the client's reads
+void stream_dump(uint32_t request_id, int fd, uint64_t conn_id, const std::shared_ptr<StreamState>& stream) {
+    lsm_tree_ptr->dumpAll([&](const std::string& chunk) {
+        if (!stream->wait_for_room()) {
+            return false;
+        }
+        DbResult part;
+        part.status = OK_WAIT_FOR_RESPONSE;
+        part.text = chunk;
+        Completion completion{fd, conn_id, 0, false, std::string()};
+        encode_response_frame(request_id, part, &completion.response, FRAME_FLAG_MORE);
+        push_completion(std::move(completion), *stream);
+        return true;
+    });
+}
 
-    if (strncmp(result, "[SERVER] Error", 14) == 0 || strncmp(result, "[CLIENT] Error", 14) == 0) {
-        send_message.status = EXECUTION_ERROR;
-    } else if (strstr(result, "not found.") != NULL) {
-         send_message.status = OBJECT_NOT_FOUND;
-    } else {
-        send_message.status = OK_WAIT_FOR_RESPONSE;
+/** Step 3, on a worker thread:
+ * run the queries in order, queue their responses for the event loop
+ **/
+void run_queries(std::vector<PendingRequest> requests, bool was_write, int fd, uint64_t conn_id,
+                 std::shared_ptr<StreamState> stream) {
+    Completion completion{fd, conn_id, requests.size(), was_write, std::string()};
+    for (PendingRequest& request : requests) {
+        DbResult result;
+        if (request.query->type == DUMP) {
+            stream_dump(request.request_id, fd, conn_id, stream);
+            // closing frame, prints as the final newline
+            result.status = OK_WAIT_FOR_RESPONSE;
+        } else {
+            execute_DbOperator(request.query, &result);
+        }
+        delete request.query;
+        encode_response_frame(request.request_id, result, &completion.response);
     }
-    send_message.length = strlen(result);
+    push_completion(std::move(completion), *stream);
+}
 
-    if (send(client_socket, &(send_message), sizeof(message), 0) == -1) {
-        log_err("[SERVER] Failed to send response header to socket %d: %s\n", client_socket, strerror(errno));
-        free(result);
-        return;
+// write as much of out_buffer as the socket takes, false if the connection broke
+bool flush_connection(Connection& conn) {
+    while (!conn.out_buffer.empty()) {
+        ssize_t sent = send(conn.fd, conn.out_buffer.data(), conn.out_buffer.size(), MSG_NOSIGNAL);
+        if (sent > 0) {
+            conn.out_buffer.erase(0, sent);
+            conn.stream->sent(sent);
+        } else if (sent < 0 && errno == EINTR) {
+            continue;
+        } else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // wait for EPOLLOUT
+            return true;
+        } else {
+            log_err("[SERVER] Failed to send response to socket %d: %s\n", conn.fd, strerror(errno));
+            return false;
+        }
     }
+    return true;
+}
 
-    if (send_message.length > 0) {
-        if (send(client_socket, result, send_message.length, 0) == -1) {
-            log_err("[SERVER] Failed to send response payload to socket %d: %s\n", client_socket, strerror(errno));
+bool is_write_op(uint8_t opcode) {
+    return opcode == PUT || opcode == DELETE || opcode == DELETE_RANGE || opcode == MERGE || opcode == PUT_BATCH || opcode == LOAD || opcode == INGEST;
+}
+
+/** Step 1 in handle_client_request:
+ * decode every buffered frame we are allowed to start and hand it to the pool
+ * returns false if the connection should be closed
+ **/
+bool dispatch_requests(Connection& conn, ThreadPool& workers) {
+    size_t consumed = 0;
+    std::vector<PendingRequest> write_run;
+
+    while (conn.requests_in_flight + write_run.size() < MAX_REQUESTS_IN_FLIGHT
+           && conn.in_buffer.size() - consumed >= sizeof(frame_header)) {
+        frame_header header;
+        memcpy(&header, conn.in_buffer.data() + consumed, sizeof(header));
+
+        if (header.magic != FRAME_MAGIC || header.version != FRAME_VERSION
+            || header.payload_len > FRAME_MAX_PAYLOAD) {
+            log_info("[SERVER] Received invalid frame on socket %d\n", conn.fd);
+            return false;
+        }
+        if (conn.in_buffer.size() - consumed < sizeof(header) + header.payload_len) {
+            break;
         }
-    }
 
-    free(result);
+        // writes start only once everything before them finished, reads wait behind writes
+        bool is_write = is_write_op(header.opcode);
+        if (conn.write_in_flight || (is_write && conn.requests_in_flight > 0)
+            || (!is_write && !write_run.empty())) {
+            break;
+        }
+
+        const char* payload = conn.in_buffer.data() + consumed + sizeof(header);
+        consumed += sizeof(header) + header.payload_len;
+
+        message_status status;
+        DbOperator* query = decode_request_frame(&header, payload, &status);
+        if (!query) {
+            DbResult error_result;
+            error_result.status = status;
+            error_result.text = "[SERVER] Error: Malformed request.";
+            size_t queued = conn.out_buffer.size();
+            encode_response_frame(header.request_id, error_result, &conn.out_buffer);
+            conn.stream->unsent_bytes += conn.out_buffer.size() - queued;
+            continue;
+        }
+
+        if (is_write) {
+            write_run.push_back({query, header.request_id});
+            continue;
+        }
+        conn.requests_in_flight++;
+        std::vector<PendingRequest> read_request{{query, header.request_id}};
+        int fd = conn.fd;
+        uint64_t conn_id = conn.id;
+        std::shared_ptr<StreamState> stream = conn.stream;
+        workers.submit([read_request, fd, conn_id, stream]() { run_queries(read_request, false, fd, conn_id, stream); });
+    }
+    conn.in_buffer.erase(0, consumed);
+
+    if (!write_run.empty()) {
+        conn.requests_in_flight += write_run.size();
+        conn.write_in_flight = true;
+        int fd = conn.fd;
+        uint64_t conn_id = conn.id;
+        std::shared_ptr<StreamState> stream = conn.stream;
+        workers.submit([write_run, fd, conn_id, stream]() { run_queries(write_run, true, fd, conn_id, stream); });
+    }
+    return true;
 }
 
+// edge-triggered: drain the socket until EAGAIN, false on EOF or error
+bool read_connection(Connection& conn) {
+    char read_buffer[DEFAULT_QUERY_BUFFER_SIZE * 4];
+    while (true) {
+        ssize_t received = recv(conn.fd, read_buffer, sizeof(read_buffer), 0);
+        if (received > 0) {
+            conn.in_buffer.append(read_buffer, received);
+        } else if (received == 0) {
+            log_info("[SERVER] Client disconnected: socket %d\n", conn.fd);
+            return false;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return true;
+        } else {
+            log_err("[SERVER] Error reading from socket %d: %s\n", conn.fd, strerror(errno));
+            return false;
+        }
+    }
+}
 
 // setup_server(): unchanged
 int setup_server() {
@@ -317,7 +585,7 @@ int setup_server() {
         return -1;
     }
 
-    if (listen(server_socket, 5) == -1) {
+    if (listen(server_socket, SOMAXCONN) == -1) {
         log_err("L%d: Failed to listen on socket %s: %s\n", __LINE__, local.sun_path, strerror(errno));
         close(server_socket);
         unlink(local.sun_path);
@@ -330,11 +598,20 @@ int setup_server() {
 
 int main(void)
 {
+    // SIGINT/SIGTERM are read from a signalfd in the event loop, blocked before any
+    // thread starts so every thread inherits the mask
+    sigset_t shutdown_signals;
+    sigemptyset(&shutdown_signals);
+    sigaddset(&shutdown_signals, SIGINT);
+    sigaddset(&shutdown_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &shutdown_signals, NULL);
+
     // 3. Initialize LSM Tree in main
     log_info("[SERVER INIT] Initializing LSM Tree at path: %s\n", DB_PATH.c_str());
     try {
-        lsm_tree_ptr = std::make_unique<LSMTree>(
-            DB_PATH
+        // one shard per core, each with its own buffer, flusher and compactor
+        lsm_tree_ptr = std::make_unique<ShardedLSMTree>(
+            DB_PATH, std::max(1u, std::thread::hardware_concurrency())
         );
         log_info("[SERVER INIT] LSM Tree initialized successfully.\n");
     } catch (const std::exception& e) {
@@ -349,89 +626,175 @@ int main(void)
     log_info("[SERVER] Server socket %d established, listening on %s\n", server_socket, SOCK_PATH);
 
     
-    std::set<int> clientSockets;
-    // fd_set bitmap manages set of fds when using select in multiplexing
-    fd_set read_fds;
-    // update max_fd always to current max fd number
-    int max_fd = server_socket;
-
-    // TODO: implement multiplexing here
-    while (true) {
-        FD_ZERO(&read_fds);
-        FD_SET(server_socket, &read_fds);
+    // workers run execute_DbOperator so a LOAD or stats dump only holds up its own client
+    size_t num_workers = std::max(1u, std::thread::hardware_concurrency());
+    auto workers = std::make_unique<ThreadPool>(num_workers);
+    log_info("[SERVER] Started %zu worker threads.\n", num_workers);
+
+    int epoll_fd = epoll_create1(0);
+    completion_event_fd = eventfd(0, EFD_NONBLOCK);
+    int signal_fd = signalfd(-1, &shutdown_signals, SFD_NONBLOCK);
+    if (epoll_fd < 0 || completion_event_fd < 0 || signal_fd < 0 || set_nonblocking(server_socket) == -1) {
+        log_err("[SERVER] Failed to set up epoll: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
 
-        max_fd = server_socket;
-        // add active client sockets to read_fds
-        for (int client_sock : clientSockets) {
-            FD_SET(client_sock, &read_fds);
-            max_fd = std::max(max_fd, client_sock);
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = server_socket;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_socket, &ev);
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = completion_event_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, completion_event_fd, &ev);
+    ev.events = EPOLLIN;
+    ev.data.fd = signal_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev);
+
+    std::unordered_map<int, Connection> connections;
+    // ids tell a late completion apart from a new client that reused the fd
+    uint64_t next_conn_id = 1;
+
+    auto close_connection = [&](int client_socket) {
+        auto conn_it = connections.find(client_socket);
+        if (conn_it != connections.end()) {
+            // stops any reply still streaming to it
+            conn_it->second.stream->close();
         }
-
-        // use select to get all socket fds that can be read
-        int activity = select(max_fd + 1, &read_fds, NULL, NULL, NULL);
-
-        if (activity < 0 && errno != EINTR) {
-            log_err("[SERVER] select() error: %s\n", strerror(errno));
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_socket, NULL);
+        close(client_socket);
+        connections.erase(client_socket);
+        log_info("[SERVER] Closed and removed client socket %d\n", client_socket);
+    };
+
+    // flush pending output, keep EPOLLOUT armed only while output is pending
+    auto update_connection = [&](Connection& conn) {
+        if (!flush_connection(conn)) {
+            close_connection(conn.fd);
+            return;
+        }
+        struct epoll_event conn_ev;
+        conn_ev.events = EPOLLIN | EPOLLET;
+        if (!conn.out_buffer.empty()) {
+            conn_ev.events |= EPOLLOUT;
+        }
+        conn_ev.data.fd = conn.fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn.fd, &conn_ev);
+    };
+
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    bool running = true;
+    while (running) {
+        int ready = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_err("[SERVER] epoll_wait() error: %s\n", strerror(errno));
             break;
         }
-         if (activity == 0) {
-             continue;
-         }
 
+        for (int i = 0; i < ready; ++i) {
+            int fd = events[i].data.fd;
+
+            if (fd == server_socket) {
+                // New client connections, accept until the backlog is empty
+                while (true) {
+                    // note to self: unix socket only works for IPC on the same machine
+                    struct sockaddr_un client_addr;
+                    socklen_t socket_sz = sizeof(client_addr);
+                    int client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &socket_sz);
+                    if (client_socket < 0) {
+                        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                            log_err("[SERVER] Failed to accept new client connection: %s\n", strerror(errno));
+                        }
+                        if (errno == EINTR) {
+                            continue;
+                        }
+                        break;
+                    }
+                    set_nonblocking(client_socket);
+                    struct epoll_event client_ev;
+                    client_ev.events = EPOLLIN | EPOLLET;
+                    client_ev.data.fd = client_socket;
+                    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket, &client_ev);
+
+                    Connection conn;
+                    conn.fd = client_socket;
+                    conn.id = next_conn_id++;
+                    connections[client_socket] = std::move(conn);
+                    log_info("[SERVER] Accepted new client connection on socket %d.\n", client_socket);
+                }
 
-        // New client connection if server socket is ready
-        if (FD_ISSET(server_socket, &read_fds)) {
-            // note to self: unix socket only works for IPC on the same machine
-            struct sockaddr_un client_addr;
-            socklen_t socket_sz = sizeof(client_addr);
-            int client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &socket_sz);
+            } else if (fd == signal_fd) {
+                struct signalfd_siginfo siginfo;
+                if (read(signal_fd, &siginfo, sizeof(siginfo)) == sizeof(siginfo)) {
+                    log_info("[SERVER] Received signal %u, shutting down.\n", siginfo.ssi_signo);
+                    running = false;
+                }
+
+            } else if (fd == completion_event_fd) {
+                uint64_t signals;
+                while (read(completion_event_fd, &signals, sizeof(signals)) > 0) {}
+
+                std::vector<Completion> finished;
+                {
+                    std::lock_guard<std::mutex> lock(completions_mutex);
+                    finished.swap(completions);
+                }
+                for (auto& completion : finished) {
+                    auto conn_it = connections.find(completion.fd);
+                    // client went away while its request ran
+                    if (conn_it == connections.end() || conn_it->second.id != completion.conn_id) {
+                        continue;
+                    }
+                    Connection& conn = conn_it->second;
+                    conn.out_buffer += completion.response;
+                    conn.requests_in_flight -= completion.num_requests;
+                    if (completion.was_write) {
+                        conn.write_in_flight = false;
+                    }
+                    // requests held back by ordering or the in-flight cap can start now
+                    if (!dispatch_requests(conn, *workers)) {
+                        close_connection(conn.fd);
+                        continue;
+                    }
+                    update_connection(conn);
+                }
 
-            if (client_socket < 0) {
-                log_err("[SERVER] Failed to accept new client connection: %s\n", strerror(errno));
             } else {
-                log_info("[SERVER] Accepted new client connection on socket %d.\n", client_socket);
-                clientSockets.insert(client_socket);
-            }
-        }
+                auto conn_it = connections.find(fd);
+                if (conn_it == connections.end()) {
+                    continue;
+                }
+                Connection& conn = conn_it->second;
 
-        // all all ready client sockets (Removed redundant inner loop)
-
-        // check all ready client sockets
-        std::vector<int> clients_to_remove;
-        for (int client_socket : clientSockets) {
-            if (FD_ISSET(client_socket, &read_fds)) {
-                // check for closed
-                char buffer;
-                ssize_t peek_len = recv(client_socket, &buffer, 1, MSG_PEEK | MSG_DONTWAIT);
-
-                if (peek_len == 0) {
-                    log_info("[SERVER] Client disconnected (detected by peek): socket %d\n", client_socket);
-                    clients_to_remove.push_back(client_socket);
-                } else if (peek_len < 0) {
-                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                         log_info("[SERVER] Warning: Spurious wakeup or no data on ready socket %d?\n", client_socket);
-                    } else {
-                        log_err("[SERVER] Error peeking on socket %d: %s\n", client_socket, strerror(errno));
-                        clients_to_remove.push_back(client_socket);
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    close_connection(fd);
+                    continue;
+                }
+                if (events[i].events & EPOLLIN) {
+                    if (!read_connection(conn) || !dispatch_requests(conn, *workers)) {
+                        close_connection(fd);
+                        continue;
                     }
-                } else {
-                    handle_client_request(client_socket);
                 }
+                update_connection(conn);
             }
         }
-
-        for (int client_socket : clients_to_remove) {
-            close(client_socket);
-            clientSockets.erase(client_socket);
-            log_info("[SERVER] Closed and removed client socket %d\n", client_socket);
-        }
-
     }
 
     log_info("[SERVER] Shutting down...\n");
-    for (int client_socket : clientSockets) {
-        close(client_socket);
+    for (auto& conn_entry : connections) {
+        conn_entry.second.stream->close();
+        close(conn_entry.first);
     }
+    // requests already handed to workers finish before the tree goes away, replies are dropped
+    workers.reset();
+    // waits for the flusher and compactions, then persists the buffer
+    lsm_tree_ptr.reset();
+    close(signal_fd);
+    close(completion_event_fd);
+    close(epoll_fd);
     if (server_socket >= 0) {
         close(server_socket);
         unlink(SOCK_PATH);
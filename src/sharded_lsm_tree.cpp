@@ -0,0 +1,433 @@
+#include "sharded_lsm_tree.hh"
+#include <iostream>
+#include <queue>
+#include <future>
+
+/**
+ * ShardedLSMTree methods
+ *
+ */
+ShardedLSMTree::ShardedLSMTree(const std::string& db_path,
+                               size_t num_shards,
+                               size_t buffer_capacity,
+                               size_t base_level_table_capacity,
+                               size_t total_levels,
+                               size_t level_size_ratio) {
+    this->db_path_ = db_path;
+    std::error_code ec;
+    std::filesystem::create_directories(db_path_, ec);
+
+    // the shard count is fixed when the database is created, a tree that predates
+    // sharding has its history right in db_path and stays a single shard
+    std::string shards_path = db_path_ + "/shards";
+    size_t stored_shards = 0;
+    std::ifstream shards_file(shards_path);
+    if (shards_file >> stored_shards && stored_shards > 0) {
+        if (stored_shards != num_shards) {
+            std::cout << "[ShardedLSMTree] " << db_path_ << " was created with " << stored_shards
+                      << " shards, using those instead of " << num_shards << std::endl;
+        }
+        num_shards = stored_shards;
+    } else {
+        if (std::filesystem::exists(db_path_ + "/history")) {
+            num_shards = 1;
+        }
+        num_shards = std::max<size_t>(num_shards, 1);
+        // written next to it and renamed over, a crash mid-write must not leave a wrong count
+        std::string tmp_path = shards_path + ".tmp";
+        std::ofstream out(tmp_path, std::ios::trunc);
+        out << num_shards << "\n";
+        out.close();
+        std::error_code rename_ec;
+        if (!out.fail()) {
+            std::filesystem::rename(tmp_path, shards_path, rename_ec);
+        }
+        if (out.fail() || rename_ec) {
+            std::cerr << "[ShardedLSMTree] can't record the shard count in " << shards_path << std::endl;
+            std::filesystem::remove(tmp_path, rename_ec);
+        }
+    }
+
+    this->range_pool_ = std::make_shared<ThreadPool>(std::thread::hardware_concurrency());
+    shards_.reserve(num_shards);
+    for (size_t i = 0; i < num_shards; ++i) {
+        std::string shard_path = num_shards == 1 ? db_path_ : db_path_ + "/shard_" + std::to_string(i);
+        shards_.push_back(std::make_unique<LSMTree>(shard_path, buffer_capacity, base_level_table_capacity,
+                                                    total_levels, level_size_ratio, range_pool_));
+    }
+    if (num_shards > 1) {
+        this->shard_pool_ = std::make_unique<ThreadPool>(num_shards);
+    }
+    std::cout << "[ShardedLSMTree] Opened " << num_shards << " shard(s) in " << db_path_ << std::endl;
+}
+
+ShardedLSMTree::~ShardedLSMTree() {
+    shutdown();
+}
+
+void ShardedLSMTree::shutdown() {
+    // each shard waits on its own flusher and compactions, no reason to do that in turn
+    std::vector<std::thread> shutdown_threads;
+    shutdown_threads.reserve(shards_.size());
+    for (auto& shard_ptr : shards_) {
+        LSMTree* tree = shard_ptr.get();
+        shutdown_threads.emplace_back([tree]() { tree->shutdown(); });
+    }
+    for (auto& shutdown_thread : shutdown_threads) {
+        shutdown_thread.join();
+    }
+}
+
+size_t ShardedLSMTree::numShards() const {
+    return shards_.size();
+}
+
+size_t ShardedLSMTree::shardFor(int key) const {
+    // Fibonacci hash spreads sequential keys, then multiply-shift maps it onto the shards
+    uint32_t hash = static_cast<uint32_t>(key) * 0x9E3779B1u;
+    return static_cast<size_t>((static_cast<uint64_t>(hash) * shards_.size()) >> 32);
+}
+
+LSMTree& ShardedLSMTree::shard(size_t index) {
+    return *shards_[index];
+}
+
+bool ShardedLSMTree::putData(const DataPair& data) {
+    return shards_[shardFor(data.key_)]->putData(data);
+}
+
+std::optional<DataPair> ShardedLSMTree::getData(int key) {
+    return shards_[shardFor(key)]->getData(key);
+}
+
+std::vector<DataPair> ShardedLSMTree::rangeData(int low, int high) {
+    if (shards_.size() == 1) {
+        return shards_[0]->rangeData(low, high);
+    }
+    std::vector<std::future<std::vector<DataPair>>> shard_futures;
+    shard_futures.reserve(shards_.size());
+    for (auto& shard_ptr : shards_) {
+        LSMTree* tree = shard_ptr.get();
+        shard_futures.push_back(shard_pool_->submit([tree, low, high]() {
+            return tree->rangeData(low, high);
+        }));
+    }
+    std::vector<std::vector<DataPair>> shard_results;
+    shard_results.reserve(shards_.size());
+    size_t total_results = 0;
+    for (auto& shard_future : shard_futures) {
+        shard_results.push_back(shard_future.get());
+        total_results += shard_results.back().size();
+    }
+
+    // every shard's result is in key order and no key is in two shards: a k-way merge
+    std::vector<DataPair> final_results;
+    final_results.reserve(total_results);
+    std::vector<size_t> positions(shard_results.size(), 0);
+    // smallest key on top, with the shard it came from
+    std::priority_queue<std::pair<int, size_t>, std::vector<std::pair<int, size_t>>,
+                        std::greater<std::pair<int, size_t>>> heap;
+    for (size_t i = 0; i < shard_results.size(); ++i) {
+        if (!shard_results[i].empty()) {
+            heap.push({shard_results[i][0].key_, i});
+        }
+    }
+    while (!heap.empty()) {
+        size_t shard_index = heap.top().second;
+        heap.pop();
+        final_results.push_back(shard_results[shard_index][positions[shard_index]++]);
+        if (positions[shard_index] < shard_results[shard_index].size()) {
+            heap.push({shard_results[shard_index][positions[shard_index]].key_, shard_index});
+        }
+    }
+    return final_results;
+}
+
+bool ShardedLSMTree::deleteData(int key) {
+    return shards_[shardFor(key)]->deleteData(key);
+}
+
+bool ShardedLSMTree::deleteRange(int low, int high) {
+    bool rt = true;
+    for (auto& shard_ptr : shards_) {
+        rt = shard_ptr->deleteRange(low, high) && rt;
+    }
+    return rt;
+}
+
+bool ShardedLSMTree::mergeData(int key, int operand) {
+    return shards_[shardFor(key)]->mergeData(key, operand);
+}
+
+void ShardedLSMTree::setMergeOperator(MergeOperator merge_operator) {
+    for (auto& shard_ptr : shards_) {
+        shard_ptr->setMergeOperator(merge_operator);
+    }
+}
+
+bool ShardedLSMTree::writeBatch(const WriteBatch& batch) {
+    if (shards_.size() == 1) {
+        return shards_[0]->writeBatch(batch);
+    }
+    // order within a shard is kept, so a later write to a key still wins
+    std::vector<WriteBatch> shard_batches(shards_.size());
+    for (const DataPair& data : batch.entries_) {
+        shard_batches[shardFor(data.key_)].entries_.push_back(data);
+    }
+    bool rt = true;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        if (!shard_batches[i].empty()) {
+            rt = shards_[i]->writeBatch(shard_batches[i]) && rt;
+        }
+    }
+    return rt;
+}
+
+/**
+ * bulk ingestion
+ */
+
+// runs load(i) for every shard on its own thread and tallies the outcome; loads hold a
+// thread for seconds, so they stay off shard_pool_ where range queries would queue behind them
+template <typename LoadFn>
+static ShardedLoadResult loadShardsInParallel(size_t num_shards, LoadFn load) {
+    std::vector<char> applied(num_shards, 0);
+    std::vector<size_t> shard_pairs(num_shards, 0);
+    std::vector<std::thread> load_threads;
+    load_threads.reserve(num_shards);
+    for (size_t i = 0; i < num_shards; ++i) {
+        load_threads.emplace_back([&, i]() { applied[i] = load(i, &shard_pairs[i]) ? 1 : 0; });
+    }
+    for (auto& load_thread : load_threads) {
+        load_thread.join();
+    }
+    ShardedLoadResult result;
+    for (size_t i = 0; i < num_shards; ++i) {
+        if (applied[i]) {
+            result.shards_applied++;
+            result.pairs_loaded += shard_pairs[i];
+        } else {
+            result.shards_failed++;
+        }
+    }
+    result.ok = result.shards_failed == 0;
+    return result;
+}
+
+ShardedLoadResult ShardedLSMTree::bulkLoad(const std::string& file_path) {
+    ShardedLoadResult result;
+    if (shards_.size() == 1) {
+        result.ok = shards_[0]->bulkLoad(file_path, &result.pairs_loaded);
+        result.shards_applied = result.ok ? 1 : 0;
+        result.shards_failed = result.ok ? 0 : 1;
+        return result;
+    }
+    result.shards_failed = shards_.size();
+    std::ifstream infile(file_path, std::ios::binary);
+    if (!infile) {
+        std::cerr << "[ShardedLSMTree::bulkLoad] can't open " << file_path << std::endl;
+        return result;
+    }
+    std::string part_prefix = db_path_ + "/bulk_load_" + std::to_string(next_part_id_.fetch_add(1)) + "_";
+    std::vector<std::string> part_paths;
+    std::vector<std::ofstream> parts;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        part_paths.push_back(part_prefix + std::to_string(i) + ".tmp");
+        parts.emplace_back(part_paths.back(), std::ios::binary | std::ios::trunc);
+    }
+    auto remove_parts = [&]() {
+        for (const auto& part_path : part_paths) {
+            std::error_code ec;
+            std::filesystem::remove(part_path, ec);
+        }
+    };
+
+    // pairs keep their file order within each part, so the last pair of a key still wins
+    std::vector<int32_t> block(2 * 65536);
+    bool whole_pairs = true;
+    while (infile) {
+        infile.read(reinterpret_cast<char*>(block.data()), block.size() * sizeof(int32_t));
+        size_t bytes_read = static_cast<size_t>(infile.gcount());
+        if (bytes_read % (2 * sizeof(int32_t)) != 0) {
+            whole_pairs = false;
+            break;
+        }
+        for (size_t i = 0; i < bytes_read / sizeof(int32_t); i += 2) {
+            parts[shardFor(block[i])].write(reinterpret_cast<const char*>(&block[i]), 2 * sizeof(int32_t));
+        }
+    }
+    bool parts_ok = true;
+    for (auto& part : parts) {
+        part.close();
+        parts_ok = parts_ok && !part.fail();
+    }
+    if (!whole_pairs || !parts_ok) {
+        std::cerr << "[ShardedLSMTree::bulkLoad] " << file_path
+                  << (whole_pairs ? ": failed to split by shard" : " is not a whole number of key,value pairs")
+                  << std::endl;
+        remove_parts();
+        return result;
+    }
+
+    result = loadShardsInParallel(shards_.size(), [&](size_t i, size_t* shard_pairs) {
+        return shards_[i]->bulkLoad(part_paths[i], shard_pairs);
+    });
+    if (result.partial()) {
+        std::cerr << "[ShardedLSMTree::bulkLoad] " << result.shards_failed << " of " << shards_.size()
+                  << " shards failed to load their part of " << file_path << ", the others are loaded" << std::endl;
+    }
+    remove_parts();
+    return result;
+}
+
+ShardedLoadResult ShardedLSMTree::ingestFiles(const std::vector<std::string>& file_paths) {
+    ShardedLoadResult result;
+    if (shards_.size() == 1) {
+        result.ok = shards_[0]->ingestFiles(file_paths);
+        result.shards_applied = result.ok ? 1 : 0;
+        result.shards_failed = result.ok ? 0 : 1;
+        return result;
+    }
+    result.shards_failed = shards_.size();
+    uint64_t part_id = next_part_id_.fetch_add(1);
+    std::vector<std::vector<std::string>> shard_files(shards_.size());
+    auto remove_files = [](const std::vector<std::string>& paths) {
+        for (const auto& path : paths) {
+            std::error_code ec;
+            std::filesystem::remove(path, ec);
+            std::filesystem::remove(path + ".bf", ec);
+            std::filesystem::remove(path + ".meta", ec);
+        }
+    };
+    auto remove_parts = [&]() {
+        for (const auto& part_paths : shard_files) {
+            remove_files(part_paths);
+        }
+    };
+
+    // 1. one table per shard and file, keys stay ascending and files stay disjoint
+    for (size_t file_index = 0; file_index < file_paths.size(); ++file_index) {
+        SSTable table(0, file_paths[file_index], file_paths[file_index] + ".bf");
+        if (!table.ensureLoaded() || (table.table_data_.empty() && table.range_tombstones_.empty())) {
+            std::cerr << "[ShardedLSMTree::ingestFiles] " << file_paths[file_index]
+                      << " is missing, empty or malformed" << std::endl;
+            remove_parts();
+            return result;
+        }
+        std::vector<std::vector<DataPair>> shard_data(shards_.size());
+        for (const DataPair& data : table.table_data_) {
+            shard_data[shardFor(data.key_)].push_back(data);
+        }
+        // a range tombstone goes to every shard owning a key in it; hashing spreads keys,
+        // so a wide range reaches all shards after a few keys
+        std::vector<std::vector<RangeTombstone>> shard_tombstones(shards_.size());
+        for (const RangeTombstone& tombstone : table.range_tombstones_) {
+            std::vector<bool> owns(shards_.size(), false);
+            size_t owners = 0;
+            for (int64_t key = tombstone.low; key < tombstone.high && owners < shards_.size(); ++key) {
+                size_t shard_index = shardFor(static_cast<int>(key));
+                if (!owns[shard_index]) {
+                    owns[shard_index] = true;
+                    owners++;
+                    shard_tombstones[shard_index].push_back(tombstone);
+                }
+            }
+        }
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            if (shard_data[i].empty() && shard_tombstones[i].empty()) {
+                continue;
+            }
+            std::string part_path = db_path_ + "/ingest_" + std::to_string(part_id) + "_" + std::to_string(i) +
+                                    "_" + std::to_string(file_index) + ".tmp";
+            SSTable part(shard_data[i], 0, part_path, part_path + ".bf", 0, shard_tombstones[i]);
+            shard_files[i].push_back(part_path);
+        }
+    }
+
+    // 2. each shard moves its parts in; a shard without parts has nothing to fail
+    std::vector<char> shard_applied(shards_.size(), 0);
+    result = loadShardsInParallel(shards_.size(), [&](size_t i, size_t*) {
+        shard_applied[i] = shard_files[i].empty() || shards_[i]->ingestFiles(shard_files[i]);
+        return shard_applied[i] != 0;
+    });
+    if (result.ok) {
+        // moved parts are gone already
+        remove_parts();
+        remove_files(file_paths);
+        return result;
+    }
+    if (result.shards_applied == 0) {
+        // nothing went in, the caller's files are still the whole batch
+        remove_parts();
+        return result;
+    }
+    // partial: the originals would ingest the applied shards twice, the failed shards' parts
+    // are exactly what is missing
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        if (shard_applied[i]) {
+            remove_files(shard_files[i]);
+        } else {
+            result.retry_files.insert(result.retry_files.end(), shard_files[i].begin(), shard_files[i].end());
+        }
+    }
+    remove_files(file_paths);
+    std::cerr << "[ShardedLSMTree::ingestFiles] " << result.shards_failed << " of " << shards_.size()
+              << " shards failed to ingest, their parts are kept for a retry" << std::endl;
+    return result;
+}
+
+MetricsSnapshot ShardedLSMTree::getMetrics() const {
+    MetricsSnapshot metrics;
+    for (const auto& shard_ptr : shards_) {
+        metrics.merge(shard_ptr->getMetrics());
+    }
+    return metrics;
+}
+
+TuningAdvice ShardedLSMTree::tune(bool apply) {
+    if (shards_.size() == 1) {
+        return shards_[0]->tune(apply);
+    }
+    std::lock_guard<std::mutex> lock(tuning_mutex_);
+    WorkloadStats workload = WorkloadStats::fromMetrics(getMetrics());
+    size_t entries = 0;
+    for (const auto& shard_ptr : shards_) {
+        entries += shard_ptr->diskEntries();
+    }
+    // hashed keys give each shard the same mix, and so the same best targets
+    TuningAdvice advice = adviseTuning(workload.since(tuning_baseline_), shards_[0]->tuningConfig(),
+                                       entries / shards_.size(), shards_[0]->levels_.size());
+    if (apply) {
+        for (auto& shard_ptr : shards_) {
+            shard_ptr->applyTuning(advice.recommended);
+        }
+        tuning_baseline_ = workload;
+        advice.applied = true;
+    }
+    return advice;
+}
+
+std::string ShardedLSMTree::print_stats() {
+    if (shards_.size() == 1) {
+        return shards_[0]->print_stats();
+    }
+    std::stringstream result_ss;
+    result_ss << "Shards: " << shards_.size();
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        result_ss << "\n\nShard " << i << "\n" << shards_[i]->print_stats();
+    }
+    return result_ss.str();
+}
+
+bool ShardedLSMTree::dumpAll(const std::function<bool(const std::string&)>& emit_chunk, size_t chunk_bytes) {
+    if (shards_.size() == 1) {
+        return shards_[0]->dumpAll(emit_chunk, chunk_bytes);
+    }
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        std::string header = (i == 0 ? "" : "\n") + std::string("Shard ") + std::to_string(i) + "\n";
+        if (!emit_chunk(header) || !shards_[i]->dumpAll(emit_chunk, chunk_bytes)) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,61 @@
+#include <lsm_tree.hh>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+
+// builds an SSTable (plus its .bf) offline, for LSMTree::ingestFiles / the 'i' command
+// input is the LOAD format: int32 key, int32 value pairs; the last pair of a key wins
+// usage: ./sst_writer <input.bin> <output.sst>
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        std::cerr << "usage: " << argv[0] << " <input.bin> <output.sst>" << std::endl;
+        return 1;
+    }
+    const std::string input_path = argv[1];
+    const std::string output_path = argv[2];
+
+    std::ifstream input(input_path, std::ios::binary | std::ios::ate);
+    if (!input) {
+        std::cerr << "[sst_writer] can't open " << input_path << std::endl;
+        return 1;
+    }
+    std::streamsize file_size = input.tellg();
+    input.seekg(0, std::ios::beg);
+    if (file_size <= 0 || file_size % (2 * sizeof(int32_t)) != 0) {
+        std::cerr << "[sst_writer] " << input_path << " must hold a non-zero number of 8-byte key-value pairs" << std::endl;
+        return 1;
+    }
+
+    std::vector<std::pair<int32_t, int32_t>> pairs(file_size / (2 * sizeof(int32_t)));
+    if (!input.read(reinterpret_cast<char*>(pairs.data()), file_size)) {
+        std::cerr << "[sst_writer] read error on " << input_path << std::endl;
+        return 1;
+    }
+
+    // stable, so equal keys stay in file order and the last one is kept
+    std::stable_sort(pairs.begin(), pairs.end(), [](const auto& a, const auto& b) {
+        return a.first < b.first;
+    });
+    std::vector<DataPair> table_data;
+    table_data.reserve(pairs.size());
+    for (const auto& pair : pairs) {
+        if (!table_data.empty() && table_data.back().key_ == pair.first) {
+            table_data.back().value_ = pair.second;
+        } else {
+            // seq 0, the tree assigns the ingest seq
+            table_data.emplace_back(pair.first, pair.second, false, 0);
+        }
+    }
+
+    try {
+        // the constructor writes the table and output_path + ".bf"
+        SSTable table(table_data, 0, output_path, output_path + ".bf");
+        std::cout << "[sst_writer] wrote " << table.size_ << " keys [" << table.min_key_ << ", "
+                  << table.max_key_ << "] to " << output_path << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "[sst_writer] failed to write " << output_path << ": " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
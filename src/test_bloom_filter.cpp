@@ -21,5 +21,12 @@ int main() {
         }
     }
 
+    // a flush holding only range tombstones builds a filter for no keys
+    BloomFilter empty_filter(0, fp_rate);
+    if (empty_filter.might_contain(1)) {
+        std::cout << "Empty filter claims key 1." << std::endl;
+        return 1;
+    }
+
     return 0;
 }
\ No newline at end of file
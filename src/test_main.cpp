@@ -1,4 +1,5 @@
 #include "lsm_tree.hh"
+#include "sharded_lsm_tree.hh"
 #include <iostream>
 #include <vector>
 #include <cassert>
@@ -7,6 +8,10 @@
 #include <limits>
 #include <filesystem>
 #include <system_error>
+#include <fstream>
+#include <functional>
+#include <cmath>
+#include <future>
 
 // Define a temporary directory for SSTable unit tests
 const std::string TEMP_SSTABLE_DIR = "test_sstable_temp_files";
@@ -262,24 +267,24 @@ void test_buffer() {
     // 1. test create buffer with default capacity
     Buffer buffer; // Uses default capacity defined in lsm_tree.hh
     // assert(buffer.capacity_ == BUFFER_CAPACITY); // Check against definition if needed
-    assert(buffer.cur_size_ == 0);
+    assert(buffer.buffer_data_.size() == 0);
     std::cout << "Buffer constructor tests PASSED." << std::endl;
 
     // 2. test add data to buffer
     buffer.putData(DataPair(1, 10));
-    assert(buffer.cur_size_ == 1);
-    assert(!buffer.buffer_data_.empty() && buffer.buffer_data_[0].key_ == 1);
+    assert(buffer.buffer_data_.size() == 1);
+    assert(!buffer.buffer_data_.empty() && std::next(buffer.buffer_data_.begin(), 0)->second.key_ == 1);
     buffer.putData(DataPair(3, 30)); // Insert out of order
-    assert(buffer.cur_size_ == 2);
     assert(buffer.buffer_data_.size() == 2);
-    assert(buffer.buffer_data_[0].key_ == 1); // Should be sorted
-    assert(buffer.buffer_data_[1].key_ == 3);
+    assert(buffer.buffer_data_.size() == 2);
+    assert(std::next(buffer.buffer_data_.begin(), 0)->second.key_ == 1); // Should be sorted
+    assert(std::next(buffer.buffer_data_.begin(), 1)->second.key_ == 3);
     buffer.putData(DataPair(2, 20)); // Insert in middle
-    assert(buffer.cur_size_ == 3);
     assert(buffer.buffer_data_.size() == 3);
-    assert(buffer.buffer_data_[0].key_ == 1);
-    assert(buffer.buffer_data_[1].key_ == 2);
-    assert(buffer.buffer_data_[2].key_ == 3);
+    assert(buffer.buffer_data_.size() == 3);
+    assert(std::next(buffer.buffer_data_.begin(), 0)->second.key_ == 1);
+    assert(std::next(buffer.buffer_data_.begin(), 1)->second.key_ == 2);
+    assert(std::next(buffer.buffer_data_.begin(), 2)->second.key_ == 3);
     std::cout << "Buffer putData (and sorting) tests PASSED." << std::endl;
 
     // 3. test get data from buffer
@@ -299,7 +304,7 @@ void test_buffer() {
     // 4. test put same key in buffer (update)
     assert(buffer.getData(1).value().value_ == 10);
     buffer.putData(DataPair(1, 100));
-    assert(buffer.cur_size_ == 3);
+    assert(buffer.buffer_data_.size() == 3);
     assert(buffer.getData(1).value().value_ == 100);
     std::cout << "Buffer put same key (update) tests PASSED." << std::endl;
 }
@@ -329,7 +334,7 @@ void test_lsm_tree() {
                 << ", LevelRatio=" << TEST_LEVEL_RATIO << std::endl;
 
     // Check initial state
-    assert(lsm_tree.buffer_->cur_size_ == 0);
+    assert(lsm_tree.buffer_->buffer_data_.size() == 0);
 
     for(size_t i = 0; i < total_levels; ++i) { assert(lsm_tree.levels_[i]->cur_table_count_ == 0); }
 
@@ -346,7 +351,7 @@ void test_lsm_tree() {
     // wait 2 seconds to test buffer flush
     std::this_thread::sleep_for(std::chrono::seconds(1));
 
-    assert(lsm_tree.buffer_->cur_size_ == 0);
+    assert(lsm_tree.buffer_->buffer_data_.size() == 0);
 
     std::cout << "353" << std::endl;
 
@@ -355,18 +360,20 @@ void test_lsm_tree() {
 
     lsm_tree.putData({3, 300}); // {3}
     std::this_thread::sleep_for(std::chrono::seconds(1));
-    assert(lsm_tree.buffer_->cur_size_ == 1);
+    assert(lsm_tree.buffer_->buffer_data_.size() == 1);
     lsm_tree.putData({4, 400}); // {}, l0 has 0 tables, l1 has 1 table
 
     std::cout << "355" << std::endl;
 
     std::this_thread::sleep_for(std::chrono::seconds(1));
-    assert(lsm_tree.buffer_->cur_size_ == 0); 
+    assert(lsm_tree.buffer_->buffer_data_.size() == 0); 
     assert(lsm_tree.levels_[0]->cur_table_count_ == 0);
     assert(lsm_tree.levels_[1]->cur_table_count_ == 1);
 
     lsm_tree.putData({5, 500}); // {5}
     lsm_tree.putData({6, 600}); // {}, l0 has 1 table, l1 has 2 tables
+    // like the steps above, let the flusher take {5, 6} before 7 and 8 arrive
+    std::this_thread::sleep_for(std::chrono::seconds(1));
 
     std::cout << "373" << std::endl;
 
@@ -391,6 +398,1417 @@ void test_lsm_tree() {
      std::cout << "Cleaned up test directory: " << lsm_test_dir << std::endl;
 }
 
+// range iterator tests
+void test_range_iterator() {
+    std::cout << "[TEST] testing range iterator ------------" << std::endl;
+    const std::string lsm_test_dir = "test_db_iterator";
+    remove_temp_dir(lsm_test_dir);
+    {
+        // large buffer so only our explicit flushes create SSTables
+        LSMTree lsm_tree(lsm_test_dir, 100, 4, 3, 2);
+
+        // older run: keys 0..18 even
+        for (int k = 0; k < 20; k += 2) { lsm_tree.putData({k, k * 10}); }
+        lsm_tree.flushBufferHelper();
+        // newer run: overwrite 4, delete 6, add odd keys 1..9
+        lsm_tree.putData({4, 444});
+        lsm_tree.deleteData(6);
+        for (int k = 1; k < 10; k += 2) { lsm_tree.putData({k, k * 10}); }
+        lsm_tree.flushBufferHelper();
+        // buffer: overwrite 8, delete 1
+        lsm_tree.putData({8, 888});
+        lsm_tree.deleteData(1);
+        assert(lsm_tree.levels_[0]->cur_table_count_ == 2);
+
+        std::vector<int> keys;
+        for (LSMIterator it = lsm_tree.newIterator(0, 10); it.valid(); it.next()) {
+            keys.push_back(it.key());
+            if (it.key() == 4) { assert(it.value() == 444); }
+            if (it.key() == 8) { assert(it.value() == 888); }
+        }
+        assert((keys == std::vector<int>{0, 2, 3, 4, 5, 7, 8, 9}));
+        assert(lsm_tree.rangeData(0, 10).size() == keys.size());
+        std::cout << "Iterator merge, override and tombstone tests PASSED." << std::endl;
+
+        // page through [0, 20) three pairs at a time
+        std::vector<int> paged_keys;
+        int next_low = 0;
+        while (true) {
+            size_t page_size = 0;
+            for (LSMIterator it = lsm_tree.newIterator(next_low, 20, 3); it.valid(); it.next()) {
+                paged_keys.push_back(it.key());
+                next_low = it.key() + 1;
+                page_size++;
+            }
+            if (page_size < 3) { break; }
+        }
+        std::vector<DataPair> full_range = lsm_tree.rangeData(0, 20);
+        assert(paged_keys.size() == full_range.size());
+        for (size_t i = 0; i < full_range.size(); ++i) {
+            assert(paged_keys[i] == full_range[i].key_);
+        }
+
+        // seek repositions inside the same iterator
+        LSMIterator it = lsm_tree.newIterator(0, 20);
+        it.seek(11);
+        assert(it.valid() && it.key() == 12);
+        std::cout << "Iterator limit and seek tests PASSED." << std::endl;
+    }
+    remove_temp_dir(lsm_test_dir);
+}
+
+// parallel range scan tests
+void test_parallel_range() {
+    std::cout << "[TEST] testing parallel range ------------" << std::endl;
+    const std::string lsm_test_dir = "test_db_parallel_range";
+    remove_temp_dir(lsm_test_dir);
+    {
+        LSMTree lsm_tree(lsm_test_dir, 5000, 4, 3, 2);
+        // three overlapping runs, newer runs overwrite every third key
+        for (int run = 0; run < 3; ++run) {
+            for (int k = run; k < 3000; k += 1 + run) {
+                lsm_tree.putData({k, k * 10 + run});
+            }
+            lsm_tree.flushBufferHelper();
+        }
+        for (int k = 0; k < 3000; k += 7) { lsm_tree.deleteData(k); }
+
+        // sequential merge is the reference
+        std::vector<DataPair> expected;
+        for (LSMIterator it = lsm_tree.newIterator(-5, 2990); it.valid(); it.next()) {
+            expected.push_back(it.current());
+        }
+
+        // fixed pool size so the split happens regardless of core count
+        lsm_tree.range_partition_min_entries_ = 100;
+        lsm_tree.range_pool_ = std::make_unique<ThreadPool>(4);
+        std::shared_ptr<const Version> version;
+        std::vector<RunIterator> runs = lsm_tree.collectRuns(-5, 2990, &version);
+        std::vector<int> bounds = lsm_tree.partitionRange(runs, -5, 2990);
+        assert(bounds.size() == 5);
+        for (size_t i = 1; i < bounds.size(); ++i) { assert(bounds[i - 1] < bounds[i]); }
+        assert(bounds.front() == -5 && bounds.back() == 2990);
+
+        std::vector<DataPair> parallel = lsm_tree.rangeData(-5, 2990);
+        assert(parallel.size() == expected.size());
+        for (size_t i = 0; i < expected.size(); ++i) {
+            assert(parallel[i].key_ == expected[i].key_);
+            assert(parallel[i].value_ == expected[i].value_);
+        }
+        std::cout << "Parallel range partition and merge tests PASSED." << std::endl;
+    }
+    remove_temp_dir(lsm_test_dir);
+}
+
+// snapshot (MVCC) tests
+void test_snapshot() {
+    std::cout << "[TEST] testing snapshots ------------" << std::endl;
+    const std::string lsm_test_dir = "test_db_snapshot";
+    remove_temp_dir(lsm_test_dir);
+    {
+        LSMTree lsm_tree(lsm_test_dir, 100, 2, 3, 1);
+
+        lsm_tree.putData({1, 10});
+        lsm_tree.putData({2, 20});
+        lsm_tree.putData({3, 30});
+        std::shared_ptr<Snapshot> snap = lsm_tree.getSnapshot();
+        assert(snap->seq_ == 3);
+
+        lsm_tree.putData({1, 11});
+        lsm_tree.deleteData(2);
+        lsm_tree.putData({4, 40});
+        // buffer keeps the version the snapshot reads, plus the new one
+        assert(lsm_tree.buffer_->buffer_data_.size() == 6);
+
+        auto check_views = [&]() {
+            assert(lsm_tree.getData(1, snap.get()).value().value_ == 10);
+            assert(lsm_tree.getData(2, snap.get()).value().value_ == 20);
+            assert(!lsm_tree.getData(4, snap.get()).has_value());
+            assert(lsm_tree.getData(1).value().value_ == 11);
+            assert(!lsm_tree.getData(2).has_value());
+            assert(lsm_tree.getData(4).value().value_ == 40);
+
+            std::vector<DataPair> old_view = lsm_tree.rangeData(0, 10, snap.get());
+            assert(old_view.size() == 3);
+            assert(old_view[0].value_ == 10 && old_view[1].value_ == 20 && old_view[2].value_ == 30);
+            std::vector<DataPair> new_view = lsm_tree.rangeData(0, 10);
+            assert(new_view.size() == 3);
+            assert(new_view[0].value_ == 11 && new_view[1].key_ == 3 && new_view[2].key_ == 4);
+        };
+        check_views();
+        std::cout << "Snapshot reads from buffer PASSED." << std::endl;
+
+        // flush and compact: old versions must survive while the snapshot lives
+        lsm_tree.flushBufferHelper();
+        lsm_tree.putData({3, 33});
+        lsm_tree.flushBufferHelper();
+        assert(lsm_tree.buffer_->buffer_data_.empty());
+        assert(lsm_tree.getData(3, snap.get()).value().value_ == 30);
+        lsm_tree.compactLevelHelper(0);
+        assert(lsm_tree.levels_[0]->cur_table_count_ == 0);
+        assert(lsm_tree.levels_[1]->cur_table_count_ == 1);
+        check_views();
+        assert(lsm_tree.getData(3, snap.get()).value().value_ == 30);
+        assert(lsm_tree.getData(3).value().value_ == 33);
+        std::cout << "Snapshot reads across flush and compaction PASSED." << std::endl;
+
+        // once released, compaction drops the versions nobody can read
+        size_t entries_with_snapshot = lsm_tree.levels_[1]->cur_total_entries_;
+        snap.reset();
+        assert(lsm_tree.buffer_->liveSnapshots().empty());
+        lsm_tree.putData({9, 90});
+        lsm_tree.flushBufferHelper();
+        lsm_tree.putData({10, 100});
+        lsm_tree.flushBufferHelper();
+        // L1 fills up, so the compactor thread merges it into L2
+        lsm_tree.compactLevelHelper(0);
+        for (int waited_ms = 0; waited_ms < 5000 && lsm_tree.levels_[2]->cur_table_count_ == 0; waited_ms += 10) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        assert(lsm_tree.levels_[1]->cur_table_count_ == 0);
+        assert(lsm_tree.levels_[2]->cur_table_count_ == 1);
+        // 1, 3, 4, 9, 10 live; tombstone for 2 dropped at the last level
+        assert(lsm_tree.levels_[2]->cur_total_entries_ == 5);
+        assert(entries_with_snapshot > 4);
+        assert(lsm_tree.getData(3).value().value_ == 33);
+        assert(!lsm_tree.getData(2).has_value());
+        std::cout << "Snapshot release and version GC PASSED." << std::endl;
+    }
+    // sequence numbers persist and resume after reopen
+    {
+        LSMTree lsm_tree(lsm_test_dir, 100, 2, 3, 1);
+        assert(lsm_tree.buffer_->lastSequence() == 9);
+        std::shared_ptr<Snapshot> snap = lsm_tree.getSnapshot();
+        lsm_tree.putData({3, 333});
+        assert(lsm_tree.getData(3, snap.get()).value().value_ == 33);
+        assert(lsm_tree.getData(3).value().value_ == 333);
+        std::cout << "Sequence numbers survive reopen PASSED." << std::endl;
+    }
+    remove_temp_dir(lsm_test_dir);
+}
+
+// version install and deferred file deletion tests
+void test_version() {
+    std::cout << "[TEST] testing versions ------------" << std::endl;
+    const std::string lsm_test_dir = "test_db_version";
+    remove_temp_dir(lsm_test_dir);
+    {
+        LSMTree lsm_tree(lsm_test_dir, 100, 2, 3, 2);
+        for (int k = 0; k < 10; ++k) { lsm_tree.putData({k, k}); }
+        lsm_tree.flushBufferHelper();
+
+        // pin the one-table Version, then let the second flush fill L0
+        std::shared_ptr<const Version> old_version = lsm_tree.currentVersion();
+        assert(old_version->levels[0].size() == 1);
+        std::string retired_file = old_version->levels[0][0]->file_path_;
+        LSMIterator pinned_it = lsm_tree.newIterator(0, 15);
+
+        for (int k = 5; k < 15; ++k) { lsm_tree.putData({k, k * 2}); }
+        lsm_tree.flushBufferHelper();
+        lsm_tree.compactLevelHelper(0);
+        for (int waited_ms = 0; waited_ms < 5000 && !lsm_tree.currentVersion()->levels[0].empty(); waited_ms += 10) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        std::shared_ptr<const Version> new_version = lsm_tree.currentVersion();
+        assert(new_version->levels[0].empty());
+        assert(new_version->levels[1].size() == 1);
+        // the old Version is untouched by the install
+        assert(old_version->levels[0].size() == 1);
+        assert(old_version->levels[1].empty());
+        std::cout << "Atomic version install PASSED." << std::endl;
+
+        // retired files stay on disk while anything still pins them
+        assert(std::filesystem::exists(retired_file));
+        size_t count = 0;
+        for (; pinned_it.valid(); pinned_it.next()) {
+            assert(pinned_it.value() == pinned_it.key());
+            count++;
+        }
+        assert(count == 10);
+        old_version.reset();
+        assert(std::filesystem::exists(retired_file));
+        pinned_it = lsm_tree.newIterator(0, 1);
+        assert(!std::filesystem::exists(retired_file));
+        assert(lsm_tree.rangeData(0, 15).size() == 15);
+        assert(lsm_tree.getData(7).value().value_ == 14);
+        std::cout << "Deferred SSTable deletion PASSED." << std::endl;
+    }
+    remove_temp_dir(lsm_test_dir);
+}
+
+// polls until done() holds, compaction runs on the background thread
+bool wait_until(const std::function<bool()>& done, int timeout_ms = 10000) {
+    for (int waited = 0; waited < timeout_ms; waited += 10) {
+        if (done()) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return done();
+}
+
+// writes int32 key,value pairs in the binary LOAD format
+void write_load_file(const std::string& path, const std::vector<std::pair<int, int>>& pairs) {
+    std::ofstream out(path, std::ios::binary);
+    for (const auto& pair : pairs) {
+        int32_t kv[2] = {pair.first, pair.second};
+        out.write(reinterpret_cast<const char*>(kv), sizeof(kv));
+    }
+}
+
+// bulk load tests
+void test_bulk_load() {
+    std::cout << "[TEST] testing bulk load ------------" << std::endl;
+    const std::string lsm_test_dir = "test_db_bulk_load";
+    const std::string load_file = "test_bulk_load.bin";
+    remove_temp_dir(lsm_test_dir);
+    {
+        LSMTree lsm_tree(lsm_test_dir, 100, 4, 3, 2);
+        for (int k = 0; k < 50; ++k) { lsm_tree.putData({k, k}); }
+        lsm_tree.flushBufferHelper();
+        lsm_tree.putData({10, 1010});
+        std::shared_ptr<Snapshot> snap = lsm_tree.getSnapshot();
+
+        // 5..300, key 20 appears again later in the file
+        std::vector<std::pair<int, int>> pairs;
+        for (int k = 300; k >= 5; --k) { pairs.push_back({k, k * 7}); }
+        pairs.push_back({20, -20});
+        write_load_file(load_file, pairs);
+
+        // small chunks force spilled runs and the external merge
+        lsm_tree.bulk_load_chunk_pairs_ = 64;
+        size_t loaded = 0;
+        assert(lsm_tree.bulkLoad(load_file, &loaded));
+        assert(loaded == 296);
+        assert(lsm_tree.getData(10).value().value_ == 70);
+        assert(lsm_tree.getData(20).value().value_ == -20);
+        assert(lsm_tree.getData(3).value().value_ == 3);
+        assert(lsm_tree.getData(200).value().value_ == 1400);
+        assert(lsm_tree.getData(10, snap.get()).value().value_ == 1010);
+        std::vector<DataPair> all = lsm_tree.rangeData(0, 301);
+        assert(all.size() == 301);
+        assert(all[20].value_ == -20 && all[4].value_ == 4 && all[5].value_ == 35);
+        // buffered key 10 overlapped, so it was flushed first; the batch lands in L0 as its newest table
+        assert(lsm_tree.buffer_->buffer_data_.empty());
+        assert(lsm_tree.currentVersion()->levels[0].size() == 3);
+        std::cout << "Bulk load override and dedupe tests PASSED." << std::endl;
+
+        // disjoint keys go straight to the last level
+        write_load_file(load_file, {{1000, 1}, {1001, 2}});
+        assert(lsm_tree.bulkLoad(load_file, &loaded) && loaded == 2);
+        assert(lsm_tree.currentVersion()->levels[2].size() == 1);
+        assert(lsm_tree.getData(1001).value().value_ == 2);
+        for (const auto& entry : std::filesystem::directory_iterator(lsm_test_dir)) {
+            assert(entry.path().extension() != ".run");
+        }
+        // not a whole number of pairs
+        std::ofstream(load_file, std::ios::binary) << "abc";
+        assert(!lsm_tree.bulkLoad(load_file, &loaded));
+        std::cout << "Bulk load placement tests PASSED." << std::endl;
+    }
+    {
+        LSMTree lsm_tree(lsm_test_dir, 100, 4, 3, 2);
+        assert(lsm_tree.getData(20).value().value_ == -20);
+        assert(lsm_tree.getData(10).value().value_ == 70);
+        std::cout << "Bulk load persistence PASSED." << std::endl;
+    }
+    remove_temp_dir(lsm_test_dir);
+    {
+        // puts into the range race the load; whichever value reads last must survive compaction
+        LSMTree lsm_tree(lsm_test_dir, 100, 4, 3, 2);
+        std::vector<std::pair<int, int>> pairs;
+        for (int k = 0; k < 20000; ++k) { pairs.push_back({k, -1}); }
+        write_load_file(load_file, pairs);
+        std::atomic<bool> loading{true};
+        std::thread writer([&]() {
+            for (int value = 1; loading; ++value) { lsm_tree.putData({150, value}); }
+        });
+        assert(lsm_tree.bulkLoad(load_file));
+        loading = false;
+        writer.join();
+        int visible = lsm_tree.getData(150).value().value_;
+        lsm_tree.flushBufferHelper();
+        lsm_tree.levels_[0]->table_capacity_ = 1;
+        lsm_tree.doCompactionCheck(0);
+        assert(wait_until([&] { return lsm_tree.currentVersion()->levels[0].empty(); }));
+        assert(lsm_tree.getData(150).value().value_ == visible);
+        std::cout << "Bulk load racing puts PASSED." << std::endl;
+    }
+    std::filesystem::remove(load_file);
+    remove_temp_dir(lsm_test_dir);
+}
+
+// external SSTable ingestion tests
+void test_ingest_files() {
+    std::cout << "[TEST] testing SSTable ingestion ------------" << std::endl;
+    const std::string lsm_test_dir = "test_db_ingest";
+    const std::string staging_dir = "test_ingest_staging";
+    remove_temp_dir(lsm_test_dir);
+    create_temp_dir(staging_dir);
+    {
+        LSMTree lsm_tree(lsm_test_dir, 100, 4, 3, 2);
+        for (int k = 0; k < 20; ++k) { lsm_tree.putData({k, k}); }
+        lsm_tree.flushBufferHelper();
+        lsm_tree.putData({100, 1});
+
+        // same format as writeToDisk, seq 0 like sst_writer produces
+        std::vector<DataPair> overlapping, disjoint;
+        for (int k = 10; k < 30; ++k) { overlapping.emplace_back(k, k * 100, false, 0); }
+        for (int k = 500; k < 510; ++k) { disjoint.emplace_back(k, k, false, 0); }
+        SSTable(overlapping, 0, staging_dir + "/a.sst", staging_dir + "/a.sst.bf");
+        SSTable(disjoint, 0, staging_dir + "/b.sst", staging_dir + "/b.sst.bf");
+
+        // overlapping inputs are refused and left where they were
+        SSTable(disjoint, 0, staging_dir + "/c.sst", staging_dir + "/c.sst.bf");
+        assert(!lsm_tree.ingestFiles({staging_dir + "/b.sst", staging_dir + "/c.sst"}));
+        assert(std::filesystem::exists(staging_dir + "/b.sst"));
+        assert(!lsm_tree.ingestFiles({staging_dir + "/missing.sst"}));
+
+        // bounds come from the .meta, the data is read only to verify it; swapping two
+        // lines of the same length keeps the size, only the full check sees the order
+        SSTable(std::vector<DataPair>{{600, 600, false, 0}, {601, 601, false, 0}}, 0,
+                staging_dir + "/d.sst", staging_dir + "/d.sst.bf");
+        std::ofstream(staging_dir + "/d.sst", std::ios::trunc) << "601:601:0:0\n600:600:0:0\n";
+        assert(!lsm_tree.ingestFiles({staging_dir + "/d.sst"}, true));
+        assert(std::filesystem::exists(staging_dir + "/d.sst"));
+        // data that grew since its .meta was written is refused without reading it
+        std::ofstream(staging_dir + "/d.sst", std::ios::app) << "602:602:0:0\n";
+        assert(!lsm_tree.ingestFiles({staging_dir + "/d.sst"}));
+        std::filesystem::remove(staging_dir + "/d.sst");
+
+        assert(lsm_tree.ingestFiles({staging_dir + "/a.sst", staging_dir + "/b.sst"}));
+        assert(!std::filesystem::exists(staging_dir + "/a.sst"));
+        assert(!std::filesystem::exists(staging_dir + "/a.sst.bf"));
+        std::shared_ptr<const Version> version = lsm_tree.currentVersion();
+        assert(version->levels[0].size() == 2);
+        assert(version->levels[2].size() == 1);
+        assert(version->levels[0].back()->min_key_ == 10);
+        assert(lsm_tree.getData(5).value().value_ == 5);
+        assert(lsm_tree.getData(15).value().value_ == 1500);
+        assert(lsm_tree.getData(505).value().value_ == 505);
+        assert(lsm_tree.getData(100).value().value_ == 1);
+        std::cout << "Ingest placement and override tests PASSED." << std::endl;
+
+        // newer puts still win over ingested data
+        lsm_tree.putData({15, -1});
+        assert(lsm_tree.getData(15).value().value_ == -1);
+    }
+    {
+        // ingest seq survives reopen, so later merges still rank the ingested values newer
+        LSMTree lsm_tree(lsm_test_dir, 100, 4, 3, 2);
+        assert(lsm_tree.getData(25).value().value_ == 2500);
+        assert(lsm_tree.getData(5).value().value_ == 5);
+        assert(lsm_tree.currentVersion()->levels[0].back()->global_seq_ > 20);
+        std::cout << "Ingest seq persistence PASSED." << std::endl;
+    }
+    remove_temp_dir(staging_dir);
+    remove_temp_dir(lsm_test_dir);
+}
+
+void test_stats() {
+    std::cout << "[TEST] testing stats and dump ------------" << std::endl;
+    const std::string lsm_test_dir = "test_db_stats";
+    remove_temp_dir(lsm_test_dir);
+    size_t saved_tombstones = 0, saved_entries = 0;
+    {
+        LSMTree lsm_tree(lsm_test_dir, 100, 4, 3, 2);
+        for (int k = 0; k < 1000; ++k) { lsm_tree.putData({k, k}); }
+        for (int k = 0; k < 50; ++k) { lsm_tree.deleteData(k); }
+        lsm_tree.flushBufferHelper();
+        assert(lsm_tree.puts_count_ == 1000);
+        assert(lsm_tree.deletes_count_ == 50);
+        assert(lsm_tree.flush_count_ > 0);
+
+        // stats come from per-table summaries, the key count is a sketch estimate
+        std::string stats = lsm_tree.print_stats();
+        size_t estimate = std::stoul(stats.substr(stats.find(": ") + 2));
+        assert(estimate > 850 && estimate < 1100);
+        assert(stats.find("Writes: puts 1000") != std::string::npos);
+
+        std::shared_ptr<const Version> version = lsm_tree.currentVersion();
+        size_t tombstones = 0;
+        for (const auto& level : version->levels) {
+            for (const auto& table : level) { tombstones += table->tombstone_count_; }
+        }
+        // a tombstone merged with the put it deletes has nothing left to hide and is elided
+        assert(tombstones + lsm_tree.getMetrics().counter(MetricCounter::TOMBSTONES_ELIDED) >= 50);
+        std::cout << "Stats counters and estimate PASSED." << std::endl;
+
+        // small chunks: the dump streams in several pieces and still holds every live pair
+        std::string dump;
+        size_t chunks = 0;
+        assert(lsm_tree.dumpAll([&](const std::string& chunk) {
+            dump += chunk;
+            chunks++;
+            return true;
+        }, 256));
+        assert(chunks > 1);
+        assert(dump.rfind("Logical Pairs: 950", 0) == 0);
+        assert(dump.find(" 999:999:L") != std::string::npos);
+        assert(dump.find(" 10:10:") == std::string::npos);
+        size_t stopped_after = 0;
+        assert(!lsm_tree.dumpAll([&](const std::string&) { return ++stopped_after < 2; }, 256));
+        assert(stopped_after == 2);
+        std::cout << "Chunked dump PASSED." << std::endl;
+
+        // no compaction runs after shutdown, these are the totals the .meta files hold
+        lsm_tree.shutdown();
+        for (const auto& level : lsm_tree.currentVersion()->levels) {
+            for (const auto& table : level) {
+                saved_tombstones += table->tombstone_count_;
+                saved_entries += table->size_;
+            }
+        }
+    }
+    {
+        // reopen reads table summaries back from .meta
+        LSMTree lsm_tree(lsm_test_dir, 100, 4, 3, 2);
+        std::shared_ptr<const Version> version = lsm_tree.currentVersion();
+        size_t tombstones = 0, entries = 0;
+        for (const auto& level : version->levels) {
+            for (const auto& table : level) {
+                tombstones += table->tombstone_count_;
+                entries += table->size_;
+                assert(table->data_bytes_ > 0);
+            }
+        }
+        assert(tombstones == saved_tombstones && entries == saved_entries && entries >= 950);
+        std::string stats = lsm_tree.print_stats();
+        size_t estimate = std::stoul(stats.substr(stats.find(": ") + 2));
+        assert(estimate > 850 && estimate < 1100);
+        std::cout << "Stats metadata reload PASSED." << std::endl;
+    }
+    remove_temp_dir(lsm_test_dir);
+}
+
+void test_metrics() {
+    std::cout << "[TEST] testing engine metrics ------------" << std::endl;
+    // bucket bounds: exact below 16, then 16 sub-buckets per power of two
+    for (uint64_t value : std::vector<uint64_t>{0, 7, 15, 16, 17, 1000, 123456789, UINT64_MAX}) {
+        size_t bucket = LatencyHistogram::bucketFor(value);
+        assert(bucket < LatencyHistogram::NUM_BUCKETS);
+        assert(LatencyHistogram::bucketUpperBound(bucket) >= value);
+        assert(bucket == 0 || LatencyHistogram::bucketUpperBound(bucket - 1) < value);
+    }
+    LatencyHistogram histogram;
+    for (uint64_t value = 1; value <= 1000; ++value) { histogram.record(value * 1000); }
+    HistogramSnapshot merged;
+    merged.merge(histogram);
+    assert(merged.count == 1000 && merged.min == 1000 && merged.max == 1000000);
+    uint64_t p50 = merged.percentile(50);
+    uint64_t p99 = merged.percentile(99);
+    assert(p50 >= 500000 && p50 <= 500000 * 107 / 100);
+    assert(p99 >= 990000 && p99 <= 1000000);
+    std::cout << "Histogram buckets and percentiles PASSED." << std::endl;
+
+    const std::string lsm_test_dir = "test_db_metrics";
+    remove_temp_dir(lsm_test_dir);
+    {
+        LSMTree lsm_tree(lsm_test_dir, 100, 4, 3, 2);
+        for (int k = 0; k < 500; ++k) { lsm_tree.putData({k * 2, k}); }
+        lsm_tree.deleteData(0);
+        lsm_tree.flushBufferHelper();
+        // odd keys are absent, so their bloom probes are negatives or false positives
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 4; ++t) {
+            readers.emplace_back([&lsm_tree, t]() {
+                for (int k = t; k < 1000; k += 4) { lsm_tree.getData(k); }
+            });
+        }
+        for (auto& reader : readers) { reader.join(); }
+        lsm_tree.rangeData(0, 100);
+
+        MetricsSnapshot metrics = lsm_tree.getMetrics();
+        assert(metrics.op(MetricOp::PUT).count == 500);
+        assert(metrics.op(MetricOp::DELETE).count == 1);
+        assert(metrics.op(MetricOp::GET).count == 1000);
+        assert(metrics.op(MetricOp::RANGE).count == 1);
+        assert(metrics.op(MetricOp::FLUSH).count == lsm_tree.flush_count_);
+        assert(metrics.counter(MetricCounter::FLUSH_BYTES_WRITTEN) > 0);
+        uint64_t probes = metrics.counter(MetricCounter::BLOOM_PROBES);
+        assert(probes > 0);
+        // every probe that passed searched one block, the range scan adds more
+        assert(metrics.counter(MetricCounter::BLOCKS_READ) > probes - metrics.counter(MetricCounter::BLOOM_NEGATIVES));
+        assert(metrics.counter(MetricCounter::BLOOM_FALSE_POSITIVES) <= metrics.counter(MetricCounter::BLOCKS_READ));
+        assert(metrics.toText().find("get: count 1000") != std::string::npos);
+        std::string json = metrics.toJson();
+        assert(json.front() == '{' && json.back() == '}');
+        assert(json.find("\"bloom_probes\":" + std::to_string(probes)) != std::string::npos);
+        std::cout << "Engine metrics PASSED." << std::endl;
+    }
+    remove_temp_dir(lsm_test_dir);
+}
+
+void test_io_stats() {
+    std::cout << "[TEST] testing read/write amplification accounting ------------" << std::endl;
+    const std::string lsm_test_dir = "test_db_io_stats";
+    remove_temp_dir(lsm_test_dir);
+    {
+        // base capacity 2: the second flush compacts L1 into L2
+        LSMTree lsm_tree(lsm_test_dir, 100, 2, 3, 2);
+        for (int k = 0; k < 100; ++k) { lsm_tree.putData({k, k}); }
+        lsm_tree.flushBufferHelper();
+        for (int k = 50; k < 150; ++k) { lsm_tree.putData({k, -k}); }
+        lsm_tree.flushBufferHelper();
+        lsm_tree.compactLevelHelper(0);
+        for (int waited_ms = 0; waited_ms < 5000 && lsm_tree.recentCompactions().empty(); waited_ms += 10) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        std::vector<CompactionStats> compactions = lsm_tree.recentCompactions();
+        assert(!compactions.empty());
+        const CompactionStats& compaction = compactions.front();
+        assert(compaction.source_level == 0 && compaction.input_tables == 2);
+        // the 50 overlapping keys are merged away
+        assert(compaction.input_entries == 200 && compaction.output_entries == 150);
+        assert(compaction.bytes_read > compaction.bytes_written && compaction.bytes_written > 0);
+
+        MetricsSnapshot metrics = lsm_tree.getMetrics();
+        assert(metrics.counter(MetricCounter::USER_BYTES_WRITTEN) == 200 * 2 * sizeof(int));
+        assert(metrics.counter(MetricCounter::COMPACTION_ENTRIES_OUT) >= 150);
+        // each entry hit disk at least twice, once flushed and once compacted
+        assert(metrics.writeAmplification() > 1.0);
+        std::cout << "Compaction stats and write amplification PASSED." << std::endl;
+
+        QueryStats point_stats;
+        assert(lsm_tree.getData(70, nullptr, &point_stats).value().value_ == -70);
+        assert(point_stats.tables_probed == 1 && point_stats.bloom_passes == 1);
+        assert(point_stats.blocks_read == 1 && point_stats.bytes_read > 0);
+        QueryStats miss_stats;
+        assert(!lsm_tree.getData(1000, nullptr, &miss_stats).has_value());
+        assert(miss_stats.tables_probed == 0 && miss_stats.blocks_read == 0);
+
+        QueryStats range_stats;
+        assert(lsm_tree.rangeData(0, 150, nullptr, &range_stats).size() == 150);
+        assert(range_stats.tables_probed == 1 && range_stats.bloom_checks == 0);
+        assert(range_stats.blocks_read >= 1 && range_stats.bytes_read >= point_stats.bytes_read);
+        assert(lsm_tree.getMetrics().counter(MetricCounter::BYTES_READ) >= range_stats.bytes_read);
+        std::cout << "Query stats PASSED." << std::endl;
+    }
+    remove_temp_dir(lsm_test_dir);
+}
+
+void test_lazy_open() {
+    std::cout << "[TEST] testing lazy table opening ------------" << std::endl;
+    const std::string lsm_test_dir = "test_db_lazy_open";
+    remove_temp_dir(lsm_test_dir);
+    uint64_t last_seq = 0;
+    {
+        // big base level, so the flushed tables stay apart in level 0
+        LSMTree lsm_tree(lsm_test_dir, 100, 16, 3, 2);
+        for (int k = 0; k < 500; ++k) {
+            lsm_tree.putData({k, k * 10});
+            if (k % 100 == 99) { lsm_tree.flushBufferHelper(); }
+        }
+        last_seq = lsm_tree.buffer_->lastSequence();
+    }
+    {
+        // only .meta and .bf are read, the sequence still resumes past every entry
+        LSMTree lsm_tree(lsm_test_dir, 100, 16, 3, 2);
+        std::shared_ptr<const Version> version = lsm_tree.currentVersion();
+        size_t tables = 0;
+        for (const auto& level : version->levels) {
+            for (const auto& table : level) {
+                assert(!table->data_loaded_);
+                assert(table->size_ > 0 && table->max_seq_ > 0);
+                tables++;
+            }
+        }
+        assert(tables > 1);
+        assert(lsm_tree.buffer_->lastSequence() == last_seq);
+
+        // a lookup loads only the table holding the key, and pays for reading all of it
+        QueryStats first_stats;
+        assert(lsm_tree.getData(250, nullptr, &first_stats).value().value_ == 2500);
+        size_t loaded = 0;
+        const SSTable* loaded_table = nullptr;
+        for (const auto& level : version->levels) {
+            for (const auto& table : level) {
+                if (table->data_loaded_) {
+                    loaded++;
+                    loaded_table = table.get();
+                }
+            }
+        }
+        assert(loaded == 1);
+        assert(first_stats.blocks_read == loaded_table->fence_pointers_.size() + 1);
+        assert(first_stats.bytes_read > loaded_table->data_bytes_);
+        QueryStats again_stats;
+        lsm_tree.getData(250, nullptr, &again_stats);
+        assert(again_stats.blocks_read == 1 && again_stats.bytes_read < first_stats.bytes_read);
+        // the range loads the other tables, their whole files count
+        QueryStats range_stats;
+        assert(lsm_tree.rangeData(0, 500, nullptr, &range_stats).size() == 500);
+        assert(range_stats.bytes_read > (tables - 1) * loaded_table->data_bytes_ / 2);
+        QueryStats range_again_stats;
+        lsm_tree.rangeData(0, 500, nullptr, &range_again_stats);
+        assert(range_again_stats.bytes_read < range_stats.bytes_read);
+        std::cout << "Lazy open PASSED." << std::endl;
+    }
+    {
+        // a table without .meta is read in full once, and gets its .meta back
+        std::shared_ptr<const Version> version;
+        std::string meta_path;
+        {
+            LSMTree lsm_tree(lsm_test_dir, 100, 16, 3, 2);
+            for (const auto& level : lsm_tree.currentVersion()->levels) {
+                if (!level.empty()) { meta_path = level.front()->file_path_ + ".meta"; }
+            }
+        }
+        std::filesystem::remove(meta_path);
+        LSMTree lsm_tree(lsm_test_dir, 100, 16, 3, 2);
+        size_t loaded = 0;
+        for (const auto& level : lsm_tree.currentVersion()->levels) {
+            for (const auto& table : level) { loaded += table->data_loaded_ ? 1 : 0; }
+        }
+        assert(loaded == 1);
+        assert(std::filesystem::exists(meta_path));
+        assert(lsm_tree.buffer_->lastSequence() == last_seq);
+        assert(lsm_tree.getData(0).value().value_ == 0);
+        std::cout << "Open without .meta PASSED." << std::endl;
+    }
+    {
+        // a compaction loading the lazy tables races readers loading the same tables
+        LSMTree lsm_tree(lsm_test_dir, 100, 16, 3, 2);
+        std::atomic<bool> done{false};
+        std::atomic<int> wrong{0};
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 4; ++t) {
+            readers.emplace_back([&, t]() {
+                for (int round = 0; !done || round < 2; ++round) {
+                    for (int k = t; k < 500; k += 4) {
+                        std::optional<DataPair> found = lsm_tree.getData(k);
+                        if (!found || found->value_ != k * 10) { wrong++; }
+                    }
+                }
+            });
+        }
+        lsm_tree.compactLevelHelper(0);
+        done = true;
+        for (auto& reader : readers) { reader.join(); }
+        assert(wrong == 0);
+        assert(lsm_tree.rangeData(0, 500).size() == 500);
+        std::cout << "Lazy load racing compaction PASSED." << std::endl;
+    }
+    remove_temp_dir(lsm_test_dir);
+}
+
+void test_shutdown_persist() {
+    std::cout << "[TEST] testing shutdown persistence ------------" << std::endl;
+    const std::string lsm_test_dir = "test_db_shutdown";
+    remove_temp_dir(lsm_test_dir);
+    const std::string memtable_path = lsm_test_dir + "/memtable";
+    uint64_t last_seq = 0;
+    {
+        LSMTree lsm_tree(lsm_test_dir, 100, 4, 3, 2);
+        for (int k = 0; k < 50; ++k) { lsm_tree.putData({k, k + 1}); }
+        for (int k = 0; k < 5; ++k) { lsm_tree.deleteData(k); }
+        last_seq = lsm_tree.buffer_->lastSequence();
+    }
+    {
+        // nothing was flushed, the buffer comes back from the dump with its seqs
+        assert(std::filesystem::exists(memtable_path));
+        LSMTree lsm_tree(lsm_test_dir, 100, 4, 3, 2);
+        assert(lsm_tree.currentVersion()->levels[0].empty());
+        assert(lsm_tree.memtable_dump_pending_);
+        assert(lsm_tree.buffer_->lastSequence() == last_seq);
+        assert(lsm_tree.buffer_->tombstone_count_ == 5);
+        assert(!lsm_tree.getData(3).has_value());
+        assert(lsm_tree.getData(30).value().value_ == 31);
+        assert(lsm_tree.rangeData(0, 100).size() == 45);
+
+        // once level 0 holds the restored entries the dump goes away
+        lsm_tree.putData({60, 61});
+        lsm_tree.flushBufferHelper();
+        assert(!lsm_tree.memtable_dump_pending_);
+        assert(!std::filesystem::exists(memtable_path));
+        std::cout << "Memtable dump and restore PASSED." << std::endl;
+
+        lsm_tree.flush_on_shutdown_ = true;
+        lsm_tree.putData({70, 71});
+    }
+    {
+        // flush_on_shutdown_ wrote a level 0 table instead of a dump
+        assert(!std::filesystem::exists(memtable_path));
+        LSMTree lsm_tree(lsm_test_dir, 100, 4, 3, 2);
+        assert(lsm_tree.buffer_->buffer_data_.empty());
+        assert(lsm_tree.getData(70).value().value_ == 71);
+        assert(lsm_tree.getData(60).value().value_ == 61);
+        assert(lsm_tree.buffer_->lastSequence() == last_seq + 2);
+        std::cout << "Flush on shutdown PASSED." << std::endl;
+    }
+    remove_temp_dir(lsm_test_dir);
+}
+
+
+size_t count_tree_tombstones(const LSMTree& lsm_tree) {
+    size_t tombstones = 0;
+    for (const auto& level : lsm_tree.currentVersion()->levels) {
+        for (const auto& table : level) { tombstones += table->tombstone_count_; }
+    }
+    return tombstones;
+}
+
+void test_tombstone_compaction() {
+    std::cout << "[TEST] testing delete-aware compaction ------------" << std::endl;
+    const std::string lsm_test_dir = "test_db_tombstones";
+    remove_temp_dir(lsm_test_dir);
+    {
+        // table capacity 100 never fills, only tombstones can trigger compaction
+        LSMTree lsm_tree(lsm_test_dir, 10, 100, 3, 2);
+        lsm_tree.tombstone_density_threshold_ = 0;
+        auto start_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        auto buffer_empty = [&] {
+            std::shared_lock lock(lsm_tree.buffer_->buffer_mutex_);
+            return lsm_tree.buffer_->buffer_data_.empty();
+        };
+        // the puts reach level 0 first, a tombstone with no older version would be elided
+        for (int k = 0; k < 20; ++k) { lsm_tree.putData({k, k}); }
+        lsm_tree.flushBufferHelper();
+        assert(wait_until(buffer_empty));
+        for (int k = 0; k < 20; ++k) { lsm_tree.deleteData(k); }
+        lsm_tree.flushBufferHelper();
+        assert(wait_until(buffer_empty));
+
+        // per-table counts and ages, kept in .meta
+        assert(count_tree_tombstones(lsm_tree) == 20);
+        for (const auto& table : lsm_tree.currentVersion()->levels[0]) {
+            assert((table->tombstone_count_ > 0) == (table->oldest_tombstone_time_ >= static_cast<uint64_t>(start_ms)));
+            SSTable reopened(0, table->file_path_, table->bf_file_path_);
+            assert(reopened.oldest_tombstone_time_ == table->oldest_tombstone_time_);
+        }
+        assert(lsm_tree.levels_[0]->oldest_tombstone_time_ >= static_cast<uint64_t>(start_ms));
+        assert(lsm_tree.print_stats().find("oldest tombstone") != std::string::npos);
+        assert(!lsm_tree.levelNeedsCompaction(0));
+
+        // half of level 0 is tombstones: pushed down level by level and purged at the last
+        lsm_tree.tombstone_density_threshold_ = 0.5;
+        assert(lsm_tree.levelNeedsCompaction(0));
+        lsm_tree.doCompactionCheck(0);
+        assert(wait_until([&] { return lsm_tree.currentVersion()->levels[0].empty()
+                                       && count_tree_tombstones(lsm_tree) == 0; }));
+        assert(!lsm_tree.getData(5).has_value());
+        assert(lsm_tree.rangeData(0, 20).empty());
+        std::cout << "Tombstone density trigger PASSED." << std::endl;
+    }
+    remove_temp_dir(lsm_test_dir);
+    {
+        LSMTree lsm_tree(lsm_test_dir, 10, 100, 3, 2);
+        lsm_tree.tombstone_density_threshold_ = 0;
+        // shares of a 400 ms bound with ratio 2: L0 133 ms, L1 266 ms
+        lsm_tree.delete_persistence_ms_ = 400;
+        assert(lsm_tree.tombstoneTtl(0) == 133 && lsm_tree.tombstoneTtl(1) == 266);
+        // the put is flushed first, so the tombstone has a version to shadow in level 0
+        for (int k = 0; k < 10; ++k) { lsm_tree.putData({k, k + 100}); }
+        lsm_tree.flushBufferHelper();
+        assert(wait_until([&] {
+            std::shared_lock lock(lsm_tree.buffer_->buffer_mutex_);
+            return lsm_tree.buffer_->buffer_data_.empty();
+        }));
+        lsm_tree.deleteData(3);
+        lsm_tree.flushBufferHelper();
+        assert(count_tree_tombstones(lsm_tree) == 1);
+        // no further writes, the compactor finds the expired tombstone on its own and
+        // merges it with the put it deletes
+        assert(wait_until([&] { return lsm_tree.currentVersion()->levels[1].size() > 0
+                                       && count_tree_tombstones(lsm_tree) == 0; }));
+        assert(!lsm_tree.getData(3).has_value());
+        assert(lsm_tree.getData(4).value().value_ == 104);
+        assert(lsm_tree.compaction_count_ >= 1);
+        std::cout << "Delete persistence threshold PASSED." << std::endl;
+    }
+    remove_temp_dir(lsm_test_dir);
+    {
+        // every level holds one table, so each flush cascades down to the last level
+        LSMTree lsm_tree(lsm_test_dir, 10, 1, 3, 1);
+        for (int k = 0; k < 10; ++k) { lsm_tree.putData({k, k}); }
+        assert(wait_until([&] { return lsm_tree.currentVersion()->levels[2].size() == 1; }));
+        // the last level's older table still holds key 7, so its tombstone reaches it
+        std::shared_ptr<Snapshot> snap = lsm_tree.getSnapshot();
+        lsm_tree.delete_persistence_ms_ = 50;
+        lsm_tree.deleteData(7);
+        lsm_tree.flushBufferHelper();
+        lsm_tree.doCompactionCheck(0);
+        assert(wait_until([&] { return lsm_tree.currentVersion()->levels[0].empty()
+                                       && lsm_tree.currentVersion()->levels[1].empty(); }));
+        assert(!lsm_tree.getData(7).has_value());
+        assert(lsm_tree.rangeData(0, 10).size() == 9);
+        // expired, but the snapshot still reads the put under it
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        assert(count_tree_tombstones(lsm_tree) == 1);
+        assert(lsm_tree.getData(7, snap.get()).value().value_ == 7);
+
+        // released, the last level merges the tombstone with the put and drops both
+        snap.reset();
+        assert(wait_until([&] { return count_tree_tombstones(lsm_tree) == 0
+                                       && lsm_tree.currentVersion()->levels[2].size() == 1; }));
+        assert(lsm_tree.currentVersion()->levels[2].front()->size_ == 9);
+        assert(!lsm_tree.getData(7).has_value());
+        assert(lsm_tree.rangeData(0, 10).size() == 9);
+        std::cout << "Last level purges expired tombstones PASSED." << std::endl;
+    }
+    remove_temp_dir(lsm_test_dir);
+    {
+        // level 0 compacts at two tables, nothing fills the buffer
+        LSMTree lsm_tree(lsm_test_dir, 100, 2, 3, 2);
+        auto elided = [&] { return lsm_tree.getMetrics().counter(MetricCounter::TOMBSTONES_ELIDED); };
+        for (int k = 0; k < 10; ++k) { lsm_tree.putData({k, k}); }
+        lsm_tree.flushBufferHelper();
+        // key 1000 was never written: no table may hold it, so the flush drops its tombstone
+        lsm_tree.deleteData(1000);
+        lsm_tree.deleteData(5);
+        lsm_tree.flushBufferHelper();
+        assert(count_tree_tombstones(lsm_tree) == 1 && elided() == 1);
+        assert(!lsm_tree.getData(5).has_value());
+
+        // merged with its put into level 1, the tombstone goes above the last level
+        lsm_tree.doCompactionCheck(0);
+        assert(wait_until([&] { return lsm_tree.currentVersion()->levels[0].empty(); }));
+        assert(count_tree_tombstones(lsm_tree) == 0 && elided() == 2);
+        assert(!lsm_tree.getData(5).has_value() && lsm_tree.rangeData(0, 10).size() == 9);
+
+        // level 1 still holds key 7, so its tombstone survives the next compaction into level 1
+        lsm_tree.deleteData(7);
+        lsm_tree.flushBufferHelper();
+        for (int k = 50; k < 60; ++k) { lsm_tree.putData({k, k}); }
+        lsm_tree.flushBufferHelper();
+        lsm_tree.doCompactionCheck(0);
+        assert(wait_until([&] { return lsm_tree.currentVersion()->levels[0].empty(); }));
+        assert(count_tree_tombstones(lsm_tree) == 1 && elided() == 2);
+        assert(!lsm_tree.getData(7).has_value() && lsm_tree.rangeData(0, 60).size() == 18);
+        std::cout << "Tombstone elision PASSED." << std::endl;
+    }
+    remove_temp_dir(lsm_test_dir);
+}
+
+void test_range_delete() {
+    std::cout << "[TEST] testing range deletes ------------" << std::endl;
+    // overlapping tombstones: the newest one wins where they overlap
+    RangeTombstoneSet fragments({{0, 10, 5}, {5, 15, 3}, {20, 25, 1}});
+    assert(fragments.coveringSeq(0) == 5 && fragments.coveringSeq(7) == 5);
+    assert(fragments.coveringSeq(12) == 3 && fragments.coveringSeq(15) == 0);
+    assert(fragments.coveringSeq(24) == 1 && fragments.coveringSeq(-1) == 0);
+    assert(fragments.covers(12, 2) && !fragments.covers(12, 3));
+    // a reader at seq 4 doesn't see the tombstone written at 5
+    assert(RangeTombstoneSet({{0, 10, 5}, {5, 15, 3}}, 4).coveringSeq(7) == 3);
+    // the same at read time, on the set built once for every reader
+    assert(fragments.coveringSeq(7, 4) == 3 && fragments.coveringSeq(2, 4) == 0);
+    assert(fragments.covers(7, 2, 4) && !fragments.covers(7, 3, 4));
+    assert(RangeTombstoneSet().empty());
+
+    const std::string lsm_test_dir = "test_db_range_delete";
+    remove_temp_dir(lsm_test_dir);
+    {
+        // buffer and tables large enough that nothing flushes or compacts on its own
+        LSMTree lsm_tree(lsm_test_dir, 100, 100, 3, 2);
+        for (int k = 0; k < 50; ++k) { lsm_tree.putData({k, k}); }
+        std::shared_ptr<Snapshot> before = lsm_tree.getSnapshot();
+        assert(lsm_tree.deleteRange(10, 30));
+        // written after the range delete, so not covered by it
+        lsm_tree.putData({20, 2000});
+        assert(lsm_tree.deleteRange(5, 5) && !lsm_tree.deleteRange(6, 5));
+
+        auto check_reads = [&]() {
+            assert(!lsm_tree.getData(10).has_value() && !lsm_tree.getData(29).has_value());
+            assert(lsm_tree.getData(9).value().value_ == 9 && lsm_tree.getData(30).value().value_ == 30);
+            assert(lsm_tree.getData(20).value().value_ == 2000);
+            std::vector<DataPair> live = lsm_tree.rangeData(0, 50);
+            assert(live.size() == 31);
+            size_t iterated = 0;
+            for (LSMIterator it = lsm_tree.newIterator(0, 50); it.valid(); it.next()) {
+                assert(it.key() < 10 || it.key() >= 30 || it.key() == 20);
+                iterated++;
+            }
+            assert(iterated == 31);
+            // the snapshot predates the range delete
+            assert(lsm_tree.getData(15, before.get()).value().value_ == 15);
+            assert(lsm_tree.rangeData(0, 50, before.get()).size() == 50);
+        };
+        check_reads();
+        // one buffer slot for the whole range
+        assert(lsm_tree.buffer_->rangeTombstones().size() == 1);
+
+        lsm_tree.flushBufferHelper();
+        assert(lsm_tree.buffer_->rangeTombstones().empty());
+        assert(lsm_tree.currentVersion()->range_tombstones.size() == 1);
+        check_reads();
+
+        // kept in the .meta for lazy opens, and after the entries in the data file
+        std::shared_ptr<SSTable> table = lsm_tree.currentVersion()->levels[0].back();
+        SSTable reopened(0, table->file_path_, table->bf_file_path_);
+        assert(reopened.range_tombstones_.size() == 1 && reopened.range_tombstones_[0].low == 10);
+        std::filesystem::remove(table->file_path_ + ".meta");
+        SSTable without_meta(0, table->file_path_, table->bf_file_path_);
+        assert(without_meta.range_tombstones_.empty() && without_meta.loadFromDisk());
+        assert(without_meta.range_tombstones_.size() == 1 && without_meta.range_tombstones_[0].high == 30);
+        assert(without_meta.size_ == table->size_);
+        table->writeMeta();
+    }
+    remove_temp_dir(lsm_test_dir);
+    {
+        // every level holds one table, a compaction check pushes level 0 to the last level
+        LSMTree lsm_tree(lsm_test_dir, 100, 1, 3, 1);
+        for (int k = 0; k < 50; ++k) { lsm_tree.putData({k, k}); }
+        lsm_tree.deleteRange(10, 30);
+        lsm_tree.flushBufferHelper();
+        lsm_tree.doCompactionCheck(0);
+        assert(wait_until([&] { return lsm_tree.currentVersion()->levels[0].empty()
+                                       && lsm_tree.currentVersion()->levels[1].empty(); }));
+        // the covered entries are gone, and at the last level so is the tombstone
+        size_t entries = 0;
+        for (const auto& last_level_table : lsm_tree.currentVersion()->levels[2]) {
+            entries += last_level_table->size_;
+        }
+        assert(entries == 30);
+        assert(lsm_tree.currentVersion()->range_tombstones.empty());
+        assert(!lsm_tree.getData(15).has_value() && lsm_tree.rangeData(0, 50).size() == 30);
+
+        // the last level now holds keys 0-9 and 30-49, a tombstone over them must stay
+        lsm_tree.putData({100, 100});
+        lsm_tree.deleteRange(0, 5);
+        lsm_tree.flushBufferHelper();
+        lsm_tree.doCompactionCheck(0);
+        assert(wait_until([&] { return lsm_tree.currentVersion()->levels[0].empty()
+                                       && lsm_tree.currentVersion()->levels[1].empty(); }));
+        assert(lsm_tree.currentVersion()->range_tombstones.size() == 1);
+        assert(!lsm_tree.getData(3).has_value() && lsm_tree.getData(7).value().value_ == 7);
+        assert(lsm_tree.rangeData(0, 200).size() == 26);
+
+        // once expired, the last level merges it with the table it covers and drops both
+        lsm_tree.delete_persistence_ms_ = 50;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        lsm_tree.doCompactionCheck(2);
+        assert(wait_until([&] { return lsm_tree.currentVersion()->range_tombstones.empty(); }));
+        size_t last_level_entries = 0;
+        for (const auto& last_level_table : lsm_tree.currentVersion()->levels[2]) {
+            last_level_entries += last_level_table->size_;
+        }
+        assert(last_level_entries == 26);
+        assert(!lsm_tree.getData(3).has_value() && lsm_tree.rangeData(0, 200).size() == 26);
+        std::cout << "Compaction applies range tombstones PASSED." << std::endl;
+    }
+    remove_temp_dir(lsm_test_dir);
+    {
+        // range tombstones alone make a level dense with deletes
+        LSMTree lsm_tree(lsm_test_dir, 10, 100, 3, 2);
+        lsm_tree.tombstone_density_threshold_ = 0;
+        for (int k = 0; k < 10; ++k) { lsm_tree.putData({k, k}); }
+        lsm_tree.flushBufferHelper();
+        for (int k = 0; k < 10; ++k) { lsm_tree.deleteRange(k, k + 1); }
+        lsm_tree.flushBufferHelper();
+        assert(wait_until([&] { return lsm_tree.buffer_->rangeTombstones().empty(); }));
+        assert(lsm_tree.levels_[0]->cur_tombstones_ == 0 && lsm_tree.levels_[0]->cur_range_tombstones_ == 10);
+        lsm_tree.tombstone_density_threshold_ = 0.5;
+        assert(lsm_tree.levelNeedsCompaction(0));
+        std::cout << "Range tombstone density trigger PASSED." << std::endl;
+    }
+    remove_temp_dir(lsm_test_dir);
+    {
+        LSMTree lsm_tree(lsm_test_dir, 100, 100, 3, 2);
+        for (int k = 0; k < 10; ++k) { lsm_tree.putData({k, k}); }
+        lsm_tree.deleteRange(2, 5);
+        lsm_tree.flushBufferHelper();
+        // still buffered at shutdown, goes through the memtable dump
+        lsm_tree.deleteRange(6, 8);
+    }
+    {
+        LSMTree lsm_tree(lsm_test_dir, 100, 100, 3, 2);
+        assert(lsm_tree.buffer_->lastSequence() == 12);
+        assert(lsm_tree.buffer_->rangeTombstones().size() == 1);
+        assert(lsm_tree.currentVersion()->range_tombstones.size() == 1);
+        assert(!lsm_tree.currentVersion()->levels[0].back()->data_loaded_);
+        assert(!lsm_tree.getData(3).has_value() && !lsm_tree.getData(6).has_value());
+        assert(lsm_tree.getData(5).value().value_ == 5 && lsm_tree.getData(8).value().value_ == 8);
+        assert(lsm_tree.rangeData(0, 10).size() == 5);
+        std::cout << "Range tombstones survive reopen PASSED." << std::endl;
+    }
+    remove_temp_dir(lsm_test_dir);
+}
+
+void test_merge_operator() {
+    std::cout << "[TEST] testing merge operator ------------" << std::endl;
+    // operands fold oldest first onto a put, a tombstone or nothing
+    MergeOperator add = [](int existing, int operand) { return existing + operand; };
+    DataPair operand(1, 5, false, 9);
+    operand.merge_ = true;
+    DataPair over_put = foldMerge(DataPair(1, 10, false, 3), operand, add);
+    assert(over_put.value_ == 15 && !over_put.merge_ && over_put.seq_ == 9);
+    DataPair over_tombstone = foldMerge(DataPair(1, 10, true, 3), operand, add);
+    assert(over_tombstone.value_ == 5 && !over_tombstone.merge_ && !over_tombstone.deleted_);
+    assert(foldMerge(operand, operand, add).merge_);
+    assert(applyMergeOperands(std::nullopt, {3, 2, 1}, [](int a, int b) { return a * 10 + b; }) == 123);
+
+    const std::string lsm_test_dir = "test_db_merge";
+    remove_temp_dir(lsm_test_dir);
+    {
+        // every level holds one table, a compaction check pushes level 0 to the last level
+        LSMTree lsm_tree(lsm_test_dir, 100, 1, 3, 1);
+        // a counter with a base value, and one starting from nothing
+        lsm_tree.putData({1, 100});
+        for (int i = 0; i < 10; ++i) {
+            assert(lsm_tree.mergeData(1, 1));
+            lsm_tree.mergeData(2, 2);
+        }
+        assert(lsm_tree.getData(1).value().value_ == 110 && lsm_tree.getData(2).value().value_ == 20);
+        // written without reading, the operands wait in the buffer
+        assert(lsm_tree.buffer_->getVersions(1).size() == 11);
+
+        std::shared_ptr<Snapshot> snapshot = lsm_tree.getSnapshot();
+        lsm_tree.mergeData(1, 5);
+        assert(lsm_tree.getData(1).value().value_ == 115);
+        assert(lsm_tree.getData(1, snapshot.get()).value().value_ == 110);
+        // after a delete the next operand is the whole value
+        lsm_tree.deleteData(2);
+        lsm_tree.mergeData(2, 7);
+        assert(lsm_tree.getData(2).value().value_ == 7);
+        // a put replaces the operands under it
+        lsm_tree.putData({5, 1});
+        lsm_tree.mergeData(5, 1);
+        lsm_tree.putData({5, 50});
+        assert(lsm_tree.getData(5).value().value_ == 50);
+
+        // operands in the buffer combined with the ones flushed under them
+        lsm_tree.flushBufferHelper();
+        lsm_tree.mergeData(1, 10);
+        assert(lsm_tree.getData(1).value().value_ == 125);
+        assert(lsm_tree.getData(1, snapshot.get()).value().value_ == 110);
+        // a range delete hides the operands before it, not the ones after
+        lsm_tree.mergeData(3, 1);
+        lsm_tree.deleteRange(3, 4);
+        lsm_tree.mergeData(3, 4);
+        assert(lsm_tree.getData(3).value().value_ == 4);
+
+        auto check_reads = [&]() {
+            std::vector<DataPair> live = lsm_tree.rangeData(0, 10);
+            assert(live.size() == 4);
+            assert(live[0].key_ == 1 && live[0].value_ == 125 && !live[0].merge_);
+            assert(live[1].value_ == 7 && live[2].value_ == 4 && live[3].value_ == 50);
+            int sum = 0;
+            for (LSMIterator it = lsm_tree.newIterator(0, 10); it.valid(); it.next()) {
+                sum += it.value();
+            }
+            assert(sum == 186);
+            assert(lsm_tree.getData(1).value().value_ == 125 && lsm_tree.getData(2).value().value_ == 7);
+        };
+        check_reads();
+
+        snapshot.reset();
+        lsm_tree.flushBufferHelper();
+        lsm_tree.doCompactionCheck(0);
+        assert(wait_until([&] { return lsm_tree.currentVersion()->levels[0].empty()
+                                       && lsm_tree.currentVersion()->levels[1].empty(); }));
+        check_reads();
+        // folded into one put per key
+        size_t entries = 0;
+        for (const auto& last_level_table : lsm_tree.currentVersion()->levels[2]) {
+            assert(last_level_table->loadFromDisk());
+            for (const DataPair& entry : last_level_table->table_data_) {
+                assert(!entry.merge_);
+                entries++;
+            }
+        }
+        assert(entries == 4);
+        // an operand written to a table reads back as one
+        {
+            SSTable table({operand}, 0, lsm_test_dir + "/merge_table.txt", lsm_test_dir + "/merge_table.bf");
+            SSTable reopened(0, table.file_path_, table.bf_file_path_);
+            assert(reopened.loadFromDisk() && reopened.table_data_[0].merge_);
+        }
+        lsm_tree.mergeData(1, 1);
+        lsm_tree.flushBufferHelper();
+        assert(lsm_tree.getData(1).value().value_ == 126);
+    }
+    {
+        // operands left in the buffer come back from the memtable dump
+        LSMTree lsm_tree(lsm_test_dir, 100, 1, 3, 1);
+        assert(lsm_tree.getData(1).value().value_ == 126);
+        lsm_tree.mergeData(1, 4);
+        lsm_tree.mergeData(4, 9);
+    }
+    {
+        LSMTree lsm_tree(lsm_test_dir, 100, 1, 3, 1);
+        assert(lsm_tree.buffer_->getVersions(4).front().merge_);
+        assert(lsm_tree.getData(1).value().value_ == 130 && lsm_tree.getData(4).value().value_ == 9);
+        // a user operator, here a running maximum
+        lsm_tree.setMergeOperator([](int existing, int operand) { return std::max(existing, operand); });
+        lsm_tree.mergeData(4, 3);
+        lsm_tree.mergeData(4, 12);
+        lsm_tree.mergeData(4, 5);
+        assert(lsm_tree.getData(4).value().value_ == 12);
+        // operands not yet folded take the new operator: 125 under operands 1 and 4
+        assert(lsm_tree.getData(1).value().value_ == 125);
+        std::cout << "Merge operands survive flush, compaction and reopen PASSED." << std::endl;
+    }
+    remove_temp_dir(lsm_test_dir);
+}
+
+void test_write_batch() {
+    std::cout << "[TEST] testing write batches ------------" << std::endl;
+    const std::string lsm_test_dir = "test_db_write_batch";
+    remove_temp_dir(lsm_test_dir);
+    {
+        LSMTree lsm_tree(lsm_test_dir, 100, 100, 3, 2);
+        lsm_tree.putData({1, 1});
+        lsm_tree.putData({3, 3});
+        lsm_tree.putData({4, 1});
+        std::shared_ptr<Snapshot> before = lsm_tree.getSnapshot();
+        uint64_t seq_before = lsm_tree.buffer_->lastSequence();
+
+        WriteBatch batch;
+        batch.putData(1, 10);
+        batch.putData(2, 20);
+        batch.deleteData(3);
+        batch.mergeData(4, 5);
+        // a later write to a key in the same batch wins
+        batch.putData(2, 22);
+        assert(batch.size() == 5);
+        assert(lsm_tree.writeBatch(batch));
+        assert(lsm_tree.writeBatch(WriteBatch()));
+
+        // one seq per entry, taken together
+        assert(lsm_tree.buffer_->lastSequence() == seq_before + 5);
+        assert(lsm_tree.getData(1).value().value_ == 10 && lsm_tree.getData(2).value().value_ == 22);
+        assert(!lsm_tree.getData(3).has_value() && lsm_tree.getData(4).value().value_ == 6);
+        assert(lsm_tree.getData(1, before.get()).value().value_ == 1);
+        assert(!lsm_tree.getData(2, before.get()).has_value());
+        assert(lsm_tree.getMetrics().op(MetricOp::WRITE_BATCH).count == 1);
+        std::cout << "Batch contents PASSED." << std::endl;
+
+        // every batch sets keys 0-9 to one value, a scan never sees two of them, even as
+        // the batches fill the buffer and flush
+        std::atomic<bool> done{false};
+        std::thread writer([&]() {
+            for (int round = 0; round < 300; ++round) {
+                WriteBatch round_batch;
+                for (int k = 0; k < 10; ++k) { round_batch.putData(k, round); }
+                lsm_tree.writeBatch(round_batch);
+            }
+            done = true;
+        });
+        size_t scans = 0;
+        while (!done || scans == 0) {
+            std::vector<DataPair> live = lsm_tree.rangeData(0, 10);
+            if (live.size() == 10) {
+                for (const DataPair& pair : live) { assert(pair.value_ == live.front().value_); }
+            }
+            scans++;
+        }
+        writer.join();
+        assert(lsm_tree.getData(9).value().value_ == 299);
+        std::cout << "Batch atomic visibility PASSED." << std::endl;
+    }
+    remove_temp_dir(lsm_test_dir);
+}
+
+// sharded tree tests
+void test_sharded_lsm_tree() {
+    std::cout << "[TEST] testing sharded lsm tree ------------" << std::endl;
+    const std::string lsm_test_dir = "test_db_sharded";
+    const std::string load_file = "test_sharded_load.bin";
+    remove_temp_dir(lsm_test_dir);
+    {
+        ShardedLSMTree sharded(lsm_test_dir, 4, 50, 4, 3, 2);
+        assert(sharded.numShards() == 4);
+        // sequential keys land on every shard
+        std::vector<size_t> per_shard(4, 0);
+        for (int k = 0; k < 400; ++k) {
+            per_shard[sharded.shardFor(k)]++;
+            sharded.putData({k, k * 2});
+        }
+        for (size_t count : per_shard) { assert(count > 50); }
+        for (int k = 0; k < 400; k += 7) { assert(sharded.getData(k).value().value_ == k * 2); }
+        assert(sharded.deleteData(5) && !sharded.getData(5).has_value());
+        std::cout << "Sharded put/get/delete PASSED." << std::endl;
+
+        // one ascending result across shards
+        std::vector<DataPair> range = sharded.rangeData(0, 100);
+        assert(range.size() == 99);
+        for (size_t i = 1; i < range.size(); ++i) { assert(range[i - 1].key_ < range[i].key_); }
+        assert(sharded.deleteRange(10, 20));
+        assert(sharded.rangeData(0, 100).size() == 89);
+        assert(!sharded.getData(15).has_value() && sharded.getData(20).has_value());
+        std::cout << "Sharded range PASSED." << std::endl;
+
+        WriteBatch batch;
+        for (int k = 1000; k < 1010; ++k) { batch.putData(k, 1); }
+        batch.deleteData(1000);
+        assert(sharded.writeBatch(batch));
+        assert(sharded.rangeData(1000, 1010).size() == 9);
+        assert(sharded.mergeData(1001, 4) && sharded.getData(1001).value().value_ == 5);
+        assert(sharded.getMetrics().op(MetricOp::WRITE_BATCH).count > 1);
+        std::cout << "Sharded batch and merge PASSED." << std::endl;
+
+        // 2000..2099, split into per-shard loads
+        std::vector<std::pair<int, int>> pairs;
+        for (int k = 2099; k >= 2000; --k) { pairs.push_back({k, -k}); }
+        write_load_file(load_file, pairs);
+        ShardedLoadResult loaded = sharded.bulkLoad(load_file);
+        assert(loaded.ok && loaded.pairs_loaded == 100 && loaded.shards_applied == 4);
+        assert(sharded.getData(2050).value().value_ == -2050);
+        assert(sharded.rangeData(2000, 2100).size() == 100);
+        std::cout << "Sharded bulk load PASSED." << std::endl;
+
+        // two loads at once, as from two connections: each splits into its own parts
+        const std::string load_file_a = lsm_test_dir + "/load_a.bin";
+        const std::string load_file_b = lsm_test_dir + "/load_b.bin";
+        std::vector<std::pair<int, int>> pairs_a, pairs_b;
+        for (int k = 4000; k < 6000; ++k) { pairs_a.push_back({k, k + 1}); }
+        for (int k = 6000; k < 8000; ++k) { pairs_b.push_back({k, k + 2}); }
+        write_load_file(load_file_a, pairs_a);
+        write_load_file(load_file_b, pairs_b);
+        for (int round = 0; round < 3; ++round) {
+            auto load_a = std::async(std::launch::async, [&]() { return sharded.bulkLoad(load_file_a); });
+            auto load_b = std::async(std::launch::async, [&]() { return sharded.bulkLoad(load_file_b); });
+            ShardedLoadResult result_a = load_a.get();
+            ShardedLoadResult result_b = load_b.get();
+            assert(result_a.ok && result_a.pairs_loaded == 2000);
+            assert(result_b.ok && result_b.pairs_loaded == 2000);
+        }
+        std::vector<DataPair> loaded_range = sharded.rangeData(4000, 8000);
+        assert(loaded_range.size() == 4000);
+        for (const DataPair& data : loaded_range) {
+            assert(data.value_ == data.key_ + (data.key_ < 6000 ? 1 : 2));
+        }
+        std::cout << "Sharded concurrent bulk load PASSED." << std::endl;
+
+        // one file of entries and one of range tombstones alone; the tombstones reach
+        // every shard owning a key they cover, keys or not in the file
+        const std::string ingest_path = lsm_test_dir + "/ingest_input.sst";
+        const std::string deletes_path = lsm_test_dir + "/ingest_deletes.sst";
+        SSTable(std::vector<DataPair>{{3000, 1, false, 0}}, 0, ingest_path, ingest_path + ".bf");
+        SSTable(std::vector<DataPair>(), 0, deletes_path, deletes_path + ".bf", 0,
+                std::vector<RangeTombstone>{{2040, 2060, 0}});
+        assert(sharded.ingestFiles({ingest_path, deletes_path}).ok);
+        assert(!std::filesystem::exists(ingest_path) && !std::filesystem::exists(deletes_path));
+        assert(sharded.getData(3000).value().value_ == 1);
+        for (int k = 2040; k < 2060; ++k) { assert(!sharded.getData(k).has_value()); }
+        assert(sharded.rangeData(2000, 2100).size() == 80);
+        std::cout << "Sharded range tombstone ingest PASSED." << std::endl;
+    }
+    {
+        // the stored shard count wins over the requested one
+        ShardedLSMTree reopened(lsm_test_dir, 2, 50, 4, 3, 2);
+        assert(reopened.numShards() == 4);
+        assert(reopened.getData(399).value().value_ == 798);
+        assert(!reopened.getData(15).has_value() && reopened.getData(1001).value().value_ == 5);
+        assert(std::filesystem::exists(lsm_test_dir + "/shard_3"));
+        assert(!std::filesystem::exists(lsm_test_dir + "/shards.tmp"));
+        // concurrent range queries share the fan-out threads
+        std::vector<std::future<size_t>> ranges;
+        for (int q = 0; q < 8; ++q) {
+            ranges.push_back(std::async(std::launch::async, [&reopened]() {
+                return reopened.rangeData(0, 400).size();
+            }));
+        }
+        size_t first_size = ranges.front().get();
+        for (size_t q = 1; q < ranges.size(); ++q) { assert(ranges[q].get() == first_size); }
+        std::cout << "Sharded reopen PASSED." << std::endl;
+    }
+    remove_temp_dir(lsm_test_dir);
+    {
+        // one shard keeps the plain layout
+        ShardedLSMTree single(lsm_test_dir, 1, 50, 4, 3, 2);
+        single.putData({1, 1});
+        assert(single.numShards() == 1 && single.getData(1).value().value_ == 1);
+        assert(!std::filesystem::exists(lsm_test_dir + "/shard_0"));
+        std::cout << "Single shard layout PASSED." << std::endl;
+    }
+    remove_temp_dir(lsm_test_dir);
+    std::filesystem::remove(load_file);
+}
+
+// workload tuner tests
+void test_tuner() {
+    std::cout << "[TEST] testing workload tuner ------------" << std::endl;
+    TuningConfig current;
+    current.buffer_capacity = 100;
+    current.base_level_table_capacity = 2;
+    current.level_size_ratio = 2;
+    current.bloom_bits_per_entry = bloomBitsPerEntry(DEFAULT_FALSE_POSITIVE_RATE);
+
+    // uniform writes over 1000 keys: a 100 entry buffer absorbs ~5% of them
+    WorkloadStats updates;
+    updates.writes = 100000;
+    updates.flushed_entries = static_cast<uint64_t>(100000 * 100 / (-1000 * std::log1p(-100.0 / 1000)));
+    double working_set = updates.writeWorkingSet(100);
+    assert(working_set > 950 && working_set < 1050);
+    WorkloadStats no_repeats;
+    no_repeats.writes = no_repeats.flushed_entries = 5000;
+    assert(std::isinf(no_repeats.writeWorkingSet(100)));
+    std::cout << "Write working set PASSED." << std::endl;
+
+    // Monkey: deeper levels hold bigger runs and get higher rates
+    CostModel model(WorkloadStats(), current, 100000, 6);
+    std::vector<double> rates = model.levelFalsePositiveRates(current);
+    for (size_t i = 1; i < rates.size(); ++i) { assert(rates[i] >= rates[i - 1]); }
+    assert(rates.front() < DEFAULT_FALSE_POSITIVE_RATE && rates.back() > DEFAULT_FALSE_POSITIVE_RATE);
+    std::cout << "Monkey rates PASSED." << std::endl;
+
+    // write-heavy: fewer, bigger levels; lookups of missing keys: no fewer filter bits
+    WorkloadStats writes;
+    writes.writes = writes.flushed_entries = 10000;
+    TuningAdvice write_advice = adviseTuning(writes, current, 100000, 6);
+    assert(!(write_advice.recommended == current));
+    assert(write_advice.recommended_cost.write < write_advice.current_cost.write);
+    assert(write_advice.recommended_cost.total < write_advice.current_cost.total);
+    WorkloadStats misses;
+    misses.gets = misses.get_misses = 10000;
+    TuningAdvice miss_advice = adviseTuning(misses, current, 100000, 6);
+    assert(miss_advice.recommended_cost.get <= miss_advice.current_cost.get);
+    assert(miss_advice.recommended.bloom_bits_per_entry >= current.bloom_bits_per_entry);
+    // too short a window keeps what's there
+    WorkloadStats short_window;
+    short_window.writes = short_window.flushed_entries = TUNER_MIN_OPS - 1;
+    assert(adviseTuning(short_window, current, 100000, 6).recommended == current);
+    std::cout << "Cost model PASSED." << std::endl;
+
+    const std::string lsm_test_dir = "test_db_tuner";
+    remove_temp_dir(lsm_test_dir);
+    {
+        LSMTree lsm_tree(lsm_test_dir, 100, 2, 6, 2);
+        for (int k = 0; k < 5000; ++k) { lsm_tree.putData({k, k}); }
+        // a lagging flusher would read as updates absorbed by the buffer
+        assert(wait_until([&] {
+            return lsm_tree.getMetrics().counter(MetricCounter::FLUSH_ENTRIES_WRITTEN) >= 4900;
+        }));
+        TuningAdvice advice = lsm_tree.tune(false);
+        assert(advice.workload.writes == 5000 && !advice.applied);
+        assert(lsm_tree.tuningConfig() == advice.current);
+        assert(!(advice.recommended == advice.current));
+
+        advice = lsm_tree.tune(true);
+        assert(advice.applied && lsm_tree.tuningConfig() == advice.recommended);
+        size_t level_capacity = advice.recommended.base_level_table_capacity;
+        for (const auto& level_ptr : lsm_tree.levels_) {
+            assert(level_ptr->table_capacity_ == level_capacity);
+            level_capacity *= advice.recommended.level_size_ratio;
+        }
+        assert(lsm_tree.buffer_->capacity_ == advice.recommended.buffer_capacity);
+        assert(lsm_tree.levelFalsePositiveRate(0) <= lsm_tree.levelFalsePositiveRate(5));
+        // the next window starts at the apply
+        assert(lsm_tree.tune(false).workload.writes == 0);
+
+        // compaction reshapes the levels under the new targets, nothing is lost
+        for (int k = 5000; k < 6000; ++k) { lsm_tree.putData({k, k}); }
+        for (int k = 0; k < 6000; k += 97) { assert(lsm_tree.getData(k).value().value_ == k); }
+        assert(lsm_tree.rangeData(0, 6000).size() == 6000);
+        std::cout << "LSMTree tune PASSED." << std::endl;
+    }
+    remove_temp_dir(lsm_test_dir);
+    {
+        ShardedLSMTree sharded(lsm_test_dir, 2, 100, 2, 6, 2);
+        for (int k = 0; k < 5000; ++k) { sharded.putData({k, k}); }
+        TuningAdvice advice = sharded.tune(true);
+        assert(advice.applied && advice.workload.writes == 5000);
+        for (size_t i = 0; i < sharded.numShards(); ++i) {
+            assert(sharded.shard(i).tuningConfig() == advice.recommended);
+        }
+        assert(sharded.getData(4999).value().value_ == 4999);
+        std::cout << "Sharded tune PASSED." << std::endl;
+    }
+    remove_temp_dir(lsm_test_dir);
+}
 
 int main() {
     test_datapair();
@@ -398,6 +1816,23 @@ int main() {
     test_level();
     test_buffer();
     test_lsm_tree();
+    test_range_iterator();
+    test_parallel_range();
+    test_snapshot();
+    test_version();
+    test_bulk_load();
+    test_ingest_files();
+    test_stats();
+    test_metrics();
+    test_io_stats();
+    test_lazy_open();
+    test_shutdown_persist();
+    test_tombstone_compaction();
+    test_range_delete();
+    test_merge_operator();
+    test_write_batch();
+    test_sharded_lsm_tree();
+    test_tuner();
     std::cout << "All tests passed!" << std::endl;
     return 0;
 }
@@ -0,0 +1,337 @@
+#include "tuner.hh"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+static const double LN2_SQUARED = std::log(2.0) * std::log(2.0);
+// rates are kept above this, a lower one buys almost nothing for its bits
+static const double MIN_FALSE_POSITIVE_RATE = 1e-9;
+
+double bloomBitsPerEntry(double fp_rate) {
+    return -std::log(fp_rate) / LN2_SQUARED;
+}
+
+double bloomFalsePositiveRate(double bits_per_entry) {
+    return std::exp(-bits_per_entry * LN2_SQUARED);
+}
+
+// writes spread evenly over working_set keys fill a buffer of capacity distinct keys after
+// -working_set * ln(1 - capacity / working_set) of them, and only those distinct keys flush
+static double flushedPerWrite(double capacity, double working_set) {
+    if (std::isinf(working_set)) {
+        return 1.0;
+    }
+    if (capacity >= working_set) {
+        return 0.0;
+    }
+    return capacity / (-working_set * std::log1p(-capacity / working_set));
+}
+
+/**
+ * WorkloadStats
+ */
+
+WorkloadStats WorkloadStats::fromMetrics(const MetricsSnapshot& metrics) {
+    WorkloadStats workload;
+    workload.writes = metrics.counter(MetricCounter::USER_ENTRIES_WRITTEN);
+    workload.gets = metrics.op(MetricOp::GET).count;
+    workload.get_misses = metrics.counter(MetricCounter::GET_MISSES);
+    workload.buffer_get_hits = metrics.counter(MetricCounter::BUFFER_GET_HITS);
+    workload.ranges = metrics.op(MetricOp::RANGE).count;
+    workload.range_entries = metrics.counter(MetricCounter::RANGE_ENTRIES_READ);
+    workload.flushed_entries = metrics.counter(MetricCounter::FLUSH_ENTRIES_WRITTEN);
+    return workload;
+}
+
+WorkloadStats WorkloadStats::since(const WorkloadStats& earlier) const {
+    auto minus = [](uint64_t now, uint64_t before) { return now > before ? now - before : 0; };
+    WorkloadStats window;
+    window.writes = minus(writes, earlier.writes);
+    window.gets = minus(gets, earlier.gets);
+    window.get_misses = minus(get_misses, earlier.get_misses);
+    window.buffer_get_hits = minus(buffer_get_hits, earlier.buffer_get_hits);
+    window.ranges = minus(ranges, earlier.ranges);
+    window.range_entries = minus(range_entries, earlier.range_entries);
+    window.flushed_entries = minus(flushed_entries, earlier.flushed_entries);
+    return window;
+}
+
+uint64_t WorkloadStats::operations() const {
+    return writes + gets + ranges;
+}
+
+double WorkloadStats::writeWorkingSet(size_t buffer_capacity) const {
+    const double infinity = std::numeric_limits<double>::infinity();
+    if (writes == 0 || flushed_entries == 0 || buffer_capacity == 0) {
+        return infinity;
+    }
+    double flushed_fraction = static_cast<double>(flushed_entries) / static_cast<double>(writes);
+    double capacity = static_cast<double>(buffer_capacity);
+    // flushedPerWrite grows with the working set, from 0 at the capacity towards 1
+    double log_low = std::log(capacity);
+    double log_high = std::log(capacity) + 30.0;
+    if (flushed_fraction >= flushedPerWrite(capacity, std::exp(log_high))) {
+        return infinity;
+    }
+    for (int i = 0; i < 100; ++i) {
+        double log_mid = (log_low + log_high) / 2;
+        if (flushedPerWrite(capacity, std::exp(log_mid)) < flushed_fraction) {
+            log_low = log_mid;
+        } else {
+            log_high = log_mid;
+        }
+    }
+    return std::exp(log_high);
+}
+
+std::string WorkloadStats::toText(size_t buffer_capacity) const {
+    auto percent = [](uint64_t part, uint64_t whole) {
+        return whole == 0 ? 0.0 : 100.0 * static_cast<double>(part) / static_cast<double>(whole);
+    };
+    uint64_t ops = operations();
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(1);
+    ss << "ops " << ops << ": writes " << writes << " (" << percent(writes, ops) << "%)"
+       << ", gets " << gets << " (" << percent(gets, ops) << "%, misses " << percent(get_misses, gets)
+       << "%, buffer hits " << percent(buffer_get_hits, gets) << "%)"
+       << ", ranges " << ranges << " (" << percent(ranges, ops) << "%, avg "
+       << (ranges == 0 ? 0.0 : static_cast<double>(range_entries) / static_cast<double>(ranges)) << " pairs)";
+    double working_set = writeWorkingSet(buffer_capacity);
+    if (std::isinf(working_set)) {
+        ss << "\nwrite working set: no updates absorbed by the buffer";
+    } else {
+        ss << "\nwrite working set: ~" << std::llround(working_set) << " keys";
+    }
+    return ss.str();
+}
+
+/**
+ * TuningConfig
+ */
+
+bool TuningConfig::operator==(const TuningConfig& other) const {
+    return buffer_capacity == other.buffer_capacity &&
+           base_level_table_capacity == other.base_level_table_capacity &&
+           level_size_ratio == other.level_size_ratio &&
+           bloom_bits_per_entry == other.bloom_bits_per_entry;
+}
+
+std::string TuningConfig::toText() const {
+    std::stringstream ss;
+    ss << "buffer " << buffer_capacity << ", base level tables " << base_level_table_capacity
+       << ", size ratio " << level_size_ratio << ", bloom bits/entry " << std::fixed
+       << std::setprecision(2) << bloom_bits_per_entry;
+    return ss.str();
+}
+
+/**
+ * CostModel
+ */
+
+CostModel::CostModel(const WorkloadStats& workload, const TuningConfig& current, size_t entries, size_t max_levels)
+    : workload_(workload), current_(current), entries_(static_cast<double>(entries)),
+      max_levels_(std::max<size_t>(max_levels, 1)) {
+    this->write_working_set_ = workload_.writeWorkingSet(current_.buffer_capacity);
+}
+
+// a level compacts once it holds base * ratio^i tables, so it averages half of that less
+// one; the level the data ends at holds the rest, and the last level never compacts
+size_t CostModel::levelShape(const TuningConfig& config, std::vector<double>* runs,
+                             std::vector<double>* run_entries) const {
+    runs->assign(max_levels_, 0.0);
+    run_entries->assign(max_levels_, 0.0);
+    double entries_per_run = static_cast<double>(std::max<size_t>(config.buffer_capacity, 1));
+    double table_capacity = static_cast<double>(std::max<size_t>(config.base_level_table_capacity, 1));
+    double ratio = static_cast<double>(std::max<size_t>(config.level_size_ratio, 1));
+    double remaining = entries_;
+    size_t levels = 0;
+    for (size_t i = 0; i < max_levels_; ++i) {
+        (*run_entries)[i] = entries_per_run;
+        if (remaining > 0) {
+            levels = i + 1;
+            double level_full = (table_capacity - 1) * entries_per_run;
+            if (i + 1 == max_levels_ || remaining <= level_full) {
+                (*runs)[i] = std::max(1.0, remaining / entries_per_run);
+                remaining = 0;
+            } else {
+                (*runs)[i] = (table_capacity - 1) / 2;
+                remaining -= (*runs)[i] * entries_per_run;
+            }
+        }
+        // a full level is merged into one run of the next
+        entries_per_run *= table_capacity;
+        table_capacity *= ratio;
+    }
+    return levels;
+}
+
+// Monkey: minimizing the summed false positive rates of all runs for a fixed number of
+// filter bits sets each run's rate in proportion to its entries, p_i = lambda * n_i
+std::vector<double> CostModel::levelFalsePositiveRates(const TuningConfig& config, const std::vector<double>& runs,
+                                                       const std::vector<double>& run_entries, size_t levels) const {
+    std::vector<double> rates(max_levels_, bloomFalsePositiveRate(config.bloom_bits_per_entry));
+    double filter_bits = config.bloom_bits_per_entry * entries_;
+    if (levels == 0 || filter_bits <= 0) {
+        if (levels > 0) {
+            std::fill(rates.begin(), rates.end(), 1.0);
+        }
+        return rates;
+    }
+    auto rate = [&](double log_lambda, size_t i) {
+        return std::clamp(std::exp(log_lambda + std::log(run_entries[i])), MIN_FALSE_POSITIVE_RATE, 1.0);
+    };
+    auto bits_for = [&](double log_lambda) {
+        double bits = 0;
+        for (size_t i = 0; i < levels; ++i) {
+            bits += runs[i] * run_entries[i] * -std::log(rate(log_lambda, i)) / LN2_SQUARED;
+        }
+        return bits;
+    };
+    // every rate is 1 at the high end, and as low as it goes at the low end
+    double log_high = -std::log(run_entries[0]);
+    double log_low = std::log(MIN_FALSE_POSITIVE_RATE) - std::log(run_entries[levels - 1]);
+    for (int i = 0; i < 100; ++i) {
+        double log_mid = (log_low + log_high) / 2;
+        if (bits_for(log_mid) > filter_bits) {
+            log_low = log_mid;
+        } else {
+            log_high = log_mid;
+        }
+    }
+    for (size_t i = 0; i < max_levels_; ++i) {
+        // levels the data hasn't reached yet filter like the deepest one it has
+        rates[i] = rate(log_high, std::min(i, levels - 1));
+    }
+    return rates;
+}
+
+std::vector<double> CostModel::levelFalsePositiveRates(const TuningConfig& config) const {
+    std::vector<double> runs;
+    std::vector<double> run_entries;
+    size_t levels = levelShape(config, &runs, &run_entries);
+    return levelFalsePositiveRates(config, runs, run_entries, levels);
+}
+
+TuningCost CostModel::estimate(const TuningConfig& config) const {
+    std::vector<double> runs;
+    std::vector<double> run_entries;
+    size_t levels = levelShape(config, &runs, &run_entries);
+    std::vector<double> rates = levelFalsePositiveRates(config, runs, run_entries, levels);
+
+    double zero_result_cost = 0;
+    double run_count = 0;
+    for (size_t i = 0; i < levels; ++i) {
+        zero_result_cost += runs[i] * rates[i];
+        run_count += runs[i];
+    }
+
+    TuningCost cost;
+    cost.levels = levels;
+    // flushed once, then read and written by a compaction into every level below
+    double flushed = flushedPerWrite(static_cast<double>(config.buffer_capacity), write_working_set_);
+    cost.write = flushed * static_cast<double>(2 * std::max<size_t>(levels, 1) - 1) / TUNER_ENTRIES_PER_BLOCK;
+
+    if (workload_.gets > 0) {
+        double gets = static_cast<double>(workload_.gets);
+        double miss_fraction = std::min(1.0, static_cast<double>(workload_.get_misses) / gets);
+        double hit_fraction = 1.0 - miss_fraction;
+        // the buffer answers hot keys, more of them the more it holds
+        double buffer_fraction = static_cast<double>(workload_.buffer_get_hits) / gets *
+                                 static_cast<double>(config.buffer_capacity) /
+                                 static_cast<double>(std::max<size_t>(current_.buffer_capacity, 1));
+        buffer_fraction = std::min(buffer_fraction, hit_fraction);
+        // a hit reads its block after the false positives of the runs above it
+        cost.get = miss_fraction * zero_result_cost + (hit_fraction - buffer_fraction) * (1 + zero_result_cost);
+    }
+    double range_entries = workload_.ranges == 0 ? 0.0
+        : static_cast<double>(workload_.range_entries) / static_cast<double>(workload_.ranges);
+    cost.range = run_count + range_entries / TUNER_ENTRIES_PER_BLOCK;
+
+    uint64_t ops = workload_.operations();
+    if (ops > 0) {
+        cost.total = (static_cast<double>(workload_.writes) * cost.write +
+                      static_cast<double>(workload_.gets) * cost.get +
+                      static_cast<double>(workload_.ranges) * cost.range) / static_cast<double>(ops);
+    }
+    return cost;
+}
+
+TuningConfig CostModel::recommend() const {
+    if (workload_.operations() < TUNER_MIN_OPS || entries_ == 0) {
+        return current_;
+    }
+    // what the buffer and the filters take now, split differently by each candidate
+    double memory_bits = static_cast<double>(current_.buffer_capacity) * TUNER_BUFFER_ENTRY_BITS +
+                         current_.bloom_bits_per_entry * entries_;
+
+    std::vector<size_t> buffer_capacities;
+    for (double factor : {0.25, 0.5, 1.0, 2.0, 4.0}) {
+        buffer_capacities.push_back(std::max<size_t>(1, std::llround(current_.buffer_capacity * factor)));
+    }
+    std::vector<size_t> base_capacities = {1, 2, 4, 8, current_.base_level_table_capacity};
+    std::vector<size_t> ratios = {current_.level_size_ratio};
+    for (size_t ratio = 2; ratio <= 10; ++ratio) {
+        ratios.push_back(ratio);
+    }
+
+    TuningConfig best = current_;
+    double best_total = estimate(current_).total * (1.0 - TUNER_MIN_GAIN);
+    for (size_t buffer_capacity : buffer_capacities) {
+        double filter_bits = memory_bits - static_cast<double>(buffer_capacity) * TUNER_BUFFER_ENTRY_BITS;
+        if (filter_bits < 0) {
+            continue;
+        }
+        for (size_t base_capacity : base_capacities) {
+            for (size_t ratio : ratios) {
+                TuningConfig candidate;
+                candidate.buffer_capacity = buffer_capacity;
+                candidate.base_level_table_capacity = std::max<size_t>(base_capacity, 1);
+                candidate.level_size_ratio = std::max<size_t>(ratio, 2);
+                candidate.bloom_bits_per_entry = filter_bits / entries_;
+                double total = estimate(candidate).total;
+                if (total < best_total) {
+                    best = candidate;
+                    best_total = total;
+                }
+            }
+        }
+    }
+    return best;
+}
+
+/**
+ * TuningAdvice
+ */
+
+TuningAdvice adviseTuning(const WorkloadStats& workload, const TuningConfig& current,
+                          size_t entries, size_t max_levels) {
+    CostModel model(workload, current, entries, max_levels);
+    TuningAdvice advice;
+    advice.workload = workload;
+    advice.current = current;
+    advice.current_cost = model.estimate(current);
+    advice.recommended = model.recommend();
+    advice.recommended_cost = model.estimate(advice.recommended);
+    return advice;
+}
+
+std::string TuningAdvice::toText() const {
+    auto cost_text = [](const TuningCost& cost) {
+        std::stringstream ss;
+        ss << std::fixed << std::setprecision(3) << "I/O per op " << cost.total << " (write " << cost.write
+           << ", get " << cost.get << ", range " << cost.range << ", levels " << cost.levels << ")";
+        return ss.str();
+    };
+    std::stringstream ss;
+    ss << "Workload since last tune: " << workload.toText(current.buffer_capacity);
+    ss << "\nCurrent: " << current.toText() << "\n  " << cost_text(current_cost);
+    if (recommended == current) {
+        ss << "\nRecommended: keep the current settings";
+    } else {
+        ss << "\nRecommended: " << recommended.toText() << "\n  " << cost_text(recommended_cost);
+        ss << (applied ? "\nApplied, compaction reshapes the levels as it runs" : "\nNot applied");
+    }
+    return ss.str();
+}
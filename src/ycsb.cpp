@@ -0,0 +1,421 @@
+#include <lsm_tree.hh>
+#include <key_generator.hh>
+#include <metrics.hh>
+#include <db_client.hh>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include <chrono>
+
+// YCSB core workloads A-F against the embedded tree or a running server
+//   ./ycsb --workload=a [--target=embedded|server] [--records=N] [--operations=N] [--threads=T]
+// load inserts keys [0, records), run executes the workload's mix on top of them
+
+enum YcsbOp {
+    YCSB_READ,
+    YCSB_UPDATE,
+    YCSB_INSERT,
+    YCSB_SCAN,
+    YCSB_READ_MODIFY_WRITE,
+    NUM_YCSB_OPS,
+};
+
+static const char* const YCSB_OP_NAMES[NUM_YCSB_OPS] = {
+    "READ", "UPDATE", "INSERT", "SCAN", "READ-MODIFY-WRITE",
+};
+
+// operation mix of one core workload, proportions sum to 1
+struct WorkloadSpec {
+    char name;
+    const char* description;
+    double proportions[NUM_YCSB_OPS];
+    KeyDistribution distribution;
+};
+
+static const WorkloadSpec CORE_WORKLOADS[] = {
+    {'a', "update heavy", {0.50, 0.50, 0.00, 0.00, 0.00}, KeyDistribution::ZIPFIAN},
+    {'b', "read mostly", {0.95, 0.05, 0.00, 0.00, 0.00}, KeyDistribution::ZIPFIAN},
+    {'c', "read only", {1.00, 0.00, 0.00, 0.00, 0.00}, KeyDistribution::ZIPFIAN},
+    {'d', "read latest", {0.95, 0.00, 0.05, 0.00, 0.00}, KeyDistribution::LATEST},
+    {'e', "short ranges", {0.00, 0.00, 0.05, 0.95, 0.00}, KeyDistribution::ZIPFIAN},
+    {'f', "read-modify-write", {0.50, 0.00, 0.00, 0.00, 0.50}, KeyDistribution::ZIPFIAN},
+};
+
+struct YcsbOptions {
+    char workload = 'a';
+    bool use_server = false;
+    std::string socket_path = SOCK_PATH;
+    std::string db = "ycsb_db";
+    uint64_t records = 100000;
+    uint64_t operations = 100000;
+    size_t threads = 1;
+    // scans read a uniform [1, max_scan_length] keys
+    size_t max_scan_length = 100;
+    bool run_load = true;
+    bool run_transactions = true;
+    uint64_t seed = 165;
+};
+
+// one embedded tree shared by every thread, or one server connection per thread
+class YcsbStore {
+    public:
+    virtual ~YcsbStore() = default;
+    // true if found
+    virtual bool read(int key) = 0;
+    virtual bool write(int key, int value) = 0;
+    // entries returned
+    virtual size_t scan(int start_key, size_t length) = 0;
+};
+
+class EmbeddedStore : public YcsbStore {
+    public:
+    explicit EmbeddedStore(LSMTree* lsm_tree) : lsm_tree_(lsm_tree) {}
+    bool read(int key) override {
+        return lsm_tree_->getData(key).has_value();
+    }
+    bool write(int key, int value) override {
+        return lsm_tree_->putData({key, value, false});
+    }
+    size_t scan(int start_key, size_t length) override {
+        long long end_key = std::min<long long>(static_cast<long long>(start_key) + length, INT_MAX);
+        return lsm_tree_->rangeData(start_key, static_cast<int>(end_key)).size();
+    }
+
+    private:
+    LSMTree* lsm_tree_;
+};
+
+class ServerStore : public YcsbStore {
+    public:
+    bool connect(const std::string& socket_path) {
+        return client_.connect(socket_path);
+    }
+    bool read(int key) override {
+        return client_.get(key).has_value();
+    }
+    bool write(int key, int value) override {
+        return client_.put(key, value);
+    }
+    size_t scan(int start_key, size_t length) override {
+        long long end_key = std::min<long long>(static_cast<long long>(start_key) + length, INT_MAX);
+        std::vector<std::pair<int, int>> pairs;
+        client_.range(start_key, static_cast<int>(end_key), &pairs);
+        return pairs.size();
+    }
+
+    private:
+    DbClient client_;
+};
+
+// per thread, merged at the end of a phase
+struct YcsbThreadStats {
+    std::vector<std::unique_ptr<LatencyHistogram>> latency;
+    // ops that found their key / wrote, and the rest
+    uint64_t ok[NUM_YCSB_OPS] = {};
+    uint64_t not_found[NUM_YCSB_OPS] = {};
+
+    YcsbThreadStats() {
+        for (size_t i = 0; i < NUM_YCSB_OPS; ++i) {
+            latency.push_back(std::make_unique<LatencyHistogram>());
+        }
+    }
+};
+
+struct PhaseResult {
+    double seconds = 0.0;
+    HistogramSnapshot latency[NUM_YCSB_OPS];
+    uint64_t ok[NUM_YCSB_OPS] = {};
+    uint64_t not_found[NUM_YCSB_OPS] = {};
+    bool failed = false;
+};
+
+class YcsbDriver {
+    public:
+    YcsbDriver(const YcsbOptions& options, const WorkloadSpec& spec, LSMTree* lsm_tree)
+        : options_(options), spec_(spec), lsm_tree_(lsm_tree),
+          next_insert_key_(options.records), inserted_keys_(options.records) {
+        if (usesZipfian(spec_.distribution)) {
+            zipfian_ = std::make_unique<ZipfianGenerator>(options_.records);
+        }
+    }
+
+    // inserts [0, records), each thread one contiguous slice
+    PhaseResult load() {
+        return runPhase([this](YcsbStore& store, YcsbThreadStats& stats, size_t thread_id, size_t num_threads) {
+            uint64_t begin = options_.records * thread_id / num_threads;
+            uint64_t end = options_.records * (thread_id + 1) / num_threads;
+            std::mt19937_64 rng(options_.seed + thread_id);
+            for (uint64_t key = begin; key < end; ++key) {
+                timed(stats, YCSB_INSERT, [&]() {
+                    return store.write(static_cast<int>(key), static_cast<int>(rng() & INT_MAX));
+                });
+            }
+        });
+    }
+
+    PhaseResult run() {
+        return runPhase([this](YcsbStore& store, YcsbThreadStats& stats, size_t thread_id, size_t num_threads) {
+            uint64_t ops = options_.operations / num_threads + (thread_id < options_.operations % num_threads ? 1 : 0);
+            KeyGenerator keys(spec_.distribution, options_.records, options_.seed * 31 + thread_id,
+                              zipfian_.get(), &inserted_keys_);
+            std::mt19937_64& rng = keys.rng();
+            std::uniform_real_distribution<double> pick(0.0, 1.0);
+            std::uniform_int_distribution<size_t> scan_length(1, std::max<size_t>(options_.max_scan_length, 1));
+            for (uint64_t i = 0; i < ops; ++i) {
+                YcsbOp op = chooseOp(pick(rng));
+                int value = static_cast<int>(rng() & INT_MAX);
+                switch (op) {
+                    case YCSB_READ:
+                        timed(stats, op, [&]() { return store.read(static_cast<int>(keys.next())); });
+                        break;
+                    case YCSB_UPDATE:
+                        timed(stats, op, [&]() { return store.write(static_cast<int>(keys.next()), value); });
+                        break;
+                    case YCSB_INSERT:
+                        timed(stats, op, [&]() {
+                            uint64_t key = next_insert_key_.fetch_add(1);
+                            bool written = store.write(static_cast<int>(key), value);
+                            noteInserted(key);
+                            return written;
+                        });
+                        break;
+                    case YCSB_SCAN:
+                        timed(stats, op, [&]() {
+                            return store.scan(static_cast<int>(keys.next()), scan_length(rng)) > 0;
+                        });
+                        break;
+                    case YCSB_READ_MODIFY_WRITE:
+                        timed(stats, op, [&]() {
+                            int key = static_cast<int>(keys.next());
+                            store.read(key);
+                            return store.write(key, value);
+                        });
+                        break;
+                    default:
+                        break;
+                }
+            }
+        });
+    }
+
+    private:
+    const YcsbOptions& options_;
+    const WorkloadSpec& spec_;
+    LSMTree* lsm_tree_;
+    std::unique_ptr<ZipfianGenerator> zipfian_;
+    std::atomic<uint64_t> next_insert_key_;
+    // keys below it are written, the latest distribution follows it
+    std::atomic<uint64_t> inserted_keys_;
+
+    YcsbOp chooseOp(double draw) const {
+        double cumulative = 0.0;
+        for (size_t op = 0; op < NUM_YCSB_OPS; ++op) {
+            cumulative += spec_.proportions[op];
+            if (draw < cumulative) {
+                return static_cast<YcsbOp>(op);
+            }
+        }
+        return YCSB_READ;
+    }
+
+    void noteInserted(uint64_t key) {
+        uint64_t inserted = inserted_keys_.load(std::memory_order_relaxed);
+        while (key >= inserted && !inserted_keys_.compare_exchange_weak(inserted, key + 1)) {}
+    }
+
+    template <typename OpFn>
+    static void timed(YcsbThreadStats& stats, YcsbOp op, OpFn op_fn) {
+        auto start = std::chrono::steady_clock::now();
+        bool ok = op_fn();
+        stats.latency[op]->record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count());
+        if (ok) {
+            stats.ok[op]++;
+        } else {
+            stats.not_found[op]++;
+        }
+    }
+
+    template <typename PhaseFn>
+    PhaseResult runPhase(PhaseFn phase_fn) {
+        size_t num_threads = std::max<size_t>(options_.threads, 1);
+        PhaseResult result;
+        std::vector<std::unique_ptr<YcsbStore>> stores;
+        for (size_t t = 0; t < num_threads; ++t) {
+            if (options_.use_server) {
+                auto server_store = std::make_unique<ServerStore>();
+                if (!server_store->connect(options_.socket_path)) {
+                    result.failed = true;
+                    return result;
+                }
+                stores.push_back(std::move(server_store));
+            } else {
+                stores.push_back(std::make_unique<EmbeddedStore>(lsm_tree_));
+            }
+        }
+
+        std::vector<YcsbThreadStats> thread_stats(num_threads);
+        std::vector<std::thread> workers;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t t = 0; t < num_threads; ++t) {
+            workers.emplace_back([&, t]() { phase_fn(*stores[t], thread_stats[t], t, num_threads); });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        for (const auto& stats : thread_stats) {
+            for (size_t op = 0; op < NUM_YCSB_OPS; ++op) {
+                result.latency[op].merge(*stats.latency[op]);
+                result.ok[op] += stats.ok[op];
+                result.not_found[op] += stats.not_found[op];
+            }
+        }
+        return result;
+    }
+};
+
+// YCSB's own report layout, so the numbers line up with the other stores' runs
+void printPhase(const std::string& phase, const PhaseResult& result) {
+    uint64_t total_ops = 0;
+    for (size_t op = 0; op < NUM_YCSB_OPS; ++op) {
+        total_ops += result.latency[op].count;
+    }
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "[" << phase << "], RunTime(ms), " << result.seconds * 1000.0 << "\n";
+    std::cout << "[" << phase << "], Throughput(ops/sec), "
+              << (result.seconds > 0.0 ? static_cast<double>(total_ops) / result.seconds : 0.0) << "\n";
+    for (size_t op = 0; op < NUM_YCSB_OPS; ++op) {
+        const HistogramSnapshot& latency = result.latency[op];
+        if (latency.count == 0) {
+            continue;
+        }
+        const std::string label = std::string("[") + YCSB_OP_NAMES[op] + "], ";
+        std::cout << label << "Operations, " << latency.count << "\n";
+        std::cout << label << "AverageLatency(us), " << latency.mean() / 1000.0 << "\n";
+        std::cout << label << "MinLatency(us), " << latency.min / 1000.0 << "\n";
+        std::cout << label << "MaxLatency(us), " << latency.max / 1000.0 << "\n";
+        std::cout << label << "50thPercentileLatency(us), " << latency.percentile(50) / 1000.0 << "\n";
+        std::cout << label << "95thPercentileLatency(us), " << latency.percentile(95) / 1000.0 << "\n";
+        std::cout << label << "99thPercentileLatency(us), " << latency.percentile(99) / 1000.0 << "\n";
+        std::cout << label << "99.9PercentileLatency(us), " << latency.percentile(99.9) / 1000.0 << "\n";
+        std::cout << label << "Return=OK, " << result.ok[op] << "\n";
+        if (result.not_found[op] > 0) {
+            std::cout << label << "Return=NOT_FOUND, " << result.not_found[op] << "\n";
+        }
+    }
+    std::cout << std::flush;
+}
+
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " [--flag=value ...]\n"
+              << "  --workload=a          core workload a-f:\n";
+    for (const WorkloadSpec& spec : CORE_WORKLOADS) {
+        std::cout << "                          " << spec.name << ": " << spec.description << "\n";
+    }
+    std::cout << "  --target=embedded     embedded tree, or server (a running ./server)\n"
+              << "  --socket=" << SOCK_PATH << "\n"
+              << "  --db=ycsb_db          embedded tree directory\n"
+              << "  --records=100000      keys loaded\n"
+              << "  --operations=100000   ops of the run phase\n"
+              << "  --threads=1           client threads\n"
+              << "  --max_scan_length=100\n"
+              << "  --phase=load,run      load, run or both\n"
+              << "  --seed=165" << std::endl;
+}
+
+bool parseOptions(int argc, char* argv[], YcsbOptions* options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        size_t equals = arg.find('=');
+        if (arg.rfind("--", 0) != 0) {
+            std::cerr << "unexpected argument: " << arg << std::endl;
+            return false;
+        }
+        std::string flag = arg.substr(2, equals == std::string::npos ? std::string::npos : equals - 2);
+        std::string value = equals == std::string::npos ? "" : arg.substr(equals + 1);
+        try {
+            if (flag == "workload") {
+                if (value.size() != 1 || tolower(value[0]) < 'a' || tolower(value[0]) > 'f') {
+                    std::cerr << "workload must be one of a-f" << std::endl;
+                    return false;
+                }
+                options->workload = static_cast<char>(tolower(value[0]));
+            } else if (flag == "target") {
+                if (value != "embedded" && value != "server") {
+                    std::cerr << "target must be embedded or server" << std::endl;
+                    return false;
+                }
+                options->use_server = value == "server";
+            } else if (flag == "socket") {
+                options->socket_path = value;
+            } else if (flag == "db") {
+                options->db = value;
+            } else if (flag == "records") {
+                options->records = std::stoull(value);
+            } else if (flag == "operations") {
+                options->operations = std::stoull(value);
+            } else if (flag == "threads") {
+                options->threads = std::stoul(value);
+            } else if (flag == "max_scan_length") {
+                options->max_scan_length = std::stoul(value);
+            } else if (flag == "phase") {
+                options->run_load = value.find("load") != std::string::npos;
+                options->run_transactions = value.find("run") != std::string::npos;
+            } else if (flag == "seed") {
+                options->seed = std::stoull(value);
+            } else {
+                return false;
+            }
+        } catch (const std::exception&) {
+            std::cerr << "bad value for " << arg << std::endl;
+            return false;
+        }
+    }
+    // inserts grow the key space past records, it must stay within int keys
+    if (options->records == 0 || options->records + options->operations > static_cast<uint64_t>(INT_MAX)) {
+        std::cerr << "--records must be positive and records + operations must fit in an int key" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    YcsbOptions options;
+    if (!parseOptions(argc, argv, &options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    const WorkloadSpec& spec = CORE_WORKLOADS[options.workload - 'a'];
+
+    std::unique_ptr<LSMTree> lsm_tree;
+    if (!options.use_server) {
+        if (options.run_load) {
+            std::error_code ec;
+            std::filesystem::remove_all(options.db, ec);
+        }
+        lsm_tree = std::make_unique<LSMTree>(options.db);
+    }
+    std::cout << "Workload " << static_cast<char>(toupper(spec.name)) << " (" << spec.description << "), "
+              << keyDistributionName(spec.distribution) << " keys, " << options.records << " records, "
+              << options.operations << " operations, " << options.threads << " threads, target "
+              << (options.use_server ? options.socket_path : options.db) << std::endl;
+
+    YcsbDriver driver(options, spec, lsm_tree.get());
+    if (options.run_load) {
+        PhaseResult load_result = driver.load();
+        if (load_result.failed) {
+            return 1;
+        }
+        printPhase("LOAD", load_result);
+    }
+    if (options.run_transactions) {
+        PhaseResult run_result = driver.run();
+        if (run_result.failed) {
+            return 1;
+        }
+        printPhase("OVERALL", run_result);
+    }
+    return 0;
+}